@@ -0,0 +1,182 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * AF_PACKET socket filter dropping packets of bypassed flows in kernel.
+ *
+ * Suricata inserts both directions of a flow in flow_table_v4 or
+ * flow_table_v6 when it decides to bypass it. Packets matching an entry
+ * are accounted in the entry and not sent to userspace. Suricata reads
+ * the counters back and removes the entries once the flow is idle.
+ *
+ * Keys and values must match the definitions in src/util-ebpf.h. All
+ * key fields are in host byte order, as returned by load_*().
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/filter.h>
+
+#include "bpf_helpers.h"
+
+#define LINUX_VERSION_CODE 263682
+
+#ifndef ETH_P_8021AD
+#define ETH_P_8021AD 0x88A8
+#endif
+
+struct flowv4_keys {
+    __u32 src;
+    __u32 dst;
+    __u16 port16[2];
+    __u8 ip_proto;
+    __u8 pad;
+    __u16 vlan0;
+};
+
+struct flowv6_keys {
+    __u32 src[4];
+    __u32 dst[4];
+    __u16 port16[2];
+    __u8 ip_proto;
+    __u8 pad;
+    __u16 vlan0;
+};
+
+struct pair {
+    __u64 time;
+    __u64 packets;
+    __u64 bytes;
+};
+
+struct bpf_map_def SEC("maps") flow_table_v4 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv4_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+struct bpf_map_def SEC("maps") flow_table_v6 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flowv6_keys),
+    .value_size = sizeof(struct pair),
+    .max_entries = 32768,
+};
+
+static __always_inline int account(struct pair *value, struct __sk_buff *skb)
+{
+    /* per CPU map, no need for atomic operations */
+    value->packets++;
+    value->bytes += skb->len;
+    value->time = bpf_ktime_get_ns();
+    /* drop the packet */
+    return 0;
+}
+
+static __always_inline int ipv4_filter(struct __sk_buff *skb, __u32 nhoff, __u16 vlan0)
+{
+    struct flowv4_keys tuple;
+    struct pair *value;
+    __u32 verlen;
+
+    tuple.ip_proto = load_byte(skb, nhoff + offsetof(struct iphdr, protocol));
+    if (tuple.ip_proto != IPPROTO_TCP && tuple.ip_proto != IPPROTO_UDP)
+        return -1;
+    /* fragments are reassembled in userspace */
+    if (load_half(skb, nhoff + offsetof(struct iphdr, frag_off)) & 0x3fff)
+        return -1;
+
+    tuple.src = load_word(skb, nhoff + offsetof(struct iphdr, saddr));
+    tuple.dst = load_word(skb, nhoff + offsetof(struct iphdr, daddr));
+
+    verlen = (load_byte(skb, nhoff) & 0x0F) << 2;
+    tuple.port16[0] = load_half(skb, nhoff + verlen);
+    tuple.port16[1] = load_half(skb, nhoff + verlen + 2);
+    tuple.pad = 0;
+    tuple.vlan0 = vlan0;
+
+    value = bpf_map_lookup_elem(&flow_table_v4, &tuple);
+    if (value)
+        return account(value, skb);
+    return -1;
+}
+
+static __always_inline int ipv6_filter(struct __sk_buff *skb, __u32 nhoff, __u16 vlan0)
+{
+    struct flowv6_keys tuple;
+    struct pair *value;
+    int i;
+
+    /* extension headers are not followed */
+    tuple.ip_proto = load_byte(skb, nhoff + offsetof(struct ipv6hdr, nexthdr));
+    if (tuple.ip_proto != IPPROTO_TCP && tuple.ip_proto != IPPROTO_UDP)
+        return -1;
+
+#pragma unroll
+    for (i = 0; i < 4; i++) {
+        tuple.src[i] = load_word(skb, nhoff + offsetof(struct ipv6hdr, saddr) + i * 4);
+        tuple.dst[i] = load_word(skb, nhoff + offsetof(struct ipv6hdr, daddr) + i * 4);
+    }
+
+    tuple.port16[0] = load_half(skb, nhoff + sizeof(struct ipv6hdr));
+    tuple.port16[1] = load_half(skb, nhoff + sizeof(struct ipv6hdr) + 2);
+    tuple.pad = 0;
+    tuple.vlan0 = vlan0;
+
+    value = bpf_map_lookup_elem(&flow_table_v6, &tuple);
+    if (value)
+        return account(value, skb);
+    return -1;
+}
+
+int SEC("filter") hashfilter(struct __sk_buff *skb)
+{
+    __u32 nhoff = ETH_HLEN;
+    __u16 vlan0 = 0;
+    __u16 proto = load_half(skb, offsetof(struct ethhdr, h_proto));
+
+    if (skb->vlan_present) {
+        vlan0 = skb->vlan_tci & 0x0fff;
+    }
+    /* VLAN header still in the packet, only one level is handled as
+     * Suricata does not bypass flows with more than one VLAN */
+    if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+        if (vlan0 != 0)
+            return -1;
+        vlan0 = load_half(skb, nhoff) & 0x0fff;
+        proto = load_half(skb, nhoff + 2);
+        nhoff += 4;
+    }
+
+    switch (proto) {
+        case ETH_P_IP:
+            return ipv4_filter(skb, nhoff, vlan0);
+        case ETH_P_IPV6:
+            return ipv6_filter(skb, nhoff, vlan0);
+        default:
+            return -1;
+    }
+}
+
+char __license[] SEC("license") = "GPL";
+
+__u32 __version SEC("version") = LINUX_VERSION_CODE;
@@ -0,0 +1,243 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * AF_PACKET fanout program computing a symmetric flow hash.
+ *
+ * The value returned by the program is used by the kernel to select the
+ * socket of the fanout group, so both directions of a flow must give
+ * the same value. Addresses and ports are combined with xor for that.
+ *
+ * Up to two VLAN tags (802.1Q, 802.1ad QinQ) are skipped. One level of
+ * tunnel is decapsulated: GRE (including transparent ethernet bridging
+ * and ERSPAN type II and III), IPv4 in IP and IPv6 in IP. The hash is
+ * then computed on the inner headers, so all packets of a tunneled flow
+ * land on the same worker whatever the outer addresses.
+ *
+ * Fragments are hashed on addresses only as ports are only in the first
+ * fragment.
+ *
+ * The kernel runs the program without pushing the link layer header back:
+ * received packets start at their network header, sent ones at their link
+ * layer header. All loads are done relative to the link layer header
+ * (SKF_LL_OFF) so the offsets are the same for both. VLAN tags stripped by
+ * the NIC or the kernel are not in the data, the ethertype is then the
+ * one after the tag.
+ */
+
+#include <stddef.h>
+#include <linux/bpf.h>
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/filter.h>
+
+#include "bpf_helpers.h"
+
+#define LINUX_VERSION_CODE 263682
+
+#ifndef ETH_P_8021AD
+#define ETH_P_8021AD 0x88A8
+#endif
+#ifndef ETH_P_TEB
+#define ETH_P_TEB 0x6558
+#endif
+#ifndef ETH_P_ERSPAN
+#define ETH_P_ERSPAN 0x88BE
+#endif
+#ifndef ETH_P_ERSPAN2
+#define ETH_P_ERSPAN2 0x22EB
+#endif
+
+/* offset relative to the link layer header, wraps like the 32 bits
+ * offsets of the packet loads */
+#define LL_OFF(off) ((__u32)(SKF_LL_OFF + (off)))
+
+#define GRE_FLAG_CSUM   0x8000
+#define GRE_FLAG_KEY    0x2000
+#define GRE_FLAG_SEQ    0x1000
+#define GRE_VERSION     0x0007
+
+#define ERSPAN_II_HLEN  8
+#define ERSPAN_III_HLEN 12
+/* optional platform specific sub header of ERSPAN type III */
+#define ERSPAN_III_FLAG_O 0x01
+#define ERSPAN_III_SUBHLEN 8
+
+/* ethertype after VLAN tags, updates the offset */
+static __always_inline __u16 skip_vlan(struct __sk_buff *skb, __u32 *nhoff, __u16 proto)
+{
+    if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+        proto = load_half(skb, *nhoff + 2);
+        *nhoff += 4;
+    }
+    if (proto == ETH_P_8021Q || proto == ETH_P_8021AD) {
+        proto = load_half(skb, *nhoff + 2);
+        *nhoff += 4;
+    }
+    return proto;
+}
+
+static __always_inline __u32 ports_hash(struct __sk_buff *skb, __u32 off, __u8 ip_proto)
+{
+    switch (ip_proto) {
+        case IPPROTO_TCP:
+        case IPPROTO_UDP:
+        case IPPROTO_SCTP:
+            return load_half(skb, off) ^ load_half(skb, off + 2);
+        default:
+            return 0;
+    }
+}
+
+static __always_inline __u32 ipv4_hash(struct __sk_buff *skb, __u32 nhoff)
+{
+    __u32 src = load_word(skb, nhoff + offsetof(struct iphdr, saddr));
+    __u32 dst = load_word(skb, nhoff + offsetof(struct iphdr, daddr));
+    __u8 ip_proto = load_byte(skb, nhoff + offsetof(struct iphdr, protocol));
+    __u32 hash = src ^ dst ^ ip_proto;
+
+    if (load_half(skb, nhoff + offsetof(struct iphdr, frag_off)) & 0x3fff)
+        return hash;
+
+    __u32 verlen = (load_byte(skb, nhoff) & 0x0F) << 2;
+    return hash ^ (ports_hash(skb, nhoff + verlen, ip_proto) << 16);
+}
+
+static __always_inline __u32 ipv6_hash(struct __sk_buff *skb, __u32 nhoff)
+{
+    __u32 hash = 0;
+    int i;
+
+#pragma unroll
+    for (i = 0; i < 4; i++) {
+        hash ^= load_word(skb, nhoff + offsetof(struct ipv6hdr, saddr) + i * 4);
+        hash ^= load_word(skb, nhoff + offsetof(struct ipv6hdr, daddr) + i * 4);
+    }
+
+    /* extension headers are not followed */
+    __u8 ip_proto = load_byte(skb, nhoff + offsetof(struct ipv6hdr, nexthdr));
+    hash ^= ip_proto;
+    return hash ^ (ports_hash(skb, nhoff + sizeof(struct ipv6hdr), ip_proto) << 16);
+}
+
+static __always_inline __u32 inner_hash(struct __sk_buff *skb, __u32 nhoff, __u16 proto)
+{
+    if (proto == ETH_P_TEB) {
+        proto = load_half(skb, nhoff + offsetof(struct ethhdr, h_proto));
+        nhoff += ETH_HLEN;
+        proto = skip_vlan(skb, &nhoff, proto);
+    }
+
+    switch (proto) {
+        case ETH_P_IP:
+            return ipv4_hash(skb, nhoff);
+        case ETH_P_IPV6:
+            return ipv6_hash(skb, nhoff);
+        default:
+            return 0;
+    }
+}
+
+/* offset and ethertype of the GRE payload, ERSPAN headers are skipped */
+static __always_inline __u32 gre_payload(struct __sk_buff *skb, __u32 off, __u16 *proto)
+{
+    __u16 flags = load_half(skb, off);
+
+    if (flags & GRE_VERSION)
+        return 0;
+
+    *proto = load_half(skb, off + 2);
+    off += 4;
+    if (flags & GRE_FLAG_CSUM)
+        off += 4;
+    if (flags & GRE_FLAG_KEY)
+        off += 4;
+    if (flags & GRE_FLAG_SEQ)
+        off += 4;
+
+    if (*proto == ETH_P_ERSPAN) {
+        /* type I has no sequence number nor ERSPAN header */
+        if (flags & GRE_FLAG_SEQ)
+            off += ERSPAN_II_HLEN;
+        *proto = ETH_P_TEB;
+    } else if (*proto == ETH_P_ERSPAN2) {
+        if (load_byte(skb, off + ERSPAN_III_HLEN - 1) & ERSPAN_III_FLAG_O)
+            off += ERSPAN_III_SUBHLEN;
+        off += ERSPAN_III_HLEN;
+        *proto = ETH_P_TEB;
+    }
+    return off;
+}
+
+static __always_inline __u32 outer_hash(struct __sk_buff *skb, __u8 ip_proto,
+                                        __u32 l4off, __u32 hash)
+{
+    __u16 proto = 0;
+
+    switch (ip_proto) {
+        case IPPROTO_GRE:
+            l4off = gre_payload(skb, l4off, &proto);
+            if (l4off == 0)
+                return hash;
+            break;
+        case IPPROTO_IPIP:
+            proto = ETH_P_IP;
+            break;
+        case IPPROTO_IPV6:
+            proto = ETH_P_IPV6;
+            break;
+        default:
+            return hash;
+    }
+
+    __u32 ihash = inner_hash(skb, l4off, proto);
+    return ihash ? ihash : hash;
+}
+
+int SEC("loadbalancer") lb(struct __sk_buff *skb)
+{
+    __u32 nhoff = LL_OFF(ETH_HLEN);
+    __u16 proto = load_half(skb, LL_OFF(offsetof(struct ethhdr, h_proto)));
+    __u32 hash;
+
+    proto = skip_vlan(skb, &nhoff, proto);
+
+    switch (proto) {
+        case ETH_P_IP: {
+            __u8 ip_proto = load_byte(skb, nhoff + offsetof(struct iphdr, protocol));
+            hash = ipv4_hash(skb, nhoff);
+            if (load_half(skb, nhoff + offsetof(struct iphdr, frag_off)) & 0x3fff)
+                return hash;
+            __u32 verlen = (load_byte(skb, nhoff) & 0x0F) << 2;
+            return outer_hash(skb, ip_proto, nhoff + verlen, hash);
+        }
+        case ETH_P_IPV6: {
+            __u8 ip_proto = load_byte(skb, nhoff + offsetof(struct ipv6hdr, nexthdr));
+            hash = ipv6_hash(skb, nhoff);
+            return outer_hash(skb, ip_proto, nhoff + sizeof(struct ipv6hdr), hash);
+        }
+        default:
+            return 0;
+    }
+}
+
+char __license[] SEC("license") = "GPL";
+
+__u32 __version SEC("version") = LINUX_VERSION_CODE;
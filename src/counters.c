@@ -33,6 +33,7 @@
 #include "util-time.h"
 #include "util-unittest.h"
 #include "util-debug.h"
+#include "util-cpu.h"
 #include "util-privs.h"
 #include "util-signal.h"
 #include "unix-manager.h"
@@ -110,6 +111,20 @@ static int stats_loggers_active = 1;
 
 static uint16_t counters_global_id = 0;
 
+/** names of the histogram buckets, built at registration and kept until
+ *  the stats are released as the counters and the stats table only
+ *  reference them */
+typedef struct StatsHistogramName_ {
+    char *name;
+    struct StatsHistogramName_ *next;
+} StatsHistogramName;
+
+static StatsHistogramName *stats_histogram_names = NULL;
+static SCMutex stats_histogram_names_lock = SCMUTEX_INITIALIZER;
+
+/** record capture latency histograms */
+static int stats_capture_latency = FALSE;
+
 static void StatsPublicThreadContextInit(StatsPublicThreadContext *t)
 {
     SCMutexInit(&t->m, NULL);
@@ -148,6 +163,32 @@ void StatsAddUI64(ThreadVars *tv, uint16_t id, uint64_t x)
     return;
 }
 
+/**
+ * \brief Adds a value and a number of updates to the local counter
+ *
+ * Used to add counts accumulated outside of the counter array, as if
+ * StatsAddUI64() had been called \a updates times. For an average counter
+ * \a x is the sum of the values.
+ *
+ * \param id      ID of the counter as set by the API
+ * \param x       Value to add to this local counter
+ * \param updates Number of updates the value accounts for
+ */
+void StatsAddUI64Updates(ThreadVars *tv, uint16_t id, uint64_t x, uint64_t updates)
+{
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+#ifdef UNITTESTS
+    if (pca->initialized == 0)
+        return;
+#endif
+#ifdef DEBUG
+    BUG_ON ((id < 1) || (id > pca->size));
+#endif
+    pca->head[id].value += x;
+    pca->head[id].updates += updates;
+    return;
+}
+
 /**
  * \brief Increments the local counter
  *
@@ -237,6 +278,11 @@ static void StatsInitCtx(void)
         const char *interval = ConfNodeLookupChildValue(stats, "interval");
         if (interval != NULL)
             stats_tts = (uint32_t) atoi(interval);
+
+        const char *latency = ConfNodeLookupChildValue(stats, "capture-latency");
+        if (latency != NULL && ConfValIsTrue(latency)) {
+            stats_capture_latency = TRUE;
+        }
     }
 
     if (!OutputStatsLoggersRegistered()) {
@@ -263,6 +309,20 @@ static void StatsInitCtx(void)
     SCReturn;
 }
 
+static void StatsHistogramNamesFree(void)
+{
+    SCMutexLock(&stats_histogram_names_lock);
+    StatsHistogramName *hn = stats_histogram_names;
+    while (hn != NULL) {
+        StatsHistogramName *next = hn->next;
+        SCFree(hn->name);
+        SCFree(hn);
+        hn = next;
+    }
+    stats_histogram_names = NULL;
+    SCMutexUnlock(&stats_histogram_names_lock);
+}
+
 /**
  * \brief Releases the resources alloted to the output context of the
  *        Stats API
@@ -954,6 +1014,114 @@ uint16_t StatsRegisterMaxCounter(const char *name, struct ThreadVars_ *tv)
     return id;
 }
 
+/** \internal
+ *  \brief get the name of a bucket of a histogram
+ *
+ *  Bucket 0 counts the 0 values, bucket b the values in
+ *  [2^(b-1), 2^b) and the last bucket the values of 2^(b-1) and more.
+ *
+ *  \retval name or NULL on memory error
+ */
+static const char *StatsHistogramBucketName(const char *name, int bucket)
+{
+    char buf[256];
+
+    if (bucket == STATS_HISTOGRAM_BUCKETS - 1) {
+        snprintf(buf, sizeof(buf), "%s.ge_%"PRIu64, name,
+                 (uint64_t)1 << (bucket - 1));
+    } else {
+        snprintf(buf, sizeof(buf), "%s.lt_%"PRIu64, name,
+                 (uint64_t)1 << bucket);
+    }
+
+    SCMutexLock(&stats_histogram_names_lock);
+    StatsHistogramName *hn = stats_histogram_names;
+    while (hn != NULL) {
+        if (strcmp(hn->name, buf) == 0) {
+            SCMutexUnlock(&stats_histogram_names_lock);
+            return hn->name;
+        }
+        hn = hn->next;
+    }
+
+    hn = SCMalloc(sizeof(*hn));
+    if (hn == NULL) {
+        SCMutexUnlock(&stats_histogram_names_lock);
+        return NULL;
+    }
+    hn->name = SCStrdup(buf);
+    if (hn->name == NULL) {
+        SCFree(hn);
+        SCMutexUnlock(&stats_histogram_names_lock);
+        return NULL;
+    }
+    hn->next = stats_histogram_names;
+    stats_histogram_names = hn;
+    SCMutexUnlock(&stats_histogram_names_lock);
+    return hn->name;
+}
+
+/**
+ * \brief Registers a histogram with log2 scale buckets
+ *
+ * The histogram is made of STATS_HISTOGRAM_BUCKETS normal counters
+ * named after the upper bound of their bucket, "name.lt_1",
+ * "name.lt_2", "name.lt_4" ... up to "name.ge_1048576", so the loggers
+ * output them like any other counter.
+ *
+ * \param name Prefix of the bucket counters names
+ * \param tv   Pointer to the ThreadVars instance for which the histogram
+ *             would be registered
+ *
+ * \retval id to use with StatsHistogramAdd(), 0 on failure
+ */
+uint16_t StatsRegisterHistogram(const char *name, struct ThreadVars_ *tv)
+{
+    uint16_t id = 0;
+
+    for (int b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+        const char *bname = StatsHistogramBucketName(name, b);
+        if (bname == NULL)
+            return 0;
+        uint16_t bid = StatsRegisterCounter(bname, tv);
+        if (bid == 0)
+            return 0;
+        if (b == 0) {
+            id = bid;
+        } else if (bid != id + b) {
+            /* the bucket counters must have consecutive ids */
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "histogram %s can't be "
+                       "registered", name);
+            return 0;
+        }
+    }
+    return id;
+}
+
+/**
+ * \brief Adds a value to a histogram
+ *
+ * \param tv    ThreadVars the histogram was registered for
+ * \param id    id returned by StatsRegisterHistogram()
+ * \param value value to account in its bucket
+ */
+void StatsHistogramAdd(ThreadVars *tv, uint16_t id, uint64_t value)
+{
+    int bucket = 0;
+    if (value > 0) {
+        bucket = 64 - __builtin_clzll(value);
+        if (bucket > STATS_HISTOGRAM_BUCKETS - 1)
+            bucket = STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    StatsIncr(tv, id + bucket);
+}
+
+/** \brief are capture latency histograms enabled (stats.capture-latency) */
+int StatsCaptureLatencyEnabled(void)
+{
+    return stats_enabled && stats_capture_latency;
+}
+
 /**
  * \brief Registers a counter, which represents a global value
  *
@@ -1172,6 +1340,59 @@ int StatsSetupPrivate(ThreadVars *tv)
     return 0;
 }
 
+/**
+ * \brief Registers a function adding the counts a module keeps on its
+ *        own to the local counters of the thread
+ *
+ * The functions are called by the thread itself right before its local
+ * counters are synced, in the order they were registered. A thread can
+ * have several of them, e.g. one per DecodeThreadVars of its slots.
+ * Registering the same \a data again replaces its function.
+ *
+ * \param tv        ThreadVars of the thread
+ * \param FlushFunc function to call, with \a data as argument
+ *
+ * \retval 0 on success, -1 if the thread has no room left
+ */
+int StatsRegisterFlushFunc(ThreadVars *tv,
+        void (*FlushFunc)(ThreadVars *, void *), void *data)
+{
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+
+    for (int i = 0; i < pca->flush_cnt; i++) {
+        if (pca->flush[i].data == data) {
+            pca->flush[i].Func = FlushFunc;
+            return 0;
+        }
+    }
+    if (pca->flush_cnt == STATS_FLUSH_FUNCS_MAX) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "thread %s has no room left "
+                     "for a counters flush function", tv->name);
+        return -1;
+    }
+    pca->flush[pca->flush_cnt].Func = FlushFunc;
+    pca->flush[pca->flush_cnt].data = data;
+    pca->flush_cnt++;
+    return 0;
+}
+
+/**
+ * \brief Removes the flush function registered for \a data, if any
+ */
+void StatsDeregisterFlushFunc(ThreadVars *tv, void *data)
+{
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+
+    for (int i = 0; i < pca->flush_cnt; i++) {
+        if (pca->flush[i].data == data) {
+            memmove(&pca->flush[i], &pca->flush[i + 1],
+                    (pca->flush_cnt - i - 1) * sizeof(StatsFlushFunc));
+            pca->flush_cnt--;
+            return;
+        }
+    }
+}
+
 /**
  * \brief Syncs the counter array with the global counter variables
  *
@@ -1229,6 +1450,7 @@ void StatsReleaseResources()
 {
     StatsLogSummary();
     StatsReleaseCtx();
+    StatsHistogramNamesFree();
 
     return;
 }
@@ -1536,6 +1758,214 @@ static int StatsTestCounterValues11(void)
     return result;
 }
 
+static int StatsTestHistogram12(void)
+{
+    ThreadVars tv;
+    StatsPrivateThreadContext *pca = NULL;
+    uint16_t id1, id2;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    id2 = StatsRegisterHistogram("h", &tv);
+    FAIL_IF(id2 != id1 + 1);
+    /* registering again returns the same counters */
+    FAIL_IF(StatsRegisterHistogram("h", &tv) != id2);
+    FAIL_IF(tv.perf_public_ctx.curr_id != id2 + STATS_HISTOGRAM_BUCKETS - 1);
+
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    pca = &tv.perf_private_ctx;
+
+    StatsHistogramAdd(&tv, id2, 0);
+    StatsHistogramAdd(&tv, id2, 1);
+    StatsHistogramAdd(&tv, id2, 2);
+    StatsHistogramAdd(&tv, id2, 3);
+    StatsHistogramAdd(&tv, id2, 1024);
+    StatsHistogramAdd(&tv, id2, 1 << 20);
+    StatsHistogramAdd(&tv, id2, UINT64_MAX);
+
+    FAIL_IF(pca->head[id1].value != 0);
+    FAIL_IF(pca->head[id2].value != 1);
+    FAIL_IF(pca->head[id2 + 1].value != 1);
+    FAIL_IF(pca->head[id2 + 2].value != 2);
+    FAIL_IF(pca->head[id2 + 11].value != 1);
+    FAIL_IF(pca->head[id2 + STATS_HISTOGRAM_BUCKETS - 1].value != 2);
+
+    StatsUpdateCounterArray(pca, &tv.perf_public_ctx);
+    const StatsCounter *pc = tv.perf_public_ctx.head->next;
+    FAIL_IF(strcmp(pc->name, "h.lt_1") != 0);
+    FAIL_IF(strcmp(pc->next->name, "h.lt_2") != 0);
+    FAIL_IF(strcmp(pc->next->next->next->name, "h.lt_8") != 0);
+    while (pc->next != NULL)
+        pc = pc->next;
+    FAIL_IF(strcmp(pc->name, "h.ge_1048576") != 0);
+    FAIL_IF(pc->value != 2);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(pca);
+    StatsHistogramNamesFree();
+
+    PASS;
+}
+
+typedef struct StatsTestLocal_ {
+    uint64_t cnt;
+    uint64_t sum;
+    uint64_t values;
+} StatsTestLocal;
+
+static uint16_t stats_test_id1;
+static uint16_t stats_test_id2;
+
+static void StatsTestFlush(ThreadVars *tv, void *data)
+{
+    StatsTestLocal *l = (StatsTestLocal *)data;
+    StatsAddUI64Updates(tv, stats_test_id1, l->cnt, l->cnt);
+    StatsAddUI64Updates(tv, stats_test_id2, l->sum, l->values);
+    memset(l, 0, sizeof(*l));
+}
+
+/**
+ * \test StatsTestFlush13 counts kept outside of the counter array are
+ *       added on sync
+ */
+static int StatsTestFlush13(void)
+{
+    ThreadVars tv;
+    StatsTestLocal l;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&l, 0, sizeof(l));
+
+    stats_test_id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    stats_test_id2 = StatsRegisterQualifiedCounter("t2", "c2",
+            &tv.perf_public_ctx, STATS_TYPE_AVERAGE, NULL);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    StatsRegisterFlushFunc(&tv, StatsTestFlush, &l);
+
+    for (int i = 0; i < 10; i++) {
+        l.cnt++;
+        l.sum += i;
+        l.values++;
+    }
+    FAIL_IF(tv.perf_private_ctx.head[stats_test_id1].value != 0);
+
+    StatsSyncCounters(&tv);
+    FAIL_IF(l.cnt != 0);
+    FAIL_IF(tv.perf_public_ctx.head->value != 10);
+    FAIL_IF(tv.perf_public_ctx.head->updates != 10);
+    FAIL_IF(tv.perf_public_ctx.head->next->value != 45);
+    FAIL_IF(tv.perf_public_ctx.head->next->updates != 10);
+
+    /* not signalled, nothing is flushed */
+    l.cnt++;
+    StatsSyncCountersIfSignalled(&tv);
+    FAIL_IF(l.cnt != 1);
+
+    StatsDeregisterFlushFunc(&tv, &l);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+    PASS;
+}
+
+/**
+ * \test StatsTestFlush15 all the flush functions of a thread are called,
+ *       e.g. those of the DecodeThreadVars of two slots
+ */
+static int StatsTestFlush15(void)
+{
+    ThreadVars tv;
+    StatsTestLocal l1, l2;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&l1, 0, sizeof(l1));
+    memset(&l2, 0, sizeof(l2));
+
+    stats_test_id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    stats_test_id2 = StatsRegisterQualifiedCounter("t2", "c2",
+            &tv.perf_public_ctx, STATS_TYPE_AVERAGE, NULL);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    FAIL_IF(StatsRegisterFlushFunc(&tv, StatsTestFlush, &l1) != 0);
+    FAIL_IF(StatsRegisterFlushFunc(&tv, StatsTestFlush, &l2) != 0);
+    /* registered again, not called twice */
+    FAIL_IF(StatsRegisterFlushFunc(&tv, StatsTestFlush, &l1) != 0);
+    FAIL_IF(tv.perf_private_ctx.flush_cnt != 2);
+
+    l1.cnt = 3;
+    l2.cnt = 4;
+    StatsSyncCounters(&tv);
+    FAIL_IF(l1.cnt != 0);
+    FAIL_IF(l2.cnt != 0);
+    FAIL_IF(tv.perf_public_ctx.head->value != 7);
+
+    StatsDeregisterFlushFunc(&tv, &l1);
+    FAIL_IF(tv.perf_private_ctx.flush_cnt != 1);
+    l1.cnt = 5;
+    l2.cnt = 6;
+    StatsSyncCounters(&tv);
+    FAIL_IF(l1.cnt != 5);
+    FAIL_IF(tv.perf_public_ctx.head->value != 13);
+
+    StatsDeregisterFlushFunc(&tv, &l2);
+    FAIL_IF(tv.perf_private_ctx.flush_cnt != 0);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+    PASS;
+}
+
+#define STATS_TEST_RUNS 10000000
+
+/**
+ * \test StatsTestBatch14 prints the cycles per update of the counter
+ *       API compared to local counts flushed once
+ */
+static int StatsTestBatch14(void)
+{
+#ifdef PROFILING
+    ThreadVars tv;
+    StatsTestLocal l;
+    uint64_t ticks_start, ticks_end;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&l, 0, sizeof(l));
+
+    stats_test_id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    stats_test_id2 = StatsRegisterQualifiedCounter("t2", "c2",
+            &tv.perf_public_ctx, STATS_TYPE_AVERAGE, NULL);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+
+    printf("\n");
+
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < STATS_TEST_RUNS; i++) {
+        StatsIncr(&tv, stats_test_id1);
+        StatsAddUI64(&tv, stats_test_id2, i & 0xffff);
+    }
+    ticks_end = UtilCpuGetTicks();
+    printf("StatsIncr+StatsAddUI64(%d) \t%"PRIu64"\n", STATS_TEST_RUNS,
+           (ticks_end - ticks_start) / STATS_TEST_RUNS);
+
+    StatsRegisterFlushFunc(&tv, StatsTestFlush, &l);
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < STATS_TEST_RUNS; i++) {
+        l.cnt++;
+        l.sum += i & 0xffff;
+        l.values++;
+    }
+    StatsSyncCounters(&tv);
+    ticks_end = UtilCpuGetTicks();
+    printf("local counts and flush(%d) \t%"PRIu64"\n", STATS_TEST_RUNS,
+           (ticks_end - ticks_start) / STATS_TEST_RUNS);
+
+    FAIL_IF(tv.perf_public_ctx.head->value != 2 * STATS_TEST_RUNS);
+
+    StatsDeregisterFlushFunc(&tv, &l);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+#endif
+    PASS;
+}
+
 #endif
 
 void StatsRegisterTests(void)
@@ -1552,5 +1982,9 @@ void StatsRegisterTests(void)
     UtRegisterTest("StatsTestUpdateGlobalCounter10",
                    StatsTestUpdateGlobalCounter10);
     UtRegisterTest("StatsTestCounterValues11", StatsTestCounterValues11);
+    UtRegisterTest("StatsTestHistogram12", StatsTestHistogram12);
+    UtRegisterTest("StatsTestFlush13", StatsTestFlush13);
+    UtRegisterTest("StatsTestBatch14", StatsTestBatch14);
+    UtRegisterTest("StatsTestFlush15", StatsTestFlush15);
 #endif
 }
@@ -90,6 +90,18 @@ typedef struct StatsLocalCounter_ {
     uint64_t updates;
 } StatsLocalCounter;
 
+/* max flush functions per thread */
+#define STATS_FLUSH_FUNCS_MAX 4
+
+/**
+ * \brief function adding the counts a module keeps on its own to the
+ *        local counters of the thread
+ */
+typedef struct StatsFlushFunc_ {
+    void (*Func)(struct ThreadVars_ *, void *);
+    void *data;
+} StatsFlushFunc;
+
 /**
  * \brief used to hold the private version of the counters registered
  */
@@ -101,6 +113,11 @@ typedef struct StatsPrivateThreadContext_ {
     uint32_t size;
 
     int initialized;
+
+    /* called before the local counters are synced, so modules keeping
+     * their own counts can add them first */
+    StatsFlushFunc flush[STATS_FLUSH_FUNCS_MAX];
+    int flush_cnt;
 } StatsPrivateThreadContext;
 
 /* the initialization functions */
@@ -118,23 +135,47 @@ uint16_t StatsRegisterAvgCounter(const char *, struct ThreadVars_ *);
 uint16_t StatsRegisterMaxCounter(const char *, struct ThreadVars_ *);
 uint16_t StatsRegisterGlobalCounter(const char *cname, uint64_t (*Func)(void));
 
+/* log2 scale histograms: a bucket for 0, one per power of 2 up to 2^20
+ * and one for the larger values */
+#define STATS_HISTOGRAM_BUCKETS 22
+uint16_t StatsRegisterHistogram(const char *, struct ThreadVars_ *);
+int StatsCaptureLatencyEnabled(void);
+
 /* functions used to update local counter values */
 void StatsAddUI64(struct ThreadVars_ *, uint16_t, uint64_t);
 void StatsSetUI64(struct ThreadVars_ *, uint16_t, uint64_t);
 void StatsIncr(struct ThreadVars_ *, uint16_t);
+void StatsAddUI64Updates(struct ThreadVars_ *, uint16_t, uint64_t, uint64_t);
+void StatsHistogramAdd(struct ThreadVars_ *, uint16_t, uint64_t);
 
 /* utility functions */
 int StatsUpdateCounterArray(StatsPrivateThreadContext *, StatsPublicThreadContext *);
+int StatsRegisterFlushFunc(struct ThreadVars_ *,
+        void (*FlushFunc)(struct ThreadVars_ *, void *), void *);
+void StatsDeregisterFlushFunc(struct ThreadVars_ *, void *);
 uint64_t StatsGetLocalCounterValue(struct ThreadVars_ *, uint16_t);
 int StatsSetupPrivate(struct ThreadVars_ *);
 void StatsThreadCleanup(struct ThreadVars_ *);
 
-#define StatsSyncCounters(tv) \
-    StatsUpdateCounterArray(&(tv)->perf_private_ctx, &(tv)->perf_public_ctx);  \
+#define StatsFlushLocal(tv)                                                    \
+    do {                                                                        \
+        for (int _i = 0; _i < (tv)->perf_private_ctx.flush_cnt; _i++) {         \
+            (tv)->perf_private_ctx.flush[_i].Func((tv),                         \
+                    (tv)->perf_private_ctx.flush[_i].data);                     \
+        }                                                                       \
+    } while (0)
+
+#define StatsSyncCounters(tv)                                                  \
+    do {                                                                        \
+        StatsFlushLocal((tv));                                                  \
+        StatsUpdateCounterArray(&(tv)->perf_private_ctx,                       \
+                                &(tv)->perf_public_ctx);                        \
+    } while (0)
 
 #define StatsSyncCountersIfSignalled(tv)                                       \
     do {                                                                        \
         if ((tv)->perf_public_ctx.perf_flag == 1) {                             \
+            StatsFlushLocal((tv));                                              \
             StatsUpdateCounterArray(&(tv)->perf_private_ctx,                   \
                                      &(tv)->perf_public_ctx);                   \
         }                                                                       \
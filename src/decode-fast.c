@@ -0,0 +1,511 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Fast path decoder
+ *
+ * Most of the traffic is plain ethernet carrying IPv4 without options
+ * or IPv6 without extension headers, then TCP or UDP. For those packets
+ * all the headers are validated first in a single pass, without events
+ * to set, then the Packet is filled in. Anything else, including the
+ * invalid packets, is left untouched and handed to DecodeEthernet(), so
+ * the result is always the one of the full decoder.
+ *
+ * For TCP only segments without options or with the NOP,NOP,timestamp
+ * layout used on established connections are handled. UDP goes through
+ * DecodeUDP() as it has to look for the tunnels.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-fast.h"
+#include "decode-events.h"
+#include "conf.h"
+#include "flow.h"
+#include "defrag.h"
+#include "packet-queue.h"
+#include "pkt-var.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-cpu.h"
+#include "util-profiling.h"
+
+/* NOP, NOP, timestamp kind and len as the first option word */
+#define FAST_TCP_OPT_NOP_NOP_TS 0x0101080a
+#define FAST_TCP_TS_HEADER_LEN  (TCP_HEADER_LEN + 12)
+
+static int g_fast_path_mode = DECODE_FAST_PATH_AUTO;
+
+/**
+ * \brief read the fast path configuration
+ *
+ * \code
+ * decoder:
+ *   fast-path: auto
+ * \endcode
+ */
+void DecodeFastPathConfig(void)
+{
+    const char *mode = NULL;
+
+    if (ConfGet("decoder.fast-path", &mode) != 1 || mode == NULL)
+        return;
+
+    if (strcasecmp(mode, "auto") == 0) {
+        g_fast_path_mode = DECODE_FAST_PATH_AUTO;
+    } else if (ConfValIsTrue(mode)) {
+        g_fast_path_mode = DECODE_FAST_PATH_ON;
+    } else if (ConfValIsFalse(mode)) {
+        g_fast_path_mode = DECODE_FAST_PATH_OFF;
+    } else {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                     "decoder.fast-path '%s', using auto", mode);
+    }
+    SCLogConfig("decoder fast path: %s", mode);
+}
+
+int DecodeFastPathMode(void)
+{
+    return g_fast_path_mode;
+}
+
+/**
+ * \brief validate a TCP header, without touching the packet
+ *
+ * \retval hlen header length or 0 if the full decoder is needed
+ */
+static inline uint16_t DecodeFastTCPCheck(const uint8_t *pkt, uint16_t len)
+{
+    if (unlikely(len < TCP_HEADER_LEN))
+        return 0;
+
+    const uint16_t hlen = TCP_GET_RAW_OFFSET((const TCPHdr *)pkt) << 2;
+    if (hlen == TCP_HEADER_LEN)
+        return hlen;
+
+    if (hlen == FAST_TCP_TS_HEADER_LEN && len >= hlen) {
+        uint32_t opt;
+        memcpy(&opt, pkt + TCP_HEADER_LEN, sizeof(opt));
+        if (opt == htonl(FAST_TCP_OPT_NOP_NOP_TS))
+            return hlen;
+    }
+    return 0;
+}
+
+static inline void DecodeFastTCP(ThreadVars *tv, DecodeThreadVars *dtv,
+                                 Packet *p, uint8_t *pkt, uint16_t len,
+                                 uint16_t hlen)
+{
+    dtv->stats.tcp++;
+
+    p->tcph = (TCPHdr *)pkt;
+    if (hlen == FAST_TCP_TS_HEADER_LEN) {
+        uint32_t values[2];
+        memcpy(&values, pkt + TCP_HEADER_LEN + 4, sizeof(values));
+        p->tcpvars.ts_val = ntohl(values[0]);
+        p->tcpvars.ts_ecr = ntohl(values[1]);
+        p->tcpvars.ts_set = TRUE;
+    }
+
+    SET_TCP_SRC_PORT(p, &p->sp);
+    SET_TCP_DST_PORT(p, &p->dp);
+
+    p->proto = IPPROTO_TCP;
+    p->payload = pkt + hlen;
+    p->payload_len = len - hlen;
+
+    FlowSetupPacket(p);
+}
+
+/**
+ * \retval 1 if the packet was decoded, 0 if it was left untouched
+ */
+static inline int DecodeFastIPV4(ThreadVars *tv, DecodeThreadVars *dtv,
+                                 Packet *p, uint8_t *pkt, uint16_t len,
+                                 PacketQueue *pq)
+{
+    if (unlikely(len < IPV4_HEADER_LEN))
+        return 0;
+
+    IPV4Hdr *ip4h = (IPV4Hdr *)pkt;
+    /* version 4 and no options */
+    if (ip4h->ip_verhl != 0x45)
+        return 0;
+
+    const uint16_t iplen = ntohs(IPV4_GET_RAW_IPLEN(ip4h));
+    if (unlikely(iplen < IPV4_HEADER_LEN || iplen > len))
+        return 0;
+    /* fragment offset or more fragments */
+    if (ntohs(IPV4_GET_RAW_IPOFFSET(ip4h)) & 0x3fff)
+        return 0;
+
+    uint8_t *l4 = pkt + IPV4_HEADER_LEN;
+    const uint16_t l4len = iplen - IPV4_HEADER_LEN;
+    uint16_t tcp_hlen = 0;
+
+    switch (IPV4_GET_RAW_IPPROTO(ip4h)) {
+        case IPPROTO_TCP:
+            tcp_hlen = DecodeFastTCPCheck(l4, l4len);
+            if (tcp_hlen == 0)
+                return 0;
+            break;
+        case IPPROTO_UDP:
+            break;
+        default:
+            return 0;
+    }
+
+    dtv->stats.ipv4++;
+    p->ip4h = ip4h;
+    SET_IPV4_SRC_ADDR(p, &p->src);
+    SET_IPV4_DST_ADDR(p, &p->dst);
+    p->proto = IPV4_GET_RAW_IPPROTO(ip4h);
+
+    if (tcp_hlen != 0) {
+        DecodeFastTCP(tv, dtv, p, l4, l4len, tcp_hlen);
+    } else {
+        DecodeUDP(tv, dtv, p, l4, l4len, pq);
+    }
+    return 1;
+}
+
+/**
+ * \retval 1 if the packet was decoded, 0 if it was left untouched
+ */
+static inline int DecodeFastIPV6(ThreadVars *tv, DecodeThreadVars *dtv,
+                                 Packet *p, uint8_t *pkt, uint16_t len,
+                                 PacketQueue *pq)
+{
+    if (unlikely(len < IPV6_HEADER_LEN))
+        return 0;
+
+    IPV6Hdr *ip6h = (IPV6Hdr *)pkt;
+    if (IPV6_GET_RAW_VER(ip6h) != 6)
+        return 0;
+
+    const uint16_t plen = IPV6_GET_RAW_PLEN(ip6h);
+    if (unlikely(plen > len - IPV6_HEADER_LEN))
+        return 0;
+
+    uint8_t *l4 = pkt + IPV6_HEADER_LEN;
+    const uint8_t nh = IPV6_GET_RAW_NH(ip6h);
+    uint16_t tcp_hlen = 0;
+
+    switch (nh) {
+        case IPPROTO_TCP:
+            tcp_hlen = DecodeFastTCPCheck(l4, plen);
+            if (tcp_hlen == 0)
+                return 0;
+            break;
+        case IPPROTO_UDP:
+            break;
+        default:
+            return 0;
+    }
+
+    dtv->stats.ipv6++;
+    p->ip6h = ip6h;
+    SET_IPV6_SRC_ADDR(p, &p->src);
+    SET_IPV6_DST_ADDR(p, &p->dst);
+    IPV6_SET_L4PROTO(p, nh);
+
+    if (tcp_hlen != 0) {
+        DecodeFastTCP(tv, dtv, p, l4, plen, tcp_hlen);
+    } else {
+        DecodeUDP(tv, dtv, p, l4, plen, pq);
+    }
+    return 1;
+}
+
+/**
+ * \brief in auto mode, turn the fast path off for the thread if most of
+ *        its packets end up in the full decoder anyway
+ */
+static void DecodeFastPathAutoUpdate(DecodeThreadVars *dtv)
+{
+    if (dtv->fast_path_hits < DECODE_FAST_PATH_SAMPLE / 4) {
+        SCLogDebug("fast path taken for %u/%u packets, disabling it",
+                   dtv->fast_path_hits, dtv->fast_path_pkts);
+        dtv->fast_path = DECODE_FAST_PATH_OFF;
+    } else {
+        dtv->fast_path = DECODE_FAST_PATH_ON;
+    }
+}
+
+/**
+ * \brief decode an ethernet frame, using the fast path when possible
+ *
+ * Drop-in replacement of DecodeEthernet() for the capture sources.
+ */
+int DecodeEthernetFast(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                       uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (dtv->fast_path == DECODE_FAST_PATH_OFF ||
+            unlikely(len < ETHERNET_HEADER_LEN))
+        return DecodeEthernet(tv, dtv, p, pkt, len, pq);
+
+    EthernetHdr *ethh = (EthernetHdr *)pkt;
+    int done = 0;
+
+    if (ethh->eth_type == htons(ETHERNET_TYPE_IP)) {
+        done = DecodeFastIPV4(tv, dtv, p, pkt + ETHERNET_HEADER_LEN,
+                              len - ETHERNET_HEADER_LEN, pq);
+    } else if (ethh->eth_type == htons(ETHERNET_TYPE_IPV6)) {
+        done = DecodeFastIPV6(tv, dtv, p, pkt + ETHERNET_HEADER_LEN,
+                              len - ETHERNET_HEADER_LEN, pq);
+    }
+
+    if (dtv->fast_path == DECODE_FAST_PATH_AUTO) {
+        dtv->fast_path_hits += done;
+        if (++dtv->fast_path_pkts == DECODE_FAST_PATH_SAMPLE)
+            DecodeFastPathAutoUpdate(dtv);
+    }
+
+    if (!done)
+        return DecodeEthernet(tv, dtv, p, pkt, len, pq);
+
+    dtv->stats.eth++;
+    dtv->stats.fast_path++;
+    p->ethh = ethh;
+    return TM_ECODE_OK;
+}
+
+#ifdef UNITTESTS
+
+/* 10.0.0.1:1024 -> 10.0.0.2:80 ACK with NOP,NOP,TS and 4 bytes of data */
+static uint8_t raw_fast_ipv4_tcp_ts[] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+    0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+    0x45, 0x00, 0x00, 0x38, 0x00, 0x01, 0x40, 0x00,
+    0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+    0x0a, 0x00, 0x00, 0x02,
+    0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x80, 0x18, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x01, 0x01, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x2a,
+    0x00, 0x00, 0x00, 0x07,
+    'd', 'a', 't', 'a' };
+
+static void DecodeFastSetup(ThreadVars *tv, DecodeThreadVars *dtv,
+                            PacketQueue *pq)
+{
+    memset(tv, 0, sizeof(ThreadVars));
+    memset(dtv, 0, sizeof(DecodeThreadVars));
+    memset(pq, 0, sizeof(PacketQueue));
+    dtv->fast_path = DECODE_FAST_PATH_ON;
+    FlowInitConfig(FLOW_QUIET);
+}
+
+/**
+ * \test DecodeFastPathTest01 gives the same result as the full decoder
+ *       for a TCP segment with timestamps
+ */
+static int DecodeFastPathTest01 (void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p1);
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+
+    DecodeFastSetup(&tv, &dtv, &pq);
+
+    DecodeEthernetFast(&tv, &dtv, p1, raw_fast_ipv4_tcp_ts,
+                       sizeof(raw_fast_ipv4_tcp_ts), &pq);
+    DecodeEthernet(&tv, &dtv, p2, raw_fast_ipv4_tcp_ts,
+                   sizeof(raw_fast_ipv4_tcp_ts), &pq);
+
+    FAIL_IF_NOT(PKT_IS_IPV4(p1));
+    FAIL_IF_NOT(PKT_IS_TCP(p1));
+    FAIL_IF_NULL(p1->ethh);
+    FAIL_IF(p1->sp != 1024 || p1->dp != 80);
+    FAIL_IF(p1->payload_len != 4);
+    FAIL_IF_NOT(TCP_HAS_TS(p1));
+    FAIL_IF(TCP_GET_TSVAL(p1) != 42 || TCP_GET_TSECR(p1) != 7);
+    FAIL_IF_NOT(p1->flags & PKT_WANTS_FLOW);
+
+    FAIL_IF(CMP_ADDR(&p1->src, &p2->src) == 0);
+    FAIL_IF(CMP_ADDR(&p1->dst, &p2->dst) == 0);
+    FAIL_IF(p1->sp != p2->sp || p1->dp != p2->dp);
+    FAIL_IF(p1->proto != p2->proto);
+    FAIL_IF(p1->payload != p2->payload);
+    FAIL_IF(p1->payload_len != p2->payload_len);
+    FAIL_IF(TCP_GET_TSVAL(p1) != TCP_GET_TSVAL(p2));
+    FAIL_IF(p1->flow_hash != p2->flow_hash);
+
+    SCFree(p1);
+    SCFree(p2);
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ * \test DecodeFastPathTest02 leaves a SYN with MSS and a fragment to the
+ *       full decoder
+ */
+static int DecodeFastPathTest02 (void)
+{
+    uint8_t raw_syn[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x60, 0x02, 0x01, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x02, 0x04, 0x05, 0xb4 };
+    uint8_t raw_frag[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x20, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x10, 0x00, 0x00 };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    DecodeFastSetup(&tv, &dtv, &pq);
+    DefragInit();
+
+    DecodeEthernetFast(&tv, &dtv, p, raw_syn, sizeof(raw_syn), &pq);
+    FAIL_IF_NOT(PKT_IS_TCP(p));
+    FAIL_IF_NOT(TCP_HAS_MSS(p));
+
+    PACKET_RECYCLE(p);
+    DecodeEthernetFast(&tv, &dtv, p, raw_frag, sizeof(raw_frag), &pq);
+    FAIL_IF_NOT(p->flags & PKT_IS_FRAGMENT);
+    FAIL_IF(PKT_IS_UDP(p));
+
+    PACKET_RECYCLE(p);
+    SCFree(p);
+    DefragDestroy();
+    FlowShutdown();
+    PASS;
+}
+
+/**
+ * \test DecodeFastPathTest03 decodes IPv6 UDP on the fast path
+ */
+static int DecodeFastPathTest03 (void)
+{
+    uint8_t raw_ipv6_udp[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x86, 0xdd,
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x11, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x0c, 0x00, 0x00,
+        0x01, 0x02, 0x03, 0x04 };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    DecodeFastSetup(&tv, &dtv, &pq);
+
+    DecodeEthernetFast(&tv, &dtv, p, raw_ipv6_udp, sizeof(raw_ipv6_udp), &pq);
+    FAIL_IF_NOT(PKT_IS_IPV6(p));
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF(IPV6_GET_L4PROTO(p) != IPPROTO_UDP);
+    FAIL_IF(p->sp != 1024 || p->dp != 53);
+    FAIL_IF(p->payload_len != 4);
+    FAIL_IF_NOT(p->flags & PKT_WANTS_FLOW);
+
+    SCFree(p);
+    FlowShutdown();
+    PASS;
+}
+
+#define DECODE_FAST_RUNS 1000000
+
+/**
+ * \test DecodeFastPathTest04 prints the cycles per packet of the full
+ *       and fast decoders
+ */
+static int DecodeFastPathTest04 (void)
+{
+#ifdef PROFILING
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    uint64_t ticks_start, ticks_end;
+
+    DecodeFastSetup(&tv, &dtv, &pq);
+
+    printf("\n");
+
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < DECODE_FAST_RUNS; i++) {
+        DecodeEthernet(&tv, &dtv, p, raw_fast_ipv4_tcp_ts,
+                       sizeof(raw_fast_ipv4_tcp_ts), &pq);
+        PACKET_RECYCLE(p);
+    }
+    ticks_end = UtilCpuGetTicks();
+    printf("DecodeEthernet(%d) \t\t%"PRIu64"\n", DECODE_FAST_RUNS,
+           (ticks_end - ticks_start) / DECODE_FAST_RUNS);
+
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < DECODE_FAST_RUNS; i++) {
+        DecodeEthernetFast(&tv, &dtv, p, raw_fast_ipv4_tcp_ts,
+                           sizeof(raw_fast_ipv4_tcp_ts), &pq);
+        PACKET_RECYCLE(p);
+    }
+    ticks_end = UtilCpuGetTicks();
+    printf("DecodeEthernetFast(%d) \t%"PRIu64"\n", DECODE_FAST_RUNS,
+           (ticks_end - ticks_start) / DECODE_FAST_RUNS);
+
+    SCFree(p);
+    FlowShutdown();
+#endif
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DecodeFastPathRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeFastPathTest01", DecodeFastPathTest01);
+    UtRegisterTest("DecodeFastPathTest02", DecodeFastPathTest02);
+    UtRegisterTest("DecodeFastPathTest03", DecodeFastPathTest03);
+    UtRegisterTest("DecodeFastPathTest04", DecodeFastPathTest04);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
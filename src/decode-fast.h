@@ -0,0 +1,44 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast path decoder for ethernet/ipv4|ipv6/tcp|udp
+ */
+
+#ifndef __DECODE_FAST_H__
+#define __DECODE_FAST_H__
+
+/* values of DecodeThreadVars::fast_path */
+enum {
+    DECODE_FAST_PATH_OFF = 0,
+    DECODE_FAST_PATH_ON,
+    /* on, until the thread sees the fast path is rarely taken */
+    DECODE_FAST_PATH_AUTO,
+};
+
+/* packets looked at before the auto mode makes its choice */
+#define DECODE_FAST_PATH_SAMPLE 65536
+
+void DecodeFastPathConfig(void);
+int DecodeFastPathMode(void);
+int DecodeEthernetFast(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                       uint8_t *pkt, uint16_t len, PacketQueue *pq);
+void DecodeFastPathRegisterTests(void);
+
+#endif /* __DECODE_FAST_H__ */
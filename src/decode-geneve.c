@@ -0,0 +1,231 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decode Geneve
+ *
+ * Geneve (draft-ietf-nvo3-geneve) encapsulates ethernet frames or IP packets in UDP,
+ * after a header with variable length options. As with VXLAN the inner
+ * packet is decoded as a tunnel packet with its own flow.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-geneve.h"
+#include "decode-events.h"
+#include "packet-queue.h"
+#include "pkt-var.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-engine-port.h"
+#include "flow.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+#define GENEVE_VERSION(h)       ((h)->ver_opt_len >> 6)
+#define GENEVE_OPT_LEN(h)       (((h)->ver_opt_len & 0x3f) * 4)
+
+typedef struct GeneveHeader_ {
+    uint8_t ver_opt_len;
+    uint8_t flags;
+    uint16_t proto;
+    uint8_t vni[3];
+    uint8_t reserved;
+} __attribute__((__packed__)) GeneveHeader;
+
+static bool g_geneve_enabled = true;
+static int g_geneve_ports_cnt = 1;
+static uint16_t g_geneve_ports[GENEVE_MAX_PORTS] = { GENEVE_DEFAULT_PORT };
+
+static void DecodeGeneveConfigPorts(const char *pstr)
+{
+    DetectPort *head = NULL;
+
+    if (DetectPortParse(NULL, &head, pstr) != 0) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                     "decoder.geneve.ports '%s', using %u", pstr,
+                     GENEVE_DEFAULT_PORT);
+        DetectPortCleanupList(head);
+        return;
+    }
+
+    g_geneve_ports_cnt = 0;
+    for (DetectPort *dp = head; dp != NULL; dp = dp->next) {
+        if (g_geneve_ports_cnt >= GENEVE_MAX_PORTS) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "more than %d "
+                         "Geneve ports, ignoring the others", GENEVE_MAX_PORTS);
+            break;
+        }
+        g_geneve_ports[g_geneve_ports_cnt++] = dp->port;
+    }
+    DetectPortCleanupList(head);
+}
+
+void DecodeGeneveConfig(void)
+{
+    int enabled = 0;
+    const char *ports = NULL;
+
+    if (ConfGetBool("decoder.geneve.enabled", &enabled) == 1) {
+        g_geneve_enabled = enabled ? true : false;
+    }
+    if (g_geneve_enabled && ConfGet("decoder.geneve.ports", &ports) == 1) {
+        DecodeGeneveConfigPorts(ports);
+    }
+}
+
+static inline bool DecodeGeneveIsPort(const Port port)
+{
+    for (int i = 0; i < g_geneve_ports_cnt; i++) {
+        if (g_geneve_ports[i] == port)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * \brief Function to decode Geneve packets
+ *
+ * \param p UDP packet
+ * \param pkt UDP payload
+ *
+ * \retval TM_ECODE_FAILED if packet is not a Geneve packet, TM_ECODE_OK if it is
+ */
+int DecodeGeneve(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                 uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (!g_geneve_enabled || !DecodeGeneveIsPort(p->dp))
+        return TM_ECODE_FAILED;
+
+    if (len < GENEVE_HEADER_LEN)
+        return TM_ECODE_FAILED;
+
+    const GeneveHeader *geneveh = (const GeneveHeader *)pkt;
+    if (GENEVE_VERSION(geneveh) != 0)
+        return TM_ECODE_FAILED;
+
+    /* options are skipped */
+    const uint16_t hlen = GENEVE_HEADER_LEN + GENEVE_OPT_LEN(geneveh);
+    if (len <= hlen)
+        return TM_ECODE_FAILED;
+
+    enum DecodeTunnelProto proto;
+    switch (ntohs(geneveh->proto)) {
+        case ETHERNET_TYPE_BRIDGE:
+            proto = DECODE_TUNNEL_ETHERNET;
+            break;
+        case ETHERNET_TYPE_IP:
+            proto = DECODE_TUNNEL_IPV4;
+            break;
+        case ETHERNET_TYPE_IPV6:
+            proto = DECODE_TUNNEL_IPV6;
+            break;
+        default:
+            SCLogDebug("Geneve unsupported protocol %04x", ntohs(geneveh->proto));
+            return TM_ECODE_FAILED;
+    }
+
+    SCLogDebug("Geneve vni %u", (uint32_t)geneveh->vni[0] << 16 |
+               (uint32_t)geneveh->vni[1] << 8 | geneveh->vni[2]);
+
+    if (pq == NULL)
+        return TM_ECODE_FAILED;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + hlen, len - hlen,
+                                      proto, pq);
+    if (tp == NULL)
+        return TM_ECODE_FAILED;
+
+    PKT_SET_SRC(tp, PKT_SRC_DECODER_GENEVE);
+    PacketEnqueue(pq, tp);
+    StatsIncr(tv, dtv->counter_geneve);
+    return TM_ECODE_OK;
+}
+
+#ifdef UNITTESTS
+
+/**
+ * \test DecodeGenevetest01 decodes the inner ethernet frame after an
+ *       option as a tunnel packet with its own tuple
+ */
+static int DecodeGenevetest01 (void)
+{
+    uint8_t raw_geneve[] = {
+        /* udp 12345 -> 6081 */
+        0x30, 0x39, 0x17, 0xc1, 0x00, 0x42, 0x00, 0x00,
+        /* geneve, one 8 bytes option, ethernet, vni 42 */
+        0x02, 0x00, 0x65, 0x58, 0x00, 0x00, 0x2a, 0x00,
+        0x01, 0x02, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00,
+        /* ethernet */
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+        /* ipv4 10.0.0.1 -> 10.0.0.2 udp */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* udp 1024 -> 53 */
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FAIL_IF(PacketCopyData(p, raw_geneve, sizeof(raw_geneve)) != 0);
+    DecodeUDP(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF(p->dp != GENEVE_DEFAULT_PORT);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF(tp->pkt_src != PKT_SRC_DECODER_GENEVE);
+    FAIL_IF_NULL(tp->ethh);
+    FAIL_IF_NULL(tp->udph);
+    FAIL_IF(tp->sp != 1024 || tp->dp != 53);
+
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+    SCFree(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DecodeGeneveRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeGenevetest01", DecodeGenevetest01);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
@@ -35,9 +35,12 @@
 #include "decode.h"
 #include "decode-events.h"
 #include "decode-gre.h"
+#include "packet-queue.h"
+#include "pkt-var.h"
 
 #include "util-unittest.h"
 #include "util-debug.h"
+#include "util-profiling.h"
 
 /**
  * \brief Function to decode GRE packets
@@ -394,6 +397,46 @@ static int DecodeGREtest03 (void)
     SCFree(p);
     return 1;
 }
+
+/**
+ * \test DecodeGRETest04 checks the tunnel packet points in the data of
+ *       its root packet
+ */
+
+static int DecodeGREtest04 (void)
+{
+    uint8_t raw_gre[] = {
+        0x00, 0x00, 0x08, 0x00, 0x45, 0x00, 0x00, 0x1c,
+        0x00, 0x01, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FAIL_IF(PacketCopyData(p, raw_gre, sizeof(raw_gre)) != 0);
+    DecodeGRE(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NULL(p->greh);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF_NOT(tp->root == p);
+    FAIL_IF_NOT(tp->flags & PKT_ZERO_COPY);
+    FAIL_IF_NOT(GET_PKT_DATA(tp) == GET_PKT_DATA(p) + GRE_HDR_LEN);
+    FAIL_IF(GET_PKT_LEN(tp) != sizeof(raw_gre) - GRE_HDR_LEN);
+    FAIL_IF_NULL(tp->udph);
+
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+    SCFree(p);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -406,6 +449,7 @@ void DecodeGRERegisterTests(void)
     UtRegisterTest("DecodeGREtest01", DecodeGREtest01);
     UtRegisterTest("DecodeGREtest02", DecodeGREtest02);
     UtRegisterTest("DecodeGREtest03", DecodeGREtest03);
+    UtRegisterTest("DecodeGREtest04", DecodeGREtest04);
 #endif /* UNITTESTS */
 }
 /**
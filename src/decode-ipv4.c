@@ -532,7 +532,7 @@ static int DecodeIPV4Packet(Packet *p, uint8_t *pkt, uint16_t len)
 
 int DecodeIPV4(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
 {
-    StatsIncr(tv, dtv->counter_ipv4);
+    dtv->stats.ipv4++;
 
     SCLogDebug("pkt %p len %"PRIu16"", pkt, len);
 
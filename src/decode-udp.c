@@ -34,6 +34,8 @@
 #include "decode.h"
 #include "decode-udp.h"
 #include "decode-teredo.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "decode-events.h"
 #include "util-unittest.h"
 #include "util-debug.h"
@@ -72,7 +74,7 @@ static int DecodeUDPPacket(ThreadVars *t, Packet *p, uint8_t *pkt, uint16_t len)
 
 int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
 {
-    StatsIncr(tv, dtv->counter_udp);
+    dtv->stats.udp++;
 
     if (unlikely(DecodeUDPPacket(tv, p,pkt,len) < 0)) {
         p->udph = NULL;
@@ -89,6 +91,14 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, ui
         return TM_ECODE_OK;
     }
 
+    /* the inner packet of overlays gets its own flow and flow hash,
+     * spreading them over the workers */
+    if (DecodeVXLAN(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK ||
+            DecodeGeneve(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK) {
+        FlowSetupPacket(p);
+        return TM_ECODE_OK;
+    }
+
     FlowSetupPacket(p);
 
     return TM_ECODE_OK;
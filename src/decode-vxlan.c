@@ -0,0 +1,245 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decode VXLAN
+ *
+ * VXLAN (RFC 7348) encapsulates ethernet frames in UDP. The inner frame
+ * is decoded as a tunnel packet, so it gets its own flow and flow hash
+ * instead of being handled as the payload of the UDP flow between the
+ * tunnel end points.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-vxlan.h"
+#include "decode-events.h"
+#include "packet-queue.h"
+#include "pkt-var.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-engine-port.h"
+#include "flow.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+#define VXLAN_FLAG_I    0x08
+
+typedef struct VXLANHeader_ {
+    uint8_t flags;
+    uint8_t reserved1[3];
+    uint8_t vni[3];
+    uint8_t reserved2;
+} __attribute__((__packed__)) VXLANHeader;
+
+static bool g_vxlan_enabled = true;
+static int g_vxlan_ports_cnt = 1;
+static uint16_t g_vxlan_ports[VXLAN_MAX_PORTS] = { VXLAN_DEFAULT_PORT };
+
+static void DecodeVXLANConfigPorts(const char *pstr)
+{
+    DetectPort *head = NULL;
+
+    if (DetectPortParse(NULL, &head, pstr) != 0) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                     "decoder.vxlan.ports '%s', using %u", pstr,
+                     VXLAN_DEFAULT_PORT);
+        DetectPortCleanupList(head);
+        return;
+    }
+
+    g_vxlan_ports_cnt = 0;
+    for (DetectPort *dp = head; dp != NULL; dp = dp->next) {
+        if (g_vxlan_ports_cnt >= VXLAN_MAX_PORTS) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "more than %d "
+                         "VXLAN ports, ignoring the others", VXLAN_MAX_PORTS);
+            break;
+        }
+        g_vxlan_ports[g_vxlan_ports_cnt++] = dp->port;
+    }
+    DetectPortCleanupList(head);
+}
+
+void DecodeVXLANConfig(void)
+{
+    int enabled = 0;
+    const char *ports = NULL;
+
+    if (ConfGetBool("decoder.vxlan.enabled", &enabled) == 1) {
+        g_vxlan_enabled = enabled ? true : false;
+    }
+    if (g_vxlan_enabled && ConfGet("decoder.vxlan.ports", &ports) == 1) {
+        DecodeVXLANConfigPorts(ports);
+    }
+}
+
+static inline bool DecodeVXLANIsPort(const Port port)
+{
+    for (int i = 0; i < g_vxlan_ports_cnt; i++) {
+        if (g_vxlan_ports[i] == port)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * \brief Function to decode VXLAN packets
+ *
+ * \param p UDP packet
+ * \param pkt UDP payload
+ *
+ * \retval TM_ECODE_FAILED if packet is not a VXLAN packet, TM_ECODE_OK if it is
+ */
+int DecodeVXLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (!g_vxlan_enabled || !DecodeVXLANIsPort(p->dp))
+        return TM_ECODE_FAILED;
+
+    /* at least an ethernet header after the VXLAN one */
+    if (len < VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN)
+        return TM_ECODE_FAILED;
+
+    const VXLANHeader *vxlanh = (const VXLANHeader *)pkt;
+    if (!(vxlanh->flags & VXLAN_FLAG_I))
+        return TM_ECODE_FAILED;
+
+    SCLogDebug("VXLAN vni %u", (uint32_t)vxlanh->vni[0] << 16 |
+               (uint32_t)vxlanh->vni[1] << 8 | vxlanh->vni[2]);
+
+    if (pq == NULL)
+        return TM_ECODE_FAILED;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + VXLAN_HEADER_LEN,
+                                      len - VXLAN_HEADER_LEN,
+                                      DECODE_TUNNEL_ETHERNET, pq);
+    if (tp == NULL)
+        return TM_ECODE_FAILED;
+
+    PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
+    PacketEnqueue(pq, tp);
+    StatsIncr(tv, dtv->counter_vxlan);
+    return TM_ECODE_OK;
+}
+
+#ifdef UNITTESTS
+
+/**
+ * \test DecodeVXLANtest01 decodes the inner ethernet frame as a tunnel
+ *       packet with its own tuple
+ */
+static int DecodeVXLANtest01 (void)
+{
+    uint8_t raw_vxlan[] = {
+        /* udp 12345 -> 4789 */
+        0x30, 0x39, 0x12, 0xb5, 0x00, 0x3a, 0x00, 0x00,
+        /* vxlan, vni 42 */
+        0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a, 0x00,
+        /* ethernet */
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+        /* ipv4 10.0.0.1 -> 10.0.0.2 udp */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* udp 1024 -> 53 */
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FAIL_IF(PacketCopyData(p, raw_vxlan, sizeof(raw_vxlan)) != 0);
+    DecodeUDP(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF(p->dp != VXLAN_DEFAULT_PORT);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF(tp->pkt_src != PKT_SRC_DECODER_VXLAN);
+    FAIL_IF_NULL(tp->ethh);
+    FAIL_IF_NULL(tp->udph);
+    FAIL_IF(tp->sp != 1024 || tp->dp != 53);
+    FAIL_IF_NOT(tp->flags & PKT_WANTS_FLOW);
+
+    PACKET_RECYCLE(tp);
+    SCFree(tp);
+    SCFree(p);
+    PASS;
+}
+
+/**
+ * \test DecodeVXLANtest02 ignores packets without the VNI flag
+ */
+static int DecodeVXLANtest02 (void)
+{
+    uint8_t raw_vxlan[] = {
+        0x30, 0x39, 0x12, 0xb5, 0x00, 0x3a, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a, 0x00,
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    FAIL_IF(PacketCopyData(p, raw_vxlan, sizeof(raw_vxlan)) != 0);
+    DecodeUDP(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF_NOT_NULL(PacketDequeue(&pq));
+
+    SCFree(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DecodeVXLANRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeVXLANtest01", DecodeVXLANtest01);
+    UtRegisterTest("DecodeVXLANtest02", DecodeVXLANtest02);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
@@ -52,8 +52,13 @@
 #include "conf.h"
 #include "decode.h"
 #include "decode-teredo.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
+#include "decode-fast.h"
+#include "defrag-hash.h"
 #include "util-debug.h"
 #include "util-mem.h"
+#include "util-hugepages.h"
 #include "app-layer-detect-proto.h"
 #include "app-layer.h"
 #include "tm-threads.h"
@@ -96,7 +101,9 @@ int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
 void PacketFree(Packet *p)
 {
     PACKET_DESTRUCTOR(p);
-    SCFree(p);
+    /* packets of a huge pages backed pool are unmapped with their area */
+    if (!HugepagesOwns(p))
+        SCFree(p);
 }
 
 /**
@@ -182,6 +189,33 @@ Packet *PacketGetFromQueueOrAlloc(void)
     return p;
 }
 
+/**
+ *  \brief Get a batch of packets. Like PacketGetFromQueueOrAlloc() the
+ *         packetpool is tried first, missing packets are alloc'd.
+ *
+ *  \param pkts array to store the packets in
+ *  \param n number of packets needed
+ *
+ *  \retval cnt number of packets stored in pkts. Only less than n if
+ *              we're out of memory.
+ */
+uint32_t PacketGetBatchFromQueueOrAlloc(Packet **pkts, uint32_t n)
+{
+    uint32_t cnt = PacketPoolGetPackets(pkts, n);
+    uint32_t i;
+
+    for (i = 0; i < cnt; i++) {
+        PACKET_PROFILING_START(pkts[i]);
+    }
+
+    for ( ; cnt < n; cnt++) {
+        pkts[cnt] = PacketGetFromAlloc();
+        if (unlikely(pkts[cnt] == NULL))
+            break;
+    }
+    return cnt;
+}
+
 inline int PacketCallocExtPkt(Packet *p, int datalen)
 {
     if (! p->ext_pkt) {
@@ -251,9 +285,30 @@ inline int PacketCopyData(Packet *p, uint8_t *pktdata, int pktlen)
     return PacketCopyDataOffset(p, 0, pktdata, pktlen);
 }
 
+/**
+ *  \brief Check if a tunnel packet can point in the data of its parent
+ *
+ *  The root of the tunnel is only released once all its tunnel packets
+ *  are, so its data and the data of the tunnel packets pointing in it
+ *  outlive the tunnel packets. Data of a defrag pseudo packet lives with
+ *  that packet only. In IPS mode the inner packet data may be modified,
+ *  the outer layers would then have to be fixed up too.
+ */
+static inline int PacketTunnelCanShareData(const Packet *parent)
+{
+    if (EngineModeIsIPS())
+        return 0;
+    if (parent->root == NULL)
+        return 1;
+    return (parent->flags & PKT_ZERO_COPY) ? 1 : 0;
+}
+
 /**
  *  \brief Setup a pseudo packet (tunnel)
  *
+ *  The packet data points in the parent data when possible, see
+ *  PacketTunnelCanShareData(), it's copied otherwise.
+ *
  *  \param parent parent packet for this pseudo pkt
  *  \param pkt raw packet data
  *  \param len packet data length
@@ -275,8 +330,13 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
         SCReturnPtr(NULL, "Packet");
     }
 
-    /* copy packet and set lenght, proto */
-    PacketCopyData(p, pkt, len);
+    /* point to or copy packet and set lenght, proto */
+    if (PacketTunnelCanShareData(parent)) {
+        PacketSetData(p, pkt, len);
+    } else if (PacketCopyData(p, pkt, len) == -1) {
+        TmqhOutputPacketpool(tv, p);
+        SCReturnPtr(NULL, "Packet");
+    }
     p->recursion_level = parent->recursion_level + 1;
     p->ts.tv_sec = parent->ts.tv_sec;
     p->ts.tv_usec = parent->ts.tv_usec;
@@ -429,6 +489,9 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_avg_pkt_size = StatsRegisterAvgCounter("decoder.avg_pkt_size", tv);
     dtv->counter_max_pkt_size = StatsRegisterMaxCounter("decoder.max_pkt_size", tv);
     dtv->counter_erspan = StatsRegisterMaxCounter("decoder.erspan", tv);
+    dtv->counter_vxlan = StatsRegisterCounter("decoder.vxlan", tv);
+    dtv->counter_geneve = StatsRegisterCounter("decoder.geneve", tv);
+    dtv->counter_fast_path = StatsRegisterCounter("decoder.fast_path", tv);
     dtv->counter_flow_memcap = StatsRegisterCounter("flow.memcap", tv);
 
     dtv->counter_flow_tcp = StatsRegisterCounter("flow.tcp", tv);
@@ -458,17 +521,46 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
                 DEvents[i].event_name, tv);
     }
 
+    StatsRegisterFlushFunc(tv, DecodeStatsFlush, dtv);
     return;
 }
 
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p)
+                                DecodeThreadVars *dtv, const Packet *p)
 {
-    StatsIncr(tv, dtv->counter_pkts);
-    //StatsIncr(tv, dtv->counter_pkts_per_sec);
-    StatsAddUI64(tv, dtv->counter_bytes, GET_PKT_LEN(p));
-    StatsAddUI64(tv, dtv->counter_avg_pkt_size, GET_PKT_LEN(p));
-    StatsSetUI64(tv, dtv->counter_max_pkt_size, GET_PKT_LEN(p));
+    const uint64_t len = GET_PKT_LEN(p);
+
+    dtv->stats.pkts++;
+    dtv->stats.bytes += len;
+    if (len > dtv->stats.max_pkt_size)
+        dtv->stats.max_pkt_size = len;
+}
+
+/**
+ * \brief add the counts of DecodeThreadVars::stats to the counters
+ *
+ * Registered by DecodeRegisterPerfCounters() to run before the counters
+ * of the thread are synced.
+ *
+ * \param data the DecodeThreadVars
+ */
+void DecodeStatsFlush(ThreadVars *tv, void *data)
+{
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+    DecodeStats *s = &dtv->stats;
+
+    StatsAddUI64Updates(tv, dtv->counter_pkts, s->pkts, s->pkts);
+    StatsAddUI64Updates(tv, dtv->counter_bytes, s->bytes, s->pkts);
+    StatsAddUI64Updates(tv, dtv->counter_avg_pkt_size, s->bytes, s->pkts);
+    StatsSetUI64(tv, dtv->counter_max_pkt_size, s->max_pkt_size);
+    StatsAddUI64Updates(tv, dtv->counter_eth, s->eth, s->eth);
+    StatsAddUI64Updates(tv, dtv->counter_ipv4, s->ipv4, s->ipv4);
+    StatsAddUI64Updates(tv, dtv->counter_ipv6, s->ipv6, s->ipv6);
+    StatsAddUI64Updates(tv, dtv->counter_tcp, s->tcp, s->tcp);
+    StatsAddUI64Updates(tv, dtv->counter_udp, s->udp, s->udp);
+    StatsAddUI64Updates(tv, dtv->counter_fast_path, s->fast_path, s->fast_path);
+
+    memset(s, 0, sizeof(*s));
 }
 
 /**
@@ -494,8 +586,7 @@ void AddressDebugPrint(Address *a)
     }
 }
 
-/** \brief Alloc and setup DecodeThreadVars */
-DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
+static DecodeThreadVars *DecodeThreadVarsSetup(ThreadVars *tv, int decoder)
 {
     DecodeThreadVars *dtv = NULL;
 
@@ -518,18 +609,50 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     }
     SCLogDebug("vlan tracking is %s", dtv->vlan_disabled == 0 ? "enabled" : "disabled");
 
+    dtv->fast_path = DecodeFastPathMode();
+
+    if (decoder && DefragThreadTableEnabled()) {
+        dtv->defrag_table = DefragThreadTableAlloc();
+        if (dtv->defrag_table == NULL) {
+            SCLogError(SC_ERR_THREAD_INIT, "allocating the defrag table of "
+                       "the thread failed");
+            DecodeThreadVarsFree(tv, dtv);
+            return NULL;
+        }
+    }
+
     return dtv;
 }
 
+/** \brief Alloc and setup DecodeThreadVars of a decode thread */
+DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
+{
+    return DecodeThreadVarsSetup(tv, 1);
+}
+
+/** \brief Alloc and setup DecodeThreadVars of a thread that handles packets
+ *         decoded by another slot, like the flow worker. Fragments are
+ *         reassembled by the decoder, so there is no defrag table. */
+DecodeThreadVars *DecodeThreadVarsAllocNoDecoder(ThreadVars *tv)
+{
+    return DecodeThreadVarsSetup(tv, 0);
+}
+
 void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
 {
     if (dtv != NULL) {
+        if (tv != NULL)
+            StatsDeregisterFlushFunc(tv, dtv);
+
         if (dtv->app_tctx != NULL)
             AppLayerDestroyCtxThread(dtv->app_tctx);
 
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
+        if (dtv->defrag_table != NULL)
+            DefragThreadTableFree(dtv->defrag_table);
+
         SCFree(dtv);
     }
 }
@@ -572,6 +695,12 @@ const char *PktSrcToString(enum PktSrcEnum pkt_src)
         case PKT_SRC_DECODER_TEREDO:
             pkt_src_str = "teredo tunnel";
             break;
+        case PKT_SRC_DECODER_VXLAN:
+            pkt_src_str = "vxlan tunnel";
+            break;
+        case PKT_SRC_DECODER_GENEVE:
+            pkt_src_str = "geneve tunnel";
+            break;
         case PKT_SRC_DEFRAG:
             pkt_src_str = "defrag";
             break;
@@ -612,6 +741,9 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s)
 void DecodeGlobalConfig(void)
 {
     DecodeTeredoConfig();
+    DecodeVXLANConfig();
+    DecodeGeneveConfig();
+    DecodeFastPathConfig();
 }
 
 /**
@@ -55,6 +55,8 @@ enum PktSrcEnum {
     PKT_SRC_STREAM_TCP_STREAM_END_PSEUDO,
     PKT_SRC_FFR,
     PKT_SRC_STREAM_TCP_DETECTLOG_FLUSH,
+    PKT_SRC_DECODER_VXLAN,
+    PKT_SRC_DECODER_GENEVE,
 };
 
 #include "source-nflog.h"
@@ -64,6 +66,7 @@ enum PktSrcEnum {
 #include "source-af-packet.h"
 #include "source-mpipe.h"
 #include "source-netmap.h"
+#include "source-af-xdp.h"
 
 #include "action-globals.h"
 
@@ -434,31 +437,9 @@ typedef struct Packet_
 
     struct timeval ts;
 
-    union {
-        /* nfq stuff */
-#ifdef HAVE_NFLOG
-        NFLOGPacketVars nflog_v;
-#endif /* HAVE_NFLOG */
-#ifdef NFQ
-        NFQPacketVars nfq_v;
-#endif /* NFQ */
-#ifdef IPFW
-        IPFWPacketVars ipfw_v;
-#endif /* IPFW */
-#ifdef AF_PACKET
-        AFPPacketVars afp_v;
-#endif
-#ifdef HAVE_MPIPE
-        /* tilegx mpipe stuff */
-        MpipePacketVars mpipe_v;
-#endif
-#ifdef HAVE_NETMAP
-        NetmapPacketVars netmap_v;
-#endif
-
-        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
-        PcapPacketVars pcap_v;
-    };
+    /* The fields below up to the capture vars are the ones set by the
+     * decoders and reset by PACKET_REINIT, they are kept together so a
+     * recycle only touches a few cache lines. */
 
     /** The release function for packet structure and data */
     void (*ReleasePacket)(struct Packet_ *);
@@ -466,39 +447,13 @@ typedef struct Packet_
      * Return 1 for success and 0 on error */
     int (*BypassPacketsFlow)(struct Packet_ *);
 
-    /* pkt vars */
-    PktVar *pktvar;
-
     /* header pointers */
     EthernetHdr *ethh;
 
-    /* Checksum for IP packets. */
-    int32_t level3_comp_csum;
-    /* Check sum for TCP, UDP or ICMP packets */
-    int32_t level4_comp_csum;
-
     IPV4Hdr *ip4h;
 
     IPV6Hdr *ip6h;
 
-    /* IPv4 and IPv6 are mutually exclusive */
-    union {
-        IPV4Vars ip4vars;
-        struct {
-            IPV6Vars ip6vars;
-            IPV6ExtHdrs ip6eh;
-        };
-    };
-    /* Can only be one of TCP, UDP, ICMP at any given time */
-    union {
-        TCPVars tcpvars;
-        ICMPV4Vars icmpv4vars;
-        ICMPV6Vars icmpv6vars;
-    } l4vars;
-#define tcpvars     l4vars.tcpvars
-#define icmpv4vars  l4vars.icmpv4vars
-#define icmpv6vars  l4vars.icmpv6vars
-
     TCPHdr *tcph;
 
     UDPHdr *udph;
@@ -527,6 +482,19 @@ typedef struct Packet_
 
     uint8_t pkt_src;
 
+    /* size of the segments of a GRO super packet as reported by the
+     * capture, 0 if the packet was received as is */
+    uint16_t gso_size;
+
+    /* PKT_DIRTY_* flags: cold parts at the end of the packet written
+     * since the last recycle */
+    uint8_t dirty;
+
+    /* Checksum for IP packets. */
+    int32_t level3_comp_csum;
+    /* Check sum for TCP, UDP or ICMP packets */
+    int32_t level4_comp_csum;
+
     /* storage: set to pointer to heap and extended via allocation if necessary */
     uint32_t pktlen;
     uint8_t *ext_pkt;
@@ -534,20 +502,17 @@ typedef struct Packet_
     /* Incoming interface */
     struct LiveDevice_ *livedev;
 
-    PacketAlerts alerts;
+    /* pkt vars */
+    PktVar *pktvar;
 
     struct Host_ *host_src;
     struct Host_ *host_dst;
 
+    AppLayerDecoderEvents *app_layer_events;
+
     /** packet number in the pcap file, matches wireshark */
     uint64_t pcap_cnt;
 
-
-    /* engine events */
-    PacketEngineEvents events;
-
-    AppLayerDecoderEvents *app_layer_events;
-
     /* double linked list ptrs */
     struct Packet_ *next;
     struct Packet_ *prev;
@@ -555,6 +520,9 @@ typedef struct Packet_
     /** data linktype in host order */
     int datalink;
 
+    /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
+    uint32_t tenant_id;
+
     /* tunnel/encapsulation handling */
     struct Packet_ *root; /* in case of tunnel this is a ptr
                            * to the 'real' packet, the one we
@@ -562,24 +530,76 @@ typedef struct Packet_
                            * It should always point to the lowest
                            * packet in a encapsulated packet */
 
-    /** mutex to protect access to:
-     *  - tunnel_rtv_cnt
-     *  - tunnel_tpr_cnt
-     */
-    SCMutex tunnel_mutex;
     /* ready to set verdict counter, only set in root */
     uint16_t tunnel_rtv_cnt;
     /* tunnel packet ref count */
     uint16_t tunnel_tpr_cnt;
 
-    /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
-    uint32_t tenant_id;
-
     /* The Packet pool from which this packet was allocated. Used when returning
      * the packet to its owner's stack. If NULL, then allocated with malloc.
      */
     struct PktPool_ *pool;
 
+    union {
+        /* nfq stuff */
+#ifdef HAVE_NFLOG
+        NFLOGPacketVars nflog_v;
+#endif /* HAVE_NFLOG */
+#ifdef NFQ
+        NFQPacketVars nfq_v;
+#endif /* NFQ */
+#ifdef IPFW
+        IPFWPacketVars ipfw_v;
+#endif /* IPFW */
+#ifdef AF_PACKET
+        AFPPacketVars afp_v;
+#endif
+#ifdef HAVE_MPIPE
+        /* tilegx mpipe stuff */
+        MpipePacketVars mpipe_v;
+#endif
+#ifdef HAVE_NETMAP
+        NetmapPacketVars netmap_v;
+#endif
+#ifdef HAVE_AF_XDP
+        AFXDPPacketVars afxdp_v;
+#endif
+
+        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
+        PcapPacketVars pcap_v;
+    };
+
+    /* IPv4 and IPv6 are mutually exclusive */
+    union {
+        IPV4Vars ip4vars;
+        struct {
+            IPV6Vars ip6vars;
+            IPV6ExtHdrs ip6eh;
+        };
+    };
+    /* Can only be one of TCP, UDP, ICMP at any given time */
+    union {
+        TCPVars tcpvars;
+        ICMPV4Vars icmpv4vars;
+        ICMPV6Vars icmpv6vars;
+    } l4vars;
+#define tcpvars     l4vars.tcpvars
+#define icmpv4vars  l4vars.icmpv4vars
+#define icmpv6vars  l4vars.icmpv6vars
+
+    /* Large parts, only reset if flagged in Packet::dirty */
+
+    /* engine events */
+    PacketEngineEvents events;
+
+    PacketAlerts alerts;
+
+    /** mutex to protect access to:
+     *  - tunnel_rtv_cnt
+     *  - tunnel_tpr_cnt
+     */
+    SCMutex tunnel_mutex;
+
 #ifdef PROFILING
     PktProfiling *profile;
 #endif
@@ -615,6 +635,21 @@ typedef struct PacketQueue_ {
     SCCondT cond_q;
 } PacketQueue;
 
+/** \brief decoder counts updated for most packets, kept in the thread
+ *         and added to the counters by DecodeStatsFlush() before the
+ *         counters are synced */
+typedef struct DecodeStats_ {
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t max_pkt_size;
+    uint64_t eth;
+    uint64_t ipv4;
+    uint64_t ipv6;
+    uint64_t tcp;
+    uint64_t udp;
+    uint64_t fast_path;
+} DecodeStats;
+
 /** \brief Structure to hold thread specific data for all decode modules */
 typedef struct DecodeThreadVars_
 {
@@ -623,6 +658,20 @@ typedef struct DecodeThreadVars_
 
     int vlan_disabled;
 
+    DecodeStats stats;
+
+    /** thread local defrag trackers, NULL if the global hash is used */
+    struct DefragThreadTable_ *defrag_table;
+
+    /** flow table of the flow worker thread, NULL if the global hash
+     *  is used */
+    struct FlowThreadTable_ *flow_table;
+
+    /** fast path decoder mode, see decode-fast.h */
+    int fast_path;
+    uint32_t fast_path_pkts;
+    uint32_t fast_path_hits;
+
     /** stats/counters */
     uint16_t counter_pkts;
     uint16_t counter_bytes;
@@ -653,6 +702,9 @@ typedef struct DecodeThreadVars_
     uint16_t counter_ipv4inipv6;
     uint16_t counter_ipv6inipv6;
     uint16_t counter_erspan;
+    uint16_t counter_vxlan;
+    uint16_t counter_geneve;
+    uint16_t counter_fast_path;
 
     /** frag stats - defrag runs in the context of the decoder. */
     uint16_t counter_defrag_ipv4_fragments;
@@ -757,6 +809,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->flags = (p)->flags & PKT_ALLOC;    \
         (p)->flowflags = 0;                     \
         (p)->pkt_src = 0;                       \
+        (p)->gso_size = 0;                      \
         (p)->vlan_id[0] = 0;                    \
         (p)->vlan_id[1] = 0;                    \
         (p)->vlan_idx = 0;                      \
@@ -800,12 +853,17 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->payload_len = 0;                   \
         (p)->BypassPacketsFlow = NULL;          \
         (p)->pktlen = 0;                        \
-        (p)->alerts.cnt = 0;                    \
-        (p)->alerts.drop.action = 0;            \
+        if ((p)->dirty & PKT_DIRTY_ALERTS) {    \
+            (p)->alerts.cnt = 0;                \
+            (p)->alerts.drop.action = 0;        \
+        }                                       \
+        if ((p)->dirty & PKT_DIRTY_EVENTS) {    \
+            (p)->events.cnt = 0;                \
+        }                                       \
+        (p)->dirty = 0;                         \
         (p)->pcap_cnt = 0;                      \
         (p)->tunnel_rtv_cnt = 0;                \
         (p)->tunnel_tpr_cnt = 0;                \
-        (p)->events.cnt = 0;                    \
         AppLayerDecoderEventsResetEvents((p)->app_layer_events); \
         (p)->next = NULL;                       \
         (p)->prev = NULL;                       \
@@ -906,6 +964,7 @@ Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t
 void PacketDefragPktSetupParent(Packet *parent);
 void DecodeRegisterPerfCounters(DecodeThreadVars *, ThreadVars *);
 Packet *PacketGetFromQueueOrAlloc(void);
+uint32_t PacketGetBatchFromQueueOrAlloc(Packet **pkts, uint32_t n);
 Packet *PacketGetFromAlloc(void);
 void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p);
 void PacketFree(Packet *p);
@@ -918,9 +977,11 @@ const char *PktSrcToString(enum PktSrcEnum pkt_src);
 void PacketBypassCallback(Packet *p);
 
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *);
+DecodeThreadVars *DecodeThreadVarsAllocNoDecoder(ThreadVars *);
 void DecodeThreadVarsFree(ThreadVars *, DecodeThreadVars *);
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p);
+                                DecodeThreadVars *dtv, const Packet *p);
+void DecodeStatsFlush(ThreadVars *tv, void *data);
 
 /* decoder functions */
 int DecodeEthernet(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
@@ -990,6 +1051,7 @@ void DecodeGlobalConfig(void);
     if ((p)->events.cnt < PACKET_ENGINE_EVENT_MAX) { \
         (p)->events.events[(p)->events.cnt] = e; \
         (p)->events.cnt++; \
+        (p)->dirty |= PKT_DIRTY_EVENTS; \
     } \
 } while(0)
 
@@ -1118,6 +1180,10 @@ void DecodeGlobalConfig(void);
 #define PKT_PSEUDO_DETECTLOG_FLUSH      (1<<27)     /**< Detect/log flush for protocol upgrade */
 
 
+/* Packet::dirty flags */
+#define PKT_DIRTY_ALERTS                (1)         /**< alerts or drop alert set */
+#define PKT_DIRTY_EVENTS                (1<<1)      /**< engine events set */
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) \
     ((p)->flags & (PKT_PSEUDO_STREAM_END|PKT_PSEUDO_DETECTLOG_FLUSH))
@@ -24,12 +24,16 @@
 #include "util-byte.h"
 #include "util-misc.h"
 #include "util-hash-lookup3.h"
+#include "runmodes.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
 /** queue with spare tracker */
 static DefragTrackerQueue defragtracker_spare_q;
 
+/** number of thread tables sharing the memcap */
+SC_ATOMIC_DECLARE(unsigned int, defrag_thread_tables);
+
 uint32_t DefragTrackerSpareQueueGetSize(void)
 {
     return DefragTrackerQueueLen(&defragtracker_spare_q);
@@ -41,35 +45,47 @@ void DefragTrackerMoveToSpare(DefragTracker *h)
     (void) SC_ATOMIC_SUB(defragtracker_counter, 1);
 }
 
-static DefragTracker *DefragTrackerAlloc(void)
+static DefragTracker *DefragTrackerNew(void)
 {
-    if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
-        return NULL;
-    }
-
-    (void) SC_ATOMIC_ADD(defrag_memuse, sizeof(DefragTracker));
-
     DefragTracker *dt = SCMalloc(sizeof(DefragTracker));
     if (unlikely(dt == NULL))
-        goto error;
+        return NULL;
 
     memset(dt, 0x00, sizeof(DefragTracker));
 
     SCMutexInit(&dt->lock, NULL);
     SC_ATOMIC_INIT(dt->use_cnt);
     return dt;
+}
 
-error:
-    return NULL;
+static DefragTracker *DefragTrackerAlloc(void)
+{
+    if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
+        return NULL;
+    }
+
+    (void) SC_ATOMIC_ADD(defrag_memuse, sizeof(DefragTracker));
+
+    DefragTracker *dt = DefragTrackerNew();
+    if (unlikely(dt == NULL)) {
+        (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragTracker));
+        return NULL;
+    }
+    return dt;
+}
+
+static void DefragTrackerDelete(DefragTracker *dt)
+{
+    DefragTrackerClearMemory(dt);
+
+    SCMutexDestroy(&dt->lock);
+    SCFree(dt);
 }
 
 static void DefragTrackerFree(DefragTracker *dt)
 {
     if (dt != NULL) {
-        DefragTrackerClearMemory(dt);
-
-        SCMutexDestroy(&dt->lock);
-        SCFree(dt);
+        DefragTrackerDelete(dt);
         (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragTracker));
     }
 }
@@ -101,7 +117,6 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p)
     dt->seen_last = 0;
 
     TAILQ_INIT(&dt->frags);
-    (void) DefragTrackerIncrUsecnt(dt);
 }
 
 void DefragTrackerRelease(DefragTracker *t)
@@ -131,6 +146,7 @@ void DefragInitConfig(char quiet)
     SC_ATOMIC_INIT(defragtracker_counter);
     SC_ATOMIC_INIT(defrag_memuse);
     SC_ATOMIC_INIT(defragtracker_prune_idx);
+    SC_ATOMIC_INIT(defrag_thread_tables);
     DefragTrackerQueueInit(&defragtracker_spare_q);
 
     /* set defaults */
@@ -138,6 +154,7 @@ void DefragInitConfig(char quiet)
     defrag_config.hash_size   = DEFRAG_DEFAULT_HASHSIZE;
     defrag_config.memcap      = DEFRAG_DEFAULT_MEMCAP;
     defrag_config.prealloc    = DEFRAG_DEFAULT_PREALLOC;
+    defrag_config.hash_func   = HashWordConfig("defrag");
 
     /* Check if we have memcap and hash_size defined at config */
     const char *conf_val;
@@ -173,6 +190,10 @@ void DefragInitConfig(char quiet)
             WarnInvalidConfEntry("defrag.trackers", "%"PRIu32, defrag_config.prealloc);
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("defrag.thread-local", &thread_local) == 1) {
+        defrag_config.thread_local = thread_local;
+    }
     SCLogDebug("DefragTracker config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, defrag_config.memcap,
                defrag_config.hash_size, defrag_config.prealloc);
@@ -284,6 +305,7 @@ void DefragHashShutdown(void)
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
+    SC_ATOMIC_DESTROY(defrag_thread_tables);
     SC_ATOMIC_DESTROY(defrag_memuse);
     SC_ATOMIC_DESTROY(defragtracker_counter);
     //SC_ATOMIC_DESTROY(flow_flags);
@@ -362,7 +384,8 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
+        uint32_t hash = HashWord(defrag_config.hash_func,
+                dhk.u32, 4, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
@@ -389,7 +412,8 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
+        uint32_t hash = HashWord(defrag_config.hash_func,
+                dhk.u32, 10, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else
         key = 0;
@@ -506,6 +530,7 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
 
         /* got one, now lock, initialize and return */
         DefragTrackerInit(dt,p);
+        (void) DefragTrackerIncrUsecnt(dt);
 
         DRLOCK_UNLOCK(hb);
         return dt;
@@ -536,6 +561,7 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
 
                 /* initialize and return */
                 DefragTrackerInit(dt,p);
+                (void) DefragTrackerIncrUsecnt(dt);
 
                 DRLOCK_UNLOCK(hb);
                 return dt;
@@ -713,4 +739,216 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void)
     return NULL;
 }
 
+/* thread local tables */
+
+/* frags kept for reuse by a thread table */
+#define DEFRAG_THREAD_FRAG_POOL_SIZE 1024
+
+/**
+ *  \brief check if the thread tables are to be used
+ *
+ *  Only in the runmodes where the thread capturing a packet is the
+ *  one decoding it, and the capture method gives all the fragments of
+ *  a datagram to the same thread (e.g. af-packet with the defrag
+ *  fanout flag).
+ */
+int DefragThreadTableEnabled(void)
+{
+    if (!defrag_config.thread_local)
+        return 0;
+
+    const char *runmode = RunmodeGetActive();
+    if (runmode == NULL ||
+            (strcmp(runmode, "workers") != 0 && strcmp(runmode, "single") != 0)) {
+        static int warned = 0;
+        if (!warned) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "defrag.thread-local "
+                    "is only supported by the workers and single runmodes, "
+                    "using the global defrag table");
+            warned = 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  \brief share of the memcap of each thread table
+ */
+uint64_t DefragThreadTableMemcap(void)
+{
+    unsigned int tables = SC_ATOMIC_GET(defrag_thread_tables);
+    return defrag_config.memcap / (tables ? tables : 1);
+}
 
+DefragThreadTable *DefragThreadTableAlloc(void)
+{
+    DefragThreadTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+
+    t->hash = SCCalloc(defrag_config.hash_size, sizeof(DefragThreadHashRow));
+    if (unlikely(t->hash == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    t->frag_pool = DefragFragPoolNew(DEFRAG_THREAD_FRAG_POOL_SIZE, 0);
+    if (t->frag_pool == NULL) {
+        SCFree(t->hash);
+        SCFree(t);
+        return NULL;
+    }
+
+    (void) SC_ATOMIC_ADD(defrag_memuse, defrag_config.hash_size * sizeof(DefragThreadHashRow));
+    (void) SC_ATOMIC_ADD(defrag_thread_tables, 1);
+    SCLogDebug("thread defrag table %p, %"PRIu32" buckets", t,
+            defrag_config.hash_size);
+    return t;
+}
+
+void DefragThreadTableFree(DefragThreadTable *t)
+{
+    if (t == NULL)
+        return;
+
+    DefragTracker *dt;
+    for (uint32_t u = 0; u < defrag_config.hash_size; u++) {
+        dt = t->hash[u].head;
+        while (dt) {
+            DefragTracker *n = dt->hnext;
+            DefragTrackerDelete(dt);
+            DEFRAG_THREAD_MEMUSE_SUB(t, sizeof(DefragTracker));
+            dt = n;
+        }
+    }
+    while ((dt = t->spare) != NULL) {
+        t->spare = dt->lnext;
+        DefragTrackerDelete(dt);
+        DEFRAG_THREAD_MEMUSE_SUB(t, sizeof(DefragTracker));
+    }
+
+    PoolFree(t->frag_pool);
+    SCFree(t->hash);
+    SCFree(t);
+    (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragThreadHashRow));
+    (void) SC_ATOMIC_SUB(defrag_thread_tables, 1);
+}
+
+void DefragThreadTrackerMoveToSpare(DefragThreadTable *t, DefragTracker *dt)
+{
+    dt->lnext = t->spare;
+    t->spare = dt;
+}
+
+static inline void DefragThreadHashRowRemove(DefragThreadHashRow *hb, DefragTracker *dt)
+{
+    if (dt->hprev != NULL)
+        dt->hprev->hnext = dt->hnext;
+    if (dt->hnext != NULL)
+        dt->hnext->hprev = dt->hprev;
+    if (hb->head == dt)
+        hb->head = dt->hnext;
+    if (hb->tail == dt)
+        hb->tail = dt->hprev;
+
+    dt->hnext = NULL;
+    dt->hprev = NULL;
+}
+
+/** \internal
+ *  \brief take the least recently used tracker of a row of the table,
+ *         the memcap share of the thread is reached
+ */
+static DefragTracker *DefragThreadGetUsedTracker(DefragThreadTable *t)
+{
+    uint32_t cnt = defrag_config.hash_size;
+
+    while (cnt--) {
+        if (++t->prune_idx >= defrag_config.hash_size)
+            t->prune_idx = 0;
+
+        DefragThreadHashRow *hb = &t->hash[t->prune_idx];
+        DefragTracker *dt = hb->tail;
+        if (dt == NULL)
+            continue;
+
+        DefragThreadHashRowRemove(hb, dt);
+        t->active--;
+        DefragTrackerClearMemory(dt);
+        return dt;
+    }
+    return NULL;
+}
+
+static DefragTracker *DefragThreadTrackerGetNew(DefragThreadTable *t)
+{
+    DefragTracker *dt = t->spare;
+    if (dt != NULL) {
+        t->spare = dt->lnext;
+        dt->lnext = NULL;
+        return dt;
+    }
+
+    if (!(DEFRAG_THREAD_CHECK_MEMCAP(t, sizeof(DefragTracker)))) {
+        return DefragThreadGetUsedTracker(t);
+    }
+
+    dt = DefragTrackerNew();
+    if (dt == NULL)
+        return NULL;
+    dt->table = t;
+    DEFRAG_THREAD_MEMUSE_ADD(t, sizeof(DefragTracker));
+    return dt;
+}
+
+/**
+ *  \brief get the tracker of a fragment from a thread table
+ *
+ *  \retval dt tracker, *not* locked, or NULL if none could be had
+ */
+DefragTracker *DefragThreadGetTracker(DefragThreadTable *t, Packet *p)
+{
+    DefragThreadHashRow *hb = &t->hash[DefragHashGetKey(p)];
+    DefragTracker *dt;
+
+    for (dt = hb->head; dt != NULL; dt = dt->hnext) {
+        if (!dt->remove && DefragTrackerCompare(dt, p) != 0)
+            break;
+    }
+
+    if (dt == NULL) {
+        dt = DefragThreadTrackerGetNew(t);
+        if (dt == NULL)
+            return NULL;
+        DefragTrackerInit(dt, p);
+        t->active++;
+    } else if (dt == hb->head) {
+        return dt;
+    } else {
+        DefragThreadHashRowRemove(hb, dt);
+    }
+
+    /* most recently used on top, pruning takes the tail */
+    dt->hnext = hb->head;
+    if (hb->head != NULL)
+        hb->head->hprev = dt;
+    hb->head = dt;
+    if (hb->tail == NULL)
+        hb->tail = dt;
+    return dt;
+}
+
+/**
+ *  \brief done with the tracker of a fragment, reassembled trackers
+ *         go straight back to the spare list
+ */
+void DefragThreadTrackerRelease(DefragThreadTable *t, DefragTracker *dt, Packet *p)
+{
+    if (!dt->remove)
+        return;
+
+    DefragThreadHashRowRemove(&t->hash[DefragHashGetKey(p)], dt);
+    t->active--;
+    DefragTrackerClearMemory(dt);
+    DefragThreadTrackerMoveToSpare(t, dt);
+}
@@ -26,6 +26,7 @@
 
 #include "decode.h"
 #include "defrag.h"
+#include "util-hash-word.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define DRLOCK_SPIN
@@ -71,9 +72,41 @@ typedef struct DefragConfig_ {
     uint64_t memcap;
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** hash function of the keys, 'defrag.hash-function' */
+    HashWordFunc hash_func;
     uint32_t prealloc;
+    int thread_local;
 } DefragConfig;
 
+typedef struct DefragThreadHashRow_ {
+    DefragTracker *head;
+    DefragTracker *tail;
+} DefragThreadHashRow;
+
+/** thread local tracker table, used instead of the global hash when
+ *  all fragments of a datagram reach the same thread. It is only ever
+ *  touched by its thread so nothing is locked. */
+typedef struct DefragThreadTable_ {
+    DefragThreadHashRow *hash;
+
+    /** spare trackers, linked by lnext */
+    DefragTracker *spare;
+
+    /** memory used by the trackers and the fragments, checked against
+     *  the share of the memcap of this thread */
+    uint64_t memuse;
+
+    Pool *frag_pool;
+
+    uint32_t prune_idx;
+
+    /** trackers in the hash */
+    uint32_t active;
+
+    /** packet time of the last timeout run */
+    time_t timeout_ts;
+} DefragThreadTable;
+
 /** \brief check if a memory alloc would fit in the memcap
  *
  *  \param size memory allocation size to check
@@ -84,11 +117,29 @@ typedef struct DefragConfig_ {
 #define DEFRAG_CHECK_MEMCAP(size) \
     ((((uint64_t)SC_ATOMIC_GET(defrag_memuse) + (uint64_t)(size)) <= defrag_config.memcap))
 
+/** \brief check if a memory alloc would fit in the share of the memcap of
+ *         a thread table
+ */
+#define DEFRAG_THREAD_CHECK_MEMCAP(t, size) \
+    (((t)->memuse + (uint64_t)(size)) <= DefragThreadTableMemcap())
+
 DefragConfig defrag_config;
 SC_ATOMIC_DECLARE(uint64_t,defrag_memuse);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_counter);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_prune_idx);
 
+/** \brief account memory of a thread table, in its share of the memcap
+ *         and in the global memuse */
+#define DEFRAG_THREAD_MEMUSE_ADD(t, size) do { \
+        (t)->memuse += (size); \
+        (void) SC_ATOMIC_ADD(defrag_memuse, (size)); \
+    } while (0)
+
+#define DEFRAG_THREAD_MEMUSE_SUB(t, size) do { \
+        (t)->memuse -= (size); \
+        (void) SC_ATOMIC_SUB(defrag_memuse, (size)); \
+    } while (0)
+
 void DefragInitConfig(char quiet);
 void DefragHashShutdown(void);
 
@@ -99,5 +150,13 @@ void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
+int DefragThreadTableEnabled(void);
+uint64_t DefragThreadTableMemcap(void);
+DefragThreadTable *DefragThreadTableAlloc(void);
+void DefragThreadTableFree(DefragThreadTable *);
+DefragTracker *DefragThreadGetTracker(DefragThreadTable *, Packet *);
+void DefragThreadTrackerRelease(DefragThreadTable *, DefragTracker *, Packet *);
+void DefragThreadTrackerMoveToSpare(DefragThreadTable *, DefragTracker *);
+
 #endif /* __DEFRAG_HASH_H__ */
 
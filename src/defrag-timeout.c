@@ -142,3 +142,50 @@ uint32_t DefragTimeoutHash(struct timeval *ts)
     return cnt;
 }
 
+/**
+ *  \brief time out the trackers of a thread table
+ *
+ *  Called by the thread owning the table, from the packet path.
+ *
+ *  \param t thread table
+ *  \param ts timestamp
+ *
+ *  \retval cnt number of timed out tracker
+ */
+uint32_t DefragThreadTableTimeout(DefragThreadTable *t, struct timeval *ts)
+{
+    uint32_t idx = 0;
+    uint32_t cnt = 0;
+
+    for (idx = 0; idx < defrag_config.hash_size && t->active > 0; idx++) {
+        DefragThreadHashRow *hb = &t->hash[idx];
+        DefragTracker *dt = hb->tail;
+
+        while (dt != NULL) {
+            DefragTracker *next_dt = dt->hprev;
+
+            if (dt->remove || timercmp(&dt->timeout, ts, <=)) {
+                /* remove from the hash */
+                if (dt->hprev != NULL)
+                    dt->hprev->hnext = dt->hnext;
+                if (dt->hnext != NULL)
+                    dt->hnext->hprev = dt->hprev;
+                if (hb->head == dt)
+                    hb->head = dt->hnext;
+                if (hb->tail == dt)
+                    hb->tail = dt->hprev;
+
+                dt->hnext = NULL;
+                dt->hprev = NULL;
+
+                t->active--;
+                DefragTrackerClearMemory(dt);
+                DefragThreadTrackerMoveToSpare(t, dt);
+                cnt++;
+            }
+            dt = next_dt;
+        }
+    }
+
+    return cnt;
+}
@@ -26,6 +26,9 @@
 
 uint32_t DefragTimeoutHash(struct timeval *ts);
 
+struct DefragThreadTable_;
+uint32_t DefragThreadTableTimeout(struct DefragThreadTable_ *t, struct timeval *ts);
+
 uint32_t DefragGetSpareCount(void);
 uint32_t DefragGetActiveCount(void);
 
@@ -52,6 +52,7 @@
 
 #include "defrag.h"
 #include "defrag-hash.h"
+#include "defrag-timeout.h"
 #include "defrag-queue.h"
 #include "defrag-config.h"
 
@@ -113,9 +114,10 @@ DumpFrags(DefragTracker *tracker)
 
     printf("Dumping frags for packet: ID=%d\n", tracker->id);
     TAILQ_FOREACH(frag, &tracker->frags, next) {
-        printf("-> Frag: frag_offset=%d, frag_len=%d, data_len=%d, ltrim=%d, skip=%d\n", frag->offset, frag->len, frag->data_len, frag->ltrim, frag->skip);
-        PrintRawDataFp(stdout, frag->pkt, frag->len);
+        printf("-> Frag: frag_offset=%d, data_len=%d, ltrim=%d, skip=%d\n", frag->offset, frag->data_len, frag->ltrim, frag->skip);
     }
+    if (tracker->buf != NULL)
+        PrintRawDataFp(stdout, tracker->buf, tracker->hdr_len + tracker->data_end);
 }
 #endif /* UNITTESTS */
 #endif
@@ -126,8 +128,6 @@ DumpFrags(DefragTracker *tracker)
 static void
 DefragFragReset(Frag *frag)
 {
-    if (frag->pkt != NULL)
-        SCFree(frag->pkt);
     memset(frag, 0, sizeof(*frag));
 }
 
@@ -143,6 +143,21 @@ DefragFragInit(void *data, void *initdata)
     return 1;
 }
 
+/**
+ * \brief Free the copy of its data a fragment holds, if any.
+ */
+static void
+DefragFragRelease(DefragTracker *tracker, Frag *frag)
+{
+    if (frag->pkt == NULL)
+        return;
+
+    SCFree(frag->pkt);
+    if (tracker->table != NULL)
+        DEFRAG_THREAD_MEMUSE_SUB(tracker->table, frag->hdr_len + frag->data_len);
+    frag->pkt = NULL;
+}
+
 /**
  * \brief Free all frags associated with a tracker.
  */
@@ -151,18 +166,56 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
 
-    /* Lock the frag pool as we'll be return items to it. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
+    /* frags of a thread table go back to its own pool, no locking */
+    DefragThreadTable *t = tracker->table;
+    if (t != NULL) {
+        while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
+            TAILQ_REMOVE(&tracker->frags, frag, next);
+            DefragFragRelease(tracker, frag);
+            DEFRAG_THREAD_MEMUSE_SUB(t, sizeof(Frag));
+            DefragFragReset(frag);
+            PoolReturn(t->frag_pool, frag);
+        }
+    } else {
+        /* Lock the frag pool as we'll be return items to it. */
+        SCMutexLock(&defrag_context->frag_pool_lock);
 
-    while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
-        TAILQ_REMOVE(&tracker->frags, frag, next);
+        while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
+            TAILQ_REMOVE(&tracker->frags, frag, next);
+            DefragFragRelease(tracker, frag);
 
-        /* Don't SCFree the frag, just give it back to its pool. */
-        DefragFragReset(frag);
-        PoolReturn(defrag_context->frag_pool, frag);
+            /* Don't SCFree the frag, just give it back to its pool. */
+            DefragFragReset(frag);
+            PoolReturn(defrag_context->frag_pool, frag);
+        }
+
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
     }
 
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    if (tracker->buf != NULL) {
+        SCFree(tracker->buf);
+        if (t != NULL)
+            DEFRAG_THREAD_MEMUSE_SUB(t, tracker->buf_size);
+    }
+    tracker->buf = NULL;
+    tracker->buf_size = 0;
+    tracker->data_end = 0;
+    tracker->hdr_len = 0;
+    tracker->ip_hdr_offset = 0;
+    tracker->hdr_set = 0;
+    tracker->overlap = 0;
+}
+
+/**
+ * \brief Create a pool of frags.
+ *
+ * \param size maximum number of frags kept in the pool
+ * \param prealloc number of frags to allocate now
+ */
+Pool *DefragFragPoolNew(uint32_t size, uint32_t prealloc)
+{
+    return PoolInit(size, prealloc, sizeof(Frag),
+            NULL, DefragFragInit, NULL, NULL, NULL);
 }
 
 /**
@@ -192,9 +245,7 @@ DefragContextNew(void)
         frag_pool_size = DEFAULT_DEFRAG_POOL_SIZE;
     }
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
-    dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
-        sizeof(Frag),
-        NULL, DefragFragInit, dc, NULL, NULL);
+    dc->frag_pool = DefragFragPoolNew(frag_pool_size, frag_pool_prealloc);
     if (dc->frag_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Defrag: Failed to initialize fragment pool.");
@@ -245,32 +296,285 @@ DefragContextDestroy(DefragContext *dc)
     SCFree(dc);
 }
 
+/** \internal
+ *  \brief check if a fragment gives any data at reassembly
+ */
+static inline int DefragFragUsed(const Frag *frag)
+{
+    return !frag->skip && frag->data_len > frag->ltrim;
+}
+
 /**
- * Attempt to re-assemble a packet.
+ * \brief Make room in the reassembly buffer of a tracker.
  *
- * \param tracker The defragmentation tracker to reassemble from.
+ * \param hdr_len length of the headers before the data
+ * \param end end of the data, relative to the start of the data
+ * \param hint expected end of the data, to size a new buffer
+ *
+ * \retval 0 on success, -1 if the memcap is reached or on alloc error
  */
-static Packet *
-Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+static int
+DefragBufferReserve(DefragTracker *tracker, uint32_t hdr_len, uint32_t end,
+        uint32_t hint)
 {
-    Packet *rp = NULL;
+    end = MAX(end, tracker->data_end);
 
-    /* Should not be here unless we have seen the last fragment. */
-    if (!tracker->seen_last) {
-        return NULL;
+    uint32_t need = hdr_len + end;
+    if (need <= tracker->buf_size) {
+        tracker->data_end = end;
+        return 0;
+    }
+
+    uint32_t size;
+    if (tracker->buf == NULL) {
+        size = hdr_len + MAX(hint, end);
+    } else {
+        size = MAX(need, tracker->buf_size * 2);
+    }
+    size = MIN(size, hdr_len + IPV6_MAXPACKET);
+    size = MAX(size, need);
+
+    DefragThreadTable *t = tracker->table;
+    if (t != NULL && !(DEFRAG_THREAD_CHECK_MEMCAP(t, size - tracker->buf_size))) {
+        return -1;
+    }
+
+    uint8_t *buf = SCRealloc(tracker->buf, size);
+    if (unlikely(buf == NULL)) {
+        return -1;
+    }
+    if (t != NULL) {
+        DEFRAG_THREAD_MEMUSE_ADD(t, size - tracker->buf_size);
+    }
+    tracker->buf = buf;
+    tracker->buf_size = size;
+    tracker->data_end = end;
+    return 0;
+}
+
+/**
+ * \brief Copy the headers of a first fragment to the reassembly buffer.
+ *
+ * The data is moved if these headers are not of the length the buffer
+ * was set up with.
+ */
+static int
+DefragBufferSetHeaders(DefragTracker *tracker, const uint8_t *pkt,
+        uint16_t hdr_len, uint16_t ip_hdr_offset)
+{
+    if (hdr_len != tracker->hdr_len) {
+        if (DefragBufferReserve(tracker, hdr_len, tracker->data_end, 0) != 0)
+            return -1;
+        memmove(tracker->buf + hdr_len, tracker->buf + tracker->hdr_len,
+                tracker->data_end);
+        tracker->hdr_len = hdr_len;
+    }
+    memcpy(tracker->buf, pkt, hdr_len);
+    tracker->ip_hdr_offset = ip_hdr_offset;
+    tracker->hdr_set = 1;
+    return 0;
+}
+
+/**
+ * \brief Copy the data of a new fragment to the reassembly buffer.
+ *
+ * Only while the fragments of the tracker don't overlap: each byte of
+ * the buffer then comes from a single fragment, whatever the order they
+ * arrive in.
+ */
+static void
+DefragBufferPlace(DefragTracker *tracker, Frag *new, const uint8_t *data)
+{
+    memcpy(tracker->buf + tracker->hdr_len + new->offset, data, new->data_len);
+}
+
+/** \internal
+ *  \brief check if a new fragment overlaps a fragment of the tracker
+ */
+static int
+DefragFragOverlaps(DefragTracker *tracker, uint16_t frag_offset,
+        uint16_t frag_end)
+{
+    Frag *frag;
+
+    TAILQ_FOREACH(frag, &tracker->frags, next) {
+        /* headers too */
+        if (frag->offset == 0 && frag_offset == 0)
+            return 1;
+        if (frag->offset < frag_end &&
+                frag_offset < frag->offset + frag->data_len)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Make a fragment hold a copy of its headers and data.
+ *
+ * \param hdr headers of a first fragment, NULL for the others
+ *
+ * \retval 0 on success, -1 if the memcap is reached or on alloc error
+ */
+static int
+DefragFragHold(DefragTracker *tracker, Frag *frag, const uint8_t *hdr,
+        uint16_t hdr_len, uint16_t ip_hdr_offset, const uint8_t *data)
+{
+    if (hdr == NULL)
+        hdr_len = 0;
+
+    uint32_t size = hdr_len + frag->data_len;
+    DefragThreadTable *t = tracker->table;
+    if (t != NULL && !(DEFRAG_THREAD_CHECK_MEMCAP(t, size))) {
+        return -1;
+    }
+
+    frag->pkt = SCMalloc(MAX(size, 1));
+    if (unlikely(frag->pkt == NULL)) {
+        return -1;
+    }
+    if (hdr_len > 0)
+        memcpy(frag->pkt, hdr, hdr_len);
+    memcpy(frag->pkt + hdr_len, data, frag->data_len);
+    frag->hdr_len = hdr_len;
+    frag->ip_hdr_offset = ip_hdr_offset;
+    if (t != NULL)
+        DEFRAG_THREAD_MEMUSE_ADD(t, size);
+    return 0;
+}
+
+/**
+ * \brief Make the fragments of a tracker hold a copy of their data, on
+ *        the first overlap.
+ *
+ * Without overlap, which fragment gives a byte of the datagram never
+ * changes so it can be written once. With overlaps, a later fragment
+ * can change it: a trim, a fragment skipped, a last fragment making the
+ * ones after it unused. The fragments then keep their data, as they did
+ * before the buffer, and the buffer is filled in offset order at
+ * reassembly. Until now each byte of the buffer came from one fragment,
+ * the copies are taken from it.
+ *
+ * \retval 0 on success, -1 if the memcap is reached or on alloc error
+ */
+static int
+DefragTrackerHoldFrags(DefragTracker *tracker)
+{
+    Frag *frag;
+    const uint8_t *data = tracker->buf + tracker->hdr_len;
+
+    TAILQ_FOREACH(frag, &tracker->frags, next) {
+        const uint8_t *hdr = NULL;
+        if (frag->offset == 0 && tracker->hdr_set)
+            hdr = tracker->buf;
+        if (DefragFragHold(tracker, frag, hdr, tracker->hdr_len,
+                    tracker->ip_hdr_offset, data + frag->offset) != 0) {
+            TAILQ_FOREACH(frag, &tracker->frags, next) {
+                DefragFragRelease(tracker, frag);
+            }
+            return -1;
+        }
+    }
+    tracker->overlap = 1;
+    return 0;
+}
+
+/**
+ * \brief Fill the reassembly buffer from the copies of the fragments,
+ *        copied in offset order up to the last fragment.
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int
+DefragBufferFill(DefragTracker *tracker)
+{
+    Frag *frag;
+
+    /* trims can leave holes no fragment fills, don't let the bytes
+     * placed before the first overlap show through */
+    memset(tracker->buf + tracker->hdr_len, 0, tracker->data_end);
+
+    TAILQ_FOREACH(frag, &tracker->frags, next) {
+        if (!DefragFragUsed(frag))
+            continue;
+        if (frag->offset == 0) {
+            /* a first fragment is used whole, headers included */
+            if (frag->hdr_len == 0)
+                return -1;
+            if (DefragBufferSetHeaders(tracker, frag->pkt, frag->hdr_len,
+                        frag->ip_hdr_offset) != 0)
+                return -1;
+            memcpy(tracker->buf + tracker->hdr_len,
+                    frag->pkt + frag->hdr_len, frag->data_len);
+        } else {
+            memcpy(tracker->buf + tracker->hdr_len + frag->offset + frag->ltrim,
+                    frag->pkt + frag->ltrim, frag->data_len - frag->ltrim);
+        }
+        if (!frag->more_frags)
+            break;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief point the header before the frag header of the headers of a
+ *         first IPv6 fragment to the header after it
+ */
+static void
+DefragIPv6SetNextHeader(uint8_t *hdr, uint16_t ip_hdr_offset,
+        int nh_offset, uint8_t nh)
+{
+    if (nh_offset > 0) {
+        SCLogDebug("updating frag to have 'correct' nh value: %u -> %u",
+                hdr[nh_offset], nh);
+        hdr[nh_offset] = nh;
+    } else {
+        IPV6Hdr *ip6h = (IPV6Hdr *)(hdr + ip_hdr_offset);
+        ip6h->s_ip6_nxt = nh;
     }
+}
 
-    /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
+/** \internal
+ *  \brief length of the fragmentable part of the reassembled packet
+ */
+static int
+DefragFragmentableLen(DefragTracker *tracker)
+{
+    Frag *frag;
+    int fragmentable_len = 0;
+
+    TAILQ_FOREACH(frag, &tracker->frags, next) {
+        if (!DefragFragUsed(frag))
+            continue;
+        if (frag->offset == 0) {
+            fragmentable_len = frag->data_len;
+        } else if (frag->offset + frag->data_len > fragmentable_len) {
+            fragmentable_len = frag->offset + frag->data_len;
+        }
+        if (!frag->more_frags) {
+            break;
+        }
+    }
+    return fragmentable_len;
+}
+
+/** \internal
+ *  \brief check that the fragments cover the datagram without hole.
+ *
+ *  Relies on the fact that fragments are inserted in frag_offset order.
+ */
+static int
+DefragIsComplete(DefragTracker *tracker)
+{
     Frag *frag;
     int len = 0;
+
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
 
         if (frag == TAILQ_FIRST(&tracker->frags)) {
             if (frag->offset != 0) {
-                goto done;
+                return 0;
             }
             len = frag->data_len;
         }
@@ -278,13 +582,68 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             if (frag->offset > len) {
                 /* This fragment starts after the end of the previous
                  * fragment.  We have a hole. */
-                goto done;
+                return 0;
             }
             else {
                 len += frag->data_len;
             }
         }
     }
+    return 1;
+}
+
+/** \internal
+ *  \brief hand the reassembly buffer over to the reassembled packet, it
+ *         is freed with the packet
+ */
+static void
+DefragBufferToPacket(DefragTracker *tracker, Packet *rp, uint32_t len)
+{
+    rp->ext_pkt = tracker->buf;
+    SET_PKT_LEN(rp, len);
+
+    if (tracker->table != NULL)
+        DEFRAG_THREAD_MEMUSE_SUB(tracker->table, tracker->buf_size);
+    tracker->buf = NULL;
+    tracker->buf_size = 0;
+}
+
+/**
+ * Attempt to re-assemble a packet.
+ *
+ * The data of the fragments is already in place in the reassembly
+ * buffer, which becomes the data of the new packet.
+ *
+ * \param tracker The defragmentation tracker to reassemble from.
+ */
+static Packet *
+Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
+{
+    Packet *rp = NULL;
+
+    /* Should not be here unless we have seen the last fragment. */
+    if (!tracker->seen_last) {
+        return NULL;
+    }
+
+    /* Check that we have all the data. */
+    if (!DefragIsComplete(tracker)) {
+        goto done;
+    }
+    if (tracker->overlap && DefragBufferFill(tracker) != 0) {
+        goto error_remove_tracker;
+    }
+    if (!tracker->hdr_set) {
+        goto error_remove_tracker;
+    }
+
+    int hlen = tracker->hdr_len - tracker->ip_hdr_offset;
+    int fragmentable_len = DefragFragmentableLen(tracker);
+    if (tracker->hdr_len + fragmentable_len > (int)MAX_PAYLOAD_SIZE) {
+        SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
+                "fragmented packet, exceeds size of packet buffer.");
+        goto error_remove_tracker;
+    }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
@@ -298,64 +657,17 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     rp->flags |= PKT_REBUILT_FRAGMENT;
     rp->recursion_level = p->recursion_level;
 
-    int fragmentable_offset = 0;
-    int fragmentable_len = 0;
-    int hlen = 0;
-    int ip_hdr_offset = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
-        SCLogDebug("frag %p, data_len %u, offset %u, pcap_cnt %"PRIu64,
-                frag, frag->data_len, frag->offset, frag->pcap_cnt);
-
-        if (frag->skip)
-            continue;
-        if (frag->data_len - frag->ltrim <= 0)
-            continue;
-        if (frag->offset == 0) {
-
-            if (PacketCopyData(rp, frag->pkt, frag->len) == -1)
-                goto error_remove_tracker;
-
-            hlen = frag->hlen;
-            ip_hdr_offset = frag->ip_hdr_offset;
-
-            /* This is the start of the fragmentable portion of the
-             * first packet.  All fragment offsets are relative to
-             * this. */
-            fragmentable_offset = frag->ip_hdr_offset + frag->hlen;
-            fragmentable_len = frag->data_len;
-        }
-        else {
-            int pkt_end = fragmentable_offset + frag->offset + frag->data_len;
-            if (pkt_end > (int)MAX_PAYLOAD_SIZE) {
-                SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
-                        "fragmented packet, exceeds size of packet buffer.");
-                goto error_remove_tracker;
-            }
-            if (PacketCopyDataOffset(rp,
-                    fragmentable_offset + frag->offset + frag->ltrim,
-                    frag->pkt + frag->data_offset + frag->ltrim,
-                    frag->data_len - frag->ltrim) == -1) {
-                goto error_remove_tracker;
-            }
-            if (frag->offset + frag->data_len > fragmentable_len)
-                fragmentable_len = frag->offset + frag->data_len;
-        }
-
-        if (!frag->more_frags) {
-            break;
-        }
-    }
-
     SCLogDebug("ip_hdr_offset %u, hlen %u, fragmentable_len %u",
-            ip_hdr_offset, hlen, fragmentable_len);
+            tracker->ip_hdr_offset, hlen, fragmentable_len);
 
-    rp->ip4h = (IPV4Hdr *)(GET_PKT_DATA(rp) + ip_hdr_offset);
+    DefragBufferToPacket(tracker, rp, tracker->hdr_len + fragmentable_len);
+
+    rp->ip4h = (IPV4Hdr *)(GET_PKT_DATA(rp) + tracker->ip_hdr_offset);
     int old = rp->ip4h->ip_len + rp->ip4h->ip_off;
     rp->ip4h->ip_len = htons(fragmentable_len + hlen);
     rp->ip4h->ip_off = 0;
     rp->ip4h->ip_csum = FixChecksum(rp->ip4h->ip_csum,
         old, rp->ip4h->ip_len + rp->ip4h->ip_off);
-    SET_PKT_LEN(rp, ip_hdr_offset + hlen + fragmentable_len);
 
     tracker->remove = 1;
     DefragTrackerFreeFrags(tracker);
@@ -365,8 +677,6 @@ done:
 error_remove_tracker:
     tracker->remove = 1;
     DefragTrackerFreeFrags(tracker);
-    if (rp != NULL)
-        PacketFreeOrRelease(rp);
     return NULL;
 }
 
@@ -384,36 +694,31 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     if (!tracker->seen_last)
         return NULL;
 
-    /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
-    Frag *frag;
-    int len = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
-        if (frag->skip)
-            continue;
-
-        if (frag == TAILQ_FIRST(&tracker->frags)) {
-            if (frag->offset != 0) {
-                goto done;
-            }
-            len = frag->data_len;
-        }
-        else {
-            if (frag->offset > len) {
-                /* This fragment starts after the end of the previous
-                 * fragment.  We have a hole. */
-                goto done;
-            }
-            else {
-                len += frag->data_len;
-            }
-        }
+    /* Check that we have all the data. */
+    if (!DefragIsComplete(tracker)) {
+        goto done;
+    }
+    if (tracker->overlap && DefragBufferFill(tracker) != 0) {
+        goto error_remove_tracker;
+    }
+    if (!tracker->hdr_set) {
+        goto error_remove_tracker;
     }
 
+    /* unfragmentable part is the part between the ipv6 header
+     * and the frag header. */
+    int unfragmentable_len = (tracker->hdr_len - tracker->ip_hdr_offset) -
+        IPV6_HEADER_LEN;
+    if (unfragmentable_len < 0 || unfragmentable_len >= tracker->hdr_len)
+        goto error_remove_tracker;
+
+    int fragmentable_len = DefragFragmentableLen(tracker);
+    if (tracker->hdr_len + fragmentable_len > (int)MAX_PAYLOAD_SIZE)
+        goto error_remove_tracker;
+
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
@@ -421,68 +726,10 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
 
-    int unfragmentable_len = 0;
-    int fragmentable_offset = 0;
-    int fragmentable_len = 0;
-    int ip_hdr_offset = 0;
-    uint8_t next_hdr = 0;
-    TAILQ_FOREACH(frag, &tracker->frags, next) {
-        if (frag->skip)
-            continue;
-        if (frag->data_len - frag->ltrim <= 0)
-            continue;
-        if (frag->offset == 0) {
-            IPV6FragHdr *frag_hdr = (IPV6FragHdr *)(frag->pkt +
-                frag->frag_hdr_offset);
-            next_hdr = frag_hdr->ip6fh_nxt;
-
-            /* This is the first packet, we use this packets link and
-             * IPv6 headers. We also copy in its data, but remove the
-             * fragmentation header. */
-            if (PacketCopyData(rp, frag->pkt, frag->frag_hdr_offset) == -1)
-                goto error_remove_tracker;
-            if (PacketCopyDataOffset(rp, frag->frag_hdr_offset,
-                frag->pkt + frag->frag_hdr_offset + sizeof(IPV6FragHdr),
-                frag->data_len) == -1)
-                goto error_remove_tracker;
-            ip_hdr_offset = frag->ip_hdr_offset;
-
-            /* This is the start of the fragmentable portion of the
-             * first packet.  All fragment offsets are relative to
-             * this. */
-            fragmentable_offset = frag->frag_hdr_offset;
-            fragmentable_len = frag->data_len;
-
-            /* unfragmentable part is the part between the ipv6 header
-             * and the frag header. */
-            unfragmentable_len = (fragmentable_offset - ip_hdr_offset) - IPV6_HEADER_LEN;
-            if (unfragmentable_len >= fragmentable_offset)
-                goto error_remove_tracker;
-        }
-        else {
-            if (PacketCopyDataOffset(rp, fragmentable_offset + frag->offset + frag->ltrim,
-                frag->pkt + frag->data_offset + frag->ltrim,
-                frag->data_len - frag->ltrim) == -1)
-                goto error_remove_tracker;
-            if (frag->offset + frag->data_len > fragmentable_len)
-                fragmentable_len = frag->offset + frag->data_len;
-        }
-
-        if (!frag->more_frags) {
-            break;
-        }
-    }
+    DefragBufferToPacket(tracker, rp, tracker->hdr_len + fragmentable_len);
 
-    rp->ip6h = (IPV6Hdr *)(GET_PKT_DATA(rp) + ip_hdr_offset);
+    rp->ip6h = (IPV6Hdr *)(GET_PKT_DATA(rp) + tracker->ip_hdr_offset);
     rp->ip6h->s_ip6_plen = htons(fragmentable_len + unfragmentable_len);
-    /* if we have no unfragmentable part, so no ext hdrs before the frag
-     * header, we need to update the ipv6 headers next header field. This
-     * points to the frag header, and we will make it point to the layer
-     * directly after the frag header. */
-    if (unfragmentable_len == 0)
-        rp->ip6h->s_ip6_nxt = next_hdr;
-    SET_PKT_LEN(rp, ip_hdr_offset + sizeof(IPV6Hdr) +
-            unfragmentable_len + fragmentable_len);
 
     tracker->remove = 1;
     DefragTrackerFreeFrags(tracker);
@@ -492,11 +739,26 @@ done:
 error_remove_tracker:
     tracker->remove = 1;
     DefragTrackerFreeFrags(tracker);
-    if (rp != NULL)
-        PacketFreeOrRelease(rp);
     return NULL;
 }
 
+/** \internal
+ *  \brief give a fragment not inserted back to its pool
+ */
+static void
+DefragFragReturn(DefragThreadTable *t, Frag *frag)
+{
+    DefragFragReset(frag);
+    if (t != NULL) {
+        DEFRAG_THREAD_MEMUSE_SUB(t, sizeof(Frag));
+        PoolReturn(t->frag_pool, frag);
+    } else {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        PoolReturn(defrag_context->frag_pool, frag);
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
+    }
+}
+
 /**
  * Insert a new IPv4/IPv6 fragment into a tracker.
  *
@@ -534,6 +796,9 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
     /* Address family */
     int af = tracker->af;
 
+    /* Thread table of the tracker, NULL for the global hash. */
+    DefragThreadTable *t = tracker->table;
+
     /* settings for updating a payload when an ip6 fragment with
      * unfragmentable exthdrs are encountered. */
     int ip6_nh_set_offset = 0;
@@ -567,6 +832,7 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
         frag_end = frag_offset + data_len;
         ip_hdr_offset = (uint8_t *)p->ip6h - GET_PKT_DATA(p);
         frag_hdr_offset = p->ip6eh.fh_header_offset;
+        ip6_nh_set_value = IPV6_EXTHDR_GET_FH_NH(p);
 
         SCLogDebug("mf %s frag_offset %u data_offset %u, data_len %u, "
                 "frag_end %u, ip_hdr_offset %u, frag_hdr_offset %u",
@@ -583,7 +849,6 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
 
             /* store offset and FH 'next' value for updating frag buffer below */
             ip6_nh_set_offset = p->ip6eh.fh_prev_hdr_offset;
-            ip6_nh_set_value = IPV6_EXTHDR_GET_FH_NH(p);
             SCLogDebug("offset %d, value %u", ip6_nh_set_offset, ip6_nh_set_value);
         }
 
@@ -604,6 +869,12 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
     tracker->timeout.tv_sec = p->ts.tv_sec + tracker->host_timeout;
     tracker->timeout.tv_usec = p->ts.tv_usec;
 
+    /* from the first overlap on, the fragments keep their own data */
+    if (!tracker->overlap && DefragFragOverlaps(tracker, frag_offset, frag_end)) {
+        if (DefragTrackerHoldFrags(tracker) != 0)
+            goto ignored;
+    }
+
     Frag *prev = NULL, *next;
     int overlap = 0;
     ltrim = 0;
@@ -621,8 +892,10 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
                         ltrim = prev->offset + prev->data_len - frag_offset;
                         overlap++;
                     }
+                    /* a trim is never reduced, the bytes it gave to
+                     * the fragments before are theirs */
                     if ((next != NULL) && (frag_end > next->offset)) {
-                        next->ltrim = frag_end - next->offset;
+                        next->ltrim = MAX(next->ltrim, frag_end - next->offset);
                         overlap++;
                     }
                     if ((frag_offset < prev->offset) &&
@@ -743,8 +1016,10 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
                 break;
             case DEFRAG_POLICY_LAST:
                 if (frag_offset <= prev->offset) {
+                    /* the bytes of prev given to a more recent
+                     * fragment stay with it */
                     if (frag_end > prev->offset) {
-                        prev->ltrim = frag_end - prev->offset;
+                        prev->ltrim = MAX(prev->ltrim, frag_end - prev->offset);
                         overlap++;
                     }
                     goto insert;
@@ -764,53 +1039,56 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
-    if (new == NULL) {
-        if (af == AF_INET) {
-            ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
-        } else {
-            ENGINE_SET_EVENT(p, IPV6_FRAG_IGNORED);
+    Frag *new = NULL;
+    if (t != NULL) {
+        if (DEFRAG_THREAD_CHECK_MEMCAP(t, sizeof(Frag))) {
+            new = PoolGet(t->frag_pool);
+            if (new != NULL)
+                DEFRAG_THREAD_MEMUSE_ADD(t, sizeof(Frag));
         }
-        goto done;
-    }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
-    if (new->pkt == NULL) {
+    } else {
         SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
+        new = PoolGet(defrag_context->frag_pool);
         SCMutexUnlock(&defrag_context->frag_pool_lock);
-        if (af == AF_INET) {
-            ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
-        } else {
-            ENGINE_SET_EVENT(p, IPV6_FRAG_IGNORED);
-        }
-        goto done;
     }
-    memcpy(new->pkt, GET_PKT_DATA(p) + ltrim, GET_PKT_LEN(p) - ltrim);
-    new->len = GET_PKT_LEN(p) - ltrim;
-    /* in case of unfragmentable exthdrs, update the 'next hdr' field
-     * in the raw buffer so the reassembled packet will point to the
-     * correct next header after stripping the frag header */
-    if (ip6_nh_set_offset > 0 && frag_offset == 0 && ltrim == 0) {
-        if (new->len > ip6_nh_set_offset) {
-            SCLogDebug("updating frag to have 'correct' nh value: %u -> %u",
-                    new->pkt[ip6_nh_set_offset], ip6_nh_set_value);
-            new->pkt[ip6_nh_set_offset] = ip6_nh_set_value;
-        }
+    if (new == NULL) {
+        goto ignored;
+    }
+
+    /* the buffer is set up for headers as long as the ones of this
+     * fragment, they are the same for all fragments most of the time.
+     * If the datagram has more fragments, it is likely at least twice
+     * as long. */
+    uint16_t hdr_len = (af == AF_INET) ? ip_hdr_offset + hlen : frag_hdr_offset;
+    if (tracker->buf == NULL)
+        tracker->hdr_len = hdr_len;
+    if (DefragBufferReserve(tracker, tracker->hdr_len, frag_end,
+                more_frags ? 2 * (uint32_t)frag_end : frag_end) != 0) {
+        DefragFragReturn(t, new);
+        goto ignored;
     }
 
-    new->hlen = hlen;
     new->offset = frag_offset + ltrim;
-    new->data_offset = data_offset;
     new->data_len = data_len - ltrim;
-    new->ip_hdr_offset = ip_hdr_offset;
-    new->frag_hdr_offset = frag_hdr_offset;
     new->more_frags = more_frags;
 #ifdef DEBUG
     new->pcap_cnt = pcap_cnt;
 #endif
 
+    const uint8_t *data = GET_PKT_DATA(p) + data_offset + ltrim;
+    if (tracker->overlap) {
+        /* the buffer is filled from the copies at reassembly */
+        const uint8_t *hdr = new->offset == 0 ? GET_PKT_DATA(p) : NULL;
+        if (DefragFragHold(tracker, new, hdr, hdr_len, ip_hdr_offset, data) != 0) {
+            DefragFragReturn(t, new);
+            goto ignored;
+        }
+        if (hdr != NULL && af == AF_INET6) {
+            DefragIPv6SetNextHeader(new->pkt, ip_hdr_offset,
+                    ip6_nh_set_offset, ip6_nh_set_value);
+        }
+    }
+
     Frag *frag;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (new->offset < frag->offset)
@@ -823,6 +1101,22 @@ insert:
         TAILQ_INSERT_BEFORE(frag, new, next);
     }
 
+    if (!tracker->overlap) {
+        /* write the data once, where it goes in the reassembled packet */
+        DefragBufferPlace(tracker, new, data);
+        if (new->offset == 0 && DefragFragUsed(new)) {
+            if (DefragBufferSetHeaders(tracker, GET_PKT_DATA(p), hdr_len,
+                        ip_hdr_offset) != 0) {
+                tracker->hdr_set = 0;
+                goto ignored;
+            }
+            if (af == AF_INET6) {
+                DefragIPv6SetNextHeader(tracker->buf, ip_hdr_offset,
+                        ip6_nh_set_offset, ip6_nh_set_value);
+            }
+        }
+    }
+
     if (!more_frags) {
         tracker->seen_last = 1;
     }
@@ -862,7 +1156,17 @@ insert:
             }
         }
     }
+    goto done;
 
+ignored:
+    if (t != NULL && tv != NULL && dtv != NULL) {
+        StatsIncr(tv, dtv->counter_defrag_max_hit);
+    }
+    if (af == AF_INET) {
+        ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
+    } else {
+        ENGINE_SET_EVENT(p, IPV6_FRAG_IGNORED);
+    }
 
 done:
     if (overlap) {
@@ -998,6 +1302,27 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, PacketQueue *pq)
         }
     }
 
+    /* the thread owns its table, nothing to lock */
+    if (dtv != NULL && dtv->defrag_table != NULL) {
+        DefragThreadTable *t = dtv->defrag_table;
+
+        if (p->ts.tv_sec != t->timeout_ts) {
+            t->timeout_ts = p->ts.tv_sec;
+            DefragThreadTableTimeout(t, &p->ts);
+        }
+
+        tracker = DefragThreadGetTracker(t, p);
+        if (tracker == NULL) {
+            if (tv != NULL)
+                StatsIncr(tv, dtv->counter_defrag_max_hit);
+            return NULL;
+        }
+
+        Packet *rp = DefragInsertFrag(tv, dtv, tracker, p, pq);
+        DefragThreadTrackerRelease(t, tracker, p);
+        return rp;
+    }
+
     /* return a locked tracker or NULL */
     tracker = DefragGetTracker(tv, dtv, p);
     if (tracker == NULL)
@@ -1235,7 +1560,7 @@ static int DefragInOrderSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1287,7 +1612,7 @@ static int DefragReverseSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1338,7 +1663,7 @@ static int IPV6DefragInOrderSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1388,7 +1713,7 @@ static int IPV6DefragReverseSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1494,7 +1819,7 @@ static int DefragDoSturgesNovakTest(int policy, u_char *expected,
     FAIL_IF(IPV4_GET_IPLEN(reassembled) != 20 + 192);
 
     FAIL_IF(memcmp(GET_PKT_DATA(reassembled) + 20, expected, expected_len) != 0);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     /* Make sure all frags were returned back to the pool. */
     FAIL_IF(defrag_context->frag_pool->outstanding != 0);
@@ -1605,7 +1930,7 @@ static int IPV6DefragDoSturgesNovakTest(int policy, u_char *expected,
 
     FAIL_IF(IPV6_GET_PLEN(reassembled) != 192);
 
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     /* Make sure all frags were returned to the pool. */
     FAIL_IF(defrag_context->frag_pool->outstanding != 0);
@@ -1649,7 +1974,7 @@ DefragSturgesNovakBsdTest(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_BSD, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1684,7 +2009,7 @@ static int IPV6DefragSturgesNovakBsdTest(void)
     };
 
     FAIL_IF_NOT(IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_BSD, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1719,7 +2044,7 @@ static int DefragSturgesNovakLinuxIpv4Test(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_LINUX, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1754,7 +2079,7 @@ static int IPV6DefragSturgesNovakLinuxTest(void)
     };
 
     FAIL_IF_NOT(IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_LINUX, expected,
-            sizeof(expected)));
+            sizeof(expected) - 1));
     PASS;
 }
 
@@ -1789,7 +2114,7 @@ static int DefragSturgesNovakWindowsIpv4Test(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_WINDOWS, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1824,7 +2149,7 @@ static int IPV6DefragSturgesNovakWindowsTest(void)
     };
 
     FAIL_IF_NOT(IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_WINDOWS, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1859,7 +2184,7 @@ static int DefragSturgesNovakSolarisTest(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_SOLARIS, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1894,7 +2219,7 @@ static int IPV6DefragSturgesNovakSolarisTest(void)
     };
 
     FAIL_IF_NOT(IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_SOLARIS, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1929,7 +2254,7 @@ static int DefragSturgesNovakFirstTest(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_FIRST, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -1964,7 +2289,7 @@ static int IPV6DefragSturgesNovakFirstTest(void)
     };
 
     return IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_FIRST, expected,
-        sizeof(expected));
+        sizeof(expected) - 1);
 }
 
 static int
@@ -1999,7 +2324,7 @@ DefragSturgesNovakLastTest(void)
     };
 
     FAIL_IF_NOT(DefragDoSturgesNovakTest(DEFRAG_POLICY_LAST, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -2034,7 +2359,7 @@ static int IPV6DefragSturgesNovakLastTest(void)
     };
 
     FAIL_IF_NOT(IPV6DefragDoSturgesNovakTest(DEFRAG_POLICY_LAST, expected,
-                    sizeof(expected)));
+                    sizeof(expected) - 1));
     PASS;
 }
 
@@ -2163,7 +2488,7 @@ static int DefragVlanTest(void)
     /* With no VLAN IDs set, packets should re-assemble. */
     FAIL_IF((r = Defrag(NULL, NULL, p1, NULL)) != NULL);
     FAIL_IF((r = Defrag(NULL, NULL, p2, NULL)) == NULL);
-    SCFree(r);
+    PacketFree(r);
 
     /* With mismatched VLANs, packets should not re-assemble. */
     p1->vlan_id[0] = 1;
@@ -2195,7 +2520,7 @@ static int DefragVlanQinQTest(void)
     /* With no VLAN IDs set, packets should re-assemble. */
     FAIL_IF((r = Defrag(NULL, NULL, p1, NULL)) != NULL);
     FAIL_IF((r = Defrag(NULL, NULL, p2, NULL)) == NULL);
-    SCFree(r);
+    PacketFree(r);
 
     /* With mismatched VLANs, packets should not re-assemble. */
     p1->vlan_id[0] = 1;
@@ -2291,7 +2616,7 @@ static int DefragMfIpv4Test(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(p);
+    PacketFree(p);
     DefragDestroy();
     PASS;
 }
@@ -2334,7 +2659,7 @@ static int DefragMfIpv6Test(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(p);
+    PacketFree(p);
     DefragDestroy();
     PASS;
 }
@@ -2413,17 +2738,287 @@ static int DefragTestJeremyLinux(void)
     r = Defrag(NULL, NULL, packets[3], NULL);
     FAIL_IF_NULL(r);
 
-    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 20, sizeof(expected)) != 0);
+    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 20, sizeof(expected) - 1) != 0);
+
+    for (i = 0; i < 4; i++) {
+        SCFree(packets[i]);
+    }
+    PacketFree(r);
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * The first fragment carries IP options and arrives last: the data
+ * already in the reassembly buffer moves to make room for its header.
+ */
+static int DefragIPv4OptionsTest(void)
+{
+    char expected[] = "AAAAAAAA"
+        "BBBBBBBB"
+        "CCC";
+
+    DefragInit();
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, 1, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, 1, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p2);
+    /* 4 bytes of nop options followed by 8 bytes of data */
+    Packet *p3 = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 12);
+    FAIL_IF_NULL(p3);
+    p3->ip4h->ip_verhl = 4 << 4 | 24 >> 2;
+    memset(GET_PKT_DATA(p3) + 20, 0x01, 4);
+
+    FAIL_IF_NOT_NULL(Defrag(NULL, NULL, p1, NULL));
+    FAIL_IF_NOT_NULL(Defrag(NULL, NULL, p2, NULL));
+    Packet *r = Defrag(NULL, NULL, p3, NULL);
+    FAIL_IF_NULL(r);
+
+    FAIL_IF(IPV4_GET_HLEN(r) != 24);
+    FAIL_IF(IPV4_GET_IPLEN(r) != 24 + 19);
+    FAIL_IF(GET_PKT_LEN(r) != 24 + 19);
+    FAIL_IF(GET_PKT_DATA(r)[20] != 0x01);
+    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 24, sizeof(expected) - 1) != 0);
+
+    /* Make sure all frags were returned back to the pool. */
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    PacketFree(r);
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * BSD: a fragment that takes part of the next fragment from a more
+ * recent one must not give back what that one took from the same
+ * next fragment before.
+ */
+static int DefragBsdTrimTest(void)
+{
+    char expected[] = "AAAAAAAA"
+        "AAAAAAAA"
+        "DDDDDDDD"
+        "CCCCCCCC"
+        "BBBBBBBB"
+        "EEEEEEEE";
+
+    DefragInit();
+    default_policy = DEFRAG_POLICY_BSD;
+
+    int id = 1;
+    Packet *packets[5];
+    int i = 0;
+
+    packets[0] = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'A', 16);
+    packets[1] = BuildTestPacket(IPPROTO_ICMP, id, 2, 1, 'B', 24);
+    /* takes 16 to 32 from B */
+    packets[2] = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'C', 24);
+    /* takes 16 to 24, but B's bytes up to 32 stay with C */
+    packets[3] = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'D', 16);
+    packets[4] = BuildTestPacket(IPPROTO_ICMP, id, 5, 0, 'E', 8);
+
+    for (i = 0; i < 4; i++) {
+        FAIL_IF_NULL(packets[i]);
+        FAIL_IF_NOT_NULL(Defrag(NULL, NULL, packets[i], NULL));
+    }
+    FAIL_IF_NULL(packets[4]);
+    Packet *r = Defrag(NULL, NULL, packets[4], NULL);
+    FAIL_IF_NULL(r);
+
+    FAIL_IF(IPV4_GET_IPLEN(r) != 20 + 48);
+    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 20, sizeof(expected) - 1) != 0);
+
+    for (i = 0; i < 5; i++) {
+        SCFree(packets[i]);
+    }
+    PacketFree(r);
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * BSD: bytes an older fragment held when a fragment was received are
+ * given to that fragment if a later one trims the older fragment.
+ */
+static int DefragBsdLaterTrimTest(void)
+{
+    char expected[] = "BBBBBBBB"
+        "BBBBBBBB"
+        "BBBBBBBB"
+        "BBBBBBBB"
+        "AAAAAAAA"
+        "DDDDDDDD";
+
+    DefragInit();
+    default_policy = DEFRAG_POLICY_BSD;
+
+    int id = 1;
+    Packet *packets[4];
+    int i = 0;
+
+    packets[0] = BuildTestPacket(IPPROTO_ICMP, id, 2, 1, 'A', 24);
+    /* starts before A and doesn't cover it: A keeps 16 to 40 */
+    packets[1] = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'B', 32);
+    /* trimmed away by B, but its end takes 16 to 32 from A for B */
+    packets[2] = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'C', 32);
+    packets[3] = BuildTestPacket(IPPROTO_ICMP, id, 5, 0, 'D', 8);
+
+    for (i = 0; i < 3; i++) {
+        FAIL_IF_NULL(packets[i]);
+        FAIL_IF_NOT_NULL(Defrag(NULL, NULL, packets[i], NULL));
+    }
+    FAIL_IF_NULL(packets[3]);
+    Packet *r = Defrag(NULL, NULL, packets[3], NULL);
+    FAIL_IF_NULL(r);
+
+    FAIL_IF(IPV4_GET_IPLEN(r) != 20 + 48);
+    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 20, sizeof(expected) - 1) != 0);
 
     for (i = 0; i < 4; i++) {
         SCFree(packets[i]);
     }
-    SCFree(r);
+    PacketFree(r);
 
     DefragDestroy();
     PASS;
 }
 
+/**
+ * LAST: a fragment that takes less of a fragment than a more recent
+ * one did must not give the difference back to the older fragment.
+ */
+static int DefragLastTrimTest(void)
+{
+    char expected[] = "AAAAAAAA"
+        "CCCCCCCC"
+        "DDDD"
+        "CCCC"
+        "BBBBBBBB"
+        "BBBBBBBB"
+        "EEEEEEEE";
+
+    DefragInit();
+    default_policy = DEFRAG_POLICY_LAST;
+
+    int id = 1;
+    Packet *packets[5];
+    int i = 0;
+
+    packets[0] = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'A', 8);
+    packets[1] = BuildTestPacket(IPPROTO_ICMP, id, 2, 1, 'B', 24);
+    /* takes 16 to 24 from B */
+    packets[2] = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'C', 16);
+    /* takes 16 to 20 from C, B doesn't get 20 to 24 back */
+    packets[3] = BuildTestPacket(IPPROTO_ICMP, id, 2, 1, 'D', 4);
+    packets[4] = BuildTestPacket(IPPROTO_ICMP, id, 5, 0, 'E', 8);
+
+    for (i = 0; i < 4; i++) {
+        FAIL_IF_NULL(packets[i]);
+        FAIL_IF_NOT_NULL(Defrag(NULL, NULL, packets[i], NULL));
+    }
+    FAIL_IF_NULL(packets[4]);
+    Packet *r = Defrag(NULL, NULL, packets[4], NULL);
+    FAIL_IF_NULL(r);
+
+    FAIL_IF(IPV4_GET_IPLEN(r) != 20 + 48);
+    FAIL_IF(memcmp(expected, GET_PKT_DATA(r) + 20, sizeof(expected) - 1) != 0);
+
+    for (i = 0; i < 5; i++) {
+        SCFree(packets[i]);
+    }
+    PacketFree(r);
+
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * Fragments going through a thread table are reassembled without
+ * touching the global hash, and the tracker is recycled right away.
+ */
+static int DefragThreadTableTest01(void)
+{
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+
+    DefragInit();
+    uint64_t memuse = SC_ATOMIC_GET(defrag_memuse);
+    DefragThreadTable *t = DefragThreadTableAlloc();
+    FAIL_IF_NULL(t);
+    dtv.defrag_table = t;
+    uint64_t rows = defrag_config.hash_size * sizeof(DefragThreadHashRow);
+    FAIL_IF(SC_ATOMIC_GET(defrag_memuse) != memuse + rows);
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, 1, 1, 0, 'B', 8);
+    FAIL_IF_NULL(p2);
+
+    FAIL_IF_NOT_NULL(Defrag(NULL, &dtv, p1, NULL));
+    FAIL_IF(t->active != 1);
+    FAIL_IF_NOT_NULL(DefragLookupTrackerFromHash(p1));
+
+    Packet *r = Defrag(NULL, &dtv, p2, NULL);
+    FAIL_IF_NULL(r);
+    FAIL_IF(IPV4_GET_IPLEN(r) != 36);
+    FAIL_IF(t->active != 0);
+    FAIL_IF_NULL(t->spare);
+    FAIL_IF(t->spare->table != t);
+    FAIL_IF(t->memuse != sizeof(DefragTracker));
+    FAIL_IF(SC_ATOMIC_GET(defrag_memuse) != memuse + rows + t->memuse);
+
+    SCFree(p1);
+    SCFree(p2);
+    PacketFree(r);
+    DefragThreadTableFree(t);
+    FAIL_IF(SC_ATOMIC_GET(defrag_memuse) != memuse);
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * Trackers of a thread table are timed out by the thread itself.
+ */
+static int DefragThreadTableTest02(void)
+{
+    DecodeThreadVars dtv;
+    memset(&dtv, 0, sizeof(dtv));
+
+    DefragInit();
+    DefragThreadTable *t = DefragThreadTableAlloc();
+    FAIL_IF_NULL(t);
+    dtv.defrag_table = t;
+
+    for (int i = 0; i < 16; i++) {
+        Packet *p = BuildTestPacket(IPPROTO_ICMP, i, 0, 1, 'A' + i, 16);
+        FAIL_IF_NULL(p);
+        FAIL_IF_NOT_NULL(Defrag(NULL, &dtv, p, NULL));
+        SCFree(p);
+    }
+    FAIL_IF(t->active != 16);
+
+    Packet *p = BuildTestPacket(IPPROTO_ICMP, 99, 0, 1, 'Z', 16);
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec += (defrag_context->timeout + 1);
+    FAIL_IF_NOT_NULL(Defrag(NULL, &dtv, p, NULL));
+    FAIL_IF(t->active != 1);
+
+    DefragTracker *dt = DefragThreadGetTracker(t, p);
+    FAIL_IF_NULL(dt);
+    FAIL_IF(dt->id != 99);
+
+    SCFree(p);
+    DefragThreadTableFree(t);
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DefragRegisterTests(void)
@@ -2468,5 +3063,11 @@ void DefragRegisterTests(void)
     UtRegisterTest("DefragTestBadProto", DefragTestBadProto);
 
     UtRegisterTest("DefragTestJeremyLinux", DefragTestJeremyLinux);
+    UtRegisterTest("DefragIPv4OptionsTest", DefragIPv4OptionsTest);
+    UtRegisterTest("DefragBsdTrimTest", DefragBsdTrimTest);
+    UtRegisterTest("DefragBsdLaterTrimTest", DefragBsdLaterTrimTest);
+    UtRegisterTest("DefragLastTrimTest", DefragLastTrimTest);
+    UtRegisterTest("DefragThreadTableTest01", DefragThreadTableTest01);
+    UtRegisterTest("DefragThreadTableTest02", DefragThreadTableTest02);
 #endif /* UNITTESTS */
 }
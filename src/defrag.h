@@ -38,31 +38,29 @@ typedef struct DefragContext_ {
 } DefragContext;
 
 /**
- * Storage for an individual fragment.
+ * An individual fragment. Its data is in the reassembly buffer of its
+ * tracker, only the part of the datagram it covers is kept here. Once
+ * the fragments of a tracker overlap, each of them holds a copy of its
+ * data in pkt.
  */
 typedef struct Frag_ {
     uint16_t offset;            /**< The offset of this fragment, already
                                  *   multiplied by 8. */
 
-    uint16_t len;               /**< The length of this fragment. */
-
-    uint8_t hlen;               /**< The length of this fragments IP header. */
-
     uint8_t more_frags:4;       /**< More frags? */
     uint8_t skip:4;             /**< Skip this fragment during re-assembly. */
 
-    uint16_t ip_hdr_offset;     /**< Offset in the packet where the IP
-                                 * header starts. */
-    uint16_t frag_hdr_offset;   /**< Offset in the packet where the frag
-                                 * header starts. */
-
-    uint16_t data_offset;       /**< Offset to the packet data. */
     uint16_t data_len;          /**< Length of data. */
 
     uint16_t ltrim;             /**< Number of leading bytes to trim when
                                  * re-assembling the packet. */
 
-    uint8_t *pkt;               /**< The actual packet. */
+    uint16_t hdr_len;           /**< Length of the headers in pkt, first
+                                 *   fragment only. */
+    uint16_t ip_hdr_offset;     /**< Offset of the IP header in pkt. */
+
+    uint8_t *pkt;               /**< Headers and data of the fragment, only
+                                 *   held when the tracker has overlaps. */
 
 #ifdef DEBUG
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
@@ -71,6 +69,8 @@ typedef struct Frag_ {
     TAILQ_ENTRY(Frag_) next;    /**< Pointer to next fragment for tailq. */
 } Frag;
 
+struct DefragThreadTable_;
+
 /**
  * A defragmentation tracker.  Used to track fragments that make up a
  * single packet.
@@ -106,6 +106,24 @@ typedef struct DefragTracker_ {
 
     TAILQ_HEAD(frag_tailq, Frag_) frags; /**< Head of list of fragments. */
 
+    /** reassembly buffer: the headers of the first fragment, then the
+     *  fragmentable data the fragments are copied to as they arrive. It
+     *  becomes the data of the reassembled packet. */
+    uint8_t *buf;
+    uint32_t buf_size;          /**< allocated size of buf */
+    uint32_t data_end;          /**< end of the data room reserved in buf,
+                                 *   relative to the start of the data */
+    uint16_t hdr_len;           /**< length of the headers, where the data
+                                 *   starts in buf */
+    uint16_t ip_hdr_offset;     /**< offset of the IP header in buf */
+    uint8_t hdr_set;            /**< headers of a first fragment are in buf */
+    uint8_t overlap;            /**< fragments overlap: they hold their own
+                                 *   data and buf is filled at reassembly */
+
+    /** thread table owning this tracker, NULL if it is in the global
+     *  hash. Trackers of a thread table are never locked. */
+    struct DefragThreadTable_ *table;
+
     /** hash pointers, protected by hash row mutex/spin */
     struct DefragTracker_ *hnext;
     struct DefragTracker_ *hprev;
@@ -121,6 +139,7 @@ void DefragReload(void); /**< use only in unittests */
 
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
+Pool *DefragFragPoolNew(uint32_t size, uint32_t prealloc);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *, PacketQueue *);
 void DefragRegisterTests(void);
 
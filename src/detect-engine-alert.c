@@ -222,6 +222,7 @@ int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, const Signature *s,
 
     /* Update the count */
     p->alerts.cnt++;
+    p->dirty |= PKT_DIRTY_ALERTS;
 
     return 0;
 }
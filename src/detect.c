@@ -1456,6 +1456,7 @@ void DetectSignatureApplyActions(Packet *p,
             p->alerts.drop.num = s->num;
             p->alerts.drop.action = s->action;
             p->alerts.drop.s = (Signature *)s;
+            p->dirty |= PKT_DIRTY_ALERTS;
         }
     } else if (s->action & ACTION_PASS) {
         /* if an stream/app-layer match we enforce the pass for the flow */
@@ -0,0 +1,137 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Handling of flows bypassed in the capture method
+ *
+ * When a capture method drops the packets of a bypassed flow itself,
+ * Suricata does not see them anymore. The capture method registers a
+ * check function that is called by the flow manager to keep the Flow
+ * alive and its counters up to date as long as the capture method sees
+ * traffic, and to clean up its own tables when the flow is idle.
+ */
+
+#include "suricata-common.h"
+#include "flow.h"
+#include "flow-bypass.h"
+#include "flow-storage.h"
+#include "util-debug.h"
+
+#define BYPASSFUNCMAX   4
+
+static BypassedCheckFunc BypassedFuncList[BYPASSFUNCMAX];
+static int g_bypassed_func_max_index = 0;
+
+static int g_bypass_info_id = -1;
+
+/**
+ * \brief register a check function for bypassed flows
+ *
+ * Has to be called before the flow manager starts.
+ *
+ * \retval 0 on success, -1 if too many functions are registered
+ */
+int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc)
+{
+    if (CheckFunc == NULL)
+        return -1;
+
+    for (int i = 0; i < g_bypassed_func_max_index; i++) {
+        if (BypassedFuncList[i] == CheckFunc)
+            return 0;
+    }
+
+    if (g_bypassed_func_max_index < BYPASSFUNCMAX) {
+        BypassedFuncList[g_bypassed_func_max_index] = CheckFunc;
+        g_bypassed_func_max_index++;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief run the registered check functions
+ *
+ * \param bypassstats stats of the timed out bypassed flows
+ * \param tv current time as used by the flow engine
+ *
+ * \retval number of timed out flows
+ */
+int BypassedFlowManagerCheck(struct flows_stats *bypassstats, struct timeval *tv)
+{
+    struct timespec curtime;
+    int tcount = 0;
+
+    if (g_bypassed_func_max_index == 0)
+        return 0;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &curtime) != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Can't get time: %s (%d)",
+                     strerror(errno), errno);
+        return 0;
+    }
+
+    for (int i = 0; i < g_bypassed_func_max_index; i++) {
+        struct flows_stats stats = { 0, 0, 0 };
+        int ret = BypassedFuncList[i](&stats, &curtime, tv);
+        if (ret > 0) {
+            tcount += ret;
+            bypassstats->count += stats.count;
+            bypassstats->packets += stats.packets;
+            bypassstats->bytes += stats.bytes;
+        }
+    }
+    return tcount;
+}
+
+static void FlowBypassInfoFree(void *x)
+{
+    if (x)
+        SCFree(x);
+}
+
+/** \brief register the flow storage used to track bypassed flow counters */
+void RegisterFlowBypassInfo(void)
+{
+    g_bypass_info_id = FlowStorageRegister("bypass_counters", sizeof(void *),
+                                           NULL, FlowBypassInfoFree);
+}
+
+/**
+ * \brief get the bypass counters of a flow, allocating them if needed
+ *
+ * \param f *LOCKED* flow
+ *
+ * \retval fc counters or NULL on allocation failure
+ */
+FlowBypassInfo *FlowGetBypassInfo(Flow *f)
+{
+    if (g_bypass_info_id == -1)
+        return NULL;
+
+    FlowBypassInfo *fc = FlowGetStorageById(f, g_bypass_info_id);
+    if (fc == NULL) {
+        fc = SCCalloc(1, sizeof(FlowBypassInfo));
+        if (fc == NULL)
+            return NULL;
+        FlowSetStorageById(f, g_bypass_info_id, fc);
+    }
+    return fc;
+}
@@ -0,0 +1,63 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Handling of flows bypassed in the capture method
+ */
+
+#ifndef __FLOW_BYPASS_H__
+#define __FLOW_BYPASS_H__
+
+/** statistics of the bypassed flows, filled by the check functions */
+struct flows_stats {
+    uint64_t count;
+    uint64_t packets;
+    uint64_t bytes;
+};
+
+/** counters already accounted in a bypassed Flow, per direction */
+typedef struct FlowBypassInfo_ {
+    uint64_t tosrcpktcnt;
+    uint64_t tosrcbytecnt;
+    uint64_t todstpktcnt;
+    uint64_t todstbytecnt;
+} FlowBypassInfo;
+
+/**
+ * Check function of a capture method
+ *
+ * Called periodically by the flow manager. It has to update the Flow of
+ * the bypassed flows still seen by the capture method and to remove the
+ * timed out ones.
+ *
+ * \param bypassstats stats of the timed out flows to fill
+ * \param curtime current time, CLOCK_MONOTONIC
+ * \param tv current time, as used by the flow engine
+ */
+typedef int (*BypassedCheckFunc)(struct flows_stats *bypassstats,
+                                 struct timespec *curtime,
+                                 struct timeval *tv);
+
+int BypassedFlowManagerRegisterCheckFunc(BypassedCheckFunc CheckFunc);
+int BypassedFlowManagerCheck(struct flows_stats *bypassstats, struct timeval *tv);
+
+void RegisterFlowBypassInfo(void);
+FlowBypassInfo *FlowGetBypassInfo(Flow *f);
+
+#endif /* __FLOW_BYPASS_H__ */
@@ -36,6 +36,7 @@
 #include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 #include "app-layer-parser.h"
 
 #include "util-time.h"
@@ -46,6 +47,8 @@
 #include "conf.h"
 #include "output.h"
 #include "output-flow.h"
+#include "runmodes.h"
+#include "tm-threads.h"
 
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
@@ -53,6 +56,8 @@ SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv);
+static Flow *FlowThreadGetFlow(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, const Packet *p, Flow **dest);
 
 /** \brief compare two raw ipv6 addrs
  *
@@ -138,7 +143,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(flow_config.hash_func, fhk.u32, 5, flow_config.hash_rand);
 
         } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
             uint32_t psrc = IPV4_GET_RAW_IPSRC_U32(ICMPV4_GET_EMB_IPV4(p));
@@ -158,7 +163,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(flow_config.hash_func, fhk.u32, 5, flow_config.hash_rand);
 
         } else {
             FlowHashKey4 fhk;
@@ -172,7 +177,7 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashWord(flow_config.hash_func, fhk.u32, 5, flow_config.hash_rand);
         }
     } else if (p->ip6h != NULL) {
         FlowHashKey6 fhk;
@@ -204,12 +209,78 @@ static inline uint32_t FlowGetHash(const Packet *p)
         fhk.vlan_id[0] = p->vlan_id[0];
         fhk.vlan_id[1] = p->vlan_id[1];
 
-        hash = hashword(fhk.u32, 11, flow_config.hash_rand);
+        hash = HashWord(flow_config.hash_func, fhk.u32, 11, flow_config.hash_rand);
     }
 
     return hash;
 }
 
+/**
+ * \brief calculate the hash of a flow key
+ *
+ * Gives the same result as FlowGetHash() for the packets of the flow
+ * described by the key. Only TCP and UDP keys are supported.
+ *
+ * \param fk flow key, addresses in network byte order, ports in host
+ *        byte order
+ *
+ * \retval hash the flow hash
+ */
+uint32_t FlowKeyGetHash(FlowKey *fk)
+{
+    uint32_t hash = 0;
+
+    if (fk->src.family == AF_INET) {
+        FlowHashKey4 fhk;
+        int ai = (fk->src.addr_data32[0] > fk->dst.addr_data32[0]);
+        fhk.addrs[1-ai] = fk->src.addr_data32[0];
+        fhk.addrs[ai] = fk->dst.addr_data32[0];
+
+        const int pi = (fk->sp > fk->dp);
+        fhk.ports[1-pi] = fk->sp;
+        fhk.ports[pi] = fk->dp;
+
+        fhk.proto = (uint16_t)fk->proto;
+        fhk.recur = (uint16_t)fk->recursion_level;
+        fhk.vlan_id[0] = fk->vlan_id[0];
+        fhk.vlan_id[1] = fk->vlan_id[1];
+
+        hash = HashWord(flow_config.hash_func, fhk.u32, 5, flow_config.hash_rand);
+    } else {
+        FlowHashKey6 fhk;
+        if (FlowHashRawAddressIPv6GtU32(fk->src.addr_data32, fk->dst.addr_data32)) {
+            fhk.src[0] = fk->src.addr_data32[0];
+            fhk.src[1] = fk->src.addr_data32[1];
+            fhk.src[2] = fk->src.addr_data32[2];
+            fhk.src[3] = fk->src.addr_data32[3];
+            fhk.dst[0] = fk->dst.addr_data32[0];
+            fhk.dst[1] = fk->dst.addr_data32[1];
+            fhk.dst[2] = fk->dst.addr_data32[2];
+            fhk.dst[3] = fk->dst.addr_data32[3];
+        } else {
+            fhk.src[0] = fk->dst.addr_data32[0];
+            fhk.src[1] = fk->dst.addr_data32[1];
+            fhk.src[2] = fk->dst.addr_data32[2];
+            fhk.src[3] = fk->dst.addr_data32[3];
+            fhk.dst[0] = fk->src.addr_data32[0];
+            fhk.dst[1] = fk->src.addr_data32[1];
+            fhk.dst[2] = fk->src.addr_data32[2];
+            fhk.dst[3] = fk->src.addr_data32[3];
+        }
+
+        const int pi = (fk->sp > fk->dp);
+        fhk.ports[1-pi] = fk->sp;
+        fhk.ports[pi] = fk->dp;
+        fhk.proto = (uint16_t)fk->proto;
+        fhk.recur = (uint16_t)fk->recursion_level;
+        fhk.vlan_id[0] = fk->vlan_id[0];
+        fhk.vlan_id[1] = fk->vlan_id[1];
+
+        hash = HashWord(flow_config.hash_func, fhk.u32, 11, flow_config.hash_rand);
+    }
+    return hash;
+}
+
 /* Since two or more flows can have the same hash key, we need to compare
  * the flow with the current flow key. */
 #define CMP_FLOW(f1,f2) \
@@ -418,6 +489,89 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
     return f;
 }
 
+/** \internal
+ *  \brief Add a flow to the bucket index if there is room
+ */
+static inline void FlowBucketIndexAdd(FlowBucket *fb, Flow *f)
+{
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        if (fb->flows[i] == NULL) {
+            fb->flows[i] = f;
+            fb->tags[i] = FLOW_HASH_TAG(f->flow_hash);
+            return;
+        }
+    }
+}
+
+/** \internal
+ *  \retval slot of the flow in the bucket index or -1 if not indexed
+ */
+static inline int FlowBucketIndexGet(const FlowBucket *fb, const Flow *f)
+{
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        if (fb->flows[i] == f)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ *  \brief Add a flow at the start of the list of a bucket
+ *
+ *  f->flow_hash must be set. The bucket must be locked.
+ */
+void FlowBucketInsert(FlowBucket *fb, Flow *f)
+{
+    f->hprev = NULL;
+    f->hnext = fb->head;
+    if (fb->head != NULL)
+        fb->head->hprev = f;
+    else
+        fb->tail = f;
+    fb->head = f;
+    fb->cnt++;
+
+    FlowBucketIndexAdd(fb, f);
+}
+
+/**
+ *  \brief Remove a flow from a bucket
+ *
+ *  If the flow was indexed, the first flow of the list that was not
+ *  takes its place. The bucket must be locked.
+ */
+void FlowBucketRemove(FlowBucket *fb, Flow *f)
+{
+    if (f->hprev != NULL)
+        f->hprev->hnext = f->hnext;
+    if (f->hnext != NULL)
+        f->hnext->hprev = f->hprev;
+    if (fb->head == f)
+        fb->head = f->hnext;
+    if (fb->tail == f)
+        fb->tail = f->hprev;
+
+    f->hnext = NULL;
+    f->hprev = NULL;
+    fb->cnt--;
+
+    int i = FlowBucketIndexGet(fb, f);
+    if (i < 0)
+        return;
+    fb->flows[i] = NULL;
+
+    /* keep the index full while some flows are out of it */
+    if (fb->cnt >= FLOW_BUCKET_INLINE) {
+        for (Flow *o = fb->head; o != NULL; o = o->hnext) {
+            if (FlowBucketIndexGet(fb, o) < 0) {
+                fb->flows[i] = o;
+                fb->tags[i] = FLOW_HASH_TAG(o->flow_hash);
+                break;
+            }
+        }
+    }
+}
+
 static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
                              FlowBucket *fb, Flow *old_f,
                              const uint32_t hash, const Packet *p)
@@ -438,16 +592,19 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
 
     /* flow is locked */
 
-    /* put at the start of the list */
-    f->hnext = fb->head;
-    fb->head->hprev = f;
-    fb->head = f;
-
     /* initialize and return */
     FlowInit(f, p);
     f->flow_hash = hash;
     f->fb = fb;
 
+    /* put at the start of the list. The old flow won't be matched
+     * anymore, the new one takes its place in the index. */
+    FlowBucketInsert(fb, f);
+    int i = FlowBucketIndexGet(fb, old_f);
+    if (i >= 0 && FlowBucketIndexGet(fb, f) < 0) {
+        fb->flows[i] = f;
+    }
+
     f->thread_id = thread_id;
     return f;
 }
@@ -455,8 +612,9 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
 /** \brief Get Flow for packet
  *
  * Hash retrieval function for flows. Looks up the hash bucket containing the
- * flow pointer. Then compares the packet with the found flow to see if it is
- * the flow we need. If it isn't, walk the list until the right flow is found.
+ * flow pointer. Then compares the packet with the indexed flows having the
+ * tag of its hash. If none matches and the bucket has more flows than its
+ * index, walk the list for the others.
  *
  * If the flow is not found or the bucket was emtpy, a new flow is taken from
  * the queue. FlowDequeue() will alloc new flows as long as we stay within our
@@ -467,115 +625,68 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
  *  \param tv thread vars
  *  \param dtv decode thread vars (for flow log api thread data)
  *
- *  \retval f *LOCKED* flow or NULL
+ *  \retval f *LOCKED* flow or NULL, the flows of a thread table are
+ *          not locked
  */
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
 {
     Flow *f = NULL;
 
+    /* the thread owns its table, nothing to lock */
+    if (dtv != NULL && dtv->flow_table != NULL)
+        return FlowThreadGetFlow(tv, dtv, dtv->flow_table, p, dest);
+
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
+    const uint16_t tag = FLOW_HASH_TAG(hash);
     FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
-    /* see if the bucket already has a flow */
-    if (fb->head == NULL) {
-        f = FlowGetNew(tv, dtv, p);
-        if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
-            return NULL;
+    /* see if one of the indexed flows is our flow, only looking at the
+     * flows with our tag */
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        if (fb->tags[i] == tag && fb->flows[i] != NULL &&
+                FlowCompare(fb->flows[i], p) != 0) {
+            f = fb->flows[i];
+            goto found;
         }
+    }
 
-        /* flow is locked */
-        fb->head = f;
-        fb->tail = f;
-
-        /* got one, now lock, initialize and return */
-        FlowInit(f, p);
-        f->flow_hash = hash;
-        f->fb = fb;
-        FlowUpdateState(f, FLOW_STATE_NEW);
-
-        FlowReference(dest, f);
+    /* then the flows that didn't fit in the index */
+    if (fb->cnt > FLOW_BUCKET_INLINE) {
+        for (f = fb->head; f != NULL; f = f->hnext) {
+            if (f->flow_hash == hash && FlowBucketIndexGet(fb, f) < 0 &&
+                    FlowCompare(f, p) != 0) {
+                goto found;
+            }
+        }
+    }
 
+    /* not found, get a new flow */
+    f = FlowGetNew(tv, dtv, p);
+    if (f == NULL) {
         FBLOCK_UNLOCK(fb);
-        return f;
+        return NULL;
     }
 
-    /* ok, we have a flow in the bucket. Let's find out if it is our flow */
-    f = fb->head;
-
-    /* see if this is the flow we are looking for */
-    if (FlowCompare(f, p) == 0) {
-        Flow *pf = NULL; /* previous flow */
-
-        while (f) {
-            pf = f;
-            f = f->hnext;
-
-            if (f == NULL) {
-                f = pf->hnext = FlowGetNew(tv, dtv, p);
-                if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
-                    return NULL;
-                }
-                fb->tail = f;
-
-                /* flow is locked */
-
-                f->hprev = pf;
-
-                /* initialize and return */
-                FlowInit(f, p);
-                f->flow_hash = hash;
-                f->fb = fb;
-                FlowUpdateState(f, FLOW_STATE_NEW);
-
-                FlowReference(dest, f);
-
-                FBLOCK_UNLOCK(fb);
-                return f;
-            }
-
-            if (FlowCompare(f, p) != 0) {
-                /* we found our flow, lets put it on top of the
-                 * hash list -- this rewards active flows */
-                if (f->hnext) {
-                    f->hnext->hprev = f->hprev;
-                }
-                if (f->hprev) {
-                    f->hprev->hnext = f->hnext;
-                }
-                if (f == fb->tail) {
-                    fb->tail = f->hprev;
-                }
+    /* flow is locked */
 
-                f->hnext = fb->head;
-                f->hprev = NULL;
-                fb->head->hprev = f;
-                fb->head = f;
-
-                /* found our flow, lock & return */
-                FLOWLOCK_WRLOCK(f);
-                if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-                    f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-                    if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
-                        return NULL;
-                    }
-                }
+    /* initialize and return */
+    FlowInit(f, p);
+    f->flow_hash = hash;
+    f->fb = fb;
+    FlowBucketInsert(fb, f);
+    FlowUpdateState(f, FLOW_STATE_NEW);
 
-                FlowReference(dest, f);
+    FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
-                return f;
-            }
-        }
-    }
+    FBLOCK_UNLOCK(fb);
+    return f;
 
-    /* lock & return */
+found:
+    /* found our flow, lock & return */
     FLOWLOCK_WRLOCK(f);
     if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
         f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
@@ -591,6 +702,55 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
     return f;
 }
 
+/** \brief Look for an existing Flow in the hash
+ *
+ *  Unlike FlowGetFlowFromHash() no flow is created if none matches.
+ *  Used to find the flow of a bypassed flow entry from the capture
+ *  method.
+ *
+ *  \param key flow key
+ *  \param hash hash of the key as returned by FlowKeyGetHash()
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+Flow *FlowGetExistingFlowFromHash(FlowKey *key, const uint32_t hash)
+{
+    /* get our hash bucket and lock it */
+    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FBLOCK_LOCK(fb);
+
+    SCLogDebug("fb %p fb->head %p", fb, fb->head);
+
+    const uint16_t tag = FLOW_HASH_TAG(hash);
+    Flow *f = NULL;
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        f = fb->flows[i];
+        /* a reused session is not the flow we bypassed */
+        if (fb->tags[i] == tag && f != NULL && CMP_FLOW(f, key) &&
+                !(f->proto == IPPROTO_TCP && (f->flags & FLOW_TCP_REUSED))) {
+            goto found;
+        }
+    }
+    if (fb->cnt > FLOW_BUCKET_INLINE) {
+        for (f = fb->head; f != NULL; f = f->hnext) {
+            if (f->flow_hash == hash && FlowBucketIndexGet(fb, f) < 0 &&
+                    CMP_FLOW(f, key) &&
+                    !(f->proto == IPPROTO_TCP && (f->flags & FLOW_TCP_REUSED))) {
+                goto found;
+            }
+        }
+    }
+
+    FBLOCK_UNLOCK(fb);
+    return NULL;
+
+found:
+    /* found our flow, lock & return */
+    FLOWLOCK_WRLOCK(f);
+    FBLOCK_UNLOCK(fb);
+    return f;
+}
+
 /** \internal
  *  \brief Get a flow from the hash directly.
  *
@@ -640,19 +800,9 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         }
 
         /* remove from the hash */
-        if (f->hprev != NULL)
-            f->hprev->hnext = f->hnext;
-        if (f->hnext != NULL)
-            f->hnext->hprev = f->hprev;
-        if (fb->head == f)
-            fb->head = f->hnext;
-        if (fb->tail == f)
-            fb->tail = f->hprev;
-
-        f->hnext = NULL;
-        f->hprev = NULL;
+        FlowBucketRemove(fb, f);
         f->fb = NULL;
-        SC_ATOMIC_SET(fb->next_ts, 0);
+        FlowWheelMarkRow(fb);
         FBLOCK_UNLOCK(fb);
 
         int state = SC_ATOMIC_GET(f->flow_state);
@@ -688,3 +838,331 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
     return NULL;
 }
+
+/* spare flows kept by a thread table, the others go back to the global
+ * spare queue */
+#define FLOW_THREAD_SPARE_MAX 1024
+
+/** thread tables, for the flow manager to nudge their threads */
+static FlowThreadTable *flow_thread_tables = NULL;
+static SCMutex flow_thread_tables_lock = SCMUTEX_INITIALIZER;
+
+/**
+ *  \brief check if the thread tables are to be used
+ *
+ *  Only in the runmodes where the thread capturing a packet is the one
+ *  handling its flow, and the capture method gives all packets of a flow
+ *  to the same thread (e.g. af-packet with cluster_flow or cluster_qm).
+ */
+int FlowThreadTableEnabled(void)
+{
+    if (!flow_config.thread_local)
+        return 0;
+
+    const char *runmode = RunmodeGetActive();
+    if (runmode == NULL ||
+            (strcmp(runmode, "workers") != 0 && strcmp(runmode, "single") != 0)) {
+        static int warned = 0;
+        if (!warned) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "flow.thread-local "
+                    "is only supported by the workers and single runmodes, "
+                    "using the global flow table");
+            warned = 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  \brief alloc the flow table of a thread
+ *
+ *  The table has as many buckets as the global hash, their memory is
+ *  accounted in the flow memcap.
+ */
+FlowThreadTable *FlowThreadTableAlloc(ThreadVars *tv)
+{
+    const uint64_t hash_size = (uint64_t)flow_config.hash_size * sizeof(FlowBucket);
+    if (!(FLOW_CHECK_MEMCAP(hash_size))) {
+        SCLogError(SC_ERR_FLOW_INIT, "allocating the flow table of the "
+                "thread failed: flow memcap reached. Memcap %"PRIu64", "
+                "Memuse %"PRIu64", table size %"PRIu64".", flow_config.memcap,
+                (uint64_t)SC_ATOMIC_GET(flow_memuse), hash_size);
+        return NULL;
+    }
+
+    FlowThreadTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return NULL;
+
+    t->hash = SCMallocAligned(hash_size, CLS);
+    if (unlikely(t->hash == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    memset(t->hash, 0, hash_size);
+    for (uint32_t u = 0; u < flow_config.hash_size; u++) {
+        SC_ATOMIC_INIT(t->hash[u].next_ts);
+    }
+    (void) SC_ATOMIC_ADD(flow_memuse, hash_size);
+    t->tv = tv;
+
+    SCMutexLock(&flow_thread_tables_lock);
+    t->next = flow_thread_tables;
+    flow_thread_tables = t;
+    SCMutexUnlock(&flow_thread_tables_lock);
+
+    SCLogDebug("thread flow table %p, %"PRIu32" buckets", t,
+            flow_config.hash_size);
+    return t;
+}
+
+/**
+ *  \brief free the flow table of a thread, logging the flows still in it
+ *
+ *  Called by the owning thread when it is done with packets.
+ */
+void FlowThreadTableFree(DecodeThreadVars *dtv, FlowThreadTable *t)
+{
+    if (t == NULL)
+        return;
+
+    SCMutexLock(&flow_thread_tables_lock);
+    FlowThreadTable **pt = &flow_thread_tables;
+    while (*pt != NULL && *pt != t)
+        pt = &(*pt)->next;
+    if (*pt != NULL)
+        *pt = t->next;
+    SCMutexUnlock(&flow_thread_tables_lock);
+
+    Flow *f;
+    for (uint32_t u = 0; u < flow_config.hash_size; u++) {
+        f = t->hash[u].head;
+        while (f) {
+            Flow *n = f->hnext;
+
+            int state = SC_ATOMIC_GET(f->flow_state);
+            if (state == FLOW_STATE_NEW)
+                f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
+            else if (state == FLOW_STATE_ESTABLISHED)
+                f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
+            else if (state == FLOW_STATE_CLOSED)
+                f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+
+            f->flow_end_flags |= FLOW_END_FLAG_SHUTDOWN;
+
+            if (dtv && dtv->output_flow_thread_data)
+                (void)OutputFlowLog(t->tv, dtv->output_flow_thread_data, f);
+
+            FlowClearMemory(f, f->protomap);
+            FlowFree(f);
+            f = n;
+        }
+        SC_ATOMIC_DESTROY(t->hash[u].next_ts);
+    }
+    while ((f = t->spare) != NULL) {
+        t->spare = f->lnext;
+        FlowFree(f);
+    }
+
+    SCFreeAligned(t->hash);
+    (void) SC_ATOMIC_SUB(flow_memuse, (uint64_t)flow_config.hash_size * sizeof(FlowBucket));
+    SCFree(t);
+}
+
+/**
+ *  \brief log and clear a flow removed from the hash of a thread table,
+ *         and keep it as a spare flow
+ */
+void FlowThreadTableRecycle(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, Flow *f)
+{
+    if (dtv && dtv->output_flow_thread_data)
+        (void)OutputFlowLog(tv, dtv->output_flow_thread_data, f);
+
+    FlowClearMemory(f, f->protomap);
+    f->fb = NULL;
+    t->active--;
+
+    if (t->spare_cnt < FLOW_THREAD_SPARE_MAX) {
+        f->lnext = t->spare;
+        t->spare = f;
+        t->spare_cnt++;
+    } else {
+        FlowMoveToSpare(f);
+    }
+}
+
+/**
+ *  \brief have the threads owning a table time out their flows
+ *
+ *  A thread only runs its timeouts when it handles packets. The capture
+ *  loops inject a pseudo packet when they are idle and asked to, so the
+ *  flows of a thread without traffic time out as well.
+ */
+void FlowThreadTablesWakeup(void)
+{
+    SCMutexLock(&flow_thread_tables_lock);
+    for (FlowThreadTable *t = flow_thread_tables; t != NULL; t = t->next) {
+        if (t->tv != NULL)
+            TmThreadsSetFlag(t->tv, THV_CAPTURE_INJECT_PKT);
+    }
+    SCMutexUnlock(&flow_thread_tables_lock);
+}
+
+/** \internal
+ *  \brief take the least recently added flow of a row of the table, the
+ *         flow memcap is reached
+ */
+static Flow *FlowThreadGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t)
+{
+    uint32_t cnt = flow_config.hash_size;
+
+    while (cnt--) {
+        if (++t->prune_idx >= flow_config.hash_size)
+            t->prune_idx = 0;
+
+        FlowBucket *fb = &t->hash[t->prune_idx];
+        Flow *f = fb->tail;
+        if (f == NULL)
+            continue;
+
+        /* never prune a flow still used by one of our packets */
+        if (SC_ATOMIC_GET(f->use_cnt) > 0)
+            continue;
+
+        FlowBucketRemove(fb, f);
+
+        int state = SC_ATOMIC_GET(f->flow_state);
+        if (state == FLOW_STATE_NEW)
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
+        else if (state == FLOW_STATE_ESTABLISHED)
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
+        else if (state == FLOW_STATE_CLOSED)
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+        else if (state == FLOW_STATE_CAPTURE_BYPASSED)
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+        else if (state == FLOW_STATE_LOCAL_BYPASSED)
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+
+        f->flow_end_flags |= FLOW_END_FLAG_FORCED;
+
+        if (dtv && dtv->output_flow_thread_data)
+            (void)OutputFlowLog(tv, dtv->output_flow_thread_data, f);
+
+        FlowClearMemory(f, f->protomap);
+        f->fb = NULL;
+        t->active--;
+        return f;
+    }
+
+    return NULL;
+}
+
+/** \internal
+ *  \brief get a new flow for a thread table: from its spare flows, the
+ *         global spare queue or a new alloc. At the memcap the table
+ *         prunes one of its own flows.
+ */
+static Flow *FlowThreadGetNew(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, const Packet *p)
+{
+    if (FlowCreateCheck(p) == 0) {
+        return NULL;
+    }
+
+    Flow *f = t->spare;
+    if (f != NULL) {
+        t->spare = f->lnext;
+        f->lnext = NULL;
+        t->spare_cnt--;
+    } else if ((f = FlowDequeue(&flow_spare_q)) == NULL) {
+        if (FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize())) {
+            f = FlowAlloc();
+        } else {
+            f = FlowThreadGetUsedFlow(tv, dtv, t);
+        }
+        if (f == NULL) {
+            if (tv != NULL && dtv != NULL) {
+                StatsIncr(tv, dtv->counter_flow_memcap);
+            }
+            return NULL;
+        }
+    }
+
+    FlowUpdateCounter(tv, dtv, p->proto);
+    return f;
+}
+
+static inline void FlowThreadInsert(FlowThreadTable *t, FlowBucket *fb,
+        Flow *f, const Packet *p, const uint32_t hash)
+{
+    FlowInit(f, p);
+    f->flow_hash = hash;
+    f->fb = fb;
+    f->flags |= FLOW_THREAD_OWNED;
+    if (t->tv != NULL)
+        f->thread_id = (FlowThreadId)t->tv->id;
+    FlowBucketInsert(fb, f);
+    t->active++;
+}
+
+/** \internal
+ *  \brief FlowGetFlowFromHash() for the table of a thread
+ *
+ *  \retval f flow, *not* locked, or NULL
+ */
+static Flow *FlowThreadGetFlow(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, const Packet *p, Flow **dest)
+{
+    const uint32_t hash = p->flow_hash;
+    const uint16_t tag = FLOW_HASH_TAG(hash);
+    FlowBucket *fb = &t->hash[hash % flow_config.hash_size];
+    Flow *f = NULL;
+
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        if (fb->tags[i] == tag && fb->flows[i] != NULL &&
+                FlowCompare(fb->flows[i], p) != 0) {
+            f = fb->flows[i];
+            goto found;
+        }
+    }
+    if (fb->cnt > FLOW_BUCKET_INLINE) {
+        for (f = fb->head; f != NULL; f = f->hnext) {
+            if (f->flow_hash == hash && FlowBucketIndexGet(fb, f) < 0 &&
+                    FlowCompare(f, p) != 0) {
+                goto found;
+            }
+        }
+    }
+
+    f = FlowThreadGetNew(tv, dtv, t, p);
+    if (f == NULL)
+        return NULL;
+    FlowThreadInsert(t, fb, f, p, hash);
+    FlowUpdateState(f, FLOW_STATE_NEW);
+
+    FlowReference(dest, f);
+    return f;
+
+found:
+    if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
+        /* tag flow as reused so future lookups won't find it, it times
+         * out like any other flow */
+        Flow *old_f = f;
+        old_f->flags |= FLOW_TCP_REUSED;
+
+        f = FlowThreadGetNew(tv, dtv, t, p);
+        if (f == NULL)
+            return NULL;
+        FlowThreadInsert(t, fb, f, p, hash);
+        int i = FlowBucketIndexGet(fb, old_f);
+        if (i >= 0 && FlowBucketIndexGet(fb, f) < 0) {
+            fb->flows[i] = f;
+        }
+    }
+
+    FlowReference(dest, f);
+    return f;
+}
@@ -34,13 +34,32 @@
     #endif
 #endif
 
+/** flows indexed in the bucket itself */
+#define FLOW_BUCKET_INLINE 6
+
+/** tag of a flow in the bucket index: the hash bits not used to pick
+ *  the bucket */
+#define FLOW_HASH_TAG(hash) ((uint16_t)((hash) >> 16))
+
 /* flow hash bucket -- the hash is basically an array of these buckets.
  * Each bucket contains a flow or list of flows. All these flows have
  * the same hashkey (the hash is a chained hash). When doing modifications
- * to the list, the entire bucket is locked. */
+ * to the list, the entire bucket is locked.
+ *
+ * The first FLOW_BUCKET_INLINE flows are also indexed in the bucket with
+ * the tag of their hash, so a lookup skips the other flows of the index
+ * without reading them. The list is only walked for the flows that did
+ * not fit in the index, once the bucket holds more than
+ * FLOW_BUCKET_INLINE flows. */
 typedef struct FlowBucket_ {
     Flow *head;
     Flow *tail;
+    /** indexed flows, NULL if unused. The index is full as long as the
+     *  list has at least FLOW_BUCKET_INLINE flows. */
+    Flow *flows[FLOW_BUCKET_INLINE];
+    uint16_t tags[FLOW_BUCKET_INLINE];
+    /** number of flows in the list */
+    uint16_t cnt;
 #ifdef FBLOCK_MUTEX
     SCMutex m;
 #elif defined FBLOCK_SPIN
@@ -52,7 +71,8 @@ typedef struct FlowBucket_ {
      *  will time out in this row. Set by the flow manager. Cleared
      *  to 0 by workers, either when new flows are added or when a
      *  flow state changes. The flow manager sets this to INT_MAX for
-     *  empty buckets. */
+     *  empty buckets. In the global hash 0 means the row is queued
+     *  for the flow manager, see flow-wheel.c */
     SC_ATOMIC_DECLARE(int32_t, next_ts);
 } __attribute__((aligned(CLS))) FlowBucket;
 
@@ -72,11 +92,50 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** flow table owned by a thread of the workers runmode, used instead of
+ *  the global hash when all packets of a flow reach the same thread. Only
+ *  that thread touches its buckets, flows and spare flows, so nothing is
+ *  locked. The buckets are the ones of the global hash, their locks are
+ *  not used. */
+typedef struct FlowThreadTable_ {
+    FlowBucket *hash;
+
+    /** spare flows, linked by lnext */
+    Flow *spare;
+    uint32_t spare_cnt;
+
+    uint32_t prune_idx;
+
+    /** flows in the hash */
+    uint32_t active;
+
+    /** packet time of the last timeout run */
+    time_t timeout_ts;
+
+    /** owning thread, nudged by the flow manager to time out its flows
+     *  when it gets no packets */
+    ThreadVars *tv;
+    struct FlowThreadTable_ *next;
+} FlowThreadTable;
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
 
+Flow *FlowGetExistingFlowFromHash(FlowKey * key, uint32_t hash);
+uint32_t FlowKeyGetHash(FlowKey *flow_key);
+
+void FlowBucketInsert(FlowBucket *fb, Flow *f);
+void FlowBucketRemove(FlowBucket *fb, Flow *f);
+
 void FlowDisableTcpReuseHandling(void);
 
+int FlowThreadTableEnabled(void);
+FlowThreadTable *FlowThreadTableAlloc(ThreadVars *tv);
+void FlowThreadTableFree(DecodeThreadVars *dtv, FlowThreadTable *t);
+void FlowThreadTableRecycle(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, Flow *f);
+void FlowThreadTablesWakeup(void);
+
 #endif /* __FLOW_HASH_H__ */
 
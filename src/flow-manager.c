@@ -41,6 +41,8 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-bypass.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -342,17 +344,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
          * ready to be discarded. */
         if (FlowManagerFlowTimedOut(f, ts) == 1) {
             /* remove from the hash */
-            if (f->hprev != NULL)
-                f->hprev->hnext = f->hnext;
-            if (f->hnext != NULL)
-                f->hnext->hprev = f->hprev;
-            if (f->fb->head == f)
-                f->fb->head = f->hnext;
-            if (f->fb->tail == f)
-                f->fb->tail = f->hprev;
-
-            f->hnext = NULL;
-            f->hprev = NULL;
+            FlowBucketRemove(f->fb, f);
 
             if (f->flags & FLOW_TCP_REUSED)
                 counters->tcp_reuse++;
@@ -411,19 +403,195 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
     return cnt;
 }
 
+/**
+ *  \brief time out the flows of a thread table
+ *
+ *  Called by the thread owning the table, for its packets or the pseudo
+ *  packets it gets when idle. Flows with stream data left get their
+ *  pseudo packets injected into the thread, they are removed on one of
+ *  the next runs once those are done.
+ *
+ *  \param t thread table
+ *  \param ts timestamp
+ *
+ *  \retval cnt number of timed out flows
+ */
+uint32_t FlowThreadTableTimeout(ThreadVars *tv, DecodeThreadVars *dtv,
+        FlowThreadTable *t, struct timeval *ts)
+{
+    uint32_t idx = 0;
+    uint32_t cnt = 0;
+    int emergency = 0;
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    for (idx = 0; idx < flow_config.hash_size && t->active > 0; idx++) {
+        FlowBucket *fb = &t->hash[idx];
+
+        int32_t check_ts = SC_ATOMIC_GET(fb->next_ts);
+        if (check_ts > (int32_t)ts->tv_sec)
+            continue;
+
+        if (fb->tail == NULL) {
+            SC_ATOMIC_SET(fb->next_ts, INT_MAX);
+            continue;
+        }
+
+        int32_t next_ts = 0;
+        Flow *f = fb->tail;
+        while (f != NULL) {
+            Flow *next_flow = f->hprev;
+
+            enum FlowState state = SC_ATOMIC_GET(f->flow_state);
+            if (FlowManagerFlowTimeout(f, state, ts, &next_ts) == 1 &&
+                    FlowManagerFlowTimedOut(f, ts) == 1) {
+                FlowBucketRemove(fb, f);
+
+                if (state == FLOW_STATE_NEW)
+                    f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
+                else if (state == FLOW_STATE_ESTABLISHED)
+                    f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
+                else if (state == FLOW_STATE_CLOSED)
+                    f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+                else if (state == FLOW_STATE_LOCAL_BYPASSED)
+                    f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+                else if (state == FLOW_STATE_CAPTURE_BYPASSED)
+                    f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
+
+                if (emergency)
+                    f->flow_end_flags |= FLOW_END_FLAG_EMERGENCY;
+                f->flow_end_flags |= FLOW_END_FLAG_TIMEOUT;
+
+                FlowThreadTableRecycle(tv, dtv, t, f);
+                cnt++;
+            }
+            f = next_flow;
+        }
+
+        SC_ATOMIC_SET(fb->next_ts, next_ts);
+    }
+
+    return cnt;
+}
+
+/**
+ *  \internal
+ *
+ *  \brief time out the flows of a row of the hash and slot the row in the
+ *         wheel at its new next_ts
+ *
+ *  \param w wheel of the row
+ *  \param idx row of the hash
+ *  \param ts timestamp
+ *  \param emergency bool indicating emergency mode
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param queued bool indicating the row was taken off the queue
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowTimeoutRow(FlowWheel *w, uint32_t idx, struct timeval *ts,
+        int emergency, FlowTimeoutCounters *counters, int queued)
+{
+    FlowBucket *fb = &flow_hash[idx];
+    uint32_t cnt = 0;
+
+    counters->rows_checked++;
+
+    /* before grabbing the row lock, make sure we have at least
+     * 9 packets in the pool */
+    PacketPoolWaitForN(9);
+
+    if (FBLOCK_TRYLOCK(fb) != 0) {
+        counters->rows_busy++;
+        /* try again on the next pass */
+        if (queued)
+            FlowWheelRequeue(w, idx);
+        else
+            FlowWheelInsert(w, idx, (int32_t)ts->tv_sec + 1);
+        return 0;
+    }
+
+    /* flow hash bucket is now locked */
+
+    int32_t check_ts;
+    if (queued) {
+        /* off the queue: a worker changing the row from here on queues
+         * it again */
+        check_ts = INT_MAX;
+        SC_ATOMIC_SET(fb->next_ts, check_ts);
+    } else {
+        check_ts = SC_ATOMIC_GET(fb->next_ts);
+        /* queued in the meantime, left to the queue */
+        if (check_ts == 0) {
+            FBLOCK_UNLOCK(fb);
+            return 0;
+        }
+    }
+
+    int32_t next_ts = INT_MAX;
+    if (fb->tail == NULL) {
+        counters->rows_empty++;
+    } else {
+        next_ts = 0;
+
+        /* we have a flow, or more than one */
+        cnt = FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts);
+        if (fb->tail == NULL)
+            next_ts = INT_MAX;
+        else if (next_ts == 0)
+            next_ts = 1;
+    }
+
+    /* if a worker queued the row in the meantime, it stays queued */
+    (void)SC_ATOMIC_CAS(&fb->next_ts, check_ts, next_ts);
+
+    FBLOCK_UNLOCK(fb);
+
+    if (next_ts == INT_MAX)
+        FlowWheelRemove(w, idx);
+    else
+        FlowWheelInsert(w, idx, next_ts);
+    return cnt;
+}
+
+/**
+ *  \internal
+ *
+ *  \brief time out the flows of the rows queued by the workers
+ *
+ *  \retval cnt number of timed out flows
+ */
+static uint32_t FlowTimeoutQueued(FlowWheel *w, struct timeval *ts,
+        int emergency, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+
+    uint32_t idx = FlowWheelTakeQueued(w);
+    while (idx != FLOW_WHEEL_NONE) {
+        /* get the next one first, requeueing the row overwrites it */
+        uint32_t next = FlowWheelQueuedNext(w, idx);
+        cnt += FlowTimeoutRow(w, idx, ts, emergency, counters, 1);
+        idx = next;
+    }
+
+    return cnt;
+}
+
 /**
  *  \brief time out flows from the hash
  *
+ *  Checks all rows of the wheel and slots them again. Used when the
+ *  wheel can't be trusted: on start, when the time jumped and when the
+ *  timeouts got shorter entering emergency mode.
+ *
+ *  \param w wheel of the hash rows to consider
  *  \param ts timestamp
- *  \param try_cnt number of flows to time out max (0 is unlimited)
- *  \param hash_min min hash index to consider
- *  \param hash_max max hash index to consider
  *  \param counters ptr to FlowTimeoutCounters structure
  *
  *  \retval cnt number of timed out flow
  */
-static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
-        uint32_t hash_min, uint32_t hash_max,
+static uint32_t FlowTimeoutHash(FlowWheel *w, struct timeval *ts,
         FlowTimeoutCounters *counters)
 {
     uint32_t idx = 0;
@@ -433,48 +601,68 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
     if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
         emergency = 1;
 
-    for (idx = hash_min; idx < hash_max; idx++) {
-        FlowBucket *fb = &flow_hash[idx];
+    FlowWheelReset(w, (int32_t)ts->tv_sec);
 
-        counters->rows_checked++;
+    for (idx = w->min; idx < w->max; idx++) {
+        FlowBucket *fb = &flow_hash[idx];
 
         int32_t check_ts = SC_ATOMIC_GET(fb->next_ts);
-        if (check_ts > (int32_t)ts->tv_sec) {
+        /* queued rows are done below, empty ones are out of the wheel */
+        if (check_ts == 0 || check_ts == INT_MAX) {
             counters->rows_skipped++;
             continue;
         }
-
-        /* before grabbing the row lock, make sure we have at least
-         * 9 packets in the pool */
-        PacketPoolWaitForN(9);
-
-        if (FBLOCK_TRYLOCK(fb) != 0) {
-            counters->rows_busy++;
+        if (check_ts > (int32_t)ts->tv_sec) {
+            counters->rows_skipped++;
+            FlowWheelInsert(w, idx, check_ts);
             continue;
         }
 
-        /* flow hash bucket is now locked */
-
-        if (fb->tail == NULL) {
-            SC_ATOMIC_SET(fb->next_ts, INT_MAX);
-            counters->rows_empty++;
-            goto next;
-        }
+        cnt += FlowTimeoutRow(w, idx, ts, emergency, counters, 0);
+    }
 
-        int32_t next_ts = 0;
+    cnt += FlowTimeoutQueued(w, ts, emergency, counters);
+    return cnt;
+}
 
-        /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, &next_ts);
+/**
+ *  \brief time out flows from the rows due in the wheel and the rows
+ *         queued by the workers
+ *
+ *  \param w wheel of the hash rows to consider
+ *  \param ts timestamp
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flow
+ */
+static uint32_t FlowTimeoutWheel(FlowWheel *w, struct timeval *ts,
+        FlowTimeoutCounters *counters)
+{
+    uint32_t idx;
+    uint32_t cnt = 0;
+    int emergency = 0;
 
-        SC_ATOMIC_SET(fb->next_ts, next_ts);
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
 
-next:
-        FBLOCK_UNLOCK(fb);
+    while ((idx = FlowWheelNextDue(w, (int32_t)ts->tv_sec)) != FLOW_WHEEL_NONE) {
+        int32_t check_ts = SC_ATOMIC_GET(flow_hash[idx].next_ts);
+        /* queued rows are done below */
+        if (check_ts == 0) {
+            counters->rows_skipped++;
+            continue;
+        }
+        /* slotted at the end of the wheel, not due yet */
+        if (check_ts > (int32_t)ts->tv_sec) {
+            if (check_ts != INT_MAX)
+                FlowWheelInsert(w, idx, check_ts);
+            continue;
+        }
 
-        if (try_cnt > 0 && cnt >= try_cnt)
-            break;
+        cnt += FlowTimeoutRow(w, idx, ts, emergency, counters, 0);
     }
 
+    cnt += FlowTimeoutQueued(w, ts, emergency, counters);
     return cnt;
 }
 
@@ -499,17 +687,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
         int state = SC_ATOMIC_GET(f->flow_state);
 
         /* remove from the hash */
-        if (f->hprev != NULL)
-            f->hprev->hnext = f->hnext;
-        if (f->hnext != NULL)
-            f->hnext->hprev = f->hprev;
-        if (f->fb->head == f)
-            f->fb->head = f->hnext;
-        if (f->fb->tail == f)
-            f->fb->tail = f->hprev;
-
-        f->hnext = NULL;
-        f->hprev = NULL;
+        FlowBucketRemove(f->fb, f);
 
         if (state == FLOW_STATE_NEW)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_NEW;
@@ -565,6 +743,7 @@ typedef struct FlowManagerThreadData_ {
     uint32_t instance;
     uint32_t min;
     uint32_t max;
+    FlowWheel *wheel;
 
     uint16_t flow_mgr_cnt_clo;
     uint16_t flow_mgr_cnt_new;
@@ -587,6 +766,10 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_mgr_rows_busy;
     uint16_t flow_mgr_rows_maxlen;
 
+    uint16_t flow_bypassed_cnt_clo;
+    uint16_t flow_bypassed_pkts;
+    uint16_t flow_bypassed_bytes;
+
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void **data)
@@ -599,17 +782,16 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
     SCLogDebug("flow manager instance %u", ftd->instance);
 
     /* set the min and max value used for hash row walking
-     * each thread has it's own section of the flow hash */
-    uint32_t range = flow_config.hash_size / flowmgr_number;
-    if (ftd->instance == 1)
-        ftd->max = range;
-    else if (ftd->instance == flowmgr_number) {
-        ftd->min = (range * (ftd->instance - 1));
-        ftd->max = flow_config.hash_size;
-    } else {
-        ftd->min = (range * (ftd->instance - 1));
-        ftd->max = (range * ftd->instance);
+     * each thread has it's own section of the flow hash, in its wheel */
+    ftd->wheel = FlowWheelGet(ftd->instance);
+    if (ftd->wheel == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "no hash rows for flow manager "
+                "instance %u, flow.managers exceeds flow.hash-size", ftd->instance);
+        SCFree(ftd);
+        return TM_ECODE_FAILED;
     }
+    ftd->min = ftd->wheel->min;
+    ftd->max = ftd->wheel->max;
     BUG_ON(ftd->min > flow_config.hash_size || ftd->max > flow_config.hash_size);
 
     SCLogDebug("instance %u hash range %u %u", ftd->instance, ftd->min, ftd->max);
@@ -638,6 +820,10 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, const void *initdata, void *
     ftd->flow_mgr_rows_busy = StatsRegisterCounter("flow_mgr.rows_busy", t);
     ftd->flow_mgr_rows_maxlen = StatsRegisterCounter("flow_mgr.rows_maxlen", t);
 
+    ftd->flow_bypassed_cnt_clo = StatsRegisterCounter("flow_bypassed.closed", t);
+    ftd->flow_bypassed_pkts = StatsRegisterCounter("flow_bypassed.pkts", t);
+    ftd->flow_bypassed_bytes = StatsRegisterCounter("flow_bypassed.bytes", t);
+
     PacketPoolInit();
     return TM_ECODE_OK;
 }
@@ -666,6 +852,7 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
     uint32_t established_cnt = 0, new_cnt = 0, closing_cnt = 0;
     int emerg = FALSE;
     int prev_emerg = FALSE;
+    int sweep = FALSE;
     struct timespec cond_time;
     int flow_update_delay_sec = FLOW_NORMAL_MODE_UPDATE_DELAY_SEC;
     int flow_update_delay_nsec = FLOW_NORMAL_MODE_UPDATE_DELAY_NSEC;
@@ -690,6 +877,8 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
 
             if (emerg == TRUE && prev_emerg == FALSE) {
                 prev_emerg = TRUE;
+                /* the timeouts got shorter, the wheel is off */
+                sweep = TRUE;
 
                 SCLogDebug("Flow emergency mode entered...");
 
@@ -706,10 +895,28 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         if (ftd->instance == 1)
             FlowUpdateSpareFlows();
 
+        /* update the flows bypassed in the capture method before
+         * the timeout check so active ones are kept */
+        if (ftd->instance == 1) {
+            struct flows_stats bypassstats = { 0, 0, 0};
+            BypassedFlowManagerCheck(&bypassstats, &ts);
+            StatsAddUI64(th_v, ftd->flow_bypassed_cnt_clo, (uint64_t)bypassstats.count);
+            StatsAddUI64(th_v, ftd->flow_bypassed_pkts, (uint64_t)bypassstats.packets);
+            StatsAddUI64(th_v, ftd->flow_bypassed_bytes, (uint64_t)bypassstats.bytes);
+        }
+
         /* try to time out flows */
         FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        if (sweep == TRUE || FlowWheelNeedsReset(ftd->wheel, (int32_t)ts.tv_sec)) {
+            FlowTimeoutHash(ftd->wheel, &ts, &counters);
+            sweep = FALSE;
+        } else {
+            FlowTimeoutWheel(ftd->wheel, &ts, &counters);
+        }
 
+        /* the flows of the thread tables are timed out by their threads */
+        if (ftd->instance == 1)
+            FlowThreadTablesWakeup();
 
         if (ftd->instance == 1) {
             DefragTimeoutHash(&ts);
@@ -1389,7 +1596,7 @@ static int FlowMgrTest05 (void)
     TimeGet(&ts);
     /* try to time out flows */
     FlowTimeoutCounters counters = { 0, 0, 0, 0, 0,0,0,0,0,0,0,0,0,0,0};
-    FlowTimeoutHash(&ts, 0 /* check all */, 0, flow_config.hash_size, &counters);
+    FlowTimeoutHash(FlowWheelGet(1), &ts, &counters);
 
     if (flow_recycle_q.len > 0) {
         result = 1;
@@ -34,6 +34,10 @@ SCCtrlMutex flow_manager_ctrl_mutex;
 #define FlowWakeupFlowManagerThread() SCCtrlCondSignal(&flow_manager_ctrl_cond)
 
 void FlowManagerThreadSpawn(void);
+
+struct FlowThreadTable_;
+uint32_t FlowThreadTableTimeout(ThreadVars *tv, DecodeThreadVars *dtv,
+        struct FlowThreadTable_ *t, struct timeval *ts);
 void FlowDisableFlowManagerThread(void);
 void FlowMgrRegisterTests (void);
 
@@ -268,8 +268,15 @@ static inline Packet *FlowForceReassemblyPseudoPacketGet(int direction,
                                                          TcpSession *ssn,
                                                          int dummy)
 {
-    PacketPoolWait();
-    Packet *p = PacketPoolGetPacket();
+    Packet *p;
+    if (f->flags & FLOW_THREAD_OWNED) {
+        /* we're the thread the packets return to, waiting for our
+         * pool to fill up would never end */
+        p = PacketGetFromQueueOrAlloc();
+    } else {
+        PacketPoolWait();
+        p = PacketPoolGetPacket();
+    }
     if (p == NULL) {
         return NULL;
     }
@@ -38,6 +38,87 @@
 
 #include "detect.h"
 #include "detect-engine-state.h"
+#include "util-hugepages.h"
+
+/* spare flows carved from a huge pages area, recycled through a free
+ * list linked by hnext. Flows allocated past the area use SCMalloc. */
+static uint8_t *flow_area = NULL;
+static size_t flow_area_size = 0;
+static Flow *flow_area_free = NULL;
+static SCSpinlock flow_area_lock;
+
+static inline size_t FlowAreaObjectSize(void)
+{
+    return (sizeof(Flow) + FlowStorageSize() + CLS - 1) & ~((size_t)CLS - 1);
+}
+
+static inline int FlowAreaOwns(const Flow *f)
+{
+    return (flow_area != NULL && (const uint8_t *)f >= flow_area &&
+            (const uint8_t *)f < flow_area + flow_area_size);
+}
+
+/** \brief set up the huge pages area for cnt flows
+ *
+ *  The area is shared by all the threads so it is interleaved on the
+ *  NUMA nodes. If it can't be set up flows are allocated with SCMalloc.
+ */
+void FlowAreaInit(uint32_t cnt)
+{
+    const size_t osize = FlowAreaObjectSize();
+
+    if (flow_area != NULL || cnt == 0)
+        return;
+
+    flow_area = HugepagesAlloc(osize * cnt, HUGEPAGES_NUMA_INTERLEAVE);
+    if (flow_area == NULL)
+        return;
+    flow_area_size = osize * cnt;
+    SCSpinInit(&flow_area_lock, 0);
+
+    for (uint32_t i = cnt; i > 0; i--) {
+        Flow *f = (Flow *)(flow_area + (size_t)(i - 1) * osize);
+        f->hnext = flow_area_free;
+        flow_area_free = f;
+    }
+}
+
+/** \brief release the area, all its flows must have been freed */
+void FlowAreaDeinit(void)
+{
+    if (flow_area == NULL)
+        return;
+
+    HugepagesFree(flow_area);
+    SCSpinDestroy(&flow_area_lock);
+    flow_area = NULL;
+    flow_area_size = 0;
+    flow_area_free = NULL;
+}
+
+static Flow *FlowAreaGet(void)
+{
+    Flow *f = NULL;
+
+    if (flow_area == NULL)
+        return NULL;
+
+    SCSpinLock(&flow_area_lock);
+    if (flow_area_free != NULL) {
+        f = flow_area_free;
+        flow_area_free = f->hnext;
+    }
+    SCSpinUnlock(&flow_area_lock);
+    return f;
+}
+
+static void FlowAreaPut(Flow *f)
+{
+    SCSpinLock(&flow_area_lock);
+    f->hnext = flow_area_free;
+    flow_area_free = f;
+    SCSpinUnlock(&flow_area_lock);
+}
 
 /** \brief allocate a flow
  *
@@ -57,10 +138,13 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
-    if (unlikely(f == NULL)) {
-        (void)SC_ATOMIC_SUB(flow_memuse, size);
-        return NULL;
+    f = FlowAreaGet();
+    if (f == NULL) {
+        f = SCMalloc(size);
+        if (unlikely(f == NULL)) {
+            (void)SC_ATOMIC_SUB(flow_memuse, size);
+            return NULL;
+        }
     }
     memset(f, 0, size);
 
@@ -78,7 +162,10 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    if (FlowAreaOwns(f))
+        FlowAreaPut(f);
+    else
+        SCFree(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
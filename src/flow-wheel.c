@@ -0,0 +1,468 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hierarchical timer wheel of the flow hash rows.
+ *
+ * Instead of walking all rows of the hash each pass, a flow manager
+ * keeps its rows in a wheel, slotted at the next_ts of the row: the
+ * second the first of its flows may time out. Each pass it only checks
+ * the rows that are due, and slots them again at their new next_ts. A
+ * row whose flows saw packets since it was slotted is so slotted again
+ * when it comes up.
+ *
+ * The first level has a slot per second for the next FLOW_WHEEL_SLOTS
+ * seconds, the second level a slot per FLOW_WHEEL_SLOTS seconds. The
+ * rows of a second level slot are spread over the first level when its
+ * time comes.
+ *
+ * The workers never touch the slots. When they add a flow to a row or
+ * change the state of one of its flows, they set the next_ts of the row
+ * to 0 and push the row on the queue of the wheel, a lock free stack.
+ * A row is on the queue iff its next_ts is 0, so it is pushed at most
+ * once until the flow manager took it off the queue and checked it.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+
+#include "flow.h"
+#include "flow-hash.h"
+#include "flow-private.h"
+#include "flow-wheel.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+
+/** wheel of each flow manager */
+static FlowWheel **flow_wheels = NULL;
+static uint32_t flow_wheels_cnt = 0;
+static uint32_t flow_wheel_range = 0;
+
+FlowWheel *FlowWheelAlloc(uint32_t min, uint32_t max)
+{
+    FlowWheel *w = SCCalloc(1, sizeof(*w));
+    if (unlikely(w == NULL))
+        return NULL;
+
+    const uint32_t rows = max - min;
+    w->min = min;
+    w->max = max;
+    w->next = SCMalloc(rows * sizeof(uint32_t));
+    w->prev = SCMalloc(rows * sizeof(uint32_t));
+    w->list = SCMalloc(rows * sizeof(uint16_t));
+    w->due = SCMalloc(rows * sizeof(int32_t));
+    w->queue_next = SCMalloc(rows * sizeof(uint32_t));
+    if (w->next == NULL || w->prev == NULL || w->list == NULL ||
+            w->due == NULL || w->queue_next == NULL) {
+        FlowWheelFree(w);
+        return NULL;
+    }
+
+    SC_ATOMIC_INIT(w->queue);
+    SC_ATOMIC_SET(w->queue, FLOW_WHEEL_NONE);
+    FlowWheelReset(w, 0);
+    return w;
+}
+
+void FlowWheelFree(FlowWheel *w)
+{
+    if (w == NULL)
+        return;
+
+    SCFree(w->next);
+    SCFree(w->prev);
+    SCFree(w->list);
+    SCFree(w->due);
+    SCFree(w->queue_next);
+    SC_ATOMIC_DESTROY(w->queue);
+    SCFree(w);
+}
+
+/**
+ *  \brief set up the wheels of the flow managers, each gets a range of the
+ *         hash rows like the flow manager instances do
+ */
+void FlowWheelsInit(void)
+{
+    intmax_t setting = 1;
+    (void)ConfGetInt("flow.managers", &setting);
+    /* the flow manager spawn rejects bad values */
+    if (setting < 1 || setting > 1024)
+        setting = 1;
+    if ((uint32_t)setting > flow_config.hash_size)
+        setting = flow_config.hash_size;
+
+    flow_wheels_cnt = (uint32_t)setting;
+    flow_wheel_range = flow_config.hash_size / flow_wheels_cnt;
+
+    flow_wheels = SCCalloc(flow_wheels_cnt, sizeof(FlowWheel *));
+    if (unlikely(flow_wheels == NULL)) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowWheelsInit. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t u = 0; u < flow_wheels_cnt; u++) {
+        uint32_t min = flow_wheel_range * u;
+        uint32_t max = (u == flow_wheels_cnt - 1) ?
+            flow_config.hash_size : flow_wheel_range * (u + 1);
+
+        flow_wheels[u] = FlowWheelAlloc(min, max);
+        if (flow_wheels[u] == NULL) {
+            SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowWheelsInit. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void FlowWheelsFree(void)
+{
+    if (flow_wheels == NULL)
+        return;
+
+    for (uint32_t u = 0; u < flow_wheels_cnt; u++) {
+        FlowWheelFree(flow_wheels[u]);
+    }
+    SCFree(flow_wheels);
+    flow_wheels = NULL;
+    flow_wheels_cnt = 0;
+}
+
+/**
+ *  \brief get the wheel of a flow manager
+ *
+ *  \param instance flow manager instance, starting at 1
+ */
+FlowWheel *FlowWheelGet(uint32_t instance)
+{
+    if (flow_wheels == NULL || instance == 0 || instance > flow_wheels_cnt)
+        return NULL;
+    return flow_wheels[instance - 1];
+}
+
+/**
+ *  \brief empty the wheel, the seconds up to now are expired
+ */
+void FlowWheelReset(FlowWheel *w, int32_t now)
+{
+    for (uint32_t u = 0; u < FLOW_WHEEL_LISTS; u++) {
+        w->head[u] = FLOW_WHEEL_NONE;
+    }
+    for (uint32_t u = 0; u < w->max - w->min; u++) {
+        w->list[u] = FLOW_WHEEL_LIST_NONE;
+    }
+    w->now = now;
+}
+
+/**
+ *  \brief check if the wheel can't be advanced to now: it was never set,
+ *         or the time went back or jumped past the end of the wheel
+ */
+int FlowWheelNeedsReset(const FlowWheel *w, int32_t now)
+{
+    return (w->now == 0 || now < w->now ||
+            (int64_t)now - w->now > FLOW_WHEEL_SPAN);
+}
+
+static inline void FlowWheelListAdd(FlowWheel *w, uint32_t row, uint16_t list)
+{
+    w->prev[row] = FLOW_WHEEL_NONE;
+    w->next[row] = w->head[list];
+    if (w->head[list] != FLOW_WHEEL_NONE)
+        w->prev[w->head[list]] = row;
+    w->head[list] = row;
+    w->list[row] = list;
+}
+
+/** \internal
+ *  \brief list of the slot of a due time
+ */
+static inline uint16_t FlowWheelSlot(const FlowWheel *w, int32_t due)
+{
+    int64_t diff = (int64_t)due - w->now;
+
+    /* overdue, next second */
+    if (diff <= 0)
+        return (uint32_t)(w->now + 1) & FLOW_WHEEL_MASK;
+    if (diff <= FLOW_WHEEL_SLOTS)
+        return (uint32_t)due & FLOW_WHEEL_MASK;
+
+    /* past the wheel, slotted at its end for now */
+    if (diff > FLOW_WHEEL_SPAN)
+        due = w->now + FLOW_WHEEL_SPAN;
+    return FLOW_WHEEL_SLOTS + (((uint32_t)due >> FLOW_WHEEL_BITS) & FLOW_WHEEL_MASK);
+}
+
+/**
+ *  \brief remove a row from the wheel, if it is in it
+ *
+ *  \param idx row of the hash
+ */
+void FlowWheelRemove(FlowWheel *w, uint32_t idx)
+{
+    const uint32_t row = idx - w->min;
+    const uint16_t list = w->list[row];
+    if (list == FLOW_WHEEL_LIST_NONE)
+        return;
+
+    if (w->prev[row] != FLOW_WHEEL_NONE)
+        w->next[w->prev[row]] = w->next[row];
+    else
+        w->head[list] = w->next[row];
+    if (w->next[row] != FLOW_WHEEL_NONE)
+        w->prev[w->next[row]] = w->prev[row];
+    w->list[row] = FLOW_WHEEL_LIST_NONE;
+}
+
+/**
+ *  \brief (re)slot a row of the hash
+ *
+ *  \param idx row of the hash
+ *  \param due second the first flow of the row may time out
+ */
+void FlowWheelInsert(FlowWheel *w, uint32_t idx, int32_t due)
+{
+    FlowWheelRemove(w, idx);
+
+    const uint32_t row = idx - w->min;
+    w->due[row] = due;
+    FlowWheelListAdd(w, row, FlowWheelSlot(w, due));
+}
+
+/**
+ *  \brief get the next row due, advancing the wheel up to now
+ *
+ *  The row is taken out of the wheel.
+ *
+ *  \retval idx row of the hash or FLOW_WHEEL_NONE if no row is due
+ */
+uint32_t FlowWheelNextDue(FlowWheel *w, int32_t now)
+{
+    uint32_t row;
+
+    while (w->head[FLOW_WHEEL_LIST_DUE] == FLOW_WHEEL_NONE) {
+        if (w->now >= now)
+            return FLOW_WHEEL_NONE;
+
+        const uint32_t s = (uint32_t)w->now + 1;
+
+        /* new block of the first level: spread the second level slot of
+         * the block over it */
+        if ((s & FLOW_WHEEL_MASK) == 0) {
+            const uint16_t l = FLOW_WHEEL_SLOTS + ((s >> FLOW_WHEEL_BITS) & FLOW_WHEEL_MASK);
+            row = w->head[l];
+            w->head[l] = FLOW_WHEEL_NONE;
+            while (row != FLOW_WHEEL_NONE) {
+                uint32_t next = w->next[row];
+                FlowWheelListAdd(w, row, FlowWheelSlot(w, w->due[row]));
+                row = next;
+            }
+        }
+
+        const uint16_t l = s & FLOW_WHEEL_MASK;
+        w->head[FLOW_WHEEL_LIST_DUE] = w->head[l];
+        w->head[l] = FLOW_WHEEL_NONE;
+        for (row = w->head[FLOW_WHEEL_LIST_DUE]; row != FLOW_WHEEL_NONE;
+                row = w->next[row]) {
+            w->list[row] = FLOW_WHEEL_LIST_DUE;
+        }
+        w->now = (int32_t)s;
+    }
+
+    row = w->head[FLOW_WHEEL_LIST_DUE];
+    FlowWheelRemove(w, row + w->min);
+    return row + w->min;
+}
+
+static inline void FlowWheelPush(FlowWheel *w, uint32_t row)
+{
+    uint32_t head;
+    do {
+        head = SC_ATOMIC_GET(w->queue);
+        w->queue_next[row] = head;
+    } while (!(SC_ATOMIC_CAS(&w->queue, head, row)));
+}
+
+/**
+ *  \brief have the flow manager check a row of the global hash on its
+ *         next pass
+ *
+ *  Called by the workers, with the flow or the row locked.
+ */
+void FlowWheelMarkRow(FlowBucket *fb)
+{
+    int32_t next_ts;
+    do {
+        next_ts = SC_ATOMIC_GET(fb->next_ts);
+        /* already queued */
+        if (next_ts == 0)
+            return;
+    } while (!(SC_ATOMIC_CAS(&fb->next_ts, next_ts, 0)));
+
+    if (flow_wheels == NULL)
+        return;
+
+    const uint32_t idx = (uint32_t)(fb - flow_hash);
+    uint32_t u = idx / flow_wheel_range;
+    if (u >= flow_wheels_cnt)
+        u = flow_wheels_cnt - 1;
+
+    FlowWheel *w = flow_wheels[u];
+    FlowWheelPush(w, idx - w->min);
+}
+
+/**
+ *  \brief queue a row taken off the queue again, its next_ts is still 0
+ */
+void FlowWheelRequeue(FlowWheel *w, uint32_t idx)
+{
+    FlowWheelPush(w, idx - w->min);
+}
+
+/**
+ *  \brief take all the rows off the queue
+ *
+ *  \retval idx first row, use FlowWheelQueuedNext() for the others
+ */
+uint32_t FlowWheelTakeQueued(FlowWheel *w)
+{
+    uint32_t head;
+    do {
+        head = SC_ATOMIC_GET(w->queue);
+        if (head == FLOW_WHEEL_NONE)
+            return FLOW_WHEEL_NONE;
+    } while (!(SC_ATOMIC_CAS(&w->queue, head, FLOW_WHEEL_NONE)));
+
+    return head + w->min;
+}
+
+uint32_t FlowWheelQueuedNext(const FlowWheel *w, uint32_t idx)
+{
+    uint32_t next = w->queue_next[idx - w->min];
+    return (next == FLOW_WHEEL_NONE) ? FLOW_WHEEL_NONE : next + w->min;
+}
+
+#ifdef UNITTESTS
+
+/**
+ *  \test rows come out of the wheel in the second they are due, also
+ *        from the second level and past the end of the wheel
+ */
+static int FlowWheelTest01(void)
+{
+    const int32_t start = 1000000;
+    const int32_t dues[] = { start + 1, start + 5, start + FLOW_WHEEL_SLOTS,
+        start + FLOW_WHEEL_SLOTS + 1, start + 3600, start + 3601,
+        start + FLOW_WHEEL_SPAN + 100, start - 10 };
+    const uint32_t cnt = sizeof(dues) / sizeof(dues[0]);
+
+    FlowWheel *w = FlowWheelAlloc(100, 100 + cnt);
+    FAIL_IF_NULL(w);
+    FlowWheelReset(w, start);
+
+    for (uint32_t u = 0; u < cnt; u++) {
+        FlowWheelInsert(w, 100 + u, dues[u]);
+    }
+
+    uint32_t seen = 0;
+    for (int32_t now = start + 1; now <= start + FLOW_WHEEL_SPAN + 200; now++) {
+        uint32_t idx;
+        while ((idx = FlowWheelNextDue(w, now)) != FLOW_WHEEL_NONE) {
+            FAIL_IF(idx < 100 || idx >= 100 + cnt);
+            int32_t due = dues[idx - 100];
+            if (due > now) {
+                /* only rows past the wheel come up early */
+                FAIL_IF(due - start <= FLOW_WHEEL_SPAN);
+                FlowWheelInsert(w, idx, due);
+                continue;
+            }
+            /* overdue rows come up the next second */
+            FAIL_IF(due < start && now != start + 1);
+            FAIL_IF(due >= start && due != now);
+            seen++;
+        }
+    }
+    FAIL_IF(seen != cnt);
+
+    FlowWheelFree(w);
+    PASS;
+}
+
+/**
+ *  \test removed or slotted again rows only come up once, at their
+ *        last due time
+ */
+static int FlowWheelTest02(void)
+{
+    const int32_t start = 5000;
+
+    FlowWheel *w = FlowWheelAlloc(0, 4);
+    FAIL_IF_NULL(w);
+    FlowWheelReset(w, start);
+
+    FlowWheelInsert(w, 0, start + 10);
+    FlowWheelInsert(w, 1, start + 10);
+    FlowWheelInsert(w, 2, start + 10);
+    FlowWheelInsert(w, 1, start + 2000);
+    FlowWheelRemove(w, 2);
+
+    FAIL_IF(FlowWheelNextDue(w, start + 9) != FLOW_WHEEL_NONE);
+    FAIL_IF(FlowWheelNextDue(w, start + 10) != 0);
+    FAIL_IF(FlowWheelNextDue(w, start + 10) != FLOW_WHEEL_NONE);
+    FAIL_IF(FlowWheelNextDue(w, start + 1999) != FLOW_WHEEL_NONE);
+    FAIL_IF(FlowWheelNextDue(w, start + 2000) != 1);
+    FAIL_IF(FlowWheelNextDue(w, start + 5000) != FLOW_WHEEL_NONE);
+
+    FlowWheelFree(w);
+    PASS;
+}
+
+/**
+ *  \test queued rows are taken off the queue at once
+ */
+static int FlowWheelTest03(void)
+{
+    FlowWheel *w = FlowWheelAlloc(10, 20);
+    FAIL_IF_NULL(w);
+
+    FAIL_IF(FlowWheelTakeQueued(w) != FLOW_WHEEL_NONE);
+    FlowWheelRequeue(w, 12);
+    FlowWheelRequeue(w, 15);
+
+    uint32_t idx = FlowWheelTakeQueued(w);
+    FAIL_IF(idx != 15);
+    idx = FlowWheelQueuedNext(w, idx);
+    FAIL_IF(idx != 12);
+    FAIL_IF(FlowWheelQueuedNext(w, idx) != FLOW_WHEEL_NONE);
+    FAIL_IF(FlowWheelTakeQueued(w) != FLOW_WHEEL_NONE);
+
+    FlowWheelFree(w);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FlowWheelRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowWheelTest01", FlowWheelTest01);
+    UtRegisterTest("FlowWheelTest02", FlowWheelTest02);
+    UtRegisterTest("FlowWheelTest03", FlowWheelTest03);
+#endif /* UNITTESTS */
+}
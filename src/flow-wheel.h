@@ -0,0 +1,91 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timer wheel of the flow hash rows, see flow-wheel.c
+ */
+
+#ifndef __FLOW_WHEEL_H__
+#define __FLOW_WHEEL_H__
+
+#include "flow-hash.h"
+
+#define FLOW_WHEEL_BITS     8
+/** slots per level, a first level slot is a second, a second level slot
+ *  is FLOW_WHEEL_SLOTS seconds */
+#define FLOW_WHEEL_SLOTS    (1 << FLOW_WHEEL_BITS)
+#define FLOW_WHEEL_MASK     (FLOW_WHEEL_SLOTS - 1)
+/** seconds covered by the wheel, rows due later are slotted at its end
+ *  and slotted again when it comes around */
+#define FLOW_WHEEL_SPAN     (FLOW_WHEEL_SLOTS * FLOW_WHEEL_SLOTS)
+
+/** lists of rows: the slots of both levels and the rows due now */
+#define FLOW_WHEEL_LIST_DUE (2 * FLOW_WHEEL_SLOTS)
+#define FLOW_WHEEL_LISTS    (FLOW_WHEEL_LIST_DUE + 1)
+#define FLOW_WHEEL_LIST_NONE 0xffff
+
+#define FLOW_WHEEL_NONE     UINT32_MAX
+
+/** timer wheel of the rows of the flow hash handled by a flow manager.
+ *  The slots are only used by the flow manager. The workers queue the
+ *  rows they add a flow to, or change the state of a flow in, on a lock
+ *  free stack. */
+typedef struct FlowWheel_ {
+    /** rows of the hash in the wheel */
+    uint32_t min;
+    uint32_t max;
+
+    /** the seconds up to now have been expired */
+    int32_t now;
+
+    /** first row of each list */
+    uint32_t head[FLOW_WHEEL_LISTS];
+
+    /** per row, indexed by row - min: list links, list and the second
+     *  the row is due */
+    uint32_t *next;
+    uint32_t *prev;
+    uint16_t *list;
+    int32_t *due;
+
+    /** rows queued by the workers, linked by queue_next */
+    SC_ATOMIC_DECLARE(uint32_t, queue);
+    uint32_t *queue_next;
+} FlowWheel;
+
+void FlowWheelsInit(void);
+void FlowWheelsFree(void);
+FlowWheel *FlowWheelGet(uint32_t instance);
+
+FlowWheel *FlowWheelAlloc(uint32_t min, uint32_t max);
+void FlowWheelFree(FlowWheel *w);
+void FlowWheelReset(FlowWheel *w, int32_t now);
+int FlowWheelNeedsReset(const FlowWheel *w, int32_t now);
+void FlowWheelInsert(FlowWheel *w, uint32_t idx, int32_t due);
+void FlowWheelRemove(FlowWheel *w, uint32_t idx);
+uint32_t FlowWheelNextDue(FlowWheel *w, int32_t now);
+
+void FlowWheelMarkRow(FlowBucket *fb);
+void FlowWheelRequeue(FlowWheel *w, uint32_t idx);
+uint32_t FlowWheelTakeQueued(FlowWheel *w);
+uint32_t FlowWheelQueuedNext(const FlowWheel *w, uint32_t idx);
+
+void FlowWheelRegisterTests(void);
+
+#endif /* __FLOW_WHEEL_H__ */
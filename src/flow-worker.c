@@ -28,7 +28,8 @@
  * - Applayer update
  * - Detection
  *
- * This all while holding the flow lock.
+ * This all while holding the flow lock. Flows in the flow table owned by
+ * the thread are not locked.
  */
 
 #include "suricata-common.h"
@@ -43,6 +44,8 @@
 #include "util-validate.h"
 
 #include "flow-util.h"
+#include "flow-hash.h"
+#include "flow-manager.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -60,8 +63,27 @@ typedef struct FlowWorkerThreadData_ {
 
     PacketQueue pq;
 
+    /* capture latency histograms, only set up in live mode */
+    int latency;
+    uint16_t latency_flow_worker;
+    uint16_t latency_output;
+
 } FlowWorkerThreadData;
 
+/** \brief account the time since the packet was captured
+ *
+ *  The capture timestamp is set by the kernel from the real time clock
+ *  so it is compared to the current real time. */
+static inline void FlowWorkerUpdateLatency(ThreadVars *tv, uint16_t id, const Packet *p)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    int64_t usecs = (int64_t)(now.tv_sec - p->ts.tv_sec) * 1000000 +
+        (now.tv_usec - p->ts.tv_usec);
+    StatsHistogramAdd(tv, id, usecs > 0 ? (uint64_t)usecs : 0);
+}
+
 /** \brief handle flow for packet
  *
  *  Handle flow creation/lookup
@@ -80,6 +102,24 @@ static inline TmEcode FlowUpdate(Packet *p)
     }
 }
 
+/** \brief time out the flows of the table of the thread, once per second
+ *         of packet time */
+static inline void FlowWorkerTableTimeout(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Packet *p)
+{
+    FlowThreadTable *t = dtv->flow_table;
+    struct timeval ts = p->ts;
+
+    /* pseudo packets carry no capture time */
+    if (PKT_IS_PSEUDOPKT(p))
+        TimeGet(&ts);
+
+    if (ts.tv_sec != t->timeout_ts) {
+        t->timeout_ts = ts.tv_sec;
+        FlowThreadTableTimeout(tv, dtv, t, &ts);
+    }
+}
+
 static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data);
 
 static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void **data)
@@ -91,12 +131,20 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
     SC_ATOMIC_INIT(fw->detect_thread);
     SC_ATOMIC_SET(fw->detect_thread, NULL);
 
-    fw->dtv = DecodeThreadVarsAlloc(tv);
+    fw->dtv = DecodeThreadVarsAllocNoDecoder(tv);
     if (fw->dtv == NULL) {
         FlowWorkerThreadDeinit(tv, fw);
         return TM_ECODE_FAILED;
     }
 
+    if (FlowThreadTableEnabled()) {
+        fw->dtv->flow_table = FlowThreadTableAlloc(tv);
+        if (fw->dtv->flow_table == NULL) {
+            FlowWorkerThreadDeinit(tv, fw);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     /* setup TCP */
     if (StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK) {
         FlowWorkerThreadDeinit(tv, fw);
@@ -122,6 +170,12 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
     DecodeRegisterPerfCounters(fw->dtv, tv);
     AppLayerRegisterThreadCounters(tv);
 
+    if (StatsCaptureLatencyEnabled() && TimeModeIsLive()) {
+        fw->latency_flow_worker = StatsRegisterHistogram("capture.latency_us.flow_worker", tv);
+        fw->latency_output = StatsRegisterHistogram("capture.latency_us.output", tv);
+        fw->latency = (fw->latency_flow_worker != 0 && fw->latency_output != 0);
+    }
+
     /* setup pq for stream end pkts */
     memset(&fw->pq, 0, sizeof(PacketQueue));
     SCMutexInit(&fw->pq.mutex_q, NULL);
@@ -134,6 +188,12 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
 
+    if (fw->dtv != NULL && fw->dtv->flow_table != NULL) {
+        /* flows still in the table are logged, so before the flow
+         * outputs of the thread go away */
+        FlowThreadTableFree(fw->dtv, fw->dtv->flow_table);
+        fw->dtv->flow_table = NULL;
+    }
     DecodeThreadVarsFree(tv, fw->dtv);
 
     /* free TCP */
@@ -171,6 +231,13 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
     /* update time */
     if (!(PKT_IS_PSEUDOPKT(p))) {
         TimeSetByThread(tv->id, &p->ts);
+        if (fw->latency) {
+            FlowWorkerUpdateLatency(tv, fw->latency_flow_worker, p);
+        }
+    }
+
+    if (fw->dtv->flow_table != NULL) {
+        FlowWorkerTableTimeout(tv, fw->dtv, p);
     }
 
     /* handle Flow */
@@ -181,7 +248,7 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
         if (likely(p->flow != NULL)) {
             DEBUG_ASSERT_FLOW_LOCKED(p->flow);
             if (FlowUpdate(p) == TM_ECODE_DONE) {
-                FLOWLOCK_UNLOCK(p->flow);
+                FLOWLOCK_PKT_UNLOCK(p->flow);
                 return TM_ECODE_OK;
             }
         }
@@ -192,7 +259,7 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
     /* if PKT_WANTS_FLOW is not set, but PKT_HAS_FLOW is, then this is a
      * pseudo packet created by the flow manager. */
     } else if (p->flags & PKT_HAS_FLOW) {
-        FLOWLOCK_WRLOCK(p->flow);
+        FLOWLOCK_PKT_WRLOCK(p->flow);
     }
 
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
@@ -261,6 +328,10 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
     // Outputs.
     OutputLoggerLog(tv, p, fw->output_thread);
 
+    if (fw->latency && !(PKT_IS_PSEUDOPKT(p))) {
+        FlowWorkerUpdateLatency(tv, fw->latency_output, p);
+    }
+
     /*  Release tcp segments. Done here after alerting can use them. */
     if (p->flow != NULL && p->proto == IPPROTO_TCP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_TCPPRUNE);
@@ -271,7 +342,7 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *pr
 
     if (p->flow) {
         DEBUG_ASSERT_FLOW_LOCKED(p->flow);
-        FLOWLOCK_UNLOCK(p->flow);
+        FLOWLOCK_PKT_UNLOCK(p->flow);
     }
 
     return TM_ECODE_OK;
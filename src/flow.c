@@ -43,6 +43,7 @@
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -58,6 +59,7 @@
 
 #include "detect.h"
 #include "detect-engine-state.h"
+#include "util-hugepages.h"
 #include "stream.h"
 
 #include "app-layer-parser.h"
@@ -386,6 +388,7 @@ void FlowInitConfig(char quiet)
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.memcap      = FLOW_DEFAULT_MEMCAP;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
+    flow_config.hash_func   = HashWordConfig("flow");
 
     /* If we have specific config, overwrite the defaults with them,
      * otherwise, leave the default values */
@@ -430,6 +433,10 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("flow.thread-local", &thread_local) == 1) {
+        flow_config.thread_local = thread_local;
+    }
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -456,8 +463,11 @@ void FlowInitConfig(char quiet)
     for (i = 0; i < flow_config.hash_size; i++) {
         FBLOCK_INIT(&flow_hash[i]);
         SC_ATOMIC_INIT(flow_hash[i].next_ts);
+        /* empty, the row is queued when a flow is added */
+        SC_ATOMIC_SET(flow_hash[i].next_ts, INT_MAX);
     }
     (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+    FlowWheelsInit();
 
     if (quiet == FALSE) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the flow hash... "
@@ -467,6 +477,9 @@ void FlowInitConfig(char quiet)
     }
 
     /* pre allocate flows */
+    if (HugepagesEnabled()) {
+        FlowAreaInit(flow_config.prealloc);
+    }
     for (i = 0; i < flow_config.prealloc; i++) {
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
@@ -543,9 +556,11 @@ void FlowShutdown(void)
         SCFreeAligned(flow_hash);
         flow_hash = NULL;
     }
+    FlowWheelsFree();
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_spare_q);
     FlowQueueDestroy(&flow_recycle_q);
+    FlowAreaDeinit();
 
     SC_ATOMIC_DESTROY(flow_prune_idx);
     SC_ATOMIC_DESTROY(flow_memuse);
@@ -947,7 +962,10 @@ void FlowUpdateState(Flow *f, enum FlowState s)
     if (f->fb) {
         /* and reset the flow buckup next_ts value so that the flow manager
          * has to revisit this row */
-        SC_ATOMIC_SET(f->fb->next_ts, 0);
+        if (f->flags & FLOW_THREAD_OWNED)
+            SC_ATOMIC_SET(f->fb->next_ts, 0);
+        else
+            FlowWheelMarkRow(f->fb);
     }
 }
 
@@ -1160,6 +1178,119 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test  Test the bucket index stays full while some flows are out of
+ *          it, and is emptied with the bucket.
+ */
+static int FlowTest10 (void)
+{
+    FlowBucket fb;
+    Flow flows[FLOW_BUCKET_INLINE + 4];
+    const int cnt = FLOW_BUCKET_INLINE + 4;
+
+    memset(&fb, 0, sizeof(fb));
+    memset(flows, 0, sizeof(flows));
+
+    for (int i = 0; i < cnt; i++) {
+        flows[i].flow_hash = (uint32_t)i << 16;
+        FlowBucketInsert(&fb, &flows[i]);
+    }
+    FAIL_IF(fb.cnt != cnt);
+    FAIL_IF(fb.head != &flows[cnt - 1]);
+    FAIL_IF(fb.tail != &flows[0]);
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        FAIL_IF(fb.flows[i] != &flows[i]);
+        FAIL_IF(fb.tags[i] != i);
+    }
+
+    /* an indexed flow is replaced by a flow of the list */
+    FlowBucketRemove(&fb, &flows[1]);
+    FAIL_IF(fb.cnt != cnt - 1);
+    FAIL_IF(fb.flows[1] != &flows[cnt - 1]);
+    FAIL_IF(fb.tags[1] != FLOW_HASH_TAG(flows[cnt - 1].flow_hash));
+    FAIL_IF(flows[1].hnext != NULL || flows[1].hprev != NULL);
+
+    /* removing a flow out of the index leaves the index alone */
+    FlowBucketRemove(&fb, &flows[FLOW_BUCKET_INLINE]);
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        FAIL_IF(fb.flows[i] == NULL);
+        FAIL_IF(fb.flows[i] == &flows[FLOW_BUCKET_INLINE]);
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        if (i == 1 || i == FLOW_BUCKET_INLINE)
+            continue;
+        FlowBucketRemove(&fb, &flows[i]);
+    }
+    FAIL_IF(fb.cnt != 0);
+    FAIL_IF_NOT_NULL(fb.head);
+    FAIL_IF_NOT_NULL(fb.tail);
+    for (int i = 0; i < FLOW_BUCKET_INLINE; i++) {
+        FAIL_IF_NOT_NULL(fb.flows[i]);
+    }
+    PASS;
+}
+
+/**
+ *  \test   Test the flow table of a thread: flows are owned by the thread,
+ *          not in the global hash, and time out into its spare flows.
+ */
+static int FlowTest11 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    dtv.flow_table = FlowThreadTableAlloc(NULL);
+    FAIL_IF_NULL(dtv.flow_table);
+    FlowThreadTable *t = dtv.flow_table;
+
+    uint8_t payload[] = "Payload";
+    Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_UDP);
+    FAIL_IF_NULL(p);
+
+    Flow *f = FlowGetFlowFromHash(&tv, &dtv, p, &p->flow);
+    FAIL_IF_NULL(f);
+    FAIL_IF_NOT(f->flags & FLOW_THREAD_OWNED);
+    FAIL_IF(t->active != 1);
+    FAIL_IF(f->fb != &t->hash[p->flow_hash % flow_config.hash_size]);
+    FAIL_IF(flow_hash[p->flow_hash % flow_config.hash_size].cnt != 0);
+    /* the flow is not locked */
+    FAIL_IF(FLOWLOCK_TRYWRLOCK(f) != 0);
+    FLOWLOCK_UNLOCK(f);
+    FlowDeReference(&p->flow);
+
+    /* same flow for the next packet */
+    FAIL_IF(FlowGetFlowFromHash(&tv, &dtv, p, &p->flow) != f);
+    FAIL_IF(t->active != 1);
+    f->lastts = p->ts;
+    FlowDeReference(&p->flow);
+
+    /* not timed out yet */
+    struct timeval ts = p->ts;
+    FAIL_IF(FlowThreadTableTimeout(&tv, &dtv, t, &ts) != 0);
+    FAIL_IF(t->active != 1);
+
+    ts.tv_sec += 3600;
+    FAIL_IF(FlowThreadTableTimeout(&tv, &dtv, t, &ts) != 1);
+    FAIL_IF(t->active != 0);
+    FAIL_IF(t->spare != f);
+    FAIL_IF(t->spare_cnt != 1);
+    FAIL_IF(f->flags & FLOW_THREAD_OWNED);
+
+    /* a new flow comes from the spare flows of the table */
+    FAIL_IF(FlowGetFlowFromHash(&tv, &dtv, p, &p->flow) != f);
+    FAIL_IF(t->spare_cnt != 0);
+    FlowDeReference(&p->flow);
+
+    UTHFreePacket(p);
+    FlowThreadTableFree(&dtv, t);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1177,8 +1308,11 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test flow bucket index", FlowTest10);
+    UtRegisterTest("FlowTest11 -- Test flow table of a thread", FlowTest11);
 
     FlowMgrRegisterTests();
     RegisterFlowStorageTests();
+    FlowWheelRegisterTests();
 #endif /* UNITTESTS */
 }
@@ -29,6 +29,7 @@
 #include "util-atomic.h"
 #include "detect-tag.h"
 #include "util-optimize.h"
+#include "util-hash-word.h"
 
 /* Part of the flow structure, so we declare it here.
  * The actual declaration is in app-layer-parser.c */
@@ -96,6 +97,10 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** Indicate that alproto detection for flow should be done again */
 #define FLOW_CHANGE_PROTO               BIT_U32(22)
 
+/** flow is in the flow table of a thread, only that thread uses it and
+ *  it is not locked */
+#define FLOW_THREAD_OWNED               BIT_U32(23)
+
 /* File flags */
 
 /** no magic on files in this flow */
@@ -231,6 +236,16 @@ typedef struct AppLayerParserState_ AppLayerParserState;
     #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
 #endif
 
+/** lock/unlock the flow of a packet, unless it is owned by the thread */
+#define FLOWLOCK_PKT_WRLOCK(f) do {                 \
+        if (!((f)->flags & FLOW_THREAD_OWNED))      \
+            FLOWLOCK_WRLOCK((f));                   \
+    } while (0)
+#define FLOWLOCK_PKT_UNLOCK(f) do {                 \
+        if (!((f)->flags & FLOW_THREAD_OWNED))      \
+            FLOWLOCK_UNLOCK((f));                   \
+    } while (0)
+
 #define FLOW_IS_PM_DONE(f, dir) (((dir) & STREAM_TOSERVER) ? ((f)->flags & FLOW_TS_PM_ALPROTO_DETECT_DONE) : ((f)->flags & FLOW_TC_PM_ALPROTO_DETECT_DONE))
 #define FLOW_IS_PP_DONE(f, dir) (((dir) & STREAM_TOSERVER) ? ((f)->flags & FLOW_TS_PP_ALPROTO_DETECT_DONE) : ((f)->flags & FLOW_TC_PP_ALPROTO_DETECT_DONE))
 
@@ -245,6 +260,8 @@ typedef struct FlowCnf_
 {
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** hash function of the keys, 'flow.hash-function' */
+    HashWordFunc hash_func;
     uint64_t memcap;
     uint32_t max_flows;
     uint32_t prealloc;
@@ -256,6 +273,9 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** flow tables owned by the threads of the workers runmode */
+    int thread_local;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -265,7 +285,7 @@ typedef struct FlowKey_
     Port sp, dp;
     uint8_t proto;
     uint8_t recursion_level;
-
+    uint16_t vlan_id[2];
 } FlowKey;
 
 typedef struct FlowAddress_ {
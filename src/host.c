@@ -146,6 +146,7 @@ void HostInitConfig(char quiet)
     host_config.hash_size   = HOST_DEFAULT_HASHSIZE;
     host_config.memcap      = HOST_DEFAULT_MEMCAP;
     host_config.prealloc    = HOST_DEFAULT_PREALLOC;
+    host_config.hash_func   = HashWordConfig("host");
 
     /* Check if we have memcap and hash_size defined at config */
     const char *conf_val;
@@ -350,10 +351,12 @@ static inline uint32_t HostGetKey(Address *a)
     uint32_t key;
 
     if (a->family == AF_INET) {
-        uint32_t hash = hashword(&a->addr_data32[0], 1, host_config.hash_rand);
+        uint32_t hash = HashWord(host_config.hash_func,
+                &a->addr_data32[0], 1, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else if (a->family == AF_INET6) {
-        uint32_t hash = hashword(a->addr_data32, 4, host_config.hash_rand);
+        uint32_t hash = HashWord(host_config.hash_func,
+                a->addr_data32, 4, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else
         key = 0;
@@ -142,6 +142,7 @@ void IPPairInitConfig(char quiet)
     ippair_config.hash_size   = IPPAIR_DEFAULT_HASHSIZE;
     ippair_config.memcap      = IPPAIR_DEFAULT_MEMCAP;
     ippair_config.prealloc    = IPPAIR_DEFAULT_PREALLOC;
+    ippair_config.hash_func   = HashWordConfig("ippair");
 
     /* Check if we have memcap and hash_size defined at config */
     const char *conf_val;
@@ -373,7 +374,8 @@ static uint32_t IPPairGetKey(Address *a, Address *b)
     if (a->family == AF_INET) {
         uint32_t addrs[2] = { MIN(a->addr_data32[0], b->addr_data32[0]),
                               MAX(a->addr_data32[0], b->addr_data32[0]) };
-        uint32_t hash = hashword(addrs, 2, ippair_config.hash_rand);
+        uint32_t hash = HashWord(ippair_config.hash_func,
+                addrs, 2, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else if (a->family == AF_INET6) {
         uint32_t addrs[8];
@@ -396,7 +398,8 @@ static uint32_t IPPairGetKey(Address *a, Address *b)
             addrs[6] = b->addr_data32[2];
             addrs[7] = b->addr_data32[3];
         }
-        uint32_t hash = hashword(addrs, 8, ippair_config.hash_rand);
+        uint32_t hash = HashWord(ippair_config.hash_func,
+                addrs, 8, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else
         key = 0;
@@ -26,6 +26,7 @@
 
 #include "decode.h"
 #include "util-storage.h"
+#include "util-hash-word.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define HRLOCK_SPIN
@@ -93,6 +94,8 @@ typedef struct IPPairConfig_ {
     uint64_t memcap;
     uint32_t hash_rand;
     uint32_t hash_size;
+    /** hash function of the keys, 'ippair.hash-function' */
+    HashWordFunc hash_func;
     uint32_t prealloc;
 } IPPairConfig;
 
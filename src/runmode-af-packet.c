@@ -53,6 +53,8 @@
 #include "util-device.h"
 #include "util-runmodes.h"
 #include "util-ioctl.h"
+#include "util-ebpf.h"
+#include "flow-bypass.h"
 
 #include "source-af-packet.h"
 
@@ -121,6 +123,7 @@ static void *ParseAFPConfig(const char *iface)
     intmax_t value;
     int boolval;
     const char *bpf_filter = NULL;
+    const char *ebpf_file = NULL;
     const char *out_iface = NULL;
     int cluster_type = PACKET_FANOUT_HASH;
 
@@ -145,6 +148,8 @@ static void *ParseAFPConfig(const char *iface)
     aconf->DerefFunc = AFPDerefConfig;
     aconf->flags = AFP_RING_MODE;
     aconf->bpf_filter = NULL;
+    aconf->ebpf_filter_fd = -1;
+    aconf->ebpf_lb_fd = -1;
     aconf->out_iface = NULL;
     aconf->copy_mode = AFP_COPY_MODE_NONE;
     aconf->block_timeout = 10;
@@ -225,6 +230,15 @@ static void *ParseAFPConfig(const char *iface)
                     SCLogConfig("Enabling tpacket v3 capture on iface %s",
                             aconf->iface);
                     aconf->flags |= AFP_TPACKET_V3;
+
+                    boolval = 0;
+                    (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                                           "block-batch", (int *)&boolval);
+                    if (boolval) {
+                        SCLogConfig("Enabling tpacket v3 block batching on iface %s",
+                                aconf->iface);
+                        aconf->flags |= AFP_V3_BATCH;
+                    }
 #else
                     SCLogNotice("System too old for tpacket v3 switching to v2");
                     aconf->flags &= ~AFP_TPACKET_V3;
@@ -280,6 +294,23 @@ static void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "vnet-hdr", (int *)&boolval);
+    if (boolval) {
+        if (aconf->flags & AFP_TPACKET_V3) {
+            SCLogWarning(SC_ERR_RUNMODE, "vnet-hdr is not supported by the kernel "
+                         "with tpacket v3, disabling it on iface %s", aconf->iface);
+        } else if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            /* super packets would be bigger than the MTU of the peer */
+            SCLogWarning(SC_ERR_RUNMODE, "vnet-hdr can't be used in IPS or TAP "
+                         "mode, disabling it on iface %s", aconf->iface);
+        } else {
+            SCLogConfig("Enabling vnet header to capture GRO super packets "
+                        "on iface %s", aconf->iface);
+            aconf->flags |= AFP_VNET_HDR;
+        }
+    }
+
     if (ConfGetChildValueWithDefault(if_root, if_default, "cluster-id", &tmpclusterid) != 1) {
         aconf->cluster_id = (uint16_t)(cluster_id_auto++);
     } else {
@@ -331,7 +362,52 @@ static void *ParseAFPConfig(const char *iface)
                 aconf->iface);
         aconf->cluster_type = PACKET_FANOUT_ROLLOVER;
         cluster_type = PACKET_FANOUT_ROLLOVER;
-
+    } else if (strcmp(tmpctype, "cluster_cbpf") == 0 ||
+               strcmp(tmpctype, "cluster_ebpf") == 0) {
+        uint16_t defrag = 0;
+        int conf_val = 0;
+        ConfGetChildValueBoolWithDefault(if_root, if_default, "defrag", &conf_val);
+        if (conf_val) {
+            SCLogConfig("Using defrag kernel functionality for AF_PACKET (iface %s)",
+                    aconf->iface);
+            defrag = PACKET_FANOUT_FLAG_DEFRAG;
+        }
+        if (strcmp(tmpctype, "cluster_cbpf") == 0) {
+            SCLogConfig("Using cBPF symmetric hash cluster mode for AF_PACKET (iface %s)",
+                    aconf->iface);
+            aconf->cluster_type = PACKET_FANOUT_CBPF | defrag;
+            cluster_type = PACKET_FANOUT_CBPF;
+        } else {
+#ifdef HAVE_PACKET_EBPF
+            const char *ebpf_lb_file = NULL;
+            if (ConfGetChildValueWithDefault(if_root, if_default, "ebpf-lb-file", &ebpf_lb_file) != 1) {
+                SCLogError(SC_ERR_INVALID_VALUE,
+                           "cluster_ebpf needs an ebpf-lb-file on %s", aconf->iface);
+            } else if (EBPFLoadFile(aconf->iface, ebpf_lb_file, "loadbalancer",
+                                    &aconf->ebpf_lb_fd, EBPF_SOCKET_FILTER) != 0) {
+                SCLogError(SC_ERR_INVALID_VALUE,
+                           "Error when loading eBPF lb file on %s",
+                           aconf->iface);
+                aconf->ebpf_lb_fd = -1;
+            }
+            if (aconf->ebpf_lb_fd != -1) {
+                SCLogConfig("Using eBPF '%s' cluster mode for AF_PACKET (iface %s)",
+                        ebpf_lb_file, aconf->iface);
+                aconf->cluster_type = PACKET_FANOUT_EBPF | defrag;
+                cluster_type = PACKET_FANOUT_EBPF;
+            }
+#else
+            SCLogError(SC_ERR_UNIMPLEMENTED,
+                       "eBPF support is not built-in");
+#endif
+            if (cluster_type != PACKET_FANOUT_EBPF) {
+                SCLogWarning(SC_ERR_INVALID_CLUSTER_TYPE,
+                             "Using flow cluster mode instead of cluster_ebpf (iface %s)",
+                             aconf->iface);
+                aconf->cluster_type = PACKET_FANOUT_HASH | defrag;
+                cluster_type = PACKET_FANOUT_HASH;
+            }
+        }
     } else {
         SCLogWarning(SC_ERR_INVALID_CLUSTER_TYPE,"invalid cluster-type %s",tmpctype);
     }
@@ -355,6 +431,58 @@ static void *ParseAFPConfig(const char *iface)
         }
     }
 
+    if (ConfGetChildValueWithDefault(if_root, if_default, "ebpf-filter-file", &ebpf_file) != 1) {
+        ebpf_file = NULL;
+    }
+    if (ebpf_file) {
+#ifdef HAVE_PACKET_EBPF
+        SCLogConfig("af-packet will use '%s' as eBPF filter file",
+                    ebpf_file);
+        if (aconf->bpf_filter) {
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                         "eBPF filter replaces bpf filter '%s' on iface %s",
+                         aconf->bpf_filter, aconf->iface);
+            aconf->bpf_filter = NULL;
+        }
+        if (EBPFLoadFile(aconf->iface, ebpf_file, "filter",
+                         &aconf->ebpf_filter_fd, EBPF_SOCKET_FILTER) != 0) {
+            SCLogError(SC_ERR_INVALID_VALUE,
+                       "Error when loading eBPF filter file on %s, not using eBPF",
+                       aconf->iface);
+            aconf->ebpf_filter_fd = -1;
+        }
+#else
+        SCLogError(SC_ERR_UNIMPLEMENTED,
+                   "eBPF support is not built-in");
+#endif
+    }
+
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", (int *)&boolval);
+    if (boolval) {
+#ifdef HAVE_PACKET_EBPF
+        if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            /* the socket filter drops the packets, they would not
+             * be forwarded to the peer anymore */
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                         "Bypass is not supported in copy mode on %s, not using it",
+                         aconf->iface);
+        } else if (aconf->ebpf_filter_fd != -1) {
+            SCLogConfig("Using bypass kernel functionality for AF_PACKET (iface %s)",
+                        aconf->iface);
+            aconf->flags |= AFP_BYPASS;
+            BypassedFlowManagerRegisterCheckFunc(EBPFCheckBypassedFlowTimeout);
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                         "Bypass on %s needs an eBPF filter file, not using it",
+                         aconf->iface);
+        }
+#else
+        SCLogError(SC_ERR_UNIMPLEMENTED,
+                   "Bypass can't be used without eBPF support");
+#endif
+    }
+
     if ((ConfGetChildValueIntWithDefault(if_root, if_default, "buffer-size", &value)) == 1) {
         aconf->buffer_size = value;
     } else {
@@ -399,6 +527,14 @@ static void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "checksum-offload-trust", (int *)&boolval);
+    if (boolval) {
+        SCLogConfig("Trusting the checksums validated by the NIC on iface %s",
+                    aconf->iface);
+        aconf->flags |= AFP_CSUM_OFFLOAD_TRUST;
+    }
+
 finalize:
 
     /* if the number of threads is not 1, we need to first check if fanout
@@ -415,8 +551,10 @@ finalize:
 
     /* try to automagically set the proper number of threads */
     if (aconf->threads == 0) {
-        /* for cluster_flow use core count */
-        if (cluster_type == PACKET_FANOUT_HASH) {
+        /* for cluster_flow and the symmetric hash modes use core count */
+        if (cluster_type == PACKET_FANOUT_HASH ||
+                cluster_type == PACKET_FANOUT_CBPF ||
+                cluster_type == PACKET_FANOUT_EBPF) {
             aconf->threads = (int)UtilCpuGetNumProcessorsOnline();
             SCLogPerf("%u cores, so using %u threads", aconf->threads, aconf->threads);
 
@@ -459,7 +597,14 @@ finalize:
     switch (ltype) {
         case LINKTYPE_ETHERNET:
             /* af-packet can handle csum offloading */
-            if (LiveGetOffload() == 0) {
+            if (aconf->flags & AFP_VNET_HDR) {
+                /* GRO has to stay on to get super packets, the vnet
+                 * header tells us about the segments and checksums */
+                if (LiveGetOffload() == 1) {
+                    SCLogConfig("%s: not disabling offloading as vnet-hdr "
+                                "is used", iface);
+                }
+            } else if (LiveGetOffload() == 0) {
                 if (GetIfaceOffloading(iface, 0, 1) == 1) {
                     SCLogWarning(SC_ERR_AFP_CREATE,
                             "Using AF_PACKET with offloading activated leads to capture problems");
@@ -578,6 +723,44 @@ int AFPRunModeIsIPS()
     return has_ips;
 }
 
+/**
+ * \brief max size of the packets copied from an interface
+ *
+ * Super packets of a vnet-hdr iface are only copied in the packet
+ * pool when the ring is not used, they are zero copy otherwise.
+ *
+ * \return max packet size, 0 on error
+ */
+unsigned int AFPGetIfaceMaxPacketSize(const char *iface)
+{
+    ConfNode *af_packet_node;
+    ConfNode *if_root;
+    ConfNode *if_default;
+    int vnet_hdr = 0;
+    int use_mmap = 1;
+
+    af_packet_node = ConfGetNode("af-packet");
+    if (af_packet_node == NULL) {
+        return GetIfaceMaxPacketSize(iface);
+    }
+
+    if_default = ConfNodeLookupKeyValue(af_packet_node, "interface", "default");
+    if_root = ConfFindDeviceConfig(af_packet_node, iface);
+    if (if_root == NULL) {
+        if_root = if_default;
+    }
+    if (if_root == NULL) {
+        return GetIfaceMaxPacketSize(iface);
+    }
+
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "vnet-hdr", &vnet_hdr);
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "use-mmap", &use_mmap);
+    if (vnet_hdr && !use_mmap) {
+        return AFP_VNET_HDR_SNAPLEN;
+    }
+    return GetIfaceMaxPacketSize(iface);
+}
+
 #endif
 
 
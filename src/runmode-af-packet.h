@@ -29,5 +29,6 @@ int RunModeIdsAFPWorkers(void);
 void RunModeIdsAFPRegister(void);
 const char *RunModeAFPGetDefaultMode(void);
 int AFPRunModeIsIPS(void);
+unsigned int AFPGetIfaceMaxPacketSize(const char *iface);
 
 #endif /* __RUNMODE_AF_PACKET_H__ */
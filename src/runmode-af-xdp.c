@@ -0,0 +1,445 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup afxdp
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP runmode
+ *
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-af-xdp.h"
+#include "output.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-ioctl.h"
+
+#include "source-af-xdp.h"
+
+static const char *default_mode_workers = NULL;
+
+const char *RunModeAFXDPGetDefaultMode(void)
+{
+    return default_mode_workers;
+}
+
+void RunModeIdsAFXDPRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "single",
+            "Single threaded AF_XDP mode",
+            RunModeIdsAFXDPSingle);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "workers",
+            "Workers AF_XDP mode, each thread does all"
+                    " tasks from acquisition to logging",
+            RunModeIdsAFXDPWorkers);
+    default_mode_workers = "workers";
+    return;
+}
+
+#ifdef HAVE_AF_XDP
+
+static void AFXDPDerefConfig(void *conf)
+{
+    AFXDPIfaceConfig *pfp = (AFXDPIfaceConfig *)conf;
+    /* config is used only once but cost of this low. */
+    if (SC_ATOMIC_SUB(pfp->ref, 1) == 0) {
+        SCFree(pfp);
+    }
+}
+
+static int IsPowerOfTwo(uint32_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * This is thus necessary to or copy the structure before giving it
+ * to thread or to reparse the file for each thread (and thus have
+ * new structure.
+ *
+ * \return a AFXDPIfaceConfig corresponding to the interface name
+ */
+static void *ParseAFXDPConfig(const char *iface)
+{
+    ConfNode *if_root = NULL;
+    ConfNode *if_default = NULL;
+    ConfNode *afxdp_node;
+    const char *threadsstr = NULL;
+    const char *tmpctype = NULL;
+    const char *copymodestr = NULL;
+    const char *out_iface = NULL;
+    const char *xdpmodestr = NULL;
+    intmax_t value;
+    int boolval = 0;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    AFXDPIfaceConfig *aconf = SCMalloc(sizeof(*aconf));
+    if (unlikely(aconf == NULL)) {
+        return NULL;
+    }
+    memset(aconf, 0, sizeof(*aconf));
+
+    strlcpy(aconf->iface, iface, sizeof(aconf->iface));
+    aconf->threads = 0;
+    aconf->frame_size = AFXDP_DEFAULT_FRAME_SIZE;
+    aconf->ring_size = AFXDP_DEFAULT_RING_SIZE;
+    aconf->zero_copy = 1;
+    aconf->xdp_mode = AFXDP_XDP_MODE_AUTO;
+    aconf->promisc = 1;
+    aconf->copy_mode = AFXDP_COPY_MODE_NONE;
+    aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    aconf->DerefFunc = AFXDPDerefConfig;
+    SC_ATOMIC_INIT(aconf->queue_next);
+    SC_ATOMIC_INIT(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, 1);
+
+    /* Find initial node */
+    afxdp_node = ConfGetNode("af-xdp");
+    if (afxdp_node == NULL) {
+        SCLogInfo("Unable to find af-xdp config using default values");
+        goto finalize;
+    }
+
+    if_root = ConfFindDeviceConfig(afxdp_node, iface);
+    if_default = ConfFindDeviceConfig(afxdp_node, "default");
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("Unable to find af-xdp config for "
+                "interface \"%s\" or \"default\", using default values",
+                iface);
+        goto finalize;
+
+    /* If there is no setting for current interface use default one as main iface */
+    } else if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &threadsstr) != 1) {
+        aconf->threads = 0;
+    } else {
+        if (strcmp(threadsstr, "auto") == 0) {
+            aconf->threads = 0;
+        } else {
+            aconf->threads = atoi(threadsstr);
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "frame-size", &value) == 1) {
+        if (value > 0 && IsPowerOfTwo((uint32_t)value)) {
+            aconf->frame_size = (uint32_t)value;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "frame-size of %s must be "
+                    "a power of 2, using default %" PRIu32, iface,
+                    aconf->frame_size);
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "ring-size", &value) == 1) {
+        if (value > 0 && IsPowerOfTwo((uint32_t)value)) {
+            aconf->ring_size = (uint32_t)value;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "ring-size of %s must be "
+                    "a power of 2, using default %" PRIu32, iface,
+                    aconf->ring_size);
+        }
+    }
+
+    boolval = 1;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "zero-copy", &boolval);
+    if (!boolval) {
+        SCLogConfig("Disabling zero copy bind on iface %s", iface);
+        aconf->zero_copy = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &xdpmodestr) == 1) {
+        if (strcmp(xdpmodestr, "auto") == 0) {
+            aconf->xdp_mode = AFXDP_XDP_MODE_AUTO;
+        } else if (strcmp(xdpmodestr, "driver") == 0) {
+            aconf->xdp_mode = AFXDP_XDP_MODE_DRV;
+        } else if (strcmp(xdpmodestr, "generic") == 0) {
+            aconf->xdp_mode = AFXDP_XDP_MODE_SKB;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid xdp-mode "
+                    "(valid are auto, driver, generic)");
+        }
+    }
+
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", &boolval);
+    if (boolval) {
+        SCLogConfig("Disabling promiscuous mode on iface %s", iface);
+        aconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default,
+                "checksum-checks", &tmpctype) == 1)
+    {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value for "
+                    "checksum-checks for %s", iface);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1) {
+        if (ConfGetChildValue(if_root, "copy-iface", &out_iface) == 1 &&
+                strlen(out_iface) > 0) {
+            if (strcmp(copymodestr, "ips") == 0) {
+                SCLogInfo("AF_XDP IPS mode activated %s->%s", iface, out_iface);
+                aconf->copy_mode = AFXDP_COPY_MODE_IPS;
+            } else if (strcmp(copymodestr, "tap") == 0) {
+                SCLogInfo("AF_XDP TAP mode activated %s->%s", iface, out_iface);
+                aconf->copy_mode = AFXDP_COPY_MODE_TAP;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid copy-mode "
+                        "(valid are tap, ips)");
+            }
+            if (aconf->copy_mode != AFXDP_COPY_MODE_NONE) {
+                strlcpy(aconf->out_iface, out_iface, sizeof(aconf->out_iface));
+            }
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "copy-mode of %s needs "
+                    "a copy-iface", iface);
+        }
+    }
+
+finalize:
+
+    if (aconf->threads == 0) {
+        /* one thread per RSS queue */
+        aconf->threads = GetIfaceRSSQueuesNum(iface);
+    }
+    if (aconf->threads <= 0) {
+        aconf->threads = 1;
+    }
+
+    /* an AF_XDP socket only sees the traffic of its queue */
+    char const *active_runmode = RunmodeGetActive();
+    if (active_runmode && strcmp("single", active_runmode) == 0 &&
+            aconf->threads > 1) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Single mode only reads queue 0 "
+                "of %s, traffic of the %d other queues will be lost. Use "
+                "workers mode or reduce the queue count of the interface.",
+                iface, aconf->threads - 1);
+        aconf->threads = 1;
+    }
+
+    /* frames need to hold a full packet */
+    if (aconf->frame_size < (uint32_t)GetIfaceMaxPacketSize(iface)) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "frame-size %" PRIu32 " of %s is "
+                "smaller than the interface MTU, big packets will be dropped",
+                aconf->frame_size, iface);
+    }
+
+    /* LRO and GRO prevent the use of XDP in driver mode */
+    if (LiveGetOffload() == 0) {
+        (void)GetIfaceOffloading(iface, 0, 1);
+    } else {
+        DisableIfaceOffloading(LiveGetDevice(iface), 0, 1);
+    }
+
+    SC_ATOMIC_RESET(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
+    SCLogPerf("Using %d threads for interface %s", aconf->threads, iface);
+
+    return aconf;
+}
+
+static int AFXDPConfigGeThreadsCount(void *conf)
+{
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)conf;
+    return aconf->threads;
+}
+
+int AFXDPRunModeIsIPS()
+{
+    int nlive = LiveGetDeviceCount();
+    int ldev;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *afxdp_node;
+    int has_ips = 0;
+    int has_ids = 0;
+
+    /* Find initial node */
+    afxdp_node = ConfGetNode("af-xdp");
+    if (afxdp_node == NULL) {
+        return 0;
+    }
+
+    if_default = ConfNodeLookupKeyValue(afxdp_node, "interface", "default");
+
+    for (ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+            return 0;
+        }
+        const char *copymodestr = NULL;
+        if_root = ConfNodeLookupKeyValue(afxdp_node, "interface", live_dev);
+
+        if (if_root == NULL) {
+            if (if_default == NULL) {
+                SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                return 0;
+            }
+            if_root = if_default;
+        }
+
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1 &&
+                strcmp(copymodestr, "ips") == 0) {
+            has_ips = 1;
+        } else {
+            has_ids = 1;
+        }
+    }
+
+    if (has_ids && has_ips) {
+        SCLogInfo("AF_XDP mode using IPS and IDS mode");
+        for (ldev = 0; ldev < nlive; ldev++) {
+            const char *live_dev = LiveGetDeviceName(ldev);
+            if (live_dev == NULL) {
+                SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                return 0;
+            }
+            if_root = ConfNodeLookupKeyValue(afxdp_node, "interface", live_dev);
+            const char *copymodestr = NULL;
+
+            if (if_root == NULL) {
+                if (if_default == NULL) {
+                    SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                    return 0;
+                }
+                if_root = if_default;
+            }
+
+            if (! ((ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1) &&
+                    (strcmp(copymodestr, "ips") == 0))) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                        "AF_XDP IPS mode used and interface '%s' is in IDS or TAP mode. "
+                                "Sniffing '%s' but expect bad result as stream-inline is activated.",
+                        live_dev, live_dev);
+            }
+        }
+    }
+
+    return has_ips;
+}
+
+#endif /* HAVE_AF_XDP */
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureSingle(
+                                    ParseAFXDPConfig,
+                                    AFXDPConfigGeThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_single,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPSingle initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work, one
+ * thread per interface queue.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureWorkers(
+                                    ParseAFXDPConfig,
+                                    AFXDPConfigGeThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_workers,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPWorkers initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * @}
+ */
@@ -71,10 +71,12 @@ int RunModeIpsNFQAutoFp(void)
 
     LiveDeviceHasNoStats();
 
-    ret = RunModeSetIPSAutoFp(NFQGetThread,
+    /* bulk verdicts are sent by a single verdict thread */
+    ret = RunModeSetIPSAutoFpVerdictThreads(NFQGetThread,
             "ReceiveNFQ",
             "VerdictNFQ",
-            "DecodeNFQ");
+            "DecodeNFQ",
+            NFQVerdictBulkEnabled() ? 1 : LiveGetDeviceCount());
 #endif /* NFQ */
     return ret;
 }
@@ -17,6 +17,7 @@
 
 #include "suricata-common.h"
 #include "tm-threads.h"
+#include "tm-queues.h"
 #include "conf.h"
 #include "runmodes.h"
 #include "runmode-pcap-file.h"
@@ -52,6 +53,12 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "multi",
+                              "Multi reader pcap file mode. Files are read "
+                              "and decoded by several threads, packets are "
+                              "merged back in timestamp order and assigned "
+                              "per flow to the detect threads as in \"autofp\"",
+                              RunModeFilePcapMulti);
 
     return;
 }
@@ -129,6 +136,78 @@ int RunModeFilePcapSingle(void)
     return 0;
 }
 
+/** \brief number of detect threads for the autofp style modes */
+static int RunModeFilePcapGetWorkerCount(void)
+{
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = ncpus * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+
+    return thread_max;
+}
+
+/** \brief create the detect threads reading the pickup queues */
+static void RunModeFilePcapCreateWorkers(int thread_max)
+{
+    char tname[TM_THREAD_NAME_MAX];
+    char qname[TM_QUEUE_NAME_MAX];
+    TmModule *tm_module = NULL;
+    uint16_t cpu = 0;
+    int thread;
+
+    /* Available cpus */
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* start with cpu 1 so that if we're creating an odd number of detect
+     * threads we're not creating the most on CPU0. */
+    if (ncpus > 0)
+        cpu = 1;
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
+        snprintf(qname, sizeof(qname), "pickup%d", thread+1);
+
+        SCLogDebug("tname %s, qname %s", tname, qname);
+        SCLogDebug("Assigning %s affinity to cpu %u", tname, cpu);
+
+        ThreadVars *tv_detect_ncpu =
+            TmThreadCreatePacketHandler(tname,
+                                        qname, "flow",
+                                        "packetpool", "packetpool",
+                                        "varslot");
+        if (tv_detect_ncpu == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+
+        TmThreadSetGroupName(tv_detect_ncpu, "Detect");
+
+        TmThreadSetCPU(tv_detect_ncpu, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if ((cpu + 1) == ncpus)
+            cpu = 0;
+        else
+            cpu++;
+    }
+}
+
 /**
  * \brief RunModeFilePcapAutoFp set up the following thread packet handlers:
  *        - Receive thread (from pcap file)
@@ -148,10 +227,7 @@ int RunModeFilePcapAutoFp(void)
 {
     SCEnter();
     char tname[TM_THREAD_NAME_MAX];
-    char qname[TM_QUEUE_NAME_MAX];
-    uint16_t cpu = 0;
     char *queues = NULL;
-    int thread;
 
     RunModeInitialize();
 
@@ -166,20 +242,7 @@ int RunModeFilePcapAutoFp(void)
 
     PcapFileGlobalInit();
 
-    /* Available cpus */
-    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
-
-    /* start with cpu 1 so that if we're creating an odd number of detect
-     * threads we're not creating the most on CPU0. */
-    if (ncpus > 0)
-        cpu = 1;
-
-    /* always create at least one thread */
-    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
-    if (thread_max == 0)
-        thread_max = ncpus * threading_detect_ratio;
-    if (thread_max < 1)
-        thread_max = 1;
+    int thread_max = RunModeFilePcapGetWorkerCount();
 
     queues = RunmodeAutoFpCreatePickupQueuesString(thread_max);
     if (queues == NULL) {
@@ -222,44 +285,155 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
-    for (thread = 0; thread < thread_max; thread++) {
-        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
-        snprintf(qname, sizeof(qname), "pickup%d", thread+1);
+    RunModeFilePcapCreateWorkers(thread_max);
 
-        SCLogDebug("tname %s, qname %s", tname, qname);
-        SCLogDebug("Assigning %s affinity to cpu %u", tname, cpu);
+    return 0;
+}
 
-        ThreadVars *tv_detect_ncpu =
+/**
+ * \brief RunModeFilePcapMulti set up the following thread packet handlers:
+ *        - Reader threads, each reading and decoding its share of the
+ *          files (pcap-file.file can be a directory)
+ *        - Merge thread, passing the packets of the readers on in
+ *          timestamp order to the pickup queues. Without
+ *          pcap-file.ordered the readers feed the pickup queues directly.
+ *        - Detect threads, as in autofp
+ *
+ * Ordering needs every reader to have a packet buffered, so files that
+ * follow each other in time, like a rotated capture, gain little. Files
+ * that overlap in time, like captures of several taps, read in parallel.
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapMulti(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    char qname[TM_QUEUE_NAME_MAX];
+    char *queues = NULL;
+    TmModule *tm_module = NULL;
+    int reader;
+
+    RunModeInitialize();
+
+    const char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    PcapFileGlobalInit();
+
+    intmax_t readers = 0;
+    if (ConfGetInt("pcap-file.readers", &readers) != 1 || readers < 1) {
+        readers = UtilCpuGetNumProcessorsOnline() / 2;
+        if (readers < 1)
+            readers = 1;
+    }
+    int ordered = 1;
+    if (ConfGetBool("pcap-file.ordered", &ordered) != 1) {
+        ordered = 1;
+    }
+
+    int nreaders = PcapFileMergeSetup(file, (int)readers, ordered);
+    if (nreaders < 1) {
+        SCLogError(SC_ERR_RUNMODE, "pcap file readers setup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int thread_max = RunModeFilePcapGetWorkerCount();
+
+    queues = RunmodeAutoFpCreatePickupQueuesString(thread_max);
+    if (queues == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "RunmodeAutoFpCreatePickupQueuesString failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* readers are spawned one by one, in the order of their queues */
+    for (reader = 0; reader < nreaders; reader++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, reader+1);
+        snprintf(qname, sizeof(qname), "pcap-merge%d", reader+1);
+
+        ThreadVars *tv_reader =
             TmThreadCreatePacketHandler(tname,
-                                        qname, "flow",
                                         "packetpool", "packetpool",
-                                        "varslot");
-        if (tv_detect_ncpu == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+                                        ordered ? qname : queues,
+                                        ordered ? "simple" : "flow",
+                                        "pktacqloop");
+        if (tv_reader == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
             exit(EXIT_FAILURE);
         }
 
-        tm_module = TmModuleGetByName("FlowWorker");
+        tm_module = TmModuleGetByName("ReceivePcapFile");
         if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
             exit(EXIT_FAILURE);
         }
-        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+        /* the file list comes from PcapFileMergeSetup */
+        TmSlotSetFuncAppend(tv_reader, tm_module, NULL);
 
-        TmThreadSetGroupName(tv_detect_ncpu, "Detect");
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_reader, tm_module, NULL);
 
-        TmThreadSetCPU(tv_detect_ncpu, WORKER_CPU_SET);
+        TmThreadSetCPU(tv_reader, RECEIVE_CPU_SET);
 
-        if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
+        if (TmThreadSpawn(tv_reader) != TM_ECODE_OK) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
             exit(EXIT_FAILURE);
         }
+    }
 
-        if ((cpu + 1) == ncpus)
-            cpu = 0;
-        else
-            cpu++;
+    if (ordered) {
+        snprintf(tname, sizeof(tname), "%s#merge", thread_name_autofp);
+
+        ThreadVars *tv_merge =
+            TmThreadCreatePacketHandler(tname,
+                                        "packetpool", "packetpool",
+                                        queues, "flow",
+                                        "pktacqloop");
+        if (tv_merge == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName("PcapFileMerge");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for PcapFileMerge");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_merge, tm_module, NULL);
+
+        /* the merge thread reads all reader queues itself instead of
+         * through an inq, account for it */
+        for (reader = 0; reader < nreaders; reader++) {
+            snprintf(qname, sizeof(qname), "pcap-merge%d", reader+1);
+            Tmq *tmq = TmqGetQueueByName(qname);
+            if (tmq == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "queue %s not found", qname);
+                exit(EXIT_FAILURE);
+            }
+            tmq->reader_cnt++;
+        }
+
+        TmThreadSetCPU(tv_merge, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_merge) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
     }
+    SCFree(queues);
+
+    RunModeFilePcapCreateWorkers(thread_max);
 
     return 0;
 }
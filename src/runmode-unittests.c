@@ -107,11 +107,16 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-checksum.h"
+#include "util-hash-word.h"
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
 
 #include "util-decode-asn1.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
+#include "decode-fast.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -120,6 +125,7 @@
 #include "detect-engine-siggroup.h"
 
 #include "util-streaming-buffer.h"
+#include "source-pcap-file-mmap.h"
 #include "util-lua.h"
 
 #endif /* UNITTESTS */
@@ -158,6 +164,11 @@ static void RegisterUnittests(void)
     DecodeTCPRegisterTests();
     DecodeUDPV4RegisterTests();
     DecodeGRERegisterTests();
+    DecodeVXLANRegisterTests();
+    DecodeGeneveRegisterTests();
+    DecodeFastPathRegisterTests();
+    ChecksumRegisterTests();
+    HashWordRegisterTests();
     DecodeAsn1RegisterTests();
     DecodeMPLSRegisterTests();
     AppLayerProtoDetectUnittestsRegister();
@@ -219,6 +230,7 @@ static void RegisterUnittests(void)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    PcapFileMmapRegisterTests();
 }
 #endif
 
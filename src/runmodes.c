@@ -147,6 +147,12 @@ static const char *RunModeTranslateModeToName(int runmode)
             return "NETMAP";
 #else
             return "NETMAP(DISABLED)";
+#endif
+        case RUNMODE_AFXDP_DEV:
+#ifdef HAVE_AF_XDP
+            return "AF_XDP_DEV";
+#else
+            return "AF_XDP_DEV(DISABLED)";
 #endif
         case RUNMODE_UNIX_SOCKET:
             return "UNIX_SOCKET";
@@ -220,6 +226,7 @@ void RunModeRegisterRunModes(void)
     RunModeNapatechRegister();
     RunModeIdsAFPRegister();
     RunModeIdsNetmapRegister();
+    RunModeIdsAFXDPRegister();
     RunModeIdsNflogRegister();
     RunModeTileMpipeRegister();
     RunModeUnixSocketRegister();
@@ -325,6 +332,9 @@ void RunModeDispatch(int runmode, const char *custom_mode)
             case RUNMODE_NETMAP:
                 custom_mode = RunModeNetmapGetDefaultMode();
                 break;
+            case RUNMODE_AFXDP_DEV:
+                custom_mode = RunModeAFXDPGetDefaultMode();
+                break;
             case RUNMODE_UNIX_SOCKET:
                 custom_mode = RunModeUnixSocketGetDefaultMode();
                 break;
@@ -36,6 +36,7 @@
 #include "config.h"
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "packet-queue.h"
 #include "threads.h"
 #include "threadvars.h"
@@ -52,9 +53,11 @@
 #include "util-checksum.h"
 #include "util-ioctl.h"
 #include "util-host-info.h"
+#include "util-ebpf.h"
 #include "tmqh-packetpool.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
+#include "util-unittest.h"
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -166,6 +169,10 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, const void *initdata, void **data)
 #define TP_STATUS_VLAN_VALID (1 << 4)
 #endif
 
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
 /** protect pfring_set_bpf_filter, as it is not thread safe */
 static SCMutex afpacket_bpf_set_filter_lock = SCMUTEX_INITIALIZER;
 
@@ -181,6 +188,21 @@ enum {
     AFP_RECOVERABLE_ERROR,
 };
 
+/* struct virtio_net_hdr of linux/virtio_net.h, put in front of the
+ * frames by the kernel when PACKET_VNET_HDR is set */
+typedef struct AFPVnetHdr_ {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} AFPVnetHdr;
+
+#define AFP_VNET_HDR_F_NEEDS_CSUM   1
+#define AFP_VNET_HDR_F_DATA_VALID   2
+#define AFP_VNET_HDR_GSO_NONE       0
+
 union thdr {
     struct tpacket2_hdr *h2;
 #ifdef HAVE_TPACKET_V3
@@ -219,7 +241,7 @@ typedef struct AFPThreadVars_
     /* handle state */
     uint8_t afp_state;
     uint8_t copy_mode;
-    uint8_t flags;
+    unsigned int flags;
 
     /* IPS peer */
     AFPPeer *mpeer;
@@ -243,6 +265,13 @@ typedef struct AFPThreadVars_
     int buffer_size;
     /* Filter */
     const char *bpf_filter;
+    int ebpf_filter_fd;
+    /* eBPF fanout program of cluster_ebpf */
+    int ebpf_lb_fd;
+
+    /* eBPF bypass flow tables */
+    int v4_map_fd;
+    int v6_map_fd;
 
     int promisc;
 
@@ -277,10 +306,14 @@ TmEcode DecodeAFPThreadDeinit(ThreadVars *tv, void *data);
 TmEcode DecodeAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
 TmEcode AFPSetBPFFilter(AFPThreadVars *ptv);
+static TmEcode AFPSetEBPFFilter(AFPThreadVars *ptv);
+static int AFPSetFanoutProgram(AFPThreadVars *ptv);
+static void ReceiveAFPRegisterTests(void);
 static int AFPGetIfnumByDev(int fd, const char *ifname, int verbose);
 static int AFPGetDevFlags(int fd, const char *ifname);
 static int AFPDerefSocket(AFPPeer* peer);
 static int AFPRefSocket(AFPPeer* peer);
+static int AFPBypassCallback(Packet *p);
 
 /**
  * \brief Registration Function for RecieveAFP.
@@ -295,7 +328,7 @@ void TmModuleReceiveAFPRegister (void)
     tmm_modules[TMM_RECEIVEAFP].PktAcqBreakLoop = NULL;
     tmm_modules[TMM_RECEIVEAFP].ThreadExitPrintStats = ReceiveAFPThreadExitStats;
     tmm_modules[TMM_RECEIVEAFP].ThreadDeinit = NULL;
-    tmm_modules[TMM_RECEIVEAFP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFP].RegisterTests = ReceiveAFPRegisterTests;
     tmm_modules[TMM_RECEIVEAFP].cap_flags = SC_CAP_NET_RAW;
     tmm_modules[TMM_RECEIVEAFP].flags = TM_FLAG_RECEIVE_TM;
 }
@@ -541,6 +574,49 @@ static inline void AFPDumpCounters(AFPThreadVars *ptv)
 #endif
 }
 
+/**
+ * \brief set up the bypass of a packet read from the socket
+ */
+static inline void AFPSetupPacketBypass(AFPThreadVars *ptv, Packet *p)
+{
+    if (ptv->flags & AFP_BYPASS) {
+        p->BypassPacketsFlow = AFPBypassCallback;
+#ifdef HAVE_PACKET_EBPF
+        p->afp_v.v4_map_fd = ptv->v4_map_fd;
+        p->afp_v.v6_map_fd = ptv->v6_map_fd;
+#endif
+    }
+}
+
+/**
+ * \brief set up a packet from the vnet header of its frame
+ *
+ * A GRO super packet is a coalesced TCP stream of up to 64KB with a
+ * single header. Only the checksum of the first segment was in the
+ * header, it can't be checked: the kernel tells us if the segments
+ * were checked by the NIC.
+ */
+static inline void AFPSetupPacketVnet(Packet *p, const AFPVnetHdr *vnet)
+{
+    if (vnet->gso_type != AFP_VNET_HDR_GSO_NONE) {
+        p->gso_size = vnet->gso_size;
+    }
+    if (vnet->flags & (AFP_VNET_HDR_F_NEEDS_CSUM|AFP_VNET_HDR_F_DATA_VALID)) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+}
+
+/**
+ * \brief check if the kernel says the NIC already validated the checksums
+ *
+ * Only used if checksum-offload-trust is set on the interface: the
+ * packet is then not validated again in software.
+ */
+static inline int AFPChecksumOffloadTrusted(const AFPThreadVars *ptv, uint32_t status)
+{
+    return ptv->livedev->trust_csum_offload && (status & TP_STATUS_CSUM_VALID);
+}
+
 /**
  * \brief AF packet read function.
  *
@@ -557,7 +633,8 @@ static int AFPRead(AFPThreadVars *ptv)
     int offset = 0;
     int caplen;
     struct sockaddr_ll from;
-    struct iovec iov;
+    struct iovec iov[2];
+    AFPVnetHdr vnet;
     struct msghdr msg;
     struct cmsghdr *cmsg;
     union {
@@ -568,8 +645,6 @@ static int AFPRead(AFPThreadVars *ptv)
 
     msg.msg_name = &from;
     msg.msg_namelen = sizeof(from);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
     msg.msg_control = &cmsg_buf;
     msg.msg_controllen = sizeof(cmsg_buf);
     msg.msg_flags = 0;
@@ -578,8 +653,20 @@ static int AFPRead(AFPThreadVars *ptv)
         offset = SLL_HEADER_LEN;
     else
         offset = 0;
-    iov.iov_len = ptv->datalen - offset;
-    iov.iov_base = ptv->data + offset;
+    if (ptv->flags & AFP_VNET_HDR) {
+        /* vnet header comes first, keep it out of the packet data */
+        iov[0].iov_len = sizeof(vnet);
+        iov[0].iov_base = &vnet;
+        iov[1].iov_len = ptv->datalen - offset;
+        iov[1].iov_base = ptv->data + offset;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+    } else {
+        iov[0].iov_len = ptv->datalen - offset;
+        iov[0].iov_base = ptv->data + offset;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 1;
+    }
 
     caplen = recvmsg(ptv->socket, &msg, MSG_TRUNC);
 
@@ -588,6 +675,12 @@ static int AFPRead(AFPThreadVars *ptv)
                 errno);
         SCReturnInt(AFP_READ_FAILURE);
     }
+    if (ptv->flags & AFP_VNET_HDR) {
+        if (caplen < (int)sizeof(vnet)) {
+            SCReturnInt(AFP_READ_OK);
+        }
+        caplen -= sizeof(vnet);
+    }
 
     p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
@@ -614,6 +707,7 @@ static int AFPRead(AFPThreadVars *ptv)
     }
 
     p->datalink = ptv->datalink;
+    AFPSetupPacketBypass(ptv, p);
     SET_PKT_LEN(p, caplen + offset);
     if (PacketCopyData(p, ptv->data, GET_PKT_LEN(p)) == -1) {
         TmqhOutputPacketpool(ptv->tv, p);
@@ -638,6 +732,10 @@ static int AFPRead(AFPThreadVars *ptv)
         aux_checksum = 1;
     }
 
+    if (ptv->flags & AFP_VNET_HDR) {
+        AFPSetupPacketVnet(p, &vnet);
+    }
+
     /* List is NULL if we don't have activated auxiliary data */
     for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
         struct tpacket_auxdata *aux;
@@ -651,6 +749,9 @@ static int AFPRead(AFPThreadVars *ptv)
 
         if (aux_checksum && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
             p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ptv->checksum_mode != CHECKSUM_VALIDATION_DISABLE &&
+                   AFPChecksumOffloadTrusted(ptv, aux->tp_status)) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
         }
         break;
     }
@@ -872,6 +973,7 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
         ptv->pkts++;
         p->livedev = ptv->livedev;
         p->datalink = ptv->datalink;
+        AFPSetupPacketBypass(ptv, p);
 
         if (h.h2->tp_len > h.h2->tp_snaplen) {
             SCLogDebug("Packet length (%d) > snaplen (%d), truncating",
@@ -932,6 +1034,13 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         }
+        if (AFPChecksumOffloadTrusted(ptv, h.h2->tp_status)) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+        if (ptv->flags & AFP_VNET_HDR) {
+            AFPSetupPacketVnet(p, (AFPVnetHdr *)((unsigned char *)h.raw +
+                               h.h2->tp_mac - sizeof(AFPVnetHdr)));
+        }
         if (h.h2->tp_status & TP_STATUS_LOSING) {
             emergency_flush = 1;
             AFPDumpCounters(ptv);
@@ -968,17 +1077,20 @@ static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
     pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 }
 
-static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+/**
+ * \brief Setup a Packet from a TPACKET_V3 frame
+ *
+ * \retval AFP_READ_OK on success, AFP_FAILURE on error in which case the
+ *         packet is returned to the pool
+ */
+static inline int AFPSetupPacketV3(AFPThreadVars *ptv, struct tpacket3_hdr *ppd, Packet *p)
 {
-    Packet *p = PacketGetFromQueueOrAlloc();
-    if (p == NULL) {
-        SCReturnInt(AFP_FAILURE);
-    }
     PKT_SET_SRC(p, PKT_SRC_WIRE);
 
     ptv->pkts++;
     p->livedev = ptv->livedev;
     p->datalink = ptv->datalink;
+    AFPSetupPacketBypass(ptv, p);
 
     if ((!(ptv->flags & AFP_VLAN_DISABLED)) &&
             (ppd->tp_status & TP_STATUS_VLAN_VALID || ppd->hv1.tp_vlan_tci)) {
@@ -1032,6 +1144,23 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
+    if (AFPChecksumOffloadTrusted(ptv, ppd->tp_status)) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+
+    SCReturnInt(AFP_READ_OK);
+}
+
+static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+{
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (p == NULL) {
+        SCReturnInt(AFP_FAILURE);
+    }
+
+    if (AFPSetupPacketV3(ptv, ppd, p) != AFP_READ_OK) {
+        SCReturnInt(AFP_FAILURE);
+    }
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ptv->tv, p);
@@ -1057,6 +1186,75 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
 
     SCReturnInt(AFP_READ_OK);
 }
+
+/**
+ * \brief Walk a retired block in batches
+ *
+ * Instead of handling the frames one by one, the Packets for up to
+ * AFP_V3_BATCH_SIZE frames are taken from the pool and set up in a
+ * first tight loop. The batch is then run through the slots, with the
+ * data of the next packet being prefetched while the current one is
+ * processed.
+ */
+static inline int AFPWalkBlockBatch(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
+{
+    const uint32_t num_pkts = pbd->hdr.bh1.num_pkts;
+    Packet *batch[AFP_V3_BATCH_SIZE];
+    uint8_t *ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
+    uint32_t done = 0;
+    int r = AFP_READ_OK;
+
+    while (done < num_pkts && r == AFP_READ_OK) {
+        uint32_t cnt = MIN(num_pkts - done, AFP_V3_BATCH_SIZE);
+        uint32_t i, j;
+
+        uint32_t got = PacketGetBatchFromQueueOrAlloc(batch, cnt);
+        if (unlikely(got != cnt)) {
+            for (i = 0; i < got; i++) {
+                TmqhOutputPacketpool(ptv->tv, batch[i]);
+            }
+            SCReturnInt(AFP_READ_FAILURE);
+        }
+
+        /* first pass: setup the packets of the batch */
+        for (i = 0; i < cnt; i++) {
+            struct tpacket3_hdr *h3 = (struct tpacket3_hdr *)ppd;
+            ppd = ppd + h3->tp_next_offset;
+            if (i + 1 < cnt) {
+                __builtin_prefetch(ppd);
+            }
+
+            if (unlikely(AFPSetupPacketV3(ptv, h3, batch[i]) != AFP_READ_OK)) {
+                /* batch[i] is already returned to the pool by the
+                 * setup, the packets set up before it are still
+                 * processed below. */
+                for (j = i + 1; j < cnt; j++) {
+                    TmqhOutputPacketpool(ptv->tv, batch[j]);
+                }
+                cnt = i;
+                r = AFP_READ_FAILURE;
+                break;
+            }
+        }
+
+        /* second pass: run the batch through the slots */
+        for (i = 0; i < cnt; i++) {
+            if (i + 1 < cnt) {
+                __builtin_prefetch(GET_PKT_DATA(batch[i + 1]));
+            }
+            if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, batch[i]) != TM_ECODE_OK) {
+                /* batch[i] is released by TmThreadsSlotProcessPkt */
+                for (j = i + 1; j < cnt; j++) {
+                    TmqhOutputPacketpool(ptv->tv, batch[j]);
+                }
+                SCReturnInt(AFP_READ_FAILURE);
+            }
+        }
+        done += cnt;
+    }
+
+    SCReturnInt(r);
+}
 #endif /* HAVE_TPACKET_V3 */
 
 /**
@@ -1072,6 +1270,7 @@ static int AFPReadFromRingV3(AFPThreadVars *ptv)
 {
 #ifdef HAVE_TPACKET_V3
     struct tpacket_block_desc *pbd;
+    int r;
 
     /* Loop till we have packets available */
     while (1) {
@@ -1087,7 +1286,12 @@ static int AFPReadFromRingV3(AFPThreadVars *ptv)
             SCReturnInt(AFP_READ_OK);
         }
 
-        if (unlikely(AFPWalkBlock(ptv, pbd) != AFP_READ_OK)) {
+        if (ptv->flags & AFP_V3_BATCH) {
+            r = AFPWalkBlockBatch(ptv, pbd);
+        } else {
+            r = AFPWalkBlock(ptv, pbd);
+        }
+        if (unlikely(r != AFP_READ_OK)) {
             AFPFlushBlock(pbd);
             SCReturnInt(AFP_READ_FAILURE);
         }
@@ -1622,7 +1826,10 @@ frame size: TPACKET_ALIGN(snaplen + TPACKET_ALIGN(TPACKET_ALIGN(tp_hdrlen) + siz
     int tp_hdrlen = sizeof(struct tpacket_hdr);
     int snaplen = default_packet_size;
 
-    if (snaplen == 0) {
+    if (ptv->flags & AFP_VNET_HDR) {
+        /* frames must hold the super packets and the vnet header */
+        snaplen = AFP_VNET_HDR_SNAPLEN + sizeof(AFPVnetHdr);
+    } else if (snaplen == 0) {
         snaplen = GetIfaceMaxPacketSize(ptv->iface);
         if (snaplen <= 0) {
             SCLogWarning(SC_ERR_INVALID_VALUE,
@@ -1946,13 +2153,28 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         }
     }
 
-    if (ptv->checksum_mode == CHECKSUM_VALIDATION_KERNEL) {
+    /* the checksum status of the recvfrom path comes with the aux data */
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_KERNEL ||
+            ptv->livedev->trust_csum_offload) {
         int val = 1;
         if (setsockopt(ptv->socket, SOL_PACKET, PACKET_AUXDATA, &val,
                     sizeof(val)) == -1 && errno != ENOPROTOOPT) {
             SCLogWarning(SC_ERR_NO_AF_PACKET,
                          "'kernel' checksum mode not supported, falling back to full mode.");
-            ptv->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+            if (ptv->checksum_mode == CHECKSUM_VALIDATION_KERNEL)
+                ptv->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        }
+    }
+
+    /* has to be done before the ring setup */
+    if (ptv->flags & AFP_VNET_HDR) {
+        int val = 1;
+        if (setsockopt(ptv->socket, SOL_PACKET, PACKET_VNET_HDR, &val,
+                    sizeof(val)) == -1) {
+            SCLogWarning(SC_ERR_AFP_CREATE,
+                         "Couldn't enable vnet header on iface %s, error %s",
+                         devname, strerror(errno));
+            ptv->flags &= ~AFP_VNET_HDR;
         }
     }
 
@@ -2002,6 +2224,9 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
                        strerror(errno));
             goto socket_err;
         }
+        if (AFPSetFanoutProgram(ptv) != 0) {
+            goto socket_err;
+        }
     }
 #endif
 
@@ -2042,10 +2267,18 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
     }
 
     TmEcode rc;
-    rc = AFPSetBPFFilter(ptv);
-    if (rc == TM_ECODE_FAILED) {
-        SCLogError(SC_ERR_AFP_CREATE, "Set AF_PACKET bpf filter \"%s\" failed.", ptv->bpf_filter);
-        goto frame_err;
+    if (ptv->ebpf_filter_fd != -1) {
+        rc = AFPSetEBPFFilter(ptv);
+        if (rc == TM_ECODE_FAILED) {
+            SCLogError(SC_ERR_AFP_CREATE, "Set AF_PACKET eBPF filter failed.");
+            goto frame_err;
+        }
+    } else {
+        rc = AFPSetBPFFilter(ptv);
+        if (rc == TM_ECODE_FAILED) {
+            SCLogError(SC_ERR_AFP_CREATE, "Set AF_PACKET bpf filter \"%s\" failed.", ptv->bpf_filter);
+            goto frame_err;
+        }
     }
 
     /* Init is ok */
@@ -2113,6 +2346,267 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
 }
 
 
+#ifdef HAVE_PACKET_FANOUT
+/* cluster_cbpf program: symmetric hash of the addresses, xored with the
+ * ports for TCP, UDP and SCTP. One VLAN tag still in the packet is
+ * skipped, IPv6 extension headers are not followed and fragments are
+ * hashed on their addresses only. The kernel takes the returned value
+ * modulo the number of sockets in the group.
+ *
+ * The kernel runs the program without pushing the link layer header
+ * back: received packets start at their network header, sent ones at
+ * their link layer header. All loads are done relative to the link
+ * layer header (SKF_LL_OFF) to get the same offsets for both. VLAN tags
+ * stripped by the NIC or the kernel are not in the data anymore, the
+ * ethertype at offset 12 is then the one after the tag.
+ *
+ * M[0] is the hash, M[1] the L3 offset, M[2] a scratch value and M[3]
+ * the L4 offset. */
+#define AFP_LL(off) (SKF_LL_OFF + (off))
+
+static struct sock_filter afp_cbpf_lb[] = {
+    /*  0 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, AFP_LL(12)),  /* ethertype */
+    /*  1 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x8100, 3, 0),
+    /*  2 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x88a8, 2, 0),
+    /*  3 */ BPF_STMT(BPF_LDX|BPF_W|BPF_IMM, 14),
+    /*  4 */ BPF_STMT(BPF_JMP|BPF_JA, 2),
+    /*  5 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, AFP_LL(16)),  /* ethertype after the tag */
+    /*  6 */ BPF_STMT(BPF_LDX|BPF_W|BPF_IMM, 18),
+    /*  7 */ BPF_STMT(BPF_STX, 1),
+    /*  8 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 2, 0),
+    /*  9 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IPV6, 16, 0),
+    /* 10 */ BPF_STMT(BPF_RET|BPF_K, 0),
+    /* IPv4 */
+    /* 11 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(12)),  /* src */
+    /* 12 */ BPF_STMT(BPF_ST, 0),
+    /* 13 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(16)),  /* dst */
+    /* 14 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 15 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 16 */ BPF_STMT(BPF_ST, 0),
+    /* 17 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 18 */ BPF_STMT(BPF_LD|BPF_H|BPF_IND, AFP_LL(6)),  /* flags and offset */
+    /* 19 */ BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x3fff, 62, 0),
+    /* 20 */ BPF_STMT(BPF_LD|BPF_B|BPF_IND, AFP_LL(9)),  /* protocol */
+    /* 21 */ BPF_STMT(BPF_ST, 2),
+    /* 22 */ BPF_STMT(BPF_LD|BPF_B|BPF_IND, AFP_LL(0)),  /* header length */
+    /* 23 */ BPF_STMT(BPF_ALU|BPF_AND|BPF_K, 0xf),
+    /* 24 */ BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 2),
+    /* 25 */ BPF_STMT(BPF_JMP|BPF_JA, 40),
+    /* IPv6, xor of the 8 words of the addresses */
+    /* 26 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(8)),
+    /* 27 */ BPF_STMT(BPF_ST, 0),
+    /* 28 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(12)),
+    /* 29 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 30 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 31 */ BPF_STMT(BPF_ST, 0),
+    /* 32 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 33 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(16)),
+    /* 34 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 35 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 36 */ BPF_STMT(BPF_ST, 0),
+    /* 37 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 38 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(20)),
+    /* 39 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 40 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 41 */ BPF_STMT(BPF_ST, 0),
+    /* 42 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 43 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(24)),
+    /* 44 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 45 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 46 */ BPF_STMT(BPF_ST, 0),
+    /* 47 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 48 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(28)),
+    /* 49 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 50 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 51 */ BPF_STMT(BPF_ST, 0),
+    /* 52 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 53 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(32)),
+    /* 54 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 55 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 56 */ BPF_STMT(BPF_ST, 0),
+    /* 57 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 58 */ BPF_STMT(BPF_LD|BPF_W|BPF_IND, AFP_LL(36)),
+    /* 59 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 60 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 61 */ BPF_STMT(BPF_ST, 0),
+    /* 62 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 1),
+    /* 63 */ BPF_STMT(BPF_LD|BPF_B|BPF_IND, AFP_LL(6)),  /* next header */
+    /* 64 */ BPF_STMT(BPF_ST, 2),
+    /* 65 */ BPF_STMT(BPF_LD|BPF_IMM, 40),
+    /* L4, A is the L3 header length */
+    /* 66 */ BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0),
+    /* 67 */ BPF_STMT(BPF_ST, 3),
+    /* 68 */ BPF_STMT(BPF_LD|BPF_MEM, 2),
+    /* 69 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_TCP, 2, 0),
+    /* 70 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 1, 0),
+    /* 71 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_SCTP, 0, 10),
+    /* 72 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 3),
+    /* 73 */ BPF_STMT(BPF_LD|BPF_H|BPF_IND, AFP_LL(0)),  /* sport */
+    /* 74 */ BPF_STMT(BPF_ST, 2),
+    /* 75 */ BPF_STMT(BPF_LD|BPF_H|BPF_IND, AFP_LL(2)),  /* dport */
+    /* 76 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 2),
+    /* 77 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 78 */ BPF_STMT(BPF_ALU|BPF_LSH|BPF_K, 16),
+    /* 79 */ BPF_STMT(BPF_LDX|BPF_W|BPF_MEM, 0),
+    /* 80 */ BPF_STMT(BPF_ALU|BPF_XOR|BPF_X, 0),
+    /* 81 */ BPF_STMT(BPF_RET|BPF_A, 0),
+    /* addresses only */
+    /* 82 */ BPF_STMT(BPF_LD|BPF_MEM, 0),
+    /* 83 */ BPF_STMT(BPF_RET|BPF_A, 0),
+};
+#endif /* HAVE_PACKET_FANOUT */
+
+/**
+ * \brief attach the program of a cluster_cbpf or cluster_ebpf group
+ *
+ * Must be called after the socket joined the fanout group. The program
+ * is shared by the group, each socket sets the same one.
+ *
+ * \retval 0 on success or if the group has no program, -1 on error
+ */
+static int AFPSetFanoutProgram(AFPThreadVars *ptv)
+{
+#ifdef HAVE_PACKET_FANOUT
+    int r = 0;
+
+    switch (ptv->cluster_type & 0xff) {
+        case PACKET_FANOUT_CBPF: {
+            struct sock_fprog fprog;
+            fprog.len = sizeof(afp_cbpf_lb) / sizeof(afp_cbpf_lb[0]);
+            fprog.filter = afp_cbpf_lb;
+            r = setsockopt(ptv->socket, SOL_PACKET, PACKET_FANOUT_DATA,
+                           &fprog, sizeof(fprog));
+            break;
+        }
+        case PACKET_FANOUT_EBPF:
+            r = setsockopt(ptv->socket, SOL_PACKET, PACKET_FANOUT_DATA,
+                           &ptv->ebpf_lb_fd, sizeof(ptv->ebpf_lb_fd));
+            break;
+        default:
+            return 0;
+    }
+    if (r < 0) {
+        SCLogError(SC_ERR_AFP_CREATE,
+                   "Couldn't set fanout program on iface %s, error %s",
+                   ptv->iface, strerror(errno));
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * \brief attach the eBPF socket filter loaded by the runmode
+ */
+static TmEcode AFPSetEBPFFilter(AFPThreadVars *ptv)
+{
+#ifdef SO_ATTACH_BPF
+    SCLogInfo("Using eBPF filter on iface '%s'", ptv->iface);
+
+    if (setsockopt(ptv->socket, SOL_SOCKET, SO_ATTACH_BPF,
+                   &ptv->ebpf_filter_fd, sizeof(ptv->ebpf_filter_fd)) != 0) {
+        SCLogError(SC_ERR_AFP_CREATE, "Failed to attach eBPF filter: %s",
+                   strerror(errno));
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+#else
+    SCLogError(SC_ERR_AFP_CREATE, "eBPF filters are not supported by the system");
+    return TM_ECODE_FAILED;
+#endif
+}
+
+/**
+ * \brief Bypass callback for AF_PACKET with eBPF filter
+ *
+ * Both directions of the flow are added to the flow tables of the
+ * eBPF filter. Their packets are then dropped in kernel and accounted
+ * in the tables, the flow manager reads the counters back and removes
+ * the entries when the flow is idle.
+ *
+ * \retval 1 if the flow is bypassed in kernel, 0 otherwise
+ */
+static int AFPBypassCallback(Packet *p)
+{
+#ifdef HAVE_PACKET_EBPF
+    SCLogDebug("Calling af_packet callback function");
+    /* Only bypass TCP and UDP */
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    /* The eBPF filter only sees the outer headers so
+     * tunneled packets can't be bypassed */
+    if (IS_TUNNEL_PKT(p)) {
+        return 0;
+    }
+
+    /* The eBPF filter only handles one VLAN level */
+    if (p->vlan_idx > 1) {
+        return 0;
+    }
+
+    /* keys of the flow tables are in host byte order */
+    if (PKT_IS_IPV4(p)) {
+        struct flowv4_keys key = {};
+        SCLogDebug("add an IPv4");
+        if (p->afp_v.v4_map_fd == -1) {
+            return 0;
+        }
+        key.src = ntohl(GET_IPV4_SRC_ADDR_U32(p));
+        key.dst = ntohl(GET_IPV4_DST_ADDR_U32(p));
+        key.port16[0] = GET_TCP_SRC_PORT(p);
+        key.port16[1] = GET_TCP_DST_PORT(p);
+        key.ip_proto = IPV4_GET_IPPROTO(p);
+        key.vlan0 = p->vlan_id[0];
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, &key) == 0) {
+            return 0;
+        }
+        key.src = ntohl(GET_IPV4_DST_ADDR_U32(p));
+        key.dst = ntohl(GET_IPV4_SRC_ADDR_U32(p));
+        key.port16[0] = GET_TCP_DST_PORT(p);
+        key.port16[1] = GET_TCP_SRC_PORT(p);
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, &key) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+    /* For IPv6 case we don't handle extended header in eBPF */
+    if (PKT_IS_IPV6(p) &&
+        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
+        struct flowv6_keys key = {};
+        int i;
+        SCLogDebug("add an IPv6");
+        if (p->afp_v.v6_map_fd == -1) {
+            return 0;
+        }
+        for (i = 0; i < 4; i++) {
+            key.src[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
+            key.dst[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
+        }
+        key.port16[0] = GET_TCP_SRC_PORT(p);
+        key.port16[1] = GET_TCP_DST_PORT(p);
+        key.ip_proto = IPV6_GET_NH(p);
+        key.vlan0 = p->vlan_id[0];
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, &key) == 0) {
+            return 0;
+        }
+        for (i = 0; i < 4; i++) {
+            key.src[i] = ntohl(GET_IPV6_DST_ADDR(p)[i]);
+            key.dst[i] = ntohl(GET_IPV6_SRC_ADDR(p)[i]);
+        }
+        key.port16[0] = GET_TCP_DST_PORT(p);
+        key.port16[1] = GET_TCP_SRC_PORT(p);
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, &key) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+
 /**
  * \brief Init function for ReceiveAFP.
  *
@@ -2151,6 +2645,9 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
         SCFree(ptv);
         SCReturnInt(TM_ECODE_FAILED);
     }
+    if (afpconfig->flags & AFP_CSUM_OFFLOAD_TRUST) {
+        ptv->livedev->trust_csum_offload = 1;
+    }
 
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
@@ -2176,6 +2673,24 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     if (afpconfig->bpf_filter) {
         ptv->bpf_filter = afpconfig->bpf_filter;
     }
+    ptv->ebpf_filter_fd = afpconfig->ebpf_filter_fd;
+    ptv->ebpf_lb_fd = afpconfig->ebpf_lb_fd;
+    ptv->v4_map_fd = -1;
+    ptv->v6_map_fd = -1;
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->flags & AFP_BYPASS) {
+        ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, EBPF_FLOW_TABLE_V4);
+        if (ptv->v4_map_fd == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'",
+                       EBPF_FLOW_TABLE_V4);
+        }
+        ptv->v6_map_fd = EBPFGetMapFDByName(ptv->iface, EBPF_FLOW_TABLE_V6);
+        if (ptv->v6_map_fd == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'",
+                       EBPF_FLOW_TABLE_V6);
+        }
+    }
+#endif
 
 #ifdef PACKET_STATISTICS
     ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
@@ -2307,7 +2822,7 @@ TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packet
     /* call the decoder */
     switch (p->datalink) {
         case LINKTYPE_ETHERNET:
-            DecodeEthernet(tv, dtv, p,GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            DecodeEthernetFast(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
             break;
         case LINKTYPE_LINUX_SLL:
             DecodeSll(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
@@ -2360,6 +2875,226 @@ TmEcode DecodeAFPThreadDeinit(ThreadVars *tv, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+#ifdef UNITTESTS
+#ifdef HAVE_PACKET_FANOUT
+/** \internal
+ *  \brief run a classic BPF program like the kernel runs a fanout program
+ *
+ *  The data starts at nhoff in the frame, as it does for received packets,
+ *  and SKF_LL_OFF based loads read from the start of the frame. Only the
+ *  instructions of afp_cbpf_lb are handled. Out of bounds loads end the
+ *  program with 0, as in the kernel.
+ */
+static uint32_t AFPTestRunCBPF(const struct sock_filter *prog, size_t len,
+        const uint8_t *frame, uint32_t frame_len, uint32_t nhoff)
+{
+    uint32_t A = 0, X = 0, M[BPF_MEMWORDS];
+    memset(M, 0, sizeof(M));
+
+    for (size_t pc = 0; pc < len; pc++) {
+        const struct sock_filter *f = &prog[pc];
+        uint32_t size = 0;
+        int32_t k = 0;
+
+        switch (BPF_CLASS(f->code)) {
+            case BPF_LD:
+                if (BPF_MODE(f->code) == BPF_IMM) {
+                    A = f->k;
+                    continue;
+                }
+                if (BPF_MODE(f->code) == BPF_MEM) {
+                    A = M[f->k];
+                    continue;
+                }
+                k = (int32_t)f->k;
+                if (BPF_MODE(f->code) == BPF_IND)
+                    k = (int32_t)(X + f->k);
+                size = BPF_SIZE(f->code) == BPF_W ? 4 :
+                       BPF_SIZE(f->code) == BPF_H ? 2 : 1;
+
+                const uint8_t *d;
+                uint32_t avail;
+                if (k >= 0) {
+                    if (nhoff > frame_len)
+                        return 0;
+                    d = frame + nhoff;
+                    avail = frame_len - nhoff;
+                } else if (k >= SKF_LL_OFF) {
+                    k -= SKF_LL_OFF;
+                    d = frame;
+                    avail = frame_len;
+                } else {
+                    return 0;
+                }
+                if ((uint32_t)k + size > avail)
+                    return 0;
+                A = 0;
+                for (uint32_t i = 0; i < size; i++)
+                    A = (A << 8) | d[k + i];
+                break;
+            case BPF_LDX:
+                X = BPF_MODE(f->code) == BPF_MEM ? M[f->k] : f->k;
+                break;
+            case BPF_ST:
+                M[f->k] = A;
+                break;
+            case BPF_STX:
+                M[f->k] = X;
+                break;
+            case BPF_ALU: {
+                uint32_t v = BPF_SRC(f->code) == BPF_X ? X : f->k;
+                switch (BPF_OP(f->code)) {
+                    case BPF_ADD: A += v; break;
+                    case BPF_AND: A &= v; break;
+                    case BPF_XOR: A ^= v; break;
+                    case BPF_LSH: A <<= v; break;
+                    default: return 0;
+                }
+                break;
+            }
+            case BPF_JMP:
+                switch (BPF_OP(f->code)) {
+                    case BPF_JA:
+                        pc += f->k;
+                        break;
+                    case BPF_JEQ:
+                        pc += (A == f->k) ? f->jt : f->jf;
+                        break;
+                    case BPF_JSET:
+                        pc += (A & f->k) ? f->jt : f->jf;
+                        break;
+                    default:
+                        return 0;
+                }
+                break;
+            case BPF_RET:
+                return BPF_RVAL(f->code) == BPF_A ? A : f->k;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+static uint32_t AFPTestCBPFHash(const uint8_t *frame, uint32_t frame_len,
+        uint32_t nhoff)
+{
+    return AFPTestRunCBPF(afp_cbpf_lb, sizeof(afp_cbpf_lb) / sizeof(afp_cbpf_lb[0]),
+            frame, frame_len, nhoff);
+}
+
+/** \internal
+ *  \brief ethernet frame, optionally VLAN tagged, with an IPv4 TCP header
+ */
+static uint32_t AFPTestBuildIPv4Frame(uint8_t *frame, int vlan,
+        uint32_t src, uint32_t dst, uint16_t sp, uint16_t dp)
+{
+    uint32_t off = 12;
+    memset(frame, 0, 80);
+    if (vlan) {
+        frame[off++] = 0x81;
+        frame[off++] = 0x00;
+        frame[off++] = 0x00;
+        frame[off++] = 0x0a;
+    }
+    frame[off++] = 0x08;
+    frame[off++] = 0x00;
+
+    uint8_t *ip = frame + off;
+    ip[0] = 0x45;
+    ip[3] = 40;
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    uint32_t a = htonl(src), b = htonl(dst);
+    memcpy(ip + 12, &a, 4);
+    memcpy(ip + 16, &b, 4);
+    uint16_t p1 = htons(sp), p2 = htons(dp);
+    memcpy(ip + 20, &p1, 2);
+    memcpy(ip + 22, &p2, 2);
+    ip[32] = 0x50;
+    return off + 40;
+}
+
+/**
+ * The cBPF fanout program hashes an IPv4 TCP packet the same in both
+ * directions, whether the data starts at the network header (received)
+ * or at the link layer header (sent), tagged or not.
+ */
+static int AFPCBPFTest01(void)
+{
+    uint8_t frame[80];
+    uint32_t len;
+
+    const uint32_t src = 0x0a000001, dst = 0xc0a80102;
+    const uint16_t sp = 1025, dp = 80;
+    const uint32_t expected = (src ^ dst) ^ ((uint32_t)(sp ^ dp) << 16);
+
+    len = AFPTestBuildIPv4Frame(frame, 0, src, dst, sp, dp);
+    FAIL_IF(AFPTestCBPFHash(frame, len, ETH_HLEN) != expected);
+    FAIL_IF(AFPTestCBPFHash(frame, len, 0) != expected);
+
+    len = AFPTestBuildIPv4Frame(frame, 0, dst, src, dp, sp);
+    FAIL_IF(AFPTestCBPFHash(frame, len, ETH_HLEN) != expected);
+
+    /* tag still in the data */
+    len = AFPTestBuildIPv4Frame(frame, 1, src, dst, sp, dp);
+    FAIL_IF(AFPTestCBPFHash(frame, len, ETH_HLEN + 4) != expected);
+
+    /* fragments on the addresses only */
+    len = AFPTestBuildIPv4Frame(frame, 0, src, dst, sp, dp);
+    frame[ETH_HLEN + 6] = 0x20;
+    FAIL_IF(AFPTestCBPFHash(frame, len, ETH_HLEN) != (src ^ dst));
+    PASS;
+}
+
+/**
+ * IPv6 UDP packets hash the same in both directions.
+ */
+static int AFPCBPFTest02(void)
+{
+    uint8_t fwd[80], rev[80];
+    memset(fwd, 0, sizeof(fwd));
+    memset(rev, 0, sizeof(rev));
+
+    fwd[12] = 0x86;
+    fwd[13] = 0xdd;
+    fwd[14] = 0x60;
+    fwd[14 + 5] = 8;
+    fwd[14 + 6] = IPPROTO_UDP;
+    fwd[14 + 7] = 64;
+    for (int i = 0; i < 16; i++) {
+        fwd[14 + 8 + i] = 0x20 + i;
+        fwd[14 + 24 + i] = 0x90 + i;
+    }
+    fwd[54] = 0x13;
+    fwd[55] = 0x88;
+    fwd[57] = 53;
+
+    memcpy(rev, fwd, 22);
+    memcpy(rev + 22, fwd + 38, 16);
+    memcpy(rev + 38, fwd + 22, 16);
+    memcpy(rev + 54, fwd + 56, 2);
+    memcpy(rev + 56, fwd + 54, 2);
+
+    uint32_t h = AFPTestCBPFHash(fwd, 62, ETH_HLEN);
+    FAIL_IF(h == 0);
+    FAIL_IF(h != AFPTestCBPFHash(rev, 62, ETH_HLEN));
+    FAIL_IF(h != AFPTestCBPFHash(fwd, 62, 0));
+    PASS;
+}
+#endif /* HAVE_PACKET_FANOUT */
+#endif /* UNITTESTS */
+
+static void ReceiveAFPRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef HAVE_PACKET_FANOUT
+    UtRegisterTest("AFPCBPFTest01", AFPCBPFTest01);
+    UtRegisterTest("AFPCBPFTest02", AFPCBPFTest02);
+#endif
+#endif
+}
+
 #endif /* HAVE_AF_PACKET */
 /* eof */
 /**
@@ -41,6 +41,21 @@
 #else /* HAVE_PACKET_FANOUT */
 #include <linux/if_packet.h>
 #endif /* HAVE_PACKET_FANOUT */
+
+/* programmable fanout, the program is attached with PACKET_FANOUT_DATA
+ * once the socket has joined the group */
+#ifndef PACKET_FANOUT_CBPF
+#define PACKET_FANOUT_CBPF             6
+#endif
+#ifndef PACKET_FANOUT_EBPF
+#define PACKET_FANOUT_EBPF             7
+#endif
+#ifndef PACKET_FANOUT_DATA
+#define PACKET_FANOUT_DATA             22
+#endif
+#ifndef PACKET_VNET_HDR
+#define PACKET_VNET_HDR                15
+#endif
 #include "queue.h"
 
 /* value for flags */
@@ -51,6 +66,10 @@
 #define AFP_TPACKET_V3 (1<<4)
 #define AFP_VLAN_DISABLED (1<<5)
 #define AFP_MMAP_LOCKED (1<<6)
+#define AFP_V3_BATCH (1<<7)
+#define AFP_BYPASS   (1<<8)
+#define AFP_VNET_HDR (1<<9)
+#define AFP_CSUM_OFFLOAD_TRUST (1<<10)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
@@ -65,6 +84,14 @@
  * to standard frame size */
 #define AFP_BLOCK_SIZE_DEFAULT_ORDER 3
 
+/* Max number of packets set up in one go when a tpacket_v3 block
+ * is walked in batch mode */
+#define AFP_V3_BATCH_SIZE 64
+
+/* Max size of a GRO super packet: max IP packet plus ethernet header
+ * and two VLAN tags */
+#define AFP_VNET_HDR_SNAPLEN (65535 + 14 + 2 * 4)
+
 typedef struct AFPIfaceConfig_
 {
     char iface[AFP_IFACE_NAME_LENGTH];
@@ -88,6 +115,10 @@ typedef struct AFPIfaceConfig_
     int copy_mode;
     ChecksumValidationMode checksum_mode;
     const char *bpf_filter;
+    /* fd of the eBPF socket filter, -1 if none */
+    int ebpf_filter_fd;
+    /* fd of the eBPF fanout program for cluster_ebpf, -1 if none */
+    int ebpf_lb_fd;
     const char *out_iface;
     SC_ATOMIC_DECLARE(unsigned int, ref);
     void (*DerefFunc)(void *);
@@ -126,6 +157,11 @@ typedef struct AFPPacketVars_
      */
     AFPPeer *mpeer;
     uint8_t copy_mode;
+#ifdef HAVE_PACKET_EBPF
+    /* flow tables of the eBPF filter, used by the bypass callback */
+    int v4_map_fd;
+    int v6_map_fd;
+#endif
 } AFPPacketVars;
 
 #define AFPV_CLEANUP(afpv) do {           \
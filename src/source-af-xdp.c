@@ -0,0 +1,1019 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ *  \defgroup afxdp AF_XDP running mode
+ *
+ *  @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ *
+ * Each receive thread binds one AF_XDP socket to one RX queue of the
+ * interface. Packets are handed to the engine without any copy: the
+ * Packet data points directly into the UMEM frame and the frame is given
+ * back to the kernel when the packet is released.
+ *
+ * In copy mode (IPS/TAP), the socket of queue N of the capture interface
+ * and the socket of queue N of the copy interface share a single UMEM.
+ * A released packet is then forwarded by posting its UMEM frame on the
+ * TX ring of the peer socket, so no data is copied on the way out either.
+ * Each socket owns half of the UMEM frames: frames always return to the
+ * fill ring of the socket owning them once transmitted or dropped.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "decode.h"
+#include "decode-fast.h"
+#include "packet-queue.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queuehandlers.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "tmqh-packetpool.h"
+#include "source-af-xdp.h"
+#include "runmodes.h"
+
+#ifdef HAVE_AF_XDP
+
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <sys/resource.h>
+#include <poll.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <bpf/xsk.h>
+
+#endif /* HAVE_AF_XDP */
+
+#include "util-ioctl.h"
+
+extern intmax_t max_pending_packets;
+
+#ifndef HAVE_AF_XDP
+
+TmEcode NoAFXDPSupportExit(ThreadVars *, const void *, void **);
+
+void TmModuleReceiveAFXDPRegister (void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister (void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_DECODEAFXDP].Func = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+TmEcode NoAFXDPSupportExit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_AF_XDP,"Error creating thread %s: you do not have "
+            "support for AF_XDP enabled, please recompile "
+            "with --enable-af-xdp", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+#else /* We have AF_XDP support */
+
+#define POLL_TIMEOUT 100
+
+/** max number of descriptors taken from the RX ring in one go */
+#define AFXDP_RX_BATCH  64
+
+#define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
+
+enum {
+    AFXDP_OK,
+    AFXDP_FAILURE,
+};
+
+struct AFXDPQueuePair_;
+
+/**
+ * \brief AF_XDP socket bound to one queue of one interface.
+ */
+typedef struct AFXDPSocket_
+{
+    char ifname[IFNAMSIZ];
+    struct xsk_socket *xsk;
+    int fd;
+    /* socket has a RX ring and is read by a receive thread */
+    int has_rx;
+
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_prod fq;
+    struct xsk_ring_cons cq;
+    SCSpinlock tx_lock;
+    SCSpinlock fq_lock;
+    SCSpinlock cq_lock;
+
+    /* UMEM range of the frames owned by this socket fill ring */
+    uint64_t frames_from;
+    uint64_t frames_to;
+
+    /* descriptors were posted on the TX ring since last kick */
+    int tx_pending;
+    uint64_t tx_drops;
+
+    /* socket to forward to in copy mode */
+    struct AFXDPSocket_ *peer;
+    struct AFXDPQueuePair_ *qp;
+} AFXDPSocket;
+
+/**
+ * \brief Set of sockets sharing a UMEM: queue N of the capture interface
+ *        and, in copy mode, queue N of the copy interface.
+ */
+typedef struct AFXDPQueuePair_
+{
+    uint32_t queue_id;
+    void *umem_area;
+    size_t umem_size;
+    uint32_t frame_size;
+    struct xsk_umem *umem;
+    int sockets_cnt;
+    AFXDPSocket sockets[2];
+    unsigned int ref;
+    TAILQ_ENTRY(AFXDPQueuePair_) next;
+} AFXDPQueuePair;
+
+/**
+ * \brief Module thread local variables.
+ */
+typedef struct AFXDPThreadVars_
+{
+    /* socket read by this thread */
+    AFXDPSocket *xsk;
+
+    /* internal shit */
+    TmSlot *slot;
+    ThreadVars *tv;
+    LiveDevice *livedev;
+
+    /* copy from config */
+    int copy_mode;
+    ChecksumValidationMode checksum_mode;
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t drops;
+    uint64_t kernel_drops_last;
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+} AFXDPThreadVars;
+
+typedef TAILQ_HEAD(AFXDPQueuePairList_, AFXDPQueuePair_) AFXDPQueuePairList;
+
+static AFXDPQueuePairList afxdp_qplist = TAILQ_HEAD_INITIALIZER(afxdp_qplist);
+static SCMutex afxdp_qplist_lock = SCMUTEX_INITIALIZER;
+
+/**
+ * \brief Get socket owning the UMEM frame at addr.
+ */
+static inline AFXDPSocket *AFXDPFrameOwner(AFXDPQueuePair *qp, uint64_t addr)
+{
+    if (qp->sockets_cnt == 2 && addr >= qp->sockets[1].frames_from &&
+            addr < qp->sockets[1].frames_to) {
+        return &qp->sockets[1];
+    }
+    return &qp->sockets[0];
+}
+
+/**
+ * \brief Give a UMEM frame back to the fill ring of its owner.
+ */
+static inline void AFXDPFrameRecycle(AFXDPQueuePair *qp, uint64_t addr)
+{
+    /* addr may point inside the frame, fill ring wants the frame base */
+    addr &= ~((uint64_t)qp->frame_size - 1);
+
+    AFXDPSocket *owner = AFXDPFrameOwner(qp, addr);
+    uint32_t idx;
+
+    SCSpinLock(&owner->fq_lock);
+    /* fill ring is sized to hold all the frames of its owner so this
+     * can not fail */
+    if (likely(xsk_ring_prod__reserve(&owner->fq, 1, &idx) == 1)) {
+        *xsk_ring_prod__fill_addr(&owner->fq, idx) = addr;
+        xsk_ring_prod__submit(&owner->fq, 1);
+    }
+    SCSpinUnlock(&owner->fq_lock);
+}
+
+/**
+ * \brief Return frames of completed transmissions to their owners.
+ *
+ * Completion rings of both sockets of the pair are drained here, so
+ * a TX only copy interface with no receive thread is handled as well.
+ * If a ring is already being drained by the other thread, it is skipped.
+ */
+static void AFXDPDrainCompletions(AFXDPQueuePair *qp)
+{
+    for (int i = 0; i < qp->sockets_cnt; i++) {
+        AFXDPSocket *s = &qp->sockets[i];
+        uint32_t idx;
+
+        if (SCSpinTrylock(&s->cq_lock) != 0)
+            continue;
+
+        uint32_t done = xsk_ring_cons__peek(&s->cq, UINT32_MAX, &idx);
+        for (uint32_t j = 0; j < done; j++) {
+            AFXDPFrameRecycle(qp, *xsk_ring_cons__comp_addr(&s->cq, idx + j));
+        }
+        if (done > 0) {
+            xsk_ring_cons__release(&s->cq, done);
+        }
+
+        SCSpinUnlock(&s->cq_lock);
+    }
+}
+
+/**
+ * \brief Kick the kernel if descriptors were posted on a TX ring.
+ */
+static void AFXDPKickTx(AFXDPQueuePair *qp)
+{
+    for (int i = 0; i < qp->sockets_cnt; i++) {
+        AFXDPSocket *s = &qp->sockets[i];
+        if (!s->tx_pending)
+            continue;
+
+        SCSpinLock(&s->tx_lock);
+        s->tx_pending = 0;
+        if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+            if (sendto(s->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+                    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+                    errno != ENETDOWN) {
+                SCLogDebug("Error kicking TX on %s: %s", s->ifname,
+                           strerror(errno));
+            }
+        }
+        SCSpinUnlock(&s->tx_lock);
+    }
+}
+
+static void AFXDPSocketClose(AFXDPSocket *s)
+{
+    if (s->xsk != NULL) {
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    SCSpinDestroy(&s->tx_lock);
+    SCSpinDestroy(&s->fq_lock);
+    SCSpinDestroy(&s->cq_lock);
+}
+
+/**
+ * \brief Free a queue pair. Caller must hold afxdp_qplist_lock.
+ */
+static void AFXDPQueuePairFree(AFXDPQueuePair *qp)
+{
+    for (int i = 0; i < qp->sockets_cnt; i++) {
+        /* skip socket we failed to get to */
+        if (qp->sockets[i].qp != NULL) {
+            AFXDPSocketClose(&qp->sockets[i]);
+        }
+    }
+    if (qp->umem != NULL) {
+        xsk_umem__delete(qp->umem);
+    }
+    if (qp->umem_area != NULL) {
+        munmap(qp->umem_area, qp->umem_size);
+    }
+    SCFree(qp);
+}
+
+/**
+ * \brief Create the AF_XDP socket of one interface of a queue pair.
+ * \param with_rx socket is read by a receive thread.
+ * \return Zero on success.
+ */
+static int AFXDPSocketCreate(AFXDPQueuePair *qp, AFXDPSocket *s,
+        const char *ifname, int with_rx, AFXDPIfaceConfig *aconf)
+{
+    struct xsk_socket_config cfg;
+    int r;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.rx_size = aconf->ring_size;
+    cfg.tx_size = aconf->ring_size;
+    cfg.bind_flags = XDP_USE_NEED_WAKEUP |
+        (aconf->zero_copy ? XDP_ZEROCOPY : XDP_COPY);
+    cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
+    if (aconf->xdp_mode == AFXDP_XDP_MODE_DRV) {
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+    } else if (aconf->xdp_mode == AFXDP_XDP_MODE_SKB) {
+        cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+    }
+    if (!with_rx) {
+        /* interface is only used to send, don't redirect its traffic */
+        cfg.libbpf_flags = XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD;
+    }
+
+    strlcpy(s->ifname, ifname, sizeof(s->ifname));
+    s->has_rx = with_rx;
+    s->qp = qp;
+    SCSpinInit(&s->tx_lock, 0);
+    SCSpinInit(&s->fq_lock, 0);
+    SCSpinInit(&s->cq_lock, 0);
+
+    /* check interface is up */
+    int if_flags = GetIfaceFlags(ifname);
+    if (if_flags == -1) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Can not access to interface '%s'",
+                   ifname);
+        return -1;
+    }
+    if ((if_flags & IFF_UP) == 0) {
+        SCLogWarning(SC_ERR_AF_XDP_CREATE, "Interface '%s' is down", ifname);
+        return -1;
+    }
+    /* if needed, try to set iface in promisc mode */
+    if (with_rx && aconf->promisc && (if_flags & IFF_PROMISC) == 0) {
+        if_flags |= IFF_PROMISC;
+        SetIfaceFlags(ifname, if_flags);
+    }
+
+    r = xsk_socket__create_shared(&s->xsk, ifname, qp->queue_id, qp->umem,
+            with_rx ? &s->rx : NULL, &s->tx, &s->fq, &s->cq, &cfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE,
+                   "Couldn't create AF_XDP socket on %s queue %" PRIu32 ": %s",
+                   ifname, qp->queue_id, strerror(-r));
+        s->xsk = NULL;
+        return -1;
+    }
+    s->fd = xsk_socket__fd(s->xsk);
+
+    /* hand all our frames to the kernel */
+    uint32_t nframes = (uint32_t)((s->frames_to - s->frames_from) / qp->frame_size);
+    uint32_t idx;
+    if (xsk_ring_prod__reserve(&s->fq, nframes, &idx) != nframes) {
+        SCLogError(SC_ERR_AF_XDP_CREATE,
+                   "Couldn't populate fill ring of %s queue %" PRIu32,
+                   ifname, qp->queue_id);
+        return -1;
+    }
+    for (uint32_t i = 0; i < nframes; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx + i) =
+            s->frames_from + (uint64_t)i * qp->frame_size;
+    }
+    xsk_ring_prod__submit(&s->fq, nframes);
+
+    SCLogPerf("AF_XDP: %s queue %" PRIu32 " bound in %s mode%s",
+              ifname, qp->queue_id,
+              aconf->zero_copy ? "zero copy" : "copy",
+              with_rx ? "" : " (TX only)");
+    return 0;
+}
+
+/**
+ * \brief Open or reference the AF_XDP socket of an interface queue.
+ *
+ * In copy mode, the peer socket on the copy interface is created at the
+ * same time on top of the same UMEM so packets can be forwarded without
+ * copy. If the copy interface is also captured, its receive thread will
+ * find and use that socket.
+ *
+ * \param aconf Interface config.
+ * \param queue_id Queue to bind.
+ * \param psock Pointer to the requested socket.
+ * \return Zero on success.
+ */
+static int AFXDPOpen(AFXDPIfaceConfig *aconf, uint32_t queue_id, AFXDPSocket **psock)
+{
+    static int memlock_done = 0;
+    AFXDPQueuePair *qp = NULL;
+
+    *psock = NULL;
+
+    SCMutexLock(&afxdp_qplist_lock);
+
+    /* search socket in our already opened list */
+    TAILQ_FOREACH(qp, &afxdp_qplist, next) {
+        if (qp->queue_id != queue_id)
+            continue;
+        for (int i = 0; i < qp->sockets_cnt; i++) {
+            if (qp->sockets[i].has_rx &&
+                    strcmp(qp->sockets[i].ifname, aconf->iface) == 0) {
+                *psock = &qp->sockets[i];
+                qp->ref++;
+                SCMutexUnlock(&afxdp_qplist_lock);
+                return 0;
+            }
+        }
+    }
+
+    /* UMEM is pinned memory, lift the locked memory limit once */
+    if (!memlock_done) {
+        struct rlimit rlim = { RLIM_INFINITY, RLIM_INFINITY };
+        if (setrlimit(RLIMIT_MEMLOCK, &rlim) != 0) {
+            SCLogWarning(SC_ERR_AF_XDP_CREATE,
+                         "Couldn't raise locked memory limit: %s",
+                         strerror(errno));
+        }
+        memlock_done = 1;
+    }
+
+    /* not found, create new record */
+    qp = SCMalloc(sizeof(*qp));
+    if (unlikely(qp == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+    memset(qp, 0, sizeof(*qp));
+    qp->queue_id = queue_id;
+    qp->frame_size = aconf->frame_size;
+    qp->sockets_cnt = (aconf->copy_mode != AFXDP_COPY_MODE_NONE) ? 2 : 1;
+
+    /* every socket receiving traffic owns twice its ring size in frames,
+     * so the RX ring can be full while the fill ring is still fed */
+    uint64_t frames_per_socket = (uint64_t)aconf->ring_size * 2;
+    int peer_rx = 0;
+    if (qp->sockets_cnt == 2) {
+        /* peer only receives if it is captured by us as well */
+        peer_rx = (LiveGetDevice(aconf->out_iface) != NULL);
+    }
+    uint64_t nframes = frames_per_socket * (1 + peer_rx);
+
+    qp->umem_size = nframes * qp->frame_size;
+    qp->umem_area = mmap(NULL, qp->umem_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS
+#ifdef MAP_POPULATE
+            | MAP_POPULATE
+#endif
+            , -1, 0);
+    if (qp->umem_area == MAP_FAILED) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Couldn't allocate UMEM of %" PRIuMAX
+                   " bytes: %s", (uintmax_t)qp->umem_size, strerror(errno));
+        qp->umem_area = NULL;
+        goto error_qp;
+    }
+
+    struct xsk_umem_config ucfg;
+    memset(&ucfg, 0, sizeof(ucfg));
+    ucfg.fill_size = frames_per_socket;
+    ucfg.comp_size = frames_per_socket;
+    ucfg.frame_size = qp->frame_size;
+    ucfg.frame_headroom = 0;
+
+    AFXDPSocket *s = &qp->sockets[0];
+    int r = xsk_umem__create(&qp->umem, qp->umem_area, qp->umem_size,
+            &s->fq, &s->cq, &ucfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Couldn't register UMEM for %s: %s",
+                   aconf->iface, strerror(-r));
+        qp->umem = NULL;
+        goto error_qp;
+    }
+
+    s->frames_from = 0;
+    s->frames_to = frames_per_socket * qp->frame_size;
+    if (AFXDPSocketCreate(qp, s, aconf->iface, 1, aconf) != 0) {
+        goto error_qp;
+    }
+
+    if (qp->sockets_cnt == 2) {
+        AFXDPSocket *peer = &qp->sockets[1];
+        peer->frames_from = s->frames_to;
+        peer->frames_to = peer_rx ? peer->frames_from +
+            frames_per_socket * qp->frame_size : peer->frames_from;
+        if (AFXDPSocketCreate(qp, peer, aconf->out_iface, peer_rx, aconf) != 0) {
+            goto error_qp;
+        }
+        s->peer = peer;
+        peer->peer = s;
+    }
+
+    qp->ref = 1;
+    TAILQ_INSERT_TAIL(&afxdp_qplist, qp, next);
+    *psock = s;
+
+    SCMutexUnlock(&afxdp_qplist_lock);
+    return 0;
+
+error_qp:
+    AFXDPQueuePairFree(qp);
+error:
+    SCMutexUnlock(&afxdp_qplist_lock);
+    return -1;
+}
+
+/**
+ * \brief Close or dereference AF_XDP socket.
+ * \return Zero on success.
+ */
+static int AFXDPClose(AFXDPSocket *s)
+{
+    AFXDPQueuePair *qp, *tmp;
+
+    SCMutexLock(&afxdp_qplist_lock);
+
+    TAILQ_FOREACH_SAFE(qp, &afxdp_qplist, next, tmp) {
+        if (qp == s->qp) {
+            qp->ref--;
+            if (!qp->ref) {
+                TAILQ_REMOVE(&afxdp_qplist, qp, next);
+                AFXDPQueuePairFree(qp);
+            }
+            SCMutexUnlock(&afxdp_qplist_lock);
+            return 0;
+        }
+    }
+
+    SCMutexUnlock(&afxdp_qplist_lock);
+    return -1;
+}
+
+/**
+ * \brief Update capture counters with XDP socket statistics.
+ */
+static inline void AFXDPDumpCounters(AFXDPThreadVars *ptv)
+{
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+
+    memset(&stats, 0, sizeof(stats));
+    if (getsockopt(ptv->xsk->fd, SOL_XDP, XDP_STATISTICS, &stats, &len) == 0) {
+        uint64_t kdrops = stats.rx_dropped + stats.rx_ring_full;
+        ptv->drops += kdrops - ptv->kernel_drops_last;
+        ptv->kernel_drops_last = kdrops;
+    }
+
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_packets, ptv->pkts);
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_drops, ptv->drops);
+    (void) SC_ATOMIC_ADD(ptv->livedev->drop, ptv->drops);
+    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, ptv->pkts);
+    ptv->drops = 0;
+    ptv->pkts = 0;
+}
+
+/**
+ * \brief Forward the frame of a packet on the TX ring of the peer socket.
+ * \retval 0 if the frame is now owned by the TX ring.
+ */
+static int AFXDPWritePacket(AFXDPSocket *s, Packet *p)
+{
+    AFXDPSocket *peer = s->peer;
+    uint32_t idx;
+
+    SCSpinLock(&peer->tx_lock);
+    if (xsk_ring_prod__reserve(&peer->tx, 1, &idx) != 1) {
+        peer->tx_drops++;
+        SCSpinUnlock(&peer->tx_lock);
+        return -1;
+    }
+    struct xdp_desc *desc = xsk_ring_prod__tx_desc(&peer->tx, idx);
+    desc->addr = p->afxdp_v.addr;
+    desc->len = GET_PKT_LEN(p);
+    xsk_ring_prod__submit(&peer->tx, 1);
+    peer->tx_pending = 1;
+    SCSpinUnlock(&peer->tx_lock);
+
+    return 0;
+}
+
+/**
+ * \brief Packet release routine.
+ *
+ * Forward the frame to the peer in copy mode, otherwise give it back
+ * to the kernel.
+ */
+static void AFXDPReleasePacket(Packet *p)
+{
+    AFXDPSocket *s = (AFXDPSocket *)p->afxdp_v.xsk;
+
+    /* Need to be in copy mode and need to detect early release
+       where Ethernet header could not be set (and pseudo packet) */
+    if ((p->afxdp_v.copy_mode != AFXDP_COPY_MODE_NONE) && !PKT_IS_PSEUDOPKT(p)) {
+        if (!(p->afxdp_v.copy_mode == AFXDP_COPY_MODE_IPS &&
+                    PACKET_TEST_ACTION(p, ACTION_DROP))) {
+            if (AFXDPWritePacket(s, p) == 0) {
+                goto done;
+            }
+        }
+    }
+
+    AFXDPFrameRecycle(s->qp, p->afxdp_v.addr);
+done:
+    PacketFreeOrRelease(p);
+}
+
+/**
+ * \brief Turn RX descriptors into packets and pass them further.
+ * \param idx Index of the first descriptor in the RX ring.
+ * \param cnt Number of descriptors to process.
+ */
+static int AFXDPProcessRx(AFXDPThreadVars *ptv, uint32_t idx, uint32_t cnt)
+{
+    SCEnter();
+
+    AFXDPSocket *s = ptv->xsk;
+    AFXDPQueuePair *qp = s->qp;
+    struct timeval ts;
+
+    gettimeofday(&ts, NULL);
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx + i);
+        uint8_t *pkt_data = xsk_umem__get_data(qp->umem_area, desc->addr);
+
+        Packet *p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL)) {
+            for (; i < cnt; i++) {
+                desc = xsk_ring_cons__rx_desc(&s->rx, idx + i);
+                AFXDPFrameRecycle(qp, desc->addr);
+            }
+            SCReturnInt(AFXDP_FAILURE);
+        }
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+        p->livedev = ptv->livedev;
+        p->datalink = LINKTYPE_ETHERNET;
+        p->ts = ts;
+        ptv->pkts++;
+        ptv->bytes += desc->len;
+
+        /* checksum validation */
+        if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+            if (ptv->livedev->ignore_checksum) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (ChecksumAutoModeCheck(ptv->pkts,
+                        SC_ATOMIC_GET(ptv->livedev->pkts),
+                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+                ptv->livedev->ignore_checksum = 1;
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+        }
+
+        if (PacketSetData(p, pkt_data, desc->len) == -1) {
+            AFXDPFrameRecycle(qp, desc->addr);
+            TmqhOutputPacketpool(ptv->tv, p);
+            continue;
+        }
+
+        p->ReleasePacket = AFXDPReleasePacket;
+        p->afxdp_v.xsk = s;
+        p->afxdp_v.addr = desc->addr;
+        p->afxdp_v.copy_mode = ptv->copy_mode;
+
+        SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+                   GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+        if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+            for (i++; i < cnt; i++) {
+                desc = xsk_ring_cons__rx_desc(&s->rx, idx + i);
+                AFXDPFrameRecycle(qp, desc->addr);
+            }
+            SCReturnInt(AFXDP_FAILURE);
+        }
+    }
+
+    SCReturnInt(AFXDP_OK);
+}
+
+/**
+ *  \brief Main AF_XDP reading loop function
+ */
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    TmSlot *s = (TmSlot *)slot;
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+    AFXDPSocket *xsk = ptv->xsk;
+    struct pollfd fds;
+    time_t last_dump = 0;
+    time_t current_time;
+
+    ptv->slot = s->slot_next;
+
+    fds.fd = xsk->fd;
+    fds.events = POLLIN;
+
+    for(;;) {
+        if (suricata_ctl_flags != 0) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        AFXDPDrainCompletions(xsk->qp);
+
+        uint32_t idx = 0;
+        uint32_t rcvd = xsk_ring_cons__peek(&xsk->rx, AFXDP_RX_BATCH, &idx);
+        if (rcvd == 0) {
+            int r = poll(&fds, 1, POLL_TIMEOUT);
+            if (r < 0) {
+                /* error */
+                if (errno != EINTR)
+                    SCLogError(SC_ERR_AF_XDP_READ,
+                               "Error polling AF_XDP socket of iface '%s': (%d" PRIu32 ") %s",
+                               xsk->ifname, errno, strerror(errno));
+            } else if (r == 0) {
+                /* poll timed out, lets see if we need to inject a fake packet  */
+                TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+                AFXDPDumpCounters(ptv);
+                StatsSyncCountersIfSignalled(tv);
+            } else if (fds.revents & POLL_EVENTS) {
+                SCLogError(SC_ERR_AF_XDP_READ,
+                           "Error reading data from iface '%s': (%d" PRIu32 ") %s",
+                           xsk->ifname, errno, strerror(errno));
+            }
+            continue;
+        }
+
+        int r = AFXDPProcessRx(ptv, idx, rcvd);
+        xsk_ring_cons__release(&xsk->rx, rcvd);
+        AFXDPKickTx(xsk->qp);
+
+        if (r != AFXDP_OK) {
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+
+        /* with need_wakeup the driver stops processing the fill ring
+         * until we tell it there are new frames in it */
+        if (xsk_ring_prod__needs_wakeup(&xsk->fq)) {
+            (void)recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+
+        /* Trigger one dump of stats every second */
+        current_time = time(NULL);
+        if (current_time != last_dump) {
+            AFXDPDumpCounters(ptv);
+            last_dump = current_time;
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    AFXDPDumpCounters(ptv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Init function for ReceiveAFXDP.
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with AFXDPThreadVars
+ */
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    AFXDPThreadVars *ptv = SCMalloc(sizeof(*ptv));
+    if (unlikely(ptv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+    memset(ptv, 0, sizeof(*ptv));
+
+    ptv->tv = tv;
+    ptv->checksum_mode = aconf->checksum_mode;
+    ptv->copy_mode = aconf->copy_mode;
+
+    ptv->livedev = LiveGetDevice(aconf->iface);
+    if (ptv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error_ptv;
+    }
+
+    /* one queue per thread */
+    uint32_t queue_id = SC_ATOMIC_ADD(aconf->queue_next, 1) - 1;
+
+    if (AFXDPOpen(aconf, queue_id, &ptv->xsk) != 0) {
+        goto error_ptv;
+    }
+
+    SCLogDebug("af-xdp: %s thread bound to queue %" PRIu32, aconf->iface, queue_id);
+
+    /* basic counters */
+    ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            ptv->tv);
+    ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            ptv->tv);
+
+    *data = (void *)ptv;
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_OK);
+
+error_ptv:
+    SCFree(ptv);
+error:
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static void ReceiveAFXDPThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    AFXDPDumpCounters(ptv);
+    SCLogPerf("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 ", bytes %" PRIu64 "",
+              tv->name,
+              StatsGetLocalCounterValue(tv, ptv->capture_kernel_packets),
+              StatsGetLocalCounterValue(tv, ptv->capture_kernel_drops),
+              ptv->bytes);
+    if (ptv->xsk->peer != NULL && ptv->xsk->peer->tx_drops) {
+        SCLogPerf("(%s) TX ring full on %s: %" PRIu64 " packets not forwarded",
+                  tv->name, ptv->xsk->peer->ifname, ptv->xsk->peer->tx_drops);
+    }
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to AFXDPThreadVars.
+ */
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    if (ptv->xsk) {
+        AFXDPClose(ptv->xsk);
+        ptv->xsk = NULL;
+    }
+    SCFree(ptv);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Prepare AF_XDP decode thread.
+ * \param tv Thread local avariables.
+ * \param initdata Thread config.
+ * \param data Pointer to DecodeThreadVars placed here.
+ */
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = NULL;
+
+    dtv = DecodeThreadVarsAlloc(tv);
+
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars for dtv
+ * \param pq pointer to the current PacketQueue
+ * \param postpq
+ */
+static TmEcode DecodeAFXDP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernetFast(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to DecodeThreadVars.
+ */
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Registration Function for ReceiveAFXDP.
+ */
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = ReceiveAFXDPThreadInit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqLoop = ReceiveAFXDPLoop;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = ReceiveAFXDPThreadExitStats;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = ReceiveAFXDPThreadDeinit;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = SC_CAP_NET_RAW | SC_CAP_NET_ADMIN;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = DecodeAFXDPThreadInit;
+    tmm_modules[TMM_DECODEAFXDP].Func = DecodeAFXDP;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = DecodeAFXDPThreadDeinit;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+#endif /* HAVE_AF_XDP */
+/* eof */
+/**
+ * @}
+ */
@@ -0,0 +1,81 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ */
+
+#ifndef __SOURCE_AF_XDP_H__
+#define __SOURCE_AF_XDP_H__
+
+/* copy modes */
+enum {
+    AFXDP_COPY_MODE_NONE,
+    AFXDP_COPY_MODE_TAP,
+    AFXDP_COPY_MODE_IPS,
+};
+
+/* xdp attach modes */
+enum {
+    AFXDP_XDP_MODE_AUTO,
+    AFXDP_XDP_MODE_DRV,
+    AFXDP_XDP_MODE_SKB,
+};
+
+#define AFXDP_IFACE_NAME_LENGTH 48
+
+#define AFXDP_DEFAULT_FRAME_SIZE 2048
+#define AFXDP_DEFAULT_RING_SIZE  2048
+
+typedef struct AFXDPIfaceConfig_
+{
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    /* number of threads, one RX queue per thread */
+    int threads;
+    /* size of a UMEM frame, must be a power of 2 */
+    uint32_t frame_size;
+    /* number of descriptors in RX and TX rings, must be a power of 2 */
+    uint32_t ring_size;
+    /* bind in XDP_ZEROCOPY mode instead of XDP_COPY */
+    int zero_copy;
+    int xdp_mode;
+    int promisc;
+    int copy_mode;
+    char out_iface[AFXDP_IFACE_NAME_LENGTH];
+    ChecksumValidationMode checksum_mode;
+
+    /* next queue id to be bound by a receive thread */
+    SC_ATOMIC_DECLARE(unsigned int, queue_next);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} AFXDPIfaceConfig;
+
+typedef struct AFXDPPacketVars_
+{
+    /* AFXDPSocket the frame was received on */
+    void *xsk;
+    /* UMEM address of the frame */
+    uint64_t addr;
+    uint8_t copy_mode;
+} AFXDPPacketVars;
+
+void TmModuleReceiveAFXDPRegister (void);
+void TmModuleDecodeAFXDPRegister (void);
+
+#endif /* __SOURCE_AF_XDP_H__ */
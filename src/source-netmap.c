@@ -34,6 +34,7 @@
 #include "config.h"
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "packet-queue.h"
 #include "threads.h"
 #include "threadvars.h"
@@ -132,6 +133,8 @@ TmEcode NoNetmapSupportExit(ThreadVars *tv, const void *initdata, void **data)
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 
 #define POLL_TIMEOUT 100
+/* poll timeout while slots wait for the release of their packets */
+#define POLL_TIMEOUT_HELD 1
 
 #if defined(__linux__)
 #define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
@@ -150,9 +153,24 @@ enum {
 };
 
 enum {
+    /* packets point to the data of their rx slot */
     NETMAP_FLAG_ZERO_COPY = 1,
+    /* the ports share their memory, forward by swapping slot buffers */
+    NETMAP_FLAG_SWAP_BUFFERS = 2,
+    /* rx slots are given back to the kernel once their packets are
+     * released by the other threads */
+    NETMAP_FLAG_HOLD_SLOTS = 4,
 };
 
+/**
+ * \brief State of a rx slot with the NETMAP_FLAG_HOLD_SLOTS flag.
+ */
+typedef struct NetmapSlotState_
+{
+    /* set while the packet of the slot is in use */
+    SC_ATOMIC_DECLARE(uint8_t, busy);
+} NetmapSlotState;
+
 /**
  * \brief Netmap ring isntance.
  */
@@ -165,6 +183,8 @@ typedef struct NetmapRing
     int dst_ring_to;
     int dst_next_ring;
     SCSpinlock tx_lock;
+    /* rx slots states with NETMAP_FLAG_HOLD_SLOTS, NULL otherwise */
+    NetmapSlotState *slots;
 } NetmapRing;
 
 /**
@@ -179,6 +199,8 @@ typedef struct NetmapDevice_
     int rings_cnt;
     int rx_rings_cnt;
     int tx_rings_cnt;
+    /* id of the netmap memory allocator of the port */
+    uint16_t mem_id;
     /* hw rings + sw ring */
     NetmapRing *rings;
     unsigned int ref;
@@ -396,6 +418,7 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
                 break;
             }
             pdev->nif = NETMAP_IF(pdev->mem, nm_req.nr_offset);
+            pdev->mem_id = nm_req.nr_arg2;
         }
 
         if ((i < pdev->rx_rings_cnt) || (i == pdev->rings_cnt)) {
@@ -457,6 +480,9 @@ static int NetmapClose(NetmapDevice *dev)
                     NetmapRing *pring = &pdev->rings[i];
                     close(pring->fd);
                     SCSpinDestroy(&pring->tx_lock);
+                    if (pring->slots != NULL) {
+                        SCFree(pring->slots);
+                    }
                 }
                 SCFree(pdev->rings);
                 TAILQ_REMOVE(&netmap_devlist, pdev, next);
@@ -485,6 +511,52 @@ static inline void NetmapDumpCounters(NetmapThreadVars *ntv)
     ntv->pkts = 0;
 }
 
+/**
+ * \brief Set up the slots states of the rx rings of the thread.
+ * \return Zero on success.
+ */
+static int NetmapHoldSlotsSetup(NetmapThreadVars *ntv)
+{
+    for (int i = ntv->src_ring_from; i <= ntv->src_ring_to; i++) {
+        NetmapRing *ring = &ntv->ifsrc->rings[i];
+        uint32_t num_slots = ring->rx->num_slots;
+
+        if (ring->slots != NULL) {
+            continue;
+        }
+        ring->slots = SCCalloc(num_slots, sizeof(*ring->slots));
+        if (unlikely(ring->slots == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+            return -1;
+        }
+        for (uint32_t j = 0; j < num_slots; j++) {
+            SC_ATOMIC_INIT(ring->slots[j].busy);
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Give back to the kernel the rx slots of released packets.
+ *
+ * The slots are returned in ring order, up to the first one of a packet
+ * still in use.
+ *
+ * \retval 1 if slots are still held, 0 otherwise
+ */
+static int NetmapRingReleaseSlots(NetmapRing *ring)
+{
+    struct netmap_ring *rx = ring->rx;
+    uint32_t head = rx->head;
+
+    while (head != rx->cur && SC_ATOMIC_GET(ring->slots[head].busy) == 0) {
+        head = nm_ring_next(rx, head);
+    }
+    rx->head = head;
+
+    return head != rx->cur;
+}
+
 /**
  * \brief Init function for ReceiveNetmap.
  * \param tv pointer to ThreadVars
@@ -607,14 +679,31 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, const void *initdata, voi
     ntv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
             ntv->tv);
 
-    /* enable zero-copy mode for workers runmode */
+    /* enable zero-copy mode for workers runmode. In the other runmodes,
+     * the packets are released by other threads: their rx slots are held
+     * until then, if the buffers can be swapped instead of copied. */
     char const *active_runmode = RunmodeGetActive();
-    if ((aconf->in.copy_mode != NETMAP_COPY_MODE_NONE) && active_runmode &&
-            strcmp("workers", active_runmode) == 0) {
-        ntv->flags |= NETMAP_FLAG_ZERO_COPY;
-        SCLogPerf("Enabling zero copy mode for %s->%s",
-                  aconf->in.iface, aconf->out.iface);
-    } else {
+    int workers = active_runmode && strcmp("workers", active_runmode) == 0;
+    if (aconf->in.copy_mode != NETMAP_COPY_MODE_NONE) {
+        if (ntv->ifsrc->mem_id == ntv->ifdst->mem_id) {
+            ntv->flags |= NETMAP_FLAG_SWAP_BUFFERS;
+        }
+        if (workers) {
+            ntv->flags |= NETMAP_FLAG_ZERO_COPY;
+        } else if (ntv->flags & NETMAP_FLAG_SWAP_BUFFERS) {
+            if (NetmapHoldSlotsSetup(ntv) != 0) {
+                goto error_dst;
+            }
+            ntv->flags |= NETMAP_FLAG_ZERO_COPY | NETMAP_FLAG_HOLD_SLOTS;
+        }
+        if (ntv->flags & NETMAP_FLAG_ZERO_COPY) {
+            SCLogPerf("Enabling zero copy mode for %s->%s%s",
+                      aconf->in.iface, aconf->out.iface,
+                      (ntv->flags & NETMAP_FLAG_SWAP_BUFFERS) ? "" :
+                      ", copying on output as the ports don't share memory");
+        }
+    }
+    if (!workers || !(ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
         uint16_t ring_size = ntv->ifsrc->rings[0].rx->num_slots;
         if (ring_size > max_pending_packets) {
             SCLogError(SC_ERR_NETMAP_CREATE,
@@ -685,7 +774,8 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
 
     struct netmap_slot *ts = &txring->tx->slot[txring->tx->cur];
 
-    if (ntv->flags & NETMAP_FLAG_ZERO_COPY) {
+    if ((ntv->flags & NETMAP_FLAG_ZERO_COPY) &&
+            (ntv->flags & NETMAP_FLAG_SWAP_BUFFERS)) {
         struct netmap_slot *rs = &rxring->rx->slot[p->netmap_v.slot_id];
 
         /* swap slot buffers */
@@ -717,6 +807,11 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
 
 /**
  * \brief Packet release routine.
+ *
+ * With held slots, the slot is then free to go back to the kernel:
+ * with the buffer of the tx slot if the packet was forwarded, with its
+ * own buffer if it was dropped.
+ *
  * \param p Packet.
  */
 static void NetmapReleasePacket(Packet *p)
@@ -729,6 +824,11 @@ static void NetmapReleasePacket(Packet *p)
         NetmapWritePacket(ntv, p);
     }
 
+    if ((ntv->flags & NETMAP_FLAG_HOLD_SLOTS) && !PKT_IS_PSEUDOPKT(p)) {
+        NetmapRing *ring = &ntv->ifsrc->rings[p->netmap_v.ring_id];
+        SC_ATOMIC_SET(ring->slots[p->netmap_v.slot_id].busy, 0);
+    }
+
     PacketFreeOrRelease(p);
 }
 
@@ -746,7 +846,8 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
     uint32_t avail = nm_ring_space(rx);
     uint32_t cur = rx->cur;
 
-    if (!(ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
+    if (!(ntv->flags & NETMAP_FLAG_ZERO_COPY) ||
+            (ntv->flags & NETMAP_FLAG_HOLD_SLOTS)) {
         PacketPoolWaitForN(avail);
     }
 
@@ -801,6 +902,9 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
             }
         }
 
+        if (ntv->flags & NETMAP_FLAG_HOLD_SLOTS) {
+            SC_ATOMIC_SET(ring->slots[cur].busy, 1);
+        }
         p->ReleasePacket = NetmapReleasePacket;
         p->netmap_v.ring_id = ring_id;
         p->netmap_v.slot_id = cur;
@@ -824,11 +928,35 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
 
         cur = nm_ring_next(rx, cur);
     }
-    rx->head = rx->cur = cur;
+    rx->cur = cur;
+    if (ntv->flags & NETMAP_FLAG_HOLD_SLOTS) {
+        NetmapRingReleaseSlots(ring);
+    } else {
+        rx->head = cur;
+    }
 
     SCReturnInt(NETMAP_OK);
 }
 
+/**
+ * \brief Sync the tx rings the packets of a rx ring are forwarded to.
+ * \param ntv Thread local variables.
+ * \param ring_id Rx ring id.
+ */
+static void NetmapSyncDstRings(NetmapThreadVars *ntv, int ring_id)
+{
+    NetmapRing *src_ring = &ntv->ifsrc->rings[ring_id];
+
+    for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
+        NetmapRing *dst_ring = &ntv->ifdst->rings[j];
+        /* if locked, another loop already do sync */
+        if (SCSpinTrylock(&dst_ring->tx_lock) == 0) {
+            ioctl(dst_ring->fd, NIOCTXSYNC, 0);
+            SCSpinUnlock(&dst_ring->tx_lock);
+        }
+    }
+}
+
 /**
  *  \brief Main netmap reading loop function
  */
@@ -863,7 +991,20 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
          * to prevent us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        int r = poll(fds, rings_count, POLL_TIMEOUT);
+        /* give back the slots released since the last read and send the
+         * packets forwarded meanwhile, wake up soon if slots are held */
+        int timeout = POLL_TIMEOUT;
+        if (ntv->flags & NETMAP_FLAG_HOLD_SLOTS) {
+            for (int i = 0; i < rings_count; i++) {
+                NetmapRing *ring = &ntv->ifsrc->rings[ntv->src_ring_from + i];
+                if (NetmapRingReleaseSlots(ring)) {
+                    timeout = POLL_TIMEOUT_HELD;
+                }
+                NetmapSyncDstRings(ntv, ntv->src_ring_from + i);
+            }
+        }
+
+        int r = poll(fds, rings_count, timeout);
 
         if (r < 0) {
             /* error */
@@ -901,18 +1042,8 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
 
                 if ((ntv->copy_mode != NETMAP_COPY_MODE_NONE) &&
                     (ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
-
-                    NetmapRing *src_ring = &ntv->ifsrc->rings[src_ring_id];
-
                     /* sync dst tx rings */
-                    for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
-                        NetmapRing *dst_ring = &ntv->ifdst->rings[j];
-                        /* if locked, another loop already do sync */
-                        if (SCSpinTrylock(&dst_ring->tx_lock) == 0) {
-                            ioctl(dst_ring->fd, NIOCTXSYNC, 0);
-                            SCSpinUnlock(&dst_ring->tx_lock);
-                        }
-                    }
+                    NetmapSyncDstRings(ntv, src_ring_id);
                 }
             }
         }
@@ -1024,7 +1155,7 @@ static TmEcode DecodeNetmap(ThreadVars *tv, Packet *p, void *data, PacketQueue *
     /* update counters */
     DecodeUpdatePacketCounters(tv, dtv, p);
 
-    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    DecodeEthernetFast(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
     PacketDecodeFinalize(tv, dtv, p);
 
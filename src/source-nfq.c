@@ -50,6 +50,7 @@
 #include "util-byte.h"
 #include "util-privs.h"
 #include "util-device.h"
+#include "util-unittest.h"
 
 #include "runmodes.h"
 
@@ -122,6 +123,34 @@ static int runmode_workers;
 //#define NFQ_DFT_QUEUE_LEN NFQ_BURST_FACTOR * MAX_PENDING
 //#define NFQ_NF_BUFSIZE 1500 * NFQ_DFT_QUEUE_LEN
 
+/* size of a receive buffer, fits a message with a full copy of a packet */
+#define NFQ_RECV_BUF_SIZE 70000
+/* max netlink messages read by one recvmmsg call */
+#define NFQ_RECV_BATCH_MAX 64
+
+/* room for a verdict message with a mark */
+#define NFQ_VERDICT_MSG_MAXLEN                                              \
+    (NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg))) +                   \
+     NFA_ALIGN(NFA_LENGTH(sizeof(struct nfqnl_msg_verdict_hdr))) +          \
+     NFA_ALIGN(NFA_LENGTH(sizeof(uint32_t))))
+
+/**
+ * A netlink receive buffer. Outside of the workers runmode, the packets
+ * read in a buffer point to their data in it until their verdict, the
+ * buffer is only read in again once they are all released.
+ */
+typedef struct NFQRecvBuf_ {
+    SC_ATOMIC_DECLARE(uint32_t, refcnt);
+    uint8_t *data;
+} NFQRecvBuf;
+
+/** verdict messages for a queue, sent to the kernel together */
+typedef struct NFQVerdictBulk_ {
+    uint8_t *buf;
+    uint32_t len;
+    uint16_t cnt;
+} NFQVerdictBulk;
+
 typedef struct NFQThreadVars_
 {
     uint16_t nfq_index;
@@ -131,6 +160,17 @@ typedef struct NFQThreadVars_
     char *data; /** Per function and thread data */
     int datalen; /** Length of per function and thread data */
 
+    /* receive buffers, NULL if the messages are read one by one in data */
+    NFQRecvBuf *bufs;
+    uint8_t *bufs_data;
+    uint16_t bufs_cnt;
+    uint16_t bufs_idx;
+    /* buffer of the message being handled, NULL if it is in data */
+    NFQRecvBuf *cur_buf;
+
+    /* verdict thread: pending verdicts by queue, NULL if sent one by one */
+    NFQVerdictBulk *bulk;
+
     CaptureStats stats;
 } NFQThreadVars;
 /* shared vars for all for nfq queues and threads */
@@ -154,7 +194,8 @@ TmEcode DecodeNFQ(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 TmEcode DecodeNFQThreadInit(ThreadVars *, const void *, void **);
 TmEcode DecodeNFQThreadDeinit(ThreadVars *tv, void *data);
 
-TmEcode NFQSetVerdict(Packet *p);
+static TmEcode NFQSetVerdict(Packet *p, NFQVerdictBulk *bulk);
+static void VerdictNFQRegisterTests(void);
 
 typedef enum NFQMode_ {
     NFQ_ACCEPT_MODE,
@@ -173,6 +214,7 @@ typedef struct NFQCnf_ {
     uint32_t next_queue;
     uint32_t flags;
     uint8_t batchcount;
+    uint16_t recv_batch;
 } NFQCnf;
 
 NFQCnf nfq_config;
@@ -201,7 +243,7 @@ void TmModuleVerdictNFQRegister (void)
     tmm_modules[TMM_VERDICTNFQ].Func = VerdictNFQ;
     tmm_modules[TMM_VERDICTNFQ].ThreadExitPrintStats = NULL;
     tmm_modules[TMM_VERDICTNFQ].ThreadDeinit = VerdictNFQThreadDeinit;
-    tmm_modules[TMM_VERDICTNFQ].RegisterTests = NULL;
+    tmm_modules[TMM_VERDICTNFQ].RegisterTests = VerdictNFQRegisterTests;
 }
 
 void TmModuleDecodeNFQRegister (void)
@@ -277,16 +319,26 @@ void NFQInitConfig(char quiet)
     }
 
     if ((ConfGetInt("nfq.batchcount", &value)) == 1) {
-#ifdef HAVE_NFQ_SET_VERDICT_BATCH
         if (value > 255) {
             SCLogWarning(SC_ERR_INVALID_ARGUMENT, "nfq.batchcount cannot exceed 255.");
             value = 255;
         }
         if (value > 1)
             nfq_config.batchcount = (uint8_t) (value - 1);
+    }
+
+    nfq_config.recv_batch = 1;
+    if ((ConfGetInt("nfq.recv-batch", &value)) == 1 && value > 1) {
+#ifdef HAVE_RECVMMSG
+        if (value > NFQ_RECV_BATCH_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "nfq.recv-batch cannot "
+                         "exceed %d.", NFQ_RECV_BATCH_MAX);
+            value = NFQ_RECV_BATCH_MAX;
+        }
+        nfq_config.recv_batch = (uint16_t)value;
 #else
         SCLogWarning(SC_ERR_NFQ_NOSUPPORT,
-                   "nfq.%s set but NFQ library has no support for it.", "batchcount");
+                   "nfq.%s set but the system has no recvmmsg.", "recv-batch");
 #endif
     }
 
@@ -304,10 +356,26 @@ void NFQInitConfig(char quiet)
                         nfq_config.next_queue >> 16);
             break;
         }
+        if (nfq_config.recv_batch > 1) {
+            SCLogInfo("NFQ reading up to %u messages at once",
+                    nfq_config.recv_batch);
+        }
     }
 
 }
 
+/**
+ * \brief Check if the verdicts are sent in bulk by a single thread
+ *
+ * Outside of the workers runmode, nfq.batchcount makes one verdict
+ * thread send the verdicts of all the queues, several in each message
+ * to the kernel.
+ */
+int NFQVerdictBulkEnabled(void)
+{
+    return nfq_config.batchcount > 0;
+}
+
 static uint8_t NFQVerdictCacheLen(NFQQueueVars *t)
 {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
@@ -413,6 +481,91 @@ static inline void NFQMutexInit(NFQQueueVars *nq)
         SCMutexUnlock(&(nq)->mutex_qh); \
 } while (0)
 
+/**
+ * \brief Send the pending verdicts of a queue in one netlink message
+ */
+static void NFQVerdictBulkFlush(NFQQueueVars *t, NFQVerdictBulk *b)
+{
+    struct sockaddr_nl peer;
+    int ret = 0;
+    int iter = 0;
+
+    if (b->cnt == 0)
+        return;
+
+    memset(&peer, 0, sizeof(peer));
+    peer.nl_family = AF_NETLINK;
+
+    NFQMutexLock(t);
+    if (t->qh != NULL) {
+        do {
+            ret = sendto(t->fd, b->buf, b->len, 0,
+                         (struct sockaddr *)&peer, sizeof(peer));
+        } while ((ret < 0) && (iter++ < NFQ_VERDICT_RETRY_TIME));
+    }
+    NFQMutexUnlock(t);
+
+    if (ret < 0) {
+        SCLogWarning(SC_ERR_NFQ_SET_VERDICT, "sending %u verdicts failed: %s",
+                     b->cnt, strerror(errno));
+    }
+    b->len = 0;
+    b->cnt = 0;
+}
+
+/**
+ * \brief Send the pending verdicts of all the queues
+ */
+static void NFQVerdictBulkFlushAll(NFQVerdictBulk *bulk)
+{
+    for (int i = 0; i < receive_queue_num; i++) {
+        NFQVerdictBulkFlush(&g_nfq_q[i], &bulk[i]);
+    }
+}
+
+/**
+ * \brief Add a verdict message to the pending ones of a queue
+ *
+ * The kernel handles all the messages of a netlink datagram, so the
+ * verdicts go out with a single send once batchcount are pending. The
+ * verdicts of the other queues go out at the same time: the verdict
+ * thread doesn't wait while a queue is busy, the packets of a quiet
+ * queue would be held until then.
+ *
+ * \param bulk pending verdicts of the verdict thread
+ * \param index index of the queue of the packet
+ */
+static void NFQVerdictBulkAdd(NFQVerdictBulk *bulk, uint16_t index, uint32_t id,
+                              uint32_t verdict, int set_mark, uint32_t mark)
+{
+    NFQQueueVars *t = g_nfq_q + index;
+    NFQVerdictBulk *b = &bulk[index];
+    struct nlmsghdr *nlh = (struct nlmsghdr *)(b->buf + b->len);
+    struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    struct nfqnl_msg_verdict_hdr vh;
+
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | NFQNL_MSG_VERDICT;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    nlh->nlmsg_seq = 0;
+    nlh->nlmsg_pid = 0;
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(t->queue_num);
+
+    vh.verdict = htonl(verdict);
+    vh.id = htonl(id);
+    nfnl_addattr_l(nlh, NFQ_VERDICT_MSG_MAXLEN, NFQA_VERDICT_HDR, &vh, sizeof(vh));
+    if (set_mark) {
+        uint32_t nmark = htonl(mark);
+        nfnl_addattr_l(nlh, NFQ_VERDICT_MSG_MAXLEN, NFQA_MARK, &nmark, sizeof(nmark));
+    }
+
+    b->len += NLMSG_ALIGN(nlh->nlmsg_len);
+    if (++b->cnt > nfq_config.batchcount)
+        NFQVerdictBulkFlushAll(bulk);
+}
+
 /**
  * \brief Read data from nfq message and setup Packet
  *
@@ -420,7 +573,8 @@ static inline void NFQMutexInit(NFQQueueVars *nq)
  * In case of error, this function verdict the packet
  * to avoid skb to get stuck in kernel.
  */
-static int NFQSetupPkt (Packet *p, struct nfq_q_handle *qh, void *data)
+static int NFQSetupPkt (Packet *p, NFQThreadVars *ntv, struct nfq_q_handle *qh,
+                        void *data)
 {
     struct nfq_data *tb = (struct nfq_data *)data;
     int ret;
@@ -456,6 +610,7 @@ static int NFQSetupPkt (Packet *p, struct nfq_q_handle *qh, void *data)
     p->nfq_v.ifi  = nfq_get_indev(tb);
     p->nfq_v.ifo  = nfq_get_outdev(tb);
     p->nfq_v.verdicted = 0;
+    p->nfq_v.recv_buf = NULL;
 
 #ifdef NFQ_GET_PAYLOAD_SIGNED
     ret = nfq_get_payload(tb, &pktdata);
@@ -474,6 +629,11 @@ static int NFQSetupPkt (Packet *p, struct nfq_q_handle *qh, void *data)
             SET_PKT_LEN(p, 0);
         } else if (runmode_workers) {
             PacketSetData(p, (uint8_t *)pktdata, ret);
+        } else if (ntv->cur_buf != NULL) {
+            /* the buffer is kept until the verdict */
+            PacketSetData(p, (uint8_t *)pktdata, ret);
+            p->nfq_v.recv_buf = ntv->cur_buf;
+            (void)SC_ATOMIC_ADD(ntv->cur_buf->refcnt, 1);
         } else {
             PacketCopyData(p, (uint8_t *)pktdata, ret);
         }
@@ -497,7 +657,11 @@ static void NFQReleasePacket(Packet *p)
 {
     if (unlikely(!p->nfq_v.verdicted)) {
         PACKET_UPDATE_ACTION(p, ACTION_DROP);
-        NFQSetVerdict(p);
+        NFQSetVerdict(p, NULL);
+    }
+    if (p->nfq_v.recv_buf != NULL) {
+        (void)SC_ATOMIC_SUB(p->nfq_v.recv_buf->refcnt, 1);
+        p->nfq_v.recv_buf = NULL;
     }
     PacketFreeOrRelease(p);
 }
@@ -552,7 +716,7 @@ static int NFQCallBack(struct nfq_q_handle *qh, struct nfgenmsg *nfmsg,
     if (nfq_config.bypass_mask) {
         p->BypassPacketsFlow = NFQBypassCallback;
     }
-    ret = NFQSetupPkt(p, qh, (void *)nfa);
+    ret = NFQSetupPkt(p, ntv, qh, (void *)nfa);
     if (ret == -1) {
 #ifdef COUNTERS
         NFQQueueVars *q = NFQGetQueue(ntv->nfq_index);
@@ -706,13 +870,14 @@ static TmEcode NFQInitThread(NFQThreadVars *t, uint32_t queue_maxlen)
     }
 #endif
 
+    if (runmode_workers && nfq_config.batchcount) {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
-    if (runmode_workers) {
         q->verdict_cache.maxlen = nfq_config.batchcount;
-    } else if (nfq_config.batchcount) {
-        SCLogError(SC_ERR_INVALID_ARGUMENT, "nfq.batchcount is only valid in workers runmode.");
-    }
+#else
+        SCLogWarning(SC_ERR_NFQ_NOSUPPORT,
+                   "nfq.%s set but NFQ library has no support for it.", "batchcount");
 #endif
+    }
 
     /* set a timeout to the socket so we can check for a signal
      * in case we don't get packets for a longer period. */
@@ -750,14 +915,33 @@ TmEcode ReceiveNFQThreadInit(ThreadVars *tv, const void *initdata, void **data)
         exit(EXIT_FAILURE);
     }
 
-#define T_DATA_SIZE 70000
-    ntv->data = SCMalloc(T_DATA_SIZE);
+    ntv->data = SCMalloc(NFQ_RECV_BUF_SIZE);
     if (ntv->data == NULL) {
         SCMutexUnlock(&nfq_init_lock);
         return TM_ECODE_FAILED;
     }
-    ntv->datalen = T_DATA_SIZE;
-#undef T_DATA_SIZE
+    ntv->datalen = NFQ_RECV_BUF_SIZE;
+
+    /* in workers mode a packet is done before the next message is read,
+     * the buffers are only needed to read several at once. Otherwise
+     * more buffers are kept for the packets waiting for their verdict. */
+    if (!runmode_workers || nfq_config.recv_batch > 1) {
+        ntv->bufs_cnt = nfq_config.recv_batch;
+        if (!runmode_workers)
+            ntv->bufs_cnt *= NFQ_BURST_FACTOR;
+        ntv->bufs = SCCalloc(ntv->bufs_cnt, sizeof(NFQRecvBuf));
+        ntv->bufs_data = SCMalloc((size_t)ntv->bufs_cnt * NFQ_RECV_BUF_SIZE);
+        if (ntv->bufs == NULL || ntv->bufs_data == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate the nfq "
+                       "receive buffers");
+            SCMutexUnlock(&nfq_init_lock);
+            return TM_ECODE_FAILED;
+        }
+        for (uint16_t i = 0; i < ntv->bufs_cnt; i++) {
+            SC_ATOMIC_INIT(ntv->bufs[i].refcnt);
+            ntv->bufs[i].data = ntv->bufs_data + (size_t)i * NFQ_RECV_BUF_SIZE;
+        }
+    }
 
     *data = (void *)ntv;
 
@@ -785,6 +969,20 @@ TmEcode ReceiveNFQThreadDeinit(ThreadVars *t, void *data)
     }
     NFQMutexUnlock(nq);
 
+    /* the packets are gone by now, nothing refers to the buffers */
+    if (ntv->bufs != NULL) {
+        for (uint16_t i = 0; i < ntv->bufs_cnt; i++) {
+            SC_ATOMIC_DESTROY(ntv->bufs[i].refcnt);
+        }
+        SCFree(ntv->bufs);
+        ntv->bufs = NULL;
+    }
+    if (ntv->bufs_data != NULL) {
+        SCFree(ntv->bufs_data);
+        ntv->bufs_data = NULL;
+    }
+    ntv->bufs_cnt = 0;
+
     return TM_ECODE_OK;
 }
 
@@ -792,9 +990,26 @@ TmEcode ReceiveNFQThreadDeinit(ThreadVars *t, void *data)
 TmEcode VerdictNFQThreadInit(ThreadVars *tv, const void *initdata, void **data)
 {
     NFQThreadVars *ntv = (NFQThreadVars *) initdata;
+    char *active_runmode = RunmodeGetActive();
 
     CaptureStatsSetup(tv, &ntv->stats);
 
+    /* this thread is the only verdict thread, see NFQVerdictBulkEnabled() */
+    if (NFQVerdictBulkEnabled() &&
+            !(active_runmode && !strcmp("workers", active_runmode))) {
+        ntv->bulk = SCCalloc(receive_queue_num, sizeof(NFQVerdictBulk));
+        if (ntv->bulk == NULL)
+            return TM_ECODE_FAILED;
+        for (int i = 0; i < receive_queue_num; i++) {
+            ntv->bulk[i].buf = SCMalloc((nfq_config.batchcount + 1) *
+                                        NFQ_VERDICT_MSG_MAXLEN);
+            if (ntv->bulk[i].buf == NULL)
+                return TM_ECODE_FAILED;
+        }
+        SCLogInfo("sending the verdicts of %u queues by batches of %u",
+                  receive_queue_num, nfq_config.batchcount + 1);
+    }
+
     *data = (void *)ntv;
     return TM_ECODE_OK;
 }
@@ -802,15 +1017,37 @@ TmEcode VerdictNFQThreadInit(ThreadVars *tv, const void *initdata, void **data)
 TmEcode VerdictNFQThreadDeinit(ThreadVars *tv, void *data)
 {
     NFQThreadVars *ntv = (NFQThreadVars *)data;
-    NFQQueueVars *nq = NFQGetQueue(ntv->nfq_index);
+    int first = ntv->nfq_index;
+    int last = ntv->nfq_index;
 
-    SCLogDebug("starting... will close queuenum %" PRIu32 "", nq->queue_num);
-    NFQMutexLock(nq);
-    if (nq->qh) {
-        nfq_destroy_queue(nq->qh);
-        nq->qh = NULL;
+    /* the bulk verdict thread is the verdict thread of all the queues */
+    if (ntv->bulk != NULL) {
+        first = 0;
+        last = receive_queue_num - 1;
+    }
+
+    for (int i = first; i <= last; i++) {
+        NFQQueueVars *nq = NFQGetQueue(i);
+
+        if (ntv->bulk != NULL) {
+            NFQVerdictBulkFlush(nq, &ntv->bulk[i]);
+            if (ntv->bulk[i].buf != NULL)
+                SCFree(ntv->bulk[i].buf);
+        }
+
+        SCLogDebug("starting... will close queuenum %" PRIu32 "", nq->queue_num);
+        NFQMutexLock(nq);
+        if (nq->qh) {
+            nfq_destroy_queue(nq->qh);
+            nq->qh = NULL;
+        }
+        NFQMutexUnlock(nq);
+    }
+
+    if (ntv->bulk != NULL) {
+        SCFree(ntv->bulk);
+        ntv->bulk = NULL;
     }
-    NFQMutexUnlock(nq);
 
     return TM_ECODE_OK;
 }
@@ -898,18 +1135,92 @@ void *NFQGetThread(int number)
     return (void *)&g_nfq_t[number];
 }
 
+/**
+ * \brief Pick the free receive buffers for the next read
+ *
+ * \retval cnt number of buffers set in bufs, 0 if none is free
+ */
+static int NFQRecvBufsGet(NFQThreadVars *tv, NFQRecvBuf **bufs)
+{
+    int cnt = 0;
+
+    for (uint16_t i = 0; i < tv->bufs_cnt && cnt < nfq_config.recv_batch; i++) {
+        NFQRecvBuf *b = &tv->bufs[tv->bufs_idx];
+        if (++tv->bufs_idx == tv->bufs_cnt)
+            tv->bufs_idx = 0;
+        if (SC_ATOMIC_GET(b->refcnt) == 0)
+            bufs[cnt++] = b;
+    }
+    return cnt;
+}
+
+static void NFQHandleMsg(NFQQueueVars *t, NFQThreadVars *tv, NFQRecvBuf *b,
+                         char *data, int len)
+{
+    int ret;
+
+#ifdef DBG_PERF
+    if (len > t->dbg_maxreadsize)
+        t->dbg_maxreadsize = len;
+#endif /* DBG_PERF */
+
+    tv->cur_buf = b;
+
+    NFQMutexLock(t);
+    if (t->qh != NULL) {
+        ret = nfq_handle_packet(t->h, data, len);
+    } else {
+        SCLogWarning(SC_ERR_NFQ_HANDLE_PKT, "NFQ handle has been destroyed");
+        ret = -1;
+    }
+    NFQMutexUnlock(t);
+
+    tv->cur_buf = NULL;
+
+    if (ret != 0) {
+        SCLogWarning(SC_ERR_NFQ_HANDLE_PKT, "nfq_handle_packet error %"PRId32" %s",
+                ret, strerror(errno));
+    }
+}
+
 /**
  * \brief NFQ function to get a packet from the kernel
  *
+ * With nfq.recv-batch, several messages are read by one recvmmsg call.
+ * If no receive buffer is free, a message is read in the thread data
+ * and its packet copied.
+ *
  * \note separate functions for Linux and Win32 for readability.
  */
 static void NFQRecvPkt(NFQQueueVars *t, NFQThreadVars *tv)
 {
-    int rv, ret;
+    int rv;
     int flag = NFQVerdictCacheLen(t) ? MSG_DONTWAIT : 0;
+    NFQRecvBuf *bufs[NFQ_RECV_BATCH_MAX];
+    int cnt = NFQRecvBufsGet(tv, bufs);
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[NFQ_RECV_BATCH_MAX];
+    struct iovec iovs[NFQ_RECV_BATCH_MAX];
+#endif
 
     /* XXX what happens on rv == 0? */
-    rv = recv(t->fd, tv->data, tv->datalen, flag);
+    if (cnt == 0) {
+        rv = recv(t->fd, tv->data, tv->datalen, flag);
+#ifdef HAVE_RECVMMSG
+    } else if (cnt > 1) {
+        memset(msgs, 0, cnt * sizeof(struct mmsghdr));
+        for (int i = 0; i < cnt; i++) {
+            iovs[i].iov_base = bufs[i]->data;
+            iovs[i].iov_len = NFQ_RECV_BUF_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        /* wait for the first message only */
+        rv = recvmmsg(t->fd, msgs, cnt, flag | MSG_WAITFORONE, NULL);
+#endif
+    } else {
+        rv = recv(t->fd, bufs[0]->data, NFQ_RECV_BUF_SIZE, flag);
+    }
 
     if (rv < 0) {
         if (errno == EINTR || errno == EWOULDBLOCK) {
@@ -925,27 +1236,20 @@ static void NFQRecvPkt(NFQQueueVars *t, NFQThreadVars *tv)
         }
     } else if(rv == 0) {
         SCLogWarning(SC_ERR_NFQ_RECV, "recv got returncode 0");
-    } else {
-#ifdef DBG_PERF
-        if (rv > t->dbg_maxreadsize)
-            t->dbg_maxreadsize = rv;
-#endif /* DBG_PERF */
-
-        //printf("NFQRecvPkt: t %p, rv = %" PRId32 "\n", t, rv);
-
-        NFQMutexLock(t);
-        if (t->qh != NULL) {
-            ret = nfq_handle_packet(t->h, tv->data, rv);
-        } else {
-            SCLogWarning(SC_ERR_NFQ_HANDLE_PKT, "NFQ handle has been destroyed");
-            ret = -1;
-        }
-        NFQMutexUnlock(t);
-
-        if (ret != 0) {
-            SCLogWarning(SC_ERR_NFQ_HANDLE_PKT, "nfq_handle_packet error %"PRId32" %s",
-                    ret, strerror(errno));
+    } else if (cnt == 0) {
+        NFQHandleMsg(t, tv, NULL, tv->data, rv);
+#ifdef HAVE_RECVMMSG
+    } else if (cnt > 1) {
+        /* rv is the number of messages read */
+        for (int i = 0; i < rv; i++) {
+            if (msgs[i].msg_len == 0)
+                continue;
+            NFQHandleMsg(t, tv, bufs[i], (char *)bufs[i]->data,
+                         (int)msgs[i].msg_len);
         }
+#endif
+    } else {
+        NFQHandleMsg(t, tv, bufs[0], (char *)bufs[0]->data, rv);
     }
 }
 
@@ -994,8 +1298,11 @@ void ReceiveNFQThreadExitStats(ThreadVars *tv, void *data)
 
 /**
  * \brief NFQ verdict function
+ *
+ * \param bulk pending verdicts of the verdict thread, NULL to send the
+ *        verdict right away
  */
-TmEcode NFQSetVerdict(Packet *p)
+static TmEcode NFQSetVerdict(Packet *p, NFQVerdictBulk *bulk)
 {
     int iter = 0;
     int ret = 0;
@@ -1059,6 +1366,19 @@ TmEcode NFQSetVerdict(Packet *p)
         return TM_ECODE_OK;
     }
 
+    /* a modified packet goes with its verdict, it is not delayed */
+    if (bulk != NULL && !(p->flags & PKT_STREAM_MODIFIED)) {
+        NFQMutexUnlock(t);
+        if (nfq_config.mode == NFQ_REPEAT_MODE) {
+            NFQVerdictBulkAdd(bulk, p->nfq_v.nfq_index, p->nfq_v.id, verdict, 1,
+                    (nfq_config.mark & nfq_config.mask) | (p->nfq_v.mark & ~nfq_config.mask));
+        } else {
+            NFQVerdictBulkAdd(bulk, p->nfq_v.nfq_index, p->nfq_v.id, verdict,
+                    (p->flags & PKT_MARK_MODIFIED) ? 1 : 0, p->nfq_v.mark);
+        }
+        return TM_ECODE_OK;
+    }
+
     do {
         switch (nfq_config.mode) {
             default:
@@ -1150,18 +1470,25 @@ TmEcode VerdictNFQ(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         bool verdict = VerdictTunnelPacket(p);
         /* don't verdict if we are not ready */
         if (verdict == true) {
-            ret = NFQSetVerdict(p->root ? p->root : p);
+            ret = NFQSetVerdict(p->root ? p->root : p, ntv->bulk);
             if (ret != TM_ECODE_OK) {
                 return ret;
             }
         }
     } else {
         /* no tunnel, verdict normally */
-        ret = NFQSetVerdict(p);
+        ret = NFQSetVerdict(p, ntv->bulk);
         if (ret != TM_ECODE_OK) {
             return ret;
         }
     }
+
+    /* this thread is the only one taking packets from its queue: if it
+     * is empty, the thread is about to wait so the pending verdicts are
+     * sent now */
+    if (ntv->bulk != NULL && (tv->inq == NULL || trans_q[tv->inq->id].len == 0)) {
+        NFQVerdictBulkFlushAll(ntv->bulk);
+    }
     return TM_ECODE_OK;
 }
 
@@ -1222,5 +1549,57 @@ TmEcode DecodeNFQThreadDeinit(ThreadVars *tv, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+#ifdef UNITTESTS
+/**
+ * A quiet queue gets its pending verdicts sent when a busy one has
+ * batchcount of them, the verdict thread never waits in between.
+ */
+static int NFQVerdictBulkTest01(void)
+{
+    uint16_t queue_num = receive_queue_num;
+    uint8_t batchcount = nfq_config.batchcount;
+    NFQVerdictBulk bulk[2];
+
+    receive_queue_num = 2;
+    nfq_config.batchcount = 3;
+    memset(bulk, 0, sizeof(bulk));
+    for (int i = 0; i < 2; i++) {
+        /* no handle: the flush only resets the pending verdicts */
+        FAIL_IF_NOT_NULL(g_nfq_q[i].qh);
+        bulk[i].buf = SCMalloc((nfq_config.batchcount + 1) *
+                               NFQ_VERDICT_MSG_MAXLEN);
+        FAIL_IF_NULL(bulk[i].buf);
+    }
+
+    /* quiet queue */
+    NFQVerdictBulkAdd(bulk, 1, 1, NF_ACCEPT, 0, 0);
+    /* busy queue */
+    for (uint32_t id = 1; id <= 3; id++) {
+        NFQVerdictBulkAdd(bulk, 0, id, NF_ACCEPT, 0, 0);
+    }
+    FAIL_IF(bulk[0].cnt != 3);
+    FAIL_IF(bulk[1].cnt != 1);
+
+    NFQVerdictBulkAdd(bulk, 0, 4, NF_ACCEPT, 0, 0);
+    FAIL_IF(bulk[0].cnt != 0);
+    FAIL_IF(bulk[1].cnt != 0);
+    FAIL_IF(bulk[1].len != 0);
+
+    for (int i = 0; i < 2; i++) {
+        SCFree(bulk[i].buf);
+    }
+    receive_queue_num = queue_num;
+    nfq_config.batchcount = batchcount;
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void VerdictNFQRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("NFQVerdictBulkTest01", NFQVerdictBulkTest01);
+#endif
+}
+
 #endif /* NFQ */
 
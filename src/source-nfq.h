@@ -45,6 +45,9 @@ typedef struct NFQPacketVars_
     uint32_t ifi;
     uint32_t ifo;
     uint16_t hw_protocol;
+
+    /* receive buffer the packet data points to, NULL if copied */
+    struct NFQRecvBuf_ *recv_buf;
 } NFQPacketVars;
 
 typedef struct NFQQueueVars_
@@ -94,6 +97,7 @@ int NFQGetQueueCount(void);
 void *NFQGetQueue(int number);
 int NFQGetQueueNum(int number);
 void *NFQGetThread(int number);
+int NFQVerdictBulkEnabled(void);
 #endif /* NFQ */
 #endif /* __SOURCE_NFQ_H__ */
 
@@ -0,0 +1,922 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * mmap based reader for pcap and pcapng files
+ *
+ * The file is mapped in memory and the records are walked directly, so
+ * packets can point to the mapping instead of being copied. Classic pcap
+ * and pcapng are handled, other formats are left to libpcap.
+ *
+ * For pcapng all interfaces of a section are tracked, each with its own
+ * link type, snaplen and timestamp resolution, unlike libpcap that only
+ * reads files where all interfaces share the link type of the first.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-atomic.h"
+#include "util-byte.h"
+#include "util-unittest.h"
+#include "source-pcap-file-mmap.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAP_MAGIC_SWAP     0xd4c3b2a1
+#define PCAP_MAGIC_NSEC_SWAP 0x4d3cb2a1
+
+/* pcapng block types */
+#define PCAPNG_BLOCK_SHB        0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB        0x00000001
+#define PCAPNG_BLOCK_PB         0x00000002  /**< obsolete packet block */
+#define PCAPNG_BLOCK_SPB        0x00000003
+#define PCAPNG_BLOCK_EPB        0x00000006
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+/* pcapng options we care about */
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_IF_TSOFFSET  14
+
+/** block type, length and trailing length */
+#define PCAPNG_BLOCK_MIN_LEN    12
+/** block header, byte order magic, version and section length */
+#define PCAPNG_SHB_MIN_LEN      28
+
+/** records larger than this are considered as a corrupted file, same
+ *  limit as libpcap */
+#define PCAP_FILE_MMAP_MAX_SNAPLEN 262144
+
+#define SWAP32(pfm, x) ((pfm)->swapped ? SCByteSwap32(x) : (x))
+#define SWAP16(pfm, x) ((pfm)->swapped ? SCByteSwap16(x) : (x))
+#define SWAP64(pfm, x) ((pfm)->swapped ? SCByteSwap64(x) : (x))
+
+static int PcapFileMmapNgNext(PcapFileMmap *pfm, PcapFileMmapPkt *rec,
+                              uint8_t **pkt, int peek);
+
+/**
+ * \brief map a pcap file and check its header
+ *
+ * \param filename file to map
+ * \param ppfm set to the mapped file on success
+ *
+ * \retval 0 on success
+ * \retval PCAP_FILE_MMAP_UNSUPPORTED if the file is not pcap or pcapng
+ * \retval PCAP_FILE_MMAP_ERROR on error
+ */
+int PcapFileMmapOpen(const char *filename, PcapFileMmap **ppfm)
+{
+    struct stat st;
+    PcapFileMmapHdr hdr;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", filename,
+                   strerror(errno));
+        return PCAP_FILE_MMAP_ERROR;
+    }
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        /* fifos and the like can't be mapped */
+        close(fd);
+        return PCAP_FILE_MMAP_UNSUPPORTED;
+    }
+
+    if ((uintmax_t)st.st_size < sizeof(hdr) ||
+            (uintmax_t)st.st_size > (uintmax_t)SIZE_MAX) {
+        close(fd);
+        return PCAP_FILE_MMAP_UNSUPPORTED;
+    }
+
+    /* MAP_PRIVATE and PROT_WRITE: packet data may be modified in
+     * place, changes stay local to the process */
+    uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to mmap %s: %s", filename,
+                     strerror(errno));
+        close(fd);
+        return PCAP_FILE_MMAP_UNSUPPORTED;
+    }
+#ifdef MADV_SEQUENTIAL
+    (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    PcapFileMmap *pfm = SCCalloc(1, sizeof(*pfm));
+    if (unlikely(pfm == NULL)) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return PCAP_FILE_MMAP_ERROR;
+    }
+    pfm->fd = fd;
+    pfm->map = map;
+    pfm->size = (size_t)st.st_size;
+
+    SC_ATOMIC_INIT(pfm->ref);
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.magic == PCAPNG_BLOCK_SHB) {
+        pfm->pcapng = 1;
+        /* read up to the first packet, we need the first interface */
+        if (PcapFileMmapNgNext(pfm, NULL, NULL, 1) < 0 || pfm->nifaces == 0) {
+            SCLogDebug("%s: no interface before the first packet", filename);
+            goto unsupported;
+        }
+        pfm->datalink = pfm->ifaces[0].datalink;
+        pfm->snaplen = pfm->ifaces[0].snaplen;
+        goto done;
+    }
+
+    switch (hdr.magic) {
+        case PCAP_MAGIC:
+            break;
+        case PCAP_MAGIC_NSEC:
+            pfm->nsec = 1;
+            break;
+        case PCAP_MAGIC_SWAP:
+            pfm->swapped = 1;
+            break;
+        case PCAP_MAGIC_NSEC_SWAP:
+            pfm->swapped = 1;
+            pfm->nsec = 1;
+            break;
+        default:
+            SCLogDebug("%s is not a classic pcap file", filename);
+            goto unsupported;
+    }
+
+    if (SWAP16(pfm, hdr.version_major) != 2) {
+        SCLogDebug("%s: unsupported pcap version %u", filename,
+                   SWAP16(pfm, hdr.version_major));
+        goto unsupported;
+    }
+
+    pfm->snaplen = SWAP32(pfm, hdr.snaplen);
+    /* upper bits hold the FCS length */
+    pfm->datalink = (int)(SWAP32(pfm, hdr.linktype) & 0x0FFFFFFF);
+    pfm->offset = sizeof(hdr);
+
+done:
+    (void) SC_ATOMIC_ADD(pfm->ref, 1);
+
+    SCLogDebug("mapped %s: %"PRIuMAX" bytes, %s, datalink %d, snaplen %u%s%s",
+               filename, (uintmax_t)pfm->size, pfm->pcapng ? "pcapng" : "pcap",
+               pfm->datalink, pfm->snaplen,
+               pfm->swapped ? ", swapped" : "", pfm->nsec ? ", nsec" : "");
+
+    *ppfm = pfm;
+    return 0;
+
+unsupported:
+    if (pfm->ifaces != NULL)
+        SCFree(pfm->ifaces);
+    SC_ATOMIC_DESTROY(pfm->ref);
+    munmap(pfm->map, pfm->size);
+    close(pfm->fd);
+    SCFree(pfm);
+    return PCAP_FILE_MMAP_UNSUPPORTED;
+}
+
+/**
+ * \brief handle a pcapng Section Header Block
+ *
+ * Sets the byte order of the section. Interfaces of the previous
+ * section are forgotten.
+ */
+static int PcapFileMmapNgSection(PcapFileMmap *pfm, const uint8_t *block,
+                                 size_t avail)
+{
+    uint32_t bom;
+    uint16_t major;
+
+    if (avail < PCAPNG_SHB_MIN_LEN)
+        return -1;
+
+    memcpy(&bom, block + 8, sizeof(bom));
+    if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+        pfm->swapped = 0;
+    } else if (bom == SCByteSwap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+        pfm->swapped = 1;
+    } else {
+        return -1;
+    }
+
+    memcpy(&major, block + 12, sizeof(major));
+    if (SWAP16(pfm, major) != 1) {
+        SCLogDebug("unsupported pcapng version %u", SWAP16(pfm, major));
+        return -1;
+    }
+
+    pfm->nifaces = 0;
+    pfm->section++;
+    return 0;
+}
+
+/** \brief handle a pcapng Interface Description Block */
+static int PcapFileMmapNgInterface(PcapFileMmap *pfm, const uint8_t *body,
+                                   uint32_t body_len)
+{
+    uint16_t linktype;
+    uint32_t snaplen;
+
+    if (body_len < 8)
+        return -1;
+
+    if (pfm->nifaces == pfm->ifaces_size) {
+        uint32_t size = pfm->ifaces_size ? pfm->ifaces_size * 2 : 4;
+        PcapFileMmapIf *ifaces = SCRealloc(pfm->ifaces, size * sizeof(*ifaces));
+        if (unlikely(ifaces == NULL))
+            return -1;
+        pfm->ifaces = ifaces;
+        pfm->ifaces_size = size;
+    }
+    PcapFileMmapIf *pif = &pfm->ifaces[pfm->nifaces];
+    memset(pif, 0x00, sizeof(*pif));
+
+    memcpy(&linktype, body, sizeof(linktype));
+    memcpy(&snaplen, body + 4, sizeof(snaplen));
+    pif->datalink = SWAP16(pfm, linktype);
+    pif->snaplen = SWAP32(pfm, snaplen);
+    pif->ts_units = 1000000;
+
+    uint32_t offset = 8;
+    while (body_len - offset >= 4) {
+        uint16_t code, olen;
+        memcpy(&code, body + offset, sizeof(code));
+        memcpy(&olen, body + offset + 2, sizeof(olen));
+        code = SWAP16(pfm, code);
+        olen = SWAP16(pfm, olen);
+        offset += 4;
+
+        if (code == PCAPNG_OPT_ENDOFOPT || olen > body_len - offset)
+            break;
+
+        const uint8_t *val = body + offset;
+        switch (code) {
+            case PCAPNG_OPT_IF_NAME: {
+                size_t n = MIN(olen, sizeof(pif->name) - 1);
+                memcpy(pif->name, val, n);
+                pif->name[n] = '\0';
+                break;
+            }
+            case PCAPNG_OPT_IF_TSRESOL:
+                if (olen < 1)
+                    break;
+                if (val[0] & 0x80) {
+                    /* power of 2 */
+                    if ((val[0] & 0x7f) > 63)
+                        return -1;
+                    pif->ts_units = 1ULL << (val[0] & 0x7f);
+                } else {
+                    /* power of 10 */
+                    if (val[0] > 19)
+                        return -1;
+                    uint8_t i;
+                    pif->ts_units = 1;
+                    for (i = 0; i < val[0]; i++)
+                        pif->ts_units *= 10;
+                }
+                break;
+            case PCAPNG_OPT_IF_TSOFFSET:
+                if (olen >= 8) {
+                    int64_t tsoffset;
+                    memcpy(&tsoffset, val, sizeof(tsoffset));
+                    pif->ts_offset = (int64_t)SWAP64(pfm, (uint64_t)tsoffset);
+                }
+                break;
+        }
+
+        /* option values are padded to 32 bits */
+        uint32_t padded = ((uint32_t)olen + 3) & ~3U;
+        if (padded > body_len - offset)
+            break;
+        offset += padded;
+    }
+
+    SCLogDebug("interface %u: datalink %d, snaplen %u, ts units %"PRIu64
+               ", name \"%s\"", pfm->nifaces, pif->datalink, pif->snaplen,
+               pif->ts_units, pif->name);
+    pfm->nifaces++;
+    return 0;
+}
+
+/** \brief convert a pcapng timestamp of an interface */
+static void PcapFileMmapNgSetTs(const PcapFileMmapIf *pif, uint64_t ts,
+                                PcapFileMmapPkt *rec)
+{
+    uint64_t sec = ts / pif->ts_units;
+    uint64_t frac = ts % pif->ts_units;
+    uint32_t nsec;
+
+    if (pif->ts_units <= 1000000000ULL) {
+        /* frac < 1e9, can't overflow */
+        nsec = (uint32_t)(frac * 1000000000ULL / pif->ts_units);
+    } else {
+        nsec = (uint32_t)((double)frac * 1000000000.0 / (double)pif->ts_units);
+    }
+
+    rec->h.ts.tv_sec = (time_t)((int64_t)sec + pif->ts_offset);
+    rec->h.ts.tv_usec = nsec / 1000;
+    rec->nsec = nsec;
+}
+
+/** \brief handle a pcapng Enhanced, Simple or obsolete Packet Block */
+static int PcapFileMmapNgPacket(PcapFileMmap *pfm, uint32_t type,
+                                uint8_t *body, uint32_t body_len,
+                                PcapFileMmapPkt *rec, uint8_t **pkt)
+{
+    uint32_t if_id = 0, ts_hi = 0, ts_lo = 0, caplen, len, hdr_len;
+
+    if (type == PCAPNG_BLOCK_SPB) {
+        hdr_len = 4;
+        if (body_len < hdr_len)
+            return -1;
+        memcpy(&len, body, sizeof(len));
+        len = SWAP32(pfm, len);
+        /* no captured length, it's the original length capped to the
+         * snaplen of the interface and to the block */
+        caplen = len;
+        if (pfm->nifaces > 0 && pfm->ifaces[0].snaplen != 0)
+            caplen = MIN(caplen, pfm->ifaces[0].snaplen);
+        caplen = MIN(caplen, body_len - hdr_len);
+    } else {
+        uint32_t f[5];
+        hdr_len = sizeof(f);
+        if (body_len < hdr_len)
+            return -1;
+        memcpy(f, body, sizeof(f));
+        if (type == PCAPNG_BLOCK_EPB) {
+            if_id = SWAP32(pfm, f[0]);
+        } else {
+            /* 16 bit interface id and drops count */
+            uint16_t id16;
+            memcpy(&id16, body, sizeof(id16));
+            if_id = SWAP16(pfm, id16);
+        }
+        ts_hi = SWAP32(pfm, f[1]);
+        ts_lo = SWAP32(pfm, f[2]);
+        caplen = SWAP32(pfm, f[3]);
+        len = SWAP32(pfm, f[4]);
+        if (caplen > body_len - hdr_len)
+            return -1;
+    }
+
+    if (if_id >= pfm->nifaces) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "packet of unknown interface %u "
+                     "at offset %"PRIuMAX, if_id, (uintmax_t)pfm->offset);
+        return -1;
+    }
+    if (caplen > PCAP_FILE_MMAP_MAX_SNAPLEN) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid record length %u at offset %"
+                     PRIuMAX, caplen, (uintmax_t)pfm->offset);
+        return -1;
+    }
+
+    const PcapFileMmapIf *pif = &pfm->ifaces[if_id];
+    if (type == PCAPNG_BLOCK_SPB) {
+        /* no timestamp, use the one of the previous packet so time
+         * doesn't go back */
+        rec->h.ts = pfm->last_ts;
+        rec->nsec = pfm->last_nsec;
+    } else {
+        PcapFileMmapNgSetTs(pif, ((uint64_t)ts_hi << 32) | ts_lo, rec);
+        pfm->last_ts = rec->h.ts;
+        pfm->last_nsec = rec->nsec;
+    }
+    rec->h.caplen = caplen;
+    rec->h.len = len;
+    rec->if_id = if_id;
+    rec->datalink = pif->datalink;
+
+    *pkt = body + hdr_len;
+    return 0;
+}
+
+/**
+ * \brief walk the pcapng blocks up to the next packet
+ *
+ * \param peek stop before the packet instead of returning it
+ *
+ * \retval 1 a packet was read (or is next when peeking)
+ * \retval 0 end of file
+ * \retval -1 truncated or corrupted block
+ */
+static int PcapFileMmapNgNext(PcapFileMmap *pfm, PcapFileMmapPkt *rec,
+                              uint8_t **pkt, int peek)
+{
+    while (pfm->offset < pfm->size) {
+        uint8_t *block = pfm->map + pfm->offset;
+        size_t avail = pfm->size - pfm->offset;
+        PcapFileMmapNgBlockHdr bh;
+
+        if (avail < PCAPNG_BLOCK_MIN_LEN) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated block header at "
+                         "offset %"PRIuMAX, (uintmax_t)pfm->offset);
+            return -1;
+        }
+        memcpy(&bh, block, sizeof(bh));
+
+        /* the type is the same in both byte orders, the section
+         * sets the byte order of what follows, its length included */
+        if (bh.type == PCAPNG_BLOCK_SHB) {
+            if (PcapFileMmapNgSection(pfm, block, avail) < 0) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid section header "
+                             "at offset %"PRIuMAX, (uintmax_t)pfm->offset);
+                return -1;
+            }
+        }
+
+        const uint32_t type = SWAP32(pfm, bh.type);
+        const uint32_t len = SWAP32(pfm, bh.len);
+        if (len < PCAPNG_BLOCK_MIN_LEN || (len & 3) || len > avail) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid block length %u at "
+                         "offset %"PRIuMAX, len, (uintmax_t)pfm->offset);
+            return -1;
+        }
+        uint8_t *body = block + sizeof(bh);
+        const uint32_t body_len = len - PCAPNG_BLOCK_MIN_LEN;
+
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                if (PcapFileMmapNgInterface(pfm, body, body_len) < 0) {
+                    SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid interface "
+                                 "block at offset %"PRIuMAX, (uintmax_t)pfm->offset);
+                    return -1;
+                }
+                break;
+            case PCAPNG_BLOCK_EPB:
+            case PCAPNG_BLOCK_SPB:
+            case PCAPNG_BLOCK_PB:
+                if (peek)
+                    return 1;
+                if (PcapFileMmapNgPacket(pfm, type, body, body_len, rec, pkt) < 0) {
+                    SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid packet block "
+                                 "at offset %"PRIuMAX, (uintmax_t)pfm->offset);
+                    return -1;
+                }
+                pfm->offset += len;
+                return 1;
+            default:
+                /* section header, name resolution, statistics... */
+                break;
+        }
+        pfm->offset += len;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief get the next record of the file
+ *
+ * \param rec the record, its length, timestamp and interface
+ * \param pkt set to the record data, inside the mapping
+ *
+ * \retval 1 a record was read
+ * \retval 0 end of file
+ * \retval -1 truncated or corrupted record
+ */
+int PcapFileMmapNext(PcapFileMmap *pfm, PcapFileMmapPkt *r, uint8_t **pkt)
+{
+    PcapFileMmapRecHdr rec;
+
+    if (pfm->pcapng)
+        return PcapFileMmapNgNext(pfm, r, pkt, 0);
+
+    if (pfm->offset == pfm->size)
+        return 0;
+
+    if (pfm->size - pfm->offset < sizeof(rec)) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated record header at offset %"
+                     PRIuMAX, (uintmax_t)pfm->offset);
+        return -1;
+    }
+
+    memcpy(&rec, pfm->map + pfm->offset, sizeof(rec));
+    const uint32_t caplen = SWAP32(pfm, rec.caplen);
+    if (caplen > PCAP_FILE_MMAP_MAX_SNAPLEN) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "invalid record length %u at offset %"
+                     PRIuMAX, caplen, (uintmax_t)pfm->offset);
+        return -1;
+    }
+    if (pfm->size - pfm->offset - sizeof(rec) < caplen) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "truncated record at offset %"
+                     PRIuMAX, (uintmax_t)pfm->offset);
+        return -1;
+    }
+
+    r->h.ts.tv_sec = SWAP32(pfm, rec.ts_sec);
+    if (pfm->nsec) {
+        r->nsec = SWAP32(pfm, rec.ts_frac);
+    } else {
+        r->nsec = SWAP32(pfm, rec.ts_frac) * 1000;
+    }
+    r->h.ts.tv_usec = r->nsec / 1000;
+    r->h.caplen = caplen;
+    r->h.len = SWAP32(pfm, rec.len);
+    r->if_id = 0;
+    r->datalink = pfm->datalink;
+
+    *pkt = pfm->map + pfm->offset + sizeof(rec);
+    pfm->offset += sizeof(rec) + caplen;
+    return 1;
+}
+
+/** \brief get a pcapng interface of the current section
+ *
+ *  \retval pif interface or NULL if not known */
+const PcapFileMmapIf *PcapFileMmapGetIf(const PcapFileMmap *pfm, uint32_t if_id)
+{
+    if (if_id >= pfm->nifaces)
+        return NULL;
+    return &pfm->ifaces[if_id];
+}
+
+/** \brief take a reference for a packet pointing into the mapping */
+void PcapFileMmapRef(PcapFileMmap *pfm)
+{
+    (void) SC_ATOMIC_ADD(pfm->ref, 1);
+}
+
+/** \brief release a reference, unmaps the file on the last one */
+void PcapFileMmapDeref(PcapFileMmap *pfm)
+{
+    if (SC_ATOMIC_SUB(pfm->ref, 1) == 0) {
+        SCLogDebug("unmapping %p", pfm->map);
+        munmap(pfm->map, pfm->size);
+        close(pfm->fd);
+        if (pfm->ifaces != NULL)
+            SCFree(pfm->ifaces);
+        SC_ATOMIC_DESTROY(pfm->ref);
+        SCFree(pfm);
+    }
+}
+
+/**
+ * \brief reader is done with the file
+ *
+ * Mapping is released once all packets using it are released.
+ */
+void PcapFileMmapClose(PcapFileMmap *pfm)
+{
+    if (pfm == NULL || pfm->closed)
+        return;
+    pfm->closed = 1;
+    PcapFileMmapDeref(pfm);
+}
+
+#ifdef UNITTESTS
+static const uint8_t pcap_test_pkt[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+
+/** \internal
+ *  \brief write a pcap file with two records, the 2nd is truncated if
+ *         truncate is set */
+static int PcapFileMmapTestWrite(char *path, uint32_t magic, int swap, int truncate)
+{
+    strlcpy(path, "/tmp/suricata-mmap-XXXXXX", 32);
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+
+#define T32(x) (swap ? SCByteSwap32(x) : (x))
+#define T16(x) (swap ? SCByteSwap16(x) : (x))
+    PcapFileMmapHdr hdr = { T32(magic), T16(2), T16(4), 0, 0,
+                            T32(65535), T32(1) };
+    PcapFileMmapRecHdr rec1 = { T32(1000), T32(2000), T32(sizeof(pcap_test_pkt)),
+                                T32(60) };
+    PcapFileMmapRecHdr rec2 = { T32(1001), T32(3000), T32(sizeof(pcap_test_pkt)),
+                                T32(sizeof(pcap_test_pkt)) };
+#undef T32
+#undef T16
+    int r = 0;
+    r |= write(fd, &hdr, sizeof(hdr)) != sizeof(hdr);
+    r |= write(fd, &rec1, sizeof(rec1)) != sizeof(rec1);
+    r |= write(fd, pcap_test_pkt, sizeof(pcap_test_pkt)) != sizeof(pcap_test_pkt);
+    r |= write(fd, &rec2, sizeof(rec2)) != sizeof(rec2);
+    size_t len = truncate ? 2 : sizeof(pcap_test_pkt);
+    r |= write(fd, pcap_test_pkt, len) != (ssize_t)len;
+    close(fd);
+    return r ? -1 : 0;
+}
+
+static int PcapFileMmapTestRead(uint32_t magic, int swap, uint32_t usec)
+{
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+    PcapFileMmapPkt rec;
+    uint8_t *pkt = NULL;
+
+    FAIL_IF(PcapFileMmapTestWrite(path, magic, swap, 0) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != 0);
+    unlink(path);
+    FAIL_IF(pfm->datalink != 1);
+    FAIL_IF(pfm->snaplen != 65535);
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.h.ts.tv_sec != 1000);
+    FAIL_IF(rec.h.ts.tv_usec != (suseconds_t)usec);
+    FAIL_IF(rec.h.caplen != sizeof(pcap_test_pkt));
+    FAIL_IF(rec.h.len != 60);
+    FAIL_IF(memcmp(pkt, pcap_test_pkt, sizeof(pcap_test_pkt)) != 0);
+
+    /* a packet keeps the mapping alive after close */
+    PcapFileMmapRef(pfm);
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.h.ts.tv_sec != 1001);
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 0);
+    PcapFileMmapClose(pfm);
+    FAIL_IF(memcmp(pkt, pcap_test_pkt, sizeof(pcap_test_pkt)) != 0);
+    PcapFileMmapDeref(pfm);
+    PASS;
+}
+
+/** \test microsecond file in host byte order */
+static int PcapFileMmapTest01(void)
+{
+    return PcapFileMmapTestRead(PCAP_MAGIC, 0, 2000);
+}
+
+/** \test nanosecond file in the other byte order */
+static int PcapFileMmapTest02(void)
+{
+    return PcapFileMmapTestRead(PCAP_MAGIC_NSEC, 1, 2);
+}
+
+/** \test truncated record */
+static int PcapFileMmapTest03(void)
+{
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+    PcapFileMmapPkt rec;
+    uint8_t *pkt = NULL;
+
+    FAIL_IF(PcapFileMmapTestWrite(path, PCAP_MAGIC, 0, 1) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != 0);
+    unlink(path);
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != -1);
+    PcapFileMmapClose(pfm);
+    PASS;
+}
+
+/** \test unknown magic is left to libpcap */
+static int PcapFileMmapTest04(void)
+{
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+
+    FAIL_IF(PcapFileMmapTestWrite(path, 0x12345678, 0, 0) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != PCAP_FILE_MMAP_UNSUPPORTED);
+    unlink(path);
+    FAIL_IF_NOT_NULL(pfm);
+    PASS;
+}
+/** \internal
+ *  \brief append a pcapng block, body is padded to 32 bits */
+static size_t PcapFileMmapNgTestBlock(uint8_t *buf, size_t off, int swap,
+                                      uint32_t type, const void *body,
+                                      uint32_t body_len)
+{
+    uint32_t padded = (body_len + 3) & ~3U;
+    uint32_t len = padded + PCAPNG_BLOCK_MIN_LEN;
+    uint32_t t = swap ? SCByteSwap32(type) : type;
+    uint32_t l = swap ? SCByteSwap32(len) : len;
+
+    memcpy(buf + off, &t, sizeof(t));
+    memcpy(buf + off + 4, &l, sizeof(l));
+    memset(buf + off + 8, 0x00, padded);
+    memcpy(buf + off + 8, body, body_len);
+    memcpy(buf + off + 8 + padded, &l, sizeof(l));
+    return off + len;
+}
+
+#define T32(x) (swap ? SCByteSwap32(x) : (x))
+#define T16(x) (swap ? SCByteSwap16(x) : (x))
+
+static size_t PcapFileMmapNgTestSHB(uint8_t *buf, size_t off, int swap)
+{
+    uint32_t shb[4] = { T32(PCAPNG_BYTE_ORDER_MAGIC), 0, 0xffffffff, 0xffffffff };
+    uint16_t version[2] = { T16(1), T16(0) };
+    memcpy(&shb[1], version, sizeof(version));
+    return PcapFileMmapNgTestBlock(buf, off, swap, PCAPNG_BLOCK_SHB, shb, sizeof(shb));
+}
+
+/** \internal
+ *  \brief append an IDB, with if_name and if_tsresol options if set */
+static size_t PcapFileMmapNgTestIDB(uint8_t *buf, size_t off, int swap,
+                                    uint16_t linktype, const char *name,
+                                    int tsresol)
+{
+    uint8_t body[64];
+    uint32_t len = 0;
+    uint16_t v16;
+    uint32_t v32;
+
+    memset(body, 0x00, sizeof(body));
+    v16 = T16(linktype);
+    memcpy(body, &v16, sizeof(v16));
+    v32 = T32(65535);
+    memcpy(body + 4, &v32, sizeof(v32));
+    len = 8;
+    if (name != NULL) {
+        uint16_t opt[2] = { T16(PCAPNG_OPT_IF_NAME), T16(strlen(name)) };
+        memcpy(body + len, opt, sizeof(opt));
+        memcpy(body + len + 4, name, strlen(name));
+        len += 4 + ((strlen(name) + 3) & ~3U);
+    }
+    if (tsresol >= 0) {
+        uint16_t opt[2] = { T16(PCAPNG_OPT_IF_TSRESOL), T16(1) };
+        memcpy(body + len, opt, sizeof(opt));
+        body[len + 4] = (uint8_t)tsresol;
+        len += 8;
+    }
+    return PcapFileMmapNgTestBlock(buf, off, swap, PCAPNG_BLOCK_IDB, body, len);
+}
+
+static size_t PcapFileMmapNgTestEPB(uint8_t *buf, size_t off, int swap,
+                                    uint32_t if_id, uint64_t ts)
+{
+    uint8_t body[20 + sizeof(pcap_test_pkt)];
+    uint32_t f[5] = { T32(if_id), T32((uint32_t)(ts >> 32)), T32((uint32_t)ts),
+                      T32(sizeof(pcap_test_pkt)), T32(sizeof(pcap_test_pkt)) };
+    memcpy(body, f, sizeof(f));
+    memcpy(body + sizeof(f), pcap_test_pkt, sizeof(pcap_test_pkt));
+    return PcapFileMmapNgTestBlock(buf, off, swap, PCAPNG_BLOCK_EPB, body, sizeof(body));
+}
+
+#undef T32
+#undef T16
+
+static int PcapFileMmapNgTestWriteFile(char *path, const uint8_t *buf, size_t len)
+{
+    strlcpy(path, "/tmp/suricata-mmap-XXXXXX", 32);
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    int r = write(fd, buf, len) != (ssize_t)len;
+    close(fd);
+    return r ? -1 : 0;
+}
+
+/** \test pcapng with two interfaces of different link types and
+ *        timestamp resolutions, and a simple packet block */
+static int PcapFileMmapTest05(void)
+{
+    uint8_t buf[1024];
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+    PcapFileMmapPkt rec;
+    uint8_t *pkt = NULL;
+    size_t off = 0;
+
+    off = PcapFileMmapNgTestSHB(buf, off, 0);
+    /* nanoseconds */
+    off = PcapFileMmapNgTestIDB(buf, off, 0, 1, "eth0", 9);
+    /* default, microseconds */
+    off = PcapFileMmapNgTestIDB(buf, off, 0, 101, NULL, -1);
+    off = PcapFileMmapNgTestEPB(buf, off, 0, 0, 1000123456789ULL);
+    off = PcapFileMmapNgTestEPB(buf, off, 0, 1, 2000000002ULL);
+    uint8_t spb[4 + sizeof(pcap_test_pkt)];
+    uint32_t origlen = sizeof(pcap_test_pkt);
+    memcpy(spb, &origlen, sizeof(origlen));
+    memcpy(spb + 4, pcap_test_pkt, sizeof(pcap_test_pkt));
+    off = PcapFileMmapNgTestBlock(buf, off, 0, PCAPNG_BLOCK_SPB, spb, sizeof(spb));
+
+    FAIL_IF(PcapFileMmapNgTestWriteFile(path, buf, off) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != 0);
+    unlink(path);
+    FAIL_IF(pfm->pcapng != 1);
+    FAIL_IF(pfm->datalink != 1);
+    FAIL_IF(pfm->nifaces != 2);
+    FAIL_IF(strcmp(PcapFileMmapGetIf(pfm, 0)->name, "eth0") != 0);
+    FAIL_IF(PcapFileMmapGetIf(pfm, 1)->datalink != 101);
+    FAIL_IF_NOT_NULL(PcapFileMmapGetIf(pfm, 2));
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.if_id != 0);
+    FAIL_IF(rec.datalink != 1);
+    FAIL_IF(rec.h.ts.tv_sec != 1000);
+    FAIL_IF(rec.nsec != 123456789);
+    FAIL_IF(rec.h.ts.tv_usec != 123456);
+    FAIL_IF(rec.h.caplen != sizeof(pcap_test_pkt));
+    FAIL_IF(memcmp(pkt, pcap_test_pkt, sizeof(pcap_test_pkt)) != 0);
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.if_id != 1);
+    FAIL_IF(rec.datalink != 101);
+    FAIL_IF(rec.h.ts.tv_sec != 2000);
+    FAIL_IF(rec.h.ts.tv_usec != 2);
+
+    /* simple packet block: interface 0, previous timestamp */
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.if_id != 0);
+    FAIL_IF(rec.h.ts.tv_sec != 2000);
+    FAIL_IF(rec.h.len != sizeof(pcap_test_pkt));
+    FAIL_IF(rec.h.caplen != sizeof(pcap_test_pkt));
+    FAIL_IF(memcmp(pkt, pcap_test_pkt, sizeof(pcap_test_pkt)) != 0);
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 0);
+    PcapFileMmapClose(pfm);
+    PASS;
+}
+
+/** \test a new section in the other byte order resets the interfaces */
+static int PcapFileMmapTest06(void)
+{
+    uint8_t buf[1024];
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+    PcapFileMmapPkt rec;
+    uint8_t *pkt = NULL;
+    size_t off = 0;
+
+    off = PcapFileMmapNgTestSHB(buf, off, 0);
+    off = PcapFileMmapNgTestIDB(buf, off, 0, 1, NULL, -1);
+    off = PcapFileMmapNgTestIDB(buf, off, 0, 1, NULL, -1);
+    off = PcapFileMmapNgTestEPB(buf, off, 0, 1, 1000000000ULL);
+    off = PcapFileMmapNgTestSHB(buf, off, 1);
+    /* 2^-10 resolution */
+    off = PcapFileMmapNgTestIDB(buf, off, 1, 113, "any", 0x8a);
+    off = PcapFileMmapNgTestEPB(buf, off, 1, 0, (1001ULL << 10) | 512);
+
+    FAIL_IF(PcapFileMmapNgTestWriteFile(path, buf, off) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != 0);
+    unlink(path);
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(rec.if_id != 1);
+    FAIL_IF(rec.h.ts.tv_sec != 1000);
+    uint32_t section = pfm->section;
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 1);
+    FAIL_IF(pfm->section == section);
+    FAIL_IF(pfm->swapped != 1);
+    FAIL_IF(pfm->nifaces != 1);
+    FAIL_IF(rec.if_id != 0);
+    FAIL_IF(rec.datalink != 113);
+    FAIL_IF(rec.h.ts.tv_sec != 1001);
+    FAIL_IF(rec.nsec != 500000000);
+    FAIL_IF(rec.h.caplen != sizeof(pcap_test_pkt));
+
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != 0);
+    PcapFileMmapClose(pfm);
+    PASS;
+}
+
+/** \test packet of an interface that wasn't described */
+static int PcapFileMmapTest07(void)
+{
+    uint8_t buf[1024];
+    char path[32];
+    PcapFileMmap *pfm = NULL;
+    PcapFileMmapPkt rec;
+    uint8_t *pkt = NULL;
+    size_t off = 0;
+
+    off = PcapFileMmapNgTestSHB(buf, off, 0);
+    off = PcapFileMmapNgTestIDB(buf, off, 0, 1, NULL, -1);
+    off = PcapFileMmapNgTestEPB(buf, off, 0, 3, 1000000000ULL);
+
+    FAIL_IF(PcapFileMmapNgTestWriteFile(path, buf, off) != 0);
+    FAIL_IF(PcapFileMmapOpen(path, &pfm) != 0);
+    unlink(path);
+    FAIL_IF(PcapFileMmapNext(pfm, &rec, &pkt) != -1);
+    PcapFileMmapClose(pfm);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapFileMmapRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileMmapTest01", PcapFileMmapTest01);
+    UtRegisterTest("PcapFileMmapTest02", PcapFileMmapTest02);
+    UtRegisterTest("PcapFileMmapTest03", PcapFileMmapTest03);
+    UtRegisterTest("PcapFileMmapTest04", PcapFileMmapTest04);
+    UtRegisterTest("PcapFileMmapTest05", PcapFileMmapTest05);
+    UtRegisterTest("PcapFileMmapTest06", PcapFileMmapTest06);
+    UtRegisterTest("PcapFileMmapTest07", PcapFileMmapTest07);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,131 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * mmap based reader for pcap and pcapng files
+ */
+
+#ifndef __SOURCE_PCAP_FILE_MMAP_H__
+#define __SOURCE_PCAP_FILE_MMAP_H__
+
+/** classic pcap file header, see pcap-savefile(5) */
+typedef struct PcapFileMmapHdr_ {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} PcapFileMmapHdr;
+
+/** classic pcap record header */
+typedef struct PcapFileMmapRecHdr_ {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} PcapFileMmapRecHdr;
+
+/** pcapng generic block header */
+typedef struct PcapFileMmapNgBlockHdr_ {
+    uint32_t type;
+    uint32_t len;
+} PcapFileMmapNgBlockHdr;
+
+#define PCAP_FILE_MMAP_IFNAME_LEN 64
+
+/** pcapng interface, from an Interface Description Block */
+typedef struct PcapFileMmapIf_ {
+    int datalink;
+    uint32_t snaplen;
+    /** timestamp units per second, if_tsresol */
+    uint64_t ts_units;
+    /** seconds to add to the timestamps, if_tsoffset */
+    int64_t ts_offset;
+    /** if_name, empty if not set */
+    char name[PCAP_FILE_MMAP_IFNAME_LEN];
+} PcapFileMmapIf;
+
+/** record as returned by the reader */
+typedef struct PcapFileMmapPkt_ {
+    /** lengths and timestamp, truncated to microseconds */
+    struct pcap_pkthdr h;
+    /** sub second part of the timestamp in nanoseconds */
+    uint32_t nsec;
+    /** pcapng interface of the record, 0 for pcap */
+    uint32_t if_id;
+    int datalink;
+} PcapFileMmapPkt;
+
+/** a mapped pcap or pcapng file
+ *
+ *  Packets point into the mapping, so it is only unmapped once the
+ *  file is closed and all packets are released. */
+typedef struct PcapFileMmap_ {
+    int fd;
+    uint8_t *map;
+    size_t size;
+    /** offset of the next record */
+    size_t offset;
+
+    /** datalink and snaplen of the file, of the first interface for
+     *  pcapng */
+    int datalink;
+    uint32_t snaplen;
+    /** file (pcapng: current section) was written with the other byte
+     *  order */
+    uint8_t swapped;
+    /** timestamps are in nanoseconds */
+    uint8_t nsec;
+    /** set when the reader is done with the file */
+    uint8_t closed;
+    /** file is pcapng */
+    uint8_t pcapng;
+
+    /** pcapng interfaces of the current section */
+    PcapFileMmapIf *ifaces;
+    uint32_t nifaces;
+    uint32_t ifaces_size;
+    /** bumped on every section header, interface ids restart */
+    uint32_t section;
+    /** timestamp of the last packet, for blocks without one */
+    struct timeval last_ts;
+    uint32_t last_nsec;
+
+    /** reader reference + one reference per packet in flight */
+    SC_ATOMIC_DECLARE(uint32_t, ref);
+} PcapFileMmap;
+
+enum {
+    PCAP_FILE_MMAP_ERROR = -1,
+    /** the file is not a pcap or pcapng file we handle, use libpcap */
+    PCAP_FILE_MMAP_UNSUPPORTED = -2,
+};
+
+int PcapFileMmapOpen(const char *filename, PcapFileMmap **ppfm);
+int PcapFileMmapNext(PcapFileMmap *pfm, PcapFileMmapPkt *rec, uint8_t **pkt);
+const PcapFileMmapIf *PcapFileMmapGetIf(const PcapFileMmap *pfm, uint32_t if_id);
+void PcapFileMmapRef(PcapFileMmap *pfm);
+void PcapFileMmapDeref(PcapFileMmap *pfm);
+void PcapFileMmapClose(PcapFileMmap *pfm);
+
+void PcapFileMmapRegisterTests(void);
+
+#endif /* __SOURCE_PCAP_FILE_MMAP_H__ */
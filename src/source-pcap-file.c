@@ -26,11 +26,13 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "packet-queue.h"
 #include "threads.h"
 #include "threadvars.h"
 #include "tm-queuehandlers.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-mmap.h"
 #include "util-time.h"
 #include "util-debug.h"
 #include "conf.h"
@@ -43,8 +45,11 @@
 #include "util-profiling.h"
 #include "runmode-unix-socket.h"
 #include "util-checksum.h"
+#include "util-byte.h"
 #include "util-atomic.h"
 
+#include <dirent.h>
+
 #ifdef __SC_CUDA_SUPPORT__
 
 #include "util-cuda.h"
@@ -59,20 +64,61 @@
 
 extern int max_pending_packets;
 
+typedef int (*PcapFileDecoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
+
+#define PCAP_FILE_MAX_IF_TENANTS 32
+
+/** tenant of the packets of a pcapng interface */
+typedef struct PcapFileIfTenant_ {
+    /** interface id, -1 to match on the interface name */
+    int64_t if_id;
+    char name[PCAP_FILE_MMAP_IFNAME_LEN];
+    uint32_t tenant_id;
+} PcapFileIfTenant;
+
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
-    int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
-    int datalink;
-    struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
-    ChecksumValidationMode checksum_mode;
+    /** mode of all the readers, auto mode turns it to disable */
+    SC_ATOMIC_DECLARE(int, checksum_mode);
+    /** packets of all the readers, counted in auto mode as the invalid
+     *  checksums are counted for all of them */
+    SC_ATOMIC_DECLARE(unsigned int, pkts);
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
 
+    PcapFileIfTenant if_tenants[PCAP_FILE_MAX_IF_TENANTS];
+    int if_tenants_cnt;
 } PcapFileGlobalVars;
 
+/** reader slot of the multi reader mode */
+typedef struct PcapFileMergeReader_ {
+    /** files to read, in order */
+    char **files;
+    int nfiles;
+    /** queue the reader hands its packets to the merge thread on */
+    PacketQueue *pq;
+    /** set once the reader queued its last packet */
+    SC_ATOMIC_DECLARE(int, done);
+} PcapFileMergeReader;
+
+typedef struct PcapFileMergeCtx_ {
+    PcapFileMergeReader *readers;
+    int nreaders;
+    /** merge the readers output in timestamp order */
+    int ordered;
+    SC_ATOMIC_DECLARE(int, reader_next);
+    SC_ATOMIC_DECLARE(int, done_cnt);
+} PcapFileMergeCtx;
+
 typedef struct PcapFileThreadVars_
 {
+    pcap_t *pcap_handle;
+    /** set if the file is read by the mmap reader instead of libpcap */
+    PcapFileMmap *mmap;
+    int use_bpf;
+    int datalink;
+    struct bpf_program filter;
+    uint64_t cnt; /** packet counter */
+
     uint32_t tenant_id;
 
     /* counters */
@@ -87,9 +133,34 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /** reader slot in the multi reader mode, NULL otherwise */
+    PcapFileMergeReader *reader;
+    int file_idx;
+
+    /** tenant per pcapng interface of the current section, for the
+     *  first if_tenants_cnt interfaces */
+    uint32_t *if_tenants;
+    uint32_t if_tenants_cnt;
+    uint32_t if_tenants_size;
+    uint32_t if_tenants_section;
 } PcapFileThreadVars;
 
+typedef struct PcapFileMergeThreadVars_
+{
+    ThreadVars *tv;
+    TmSlot *slot;
+
+    /** next packet of each reader, taken off its queue */
+    Packet **head;
+    /** set once a reader is done and its queue empty */
+    uint8_t *drained;
+
+    uint64_t cnt;
+} PcapFileMergeThreadVars;
+
 static PcapFileGlobalVars pcap_g;
+static PcapFileMergeCtx pcap_merge;
 
 TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
 
@@ -101,6 +172,12 @@ TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueu
 TmEcode DecodePcapFileThreadInit(ThreadVars *, const void *, void **);
 TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data);
 
+TmEcode PcapFileMergeLoop(ThreadVars *, void *, void *);
+TmEcode PcapFileMergeBreakLoop(ThreadVars *, void *);
+TmEcode PcapFileMergeThreadInit(ThreadVars *, const void *, void **);
+void PcapFileMergeThreadExitStats(ThreadVars *, void *);
+TmEcode PcapFileMergeThreadDeinit(ThreadVars *, void *);
+
 void TmModuleReceivePcapFileRegister (void)
 {
     tmm_modules[TMM_RECEIVEPCAPFILE].name = "ReceivePcapFile";
@@ -127,17 +204,312 @@ void TmModuleDecodePcapFileRegister (void)
     tmm_modules[TMM_DECODEPCAPFILE].flags = TM_FLAG_DECODE_TM;
 }
 
+void TmModulePcapFileMergeRegister (void)
+{
+    tmm_modules[TMM_PCAPFILEMERGE].name = "PcapFileMerge";
+    tmm_modules[TMM_PCAPFILEMERGE].ThreadInit = PcapFileMergeThreadInit;
+    tmm_modules[TMM_PCAPFILEMERGE].Func = NULL;
+    tmm_modules[TMM_PCAPFILEMERGE].PktAcqLoop = PcapFileMergeLoop;
+    tmm_modules[TMM_PCAPFILEMERGE].PktAcqBreakLoop = PcapFileMergeBreakLoop;
+    tmm_modules[TMM_PCAPFILEMERGE].ThreadExitPrintStats = PcapFileMergeThreadExitStats;
+    tmm_modules[TMM_PCAPFILEMERGE].ThreadDeinit = PcapFileMergeThreadDeinit;
+    tmm_modules[TMM_PCAPFILEMERGE].RegisterTests = NULL;
+    tmm_modules[TMM_PCAPFILEMERGE].cap_flags = 0;
+    tmm_modules[TMM_PCAPFILEMERGE].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/** \brief parse the pcap-file.interface-tenants mappings */
+static void PcapFileParseIfTenants(void)
+{
+    ConfNode *root = ConfGetNode("pcap-file.interface-tenants");
+    ConfNode *node = NULL;
+
+    if (root == NULL)
+        return;
+
+    TAILQ_FOREACH(node, &root->head, next) {
+        const char *iface = ConfNodeLookupChildValue(node, "interface");
+        const char *tenant = ConfNodeLookupChildValue(node, "tenant-id");
+        uint32_t tenant_id = 0;
+        uint32_t if_id = 0;
+
+        if (iface == NULL || tenant == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.interface-tenants "
+                       "entries need 'interface' and 'tenant-id'");
+            continue;
+        }
+        if (ByteExtractStringUint32(&tenant_id, 10, strlen(tenant), tenant) <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "tenant-id %s is invalid", tenant);
+            continue;
+        }
+        if (pcap_g.if_tenants_cnt == PCAP_FILE_MAX_IF_TENANTS) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "only %d pcap-file."
+                         "interface-tenants supported", PCAP_FILE_MAX_IF_TENANTS);
+            break;
+        }
+
+        PcapFileIfTenant *t = &pcap_g.if_tenants[pcap_g.if_tenants_cnt];
+        if (ByteExtractStringUint32(&if_id, 10, strlen(iface), iface) ==
+                (int)strlen(iface)) {
+            t->if_id = if_id;
+        } else {
+            t->if_id = -1;
+            strlcpy(t->name, iface, sizeof(t->name));
+        }
+        t->tenant_id = tenant_id;
+        pcap_g.if_tenants_cnt++;
+        SCLogConfig("pcapng interface %s connected to tenant-id %u", iface,
+                    tenant_id);
+    }
+}
+
 void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SC_ATOMIC_INIT(pcap_g.checksum_mode);
+    SC_ATOMIC_INIT(pcap_g.pkts);
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+
+    PcapFileParseIfTenants();
 }
 
-static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
+static PcapFileDecoder PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernetFast;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_RAW:
+        case LINKTYPE_RAW2:
+            return DecodeRaw;
+        case LINKTYPE_NULL:
+            return DecodeNull;
+        default:
+            return NULL;
+    }
+}
+
+/** \brief release a packet pointing into the mapped file */
+static void PcapFileMmapReleasePacket(Packet *p)
+{
+    if (p->pcap_v.mmap != NULL) {
+        PcapFileMmapDeref(p->pcap_v.mmap);
+        p->pcap_v.mmap = NULL;
+    }
+    PacketFreeOrRelease(p);
+}
+
+/** \brief close the file, whatever the reader */
+static void PcapFileClose(PcapFileThreadVars *ptv)
+{
+    /* packets still in flight keep their own reference on the mapping */
+    if (ptv->mmap != NULL) {
+        PcapFileMmapClose(ptv->mmap);
+        ptv->mmap = NULL;
+    }
+    if (ptv->pcap_handle != NULL) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+    }
+    pcap_freecode(&ptv->filter);
+    memset(&ptv->filter, 0x00, sizeof(ptv->filter));
+    ptv->use_bpf = 0;
+    ptv->if_tenants_cnt = 0;
+}
+
+/**
+ * \brief open a file with the mmap reader or libpcap and set up the
+ *        bpf filter for it
+ *
+ * \retval TM_ECODE_OK on success
+ * \retval TM_ECODE_DONE if the datalink is not supported
+ * \retval TM_ECODE_FAILED on error
+ */
+static TmEcode PcapFileOpen(PcapFileThreadVars *ptv, const char *filename)
+{
+    const char *tmpbpfstring = NULL;
+
+    int use_mmap = 0;
+    if (ConfGetBool("pcap-file.mmap", &use_mmap) != 1) {
+        use_mmap = 0;
+    }
+    if (use_mmap) {
+        int r = PcapFileMmapOpen(filename, &ptv->mmap);
+        if (r == PCAP_FILE_MMAP_ERROR) {
+            return TM_ECODE_FAILED;
+        } else if (r == PCAP_FILE_MMAP_UNSUPPORTED) {
+            SCLogInfo("file format not supported by the mmap reader, "
+                      "using libpcap");
+            ptv->mmap = NULL;
+        } else {
+            SCLogInfo("using mmap reader");
+        }
+    }
+
+    if (ptv->mmap == NULL) {
+        char errbuf[PCAP_ERRBUF_SIZE] = "";
+        ptv->pcap_handle = pcap_open_offline(filename, errbuf);
+        if (ptv->pcap_handle == NULL) {
+            SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+            return TM_ECODE_FAILED;
+        }
+        ptv->datalink = pcap_datalink(ptv->pcap_handle);
+    } else {
+        ptv->datalink = ptv->mmap->datalink;
+    }
+
+    SCLogDebug("datalink %" PRId32 "", ptv->datalink);
+
+    if (PcapFileGetDecoder(ptv->datalink) == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.\n", ptv->datalink);
+        PcapFileClose(ptv);
+        return TM_ECODE_DONE;
+    }
+
+    ptv->use_bpf = 0;
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        if (ptv->mmap != NULL) {
+            /* no libpcap handle, compile for the file link type and
+             * filter records ourselves */
+            pcap_t *dead = pcap_open_dead(ptv->datalink,
+                    ptv->mmap->snaplen ? (int)ptv->mmap->snaplen : 65535);
+            if (dead == NULL ||
+                    pcap_compile(dead, &ptv->filter, (char *)tmpbpfstring, 1, 0) < 0) {
+                SCLogError(SC_ERR_BPF,"bpf compilation error %s",
+                        dead ? pcap_geterr(dead) : "no memory");
+                if (dead != NULL)
+                    pcap_close(dead);
+                PcapFileClose(ptv);
+                return TM_ECODE_FAILED;
+            }
+            pcap_close(dead);
+            ptv->use_bpf = 1;
+        } else {
+            if (pcap_compile(ptv->pcap_handle, &ptv->filter, (char *)tmpbpfstring, 1, 0) < 0) {
+                SCLogError(SC_ERR_BPF,"bpf compilation error %s",
+                        pcap_geterr(ptv->pcap_handle));
+                PcapFileClose(ptv);
+                return TM_ECODE_FAILED;
+            }
+
+            if (pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+                SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(ptv->pcap_handle));
+                PcapFileClose(ptv);
+                return TM_ECODE_FAILED;
+            }
+        }
+    }
+
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief move a reader of the multi reader mode to its next file
+ *
+ * Files that fail to open are skipped.
+ *
+ * \retval TM_ECODE_OK if a file is open, TM_ECODE_DONE if none are left
+ */
+static TmEcode PcapFileReaderNextFile(PcapFileThreadVars *ptv)
+{
+    PcapFileClose(ptv);
+
+    while (++ptv->file_idx < ptv->reader->nfiles) {
+        const char *filename = ptv->reader->files[ptv->file_idx];
+        SCLogInfo("reading pcap file %s", filename);
+        if (PcapFileOpen(ptv, filename) == TM_ECODE_OK)
+            return TM_ECODE_OK;
+    }
+    return TM_ECODE_DONE;
+}
+
+/** \brief flag a reader of the multi reader mode as done */
+static void PcapFileReaderDone(PcapFileThreadVars *ptv)
+{
+    PcapFileMergeReader *r = ptv->reader;
+
+    if (ptv->done)
+        return;
+    ptv->done = 1;
+
+    if (pcap_merge.ordered) {
+        /* all our packets are queued, wake up the merge thread in case
+         * it waits on us */
+        SCMutexLock(&r->pq->mutex_q);
+        SC_ATOMIC_SET(r->done, 1);
+        SCCondSignal(&r->pq->cond_q);
+        SCMutexUnlock(&r->pq->mutex_q);
+    } else {
+        SC_ATOMIC_SET(r->done, 1);
+        /* no merge thread, the last reader to finish ends the run */
+        if (SC_ATOMIC_ADD(pcap_merge.done_cnt, 1) == pcap_merge.nreaders) {
+            SCLogInfo("all pcap file readers done");
+            EngineStop();
+        }
+    }
+}
+
+/** \internal
+ *  \brief look up the tenant of a pcapng interface */
+static uint32_t PcapFileResolveIfTenant(const PcapFileThreadVars *ptv, uint32_t if_id)
+{
+    const PcapFileMmapIf *pif = PcapFileMmapGetIf(ptv->mmap, if_id);
+    int i;
+
+    for (i = 0; i < pcap_g.if_tenants_cnt; i++) {
+        const PcapFileIfTenant *t = &pcap_g.if_tenants[i];
+        if (t->if_id >= 0) {
+            if ((uint32_t)t->if_id == if_id)
+                return t->tenant_id;
+        } else if (pif != NULL && strcmp(t->name, pif->name) == 0) {
+            return t->tenant_id;
+        }
+    }
+    return ptv->tenant_id;
+}
+
+/**
+ * \brief get the tenant of a packet of a pcapng interface
+ *
+ * Results are cached per interface until the next section or file.
+ */
+static uint32_t PcapFileGetIfTenant(PcapFileThreadVars *ptv, uint32_t if_id)
+{
+    if (ptv->if_tenants_section != ptv->mmap->section) {
+        ptv->if_tenants_cnt = 0;
+        ptv->if_tenants_section = ptv->mmap->section;
+    }
+
+    if (if_id >= ptv->if_tenants_cnt) {
+        if (if_id >= ptv->if_tenants_size) {
+            uint32_t size = if_id + 8;
+            uint32_t *if_tenants = SCRealloc(ptv->if_tenants, size * sizeof(uint32_t));
+            if (unlikely(if_tenants == NULL))
+                return PcapFileResolveIfTenant(ptv, if_id);
+            ptv->if_tenants = if_tenants;
+            ptv->if_tenants_size = size;
+        }
+        for ( ; ptv->if_tenants_cnt <= if_id; ptv->if_tenants_cnt++) {
+            ptv->if_tenants[ptv->if_tenants_cnt] =
+                PcapFileResolveIfTenant(ptv, ptv->if_tenants_cnt);
+        }
+    }
+    return ptv->if_tenants[if_id];
+}
+
+static void PcapFileProcessPacket(PcapFileThreadVars *ptv, const struct pcap_pkthdr *h,
+                                  uint8_t *pkt, int datalink, uint32_t if_id)
 {
     SCEnter();
 
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)user;
     Packet *p = PacketGetFromQueueOrAlloc();
 
     if (unlikely(p == NULL)) {
@@ -149,26 +521,45 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_sec = h->ts.tv_sec;
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = datalink;
+    p->pcap_cnt = ++ptv->cnt;
 
-    p->pcap_v.tenant_id = ptv->tenant_id;
+    p->pcap_v.if_id = if_id;
+    if (pcap_g.if_tenants_cnt > 0 && ptv->mmap != NULL && ptv->mmap->pcapng) {
+        p->pcap_v.tenant_id = PcapFileGetIfTenant(ptv, if_id);
+    } else {
+        p->pcap_v.tenant_id = ptv->tenant_id;
+    }
     ptv->pkts++;
     ptv->bytes += h->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (ptv->mmap != NULL) {
+        /* data stays in the mapping, which is kept until the
+         * packet is released */
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+            SCReturn;
+        }
+        PcapFileMmapRef(ptv->mmap);
+        p->pcap_v.mmap = ptv->mmap;
+        p->ReleasePacket = PcapFileMmapReleasePacket;
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
     }
 
     /* We only check for checksum disable */
-    if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+    const int checksum_mode = SC_ATOMIC_GET(pcap_g.checksum_mode);
+    if (checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
         p->flags |= PKT_IGNORE_CHECKSUM;
-    } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
-        if (ChecksumAutoModeCheck(ptv->pkts, p->pcap_cnt,
+    } else if (checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        /* the invalid checksums are of the packets of all the readers */
+        const unsigned int pkts = SC_ATOMIC_ADD(pcap_g.pkts, 1);
+        if (ChecksumAutoModeCheck(ptv->pkts, pkts,
                                   SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
-            pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+            SC_ATOMIC_SET(pcap_g.checksum_mode, CHECKSUM_VALIDATION_DISABLE);
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
@@ -176,13 +567,66 @@ static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        if (ptv->pcap_handle != NULL)
+            pcap_breakloop(ptv->pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+static void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
+{
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)user;
+    PcapFileProcessPacket(ptv, h, pkt, ptv->datalink, 0);
+}
+
+/**
+ * \brief pcap_dispatch() counterpart for the mmap reader
+ *
+ * \retval number of records read, 0 at end of file, -1 on error
+ */
+static int PcapFileMmapDispatch(PcapFileThreadVars *ptv, int cnt)
+{
+    PcapFileMmapPkt rec;
+    uint8_t *pkt;
+    int n = 0;
+
+    while (n < cnt) {
+        int r = PcapFileMmapNext(ptv->mmap, &rec, &pkt);
+        if (r <= 0) {
+            if (r < 0 || n == 0)
+                return r;
+            break;
+        }
+        n++;
+
+        /* pcapng interfaces can each have their own link type */
+        if (unlikely(rec.datalink != ptv->datalink)) {
+            if (PcapFileGetDecoder(rec.datalink) == NULL) {
+                SCLogDebug("datalink %d of interface %u not supported",
+                           rec.datalink, rec.if_id);
+                ptv->errs++;
+                continue;
+            }
+            /* the filter is compiled for the link type of the first
+             * interface */
+            if (ptv->use_bpf)
+                continue;
+        }
+
+        if (ptv->use_bpf &&
+                pcap_offline_filter(&ptv->filter, &rec.h, pkt) == 0) {
+            continue;
+        }
+
+        PcapFileProcessPacket(ptv, &rec.h, pkt, rec.datalink, rec.if_id);
+        if (ptv->cb_result == TM_ECODE_FAILED)
+            break;
+    }
+    return n;
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -200,6 +644,8 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
 
     while (1) {
         if (suricata_ctl_flags & SURICATA_STOP) {
+            if (ptv->reader != NULL)
+                PcapFileReaderDone(ptv);
             SCReturnInt(TM_ECODE_OK);
         }
 
@@ -208,29 +654,43 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         PacketPoolWait();
 
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
-                          (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (ptv->mmap != NULL) {
+            r = PcapFileMmapDispatch(ptv, packet_q_len);
+        } else {
+            r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
+                              (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        }
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, ptv->pcap_handle ? pcap_geterr(ptv->pcap_handle) :
+                       "reading mapped file");
             if (ptv->cb_result == TM_ECODE_FAILED) {
                 SCReturnInt(TM_ECODE_FAILED);
             }
-            if (! RunModeUnixSocketIsActive()) {
+            if (ptv->reader != NULL) {
+                /* give up on this file, but not on the next ones */
+                if (PcapFileReaderNextFile(ptv) == TM_ECODE_OK)
+                    continue;
+                PcapFileReaderDone(ptv);
+                SCReturnInt(TM_ECODE_DONE);
+            } else if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
         } else if (unlikely(r == 0)) {
             SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
-            if (! RunModeUnixSocketIsActive()) {
+            if (ptv->reader != NULL) {
+                if (PcapFileReaderNextFile(ptv) == TM_ECODE_OK)
+                    continue;
+                PcapFileReaderDone(ptv);
+                SCReturnInt(TM_ECODE_DONE);
+            } else if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -240,8 +700,7 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             if (! RunModeUnixSocketIsActive()) {
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -256,21 +715,44 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
 {
     SCEnter();
 
-    const char *tmpbpfstring = NULL;
     const char *tmpstring = NULL;
+    const char *filename = (const char *)initdata;
 
-    if (initdata == NULL) {
+    if (initdata == NULL && pcap_merge.readers == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
         SCReturnInt(TM_ECODE_FAILED);
     }
 
-    SCLogInfo("reading pcap file %s", (char *)initdata);
-
     PcapFileThreadVars *ptv = SCMalloc(sizeof(PcapFileThreadVars));
     if (unlikely(ptv == NULL))
         SCReturnInt(TM_ECODE_FAILED);
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
+    if (pcap_merge.readers != NULL) {
+        /* readers are spawned one by one, so they claim the slots in
+         * the order the runmode set up the queues */
+        int id = SC_ATOMIC_ADD(pcap_merge.reader_next, 1) - 1;
+        if (id >= pcap_merge.nreaders) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "more pcap file reader "
+                       "threads than readers set up");
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        ptv->reader = &pcap_merge.readers[id];
+        if (pcap_merge.ordered) {
+            if (tv->outq == NULL) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap file reader "
+                           "needs a queue to the merge thread");
+                SCFree(ptv);
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            ptv->reader->pq = &trans_q[tv->outq->id];
+        }
+        filename = ptv->reader->files[0];
+    }
+
+    SCLogInfo("reading pcap file %s", filename);
+
     intmax_t tenant = 0;
     if (ConfGetInt("pcap-file.tenant-id", &tenant) == 1) {
         if (tenant > 0 && tenant < UINT_MAX) {
@@ -281,73 +763,24 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
         }
     }
 
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
-        SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
+    TmEcode ret = PcapFileOpen(ptv, filename);
+    if (ret != TM_ECODE_OK && ptv->reader != NULL) {
+        ret = PcapFileReaderNextFile(ptv);
+        if (ret == TM_ECODE_DONE) {
+            SCLogError(SC_ERR_FOPEN, "no readable file for pcap file reader");
+            ret = TM_ECODE_FAILED;
+        }
+    }
+    if (ret != TM_ECODE_OK) {
         SCFree(ptv);
         if (! RunModeUnixSocketIsActive()) {
-            return TM_ECODE_FAILED;
+            SCReturnInt(TM_ECODE_FAILED);
         } else {
-            UnixSocketPcapFile(TM_ECODE_FAILED);
+            UnixSocketPcapFile(ret);
             SCReturnInt(TM_ECODE_DONE);
         }
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
-    } else {
-        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
-
-        if (pcap_compile(pcap_g.pcap_handle, &pcap_g.filter, (char *)tmpbpfstring, 1, 0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",
-                    pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-
-        if (pcap_setfilter(pcap_g.pcap_handle, &pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
-    }
-
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
-
-    switch (pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
-        case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
-        case LINKTYPE_RAW:
-        case LINKTYPE_RAW2:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-        case LINKTYPE_NULL:
-            pcap_g.Decoder = DecodeNull;
-            break;
-
-        default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
-            } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
-            }
-    }
-
     if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
         pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
     } else {
@@ -359,7 +792,7 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
             pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_DISABLE;
         }
     }
-    pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
+    SC_ATOMIC_SET(pcap_g.checksum_mode, pcap_g.conf_checksum_mode);
 
     ptv->tv = tv;
     *data = (void *)ptv;
@@ -372,10 +805,11 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
+    const uint64_t pkts = SC_ATOMIC_GET(pcap_g.pkts);
     if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            pkts < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-        uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+        uint64_t chrate = pkts / SC_ATOMIC_GET(pcap_g.invalid_checksums);
         if (chrate < CHECKSUM_INVALID_RATIO)
             SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
@@ -387,6 +821,10 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
                       chrate);
     }
     SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    if (ptv->errs > 0) {
+        SCLogWarning(SC_ERR_UNIMPLEMENTED, "Pcap-file module skipped %" PRIu32
+                     " packets of unsupported link types", ptv->errs);
+    }
     return;
 }
 
@@ -395,11 +833,325 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     if (ptv) {
+        PcapFileClose(ptv);
+        if (ptv->if_tenants != NULL)
+            SCFree(ptv->if_tenants);
         SCFree(ptv);
     }
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief set up the readers of the multi reader mode
+ *
+ * If path is a directory, the regular files in it are read. They are
+ * sorted by name and dealt out to the readers, so each reader reads
+ * every nth file in order.
+ *
+ * \param path file or directory to read
+ * \param readers max number of reader threads
+ * \param ordered merge the output of the readers in timestamp order
+ *
+ * \retval number of reader threads to create, -1 on error
+ */
+int PcapFileMergeSetup(const char *path, int readers, int ordered)
+{
+    struct stat st;
+    char **files = NULL;
+    int nfiles = 0;
+    int i;
+
+    if (readers < 1)
+        readers = 1;
+
+    if (stat(path, &st) != 0) {
+        SCLogError(SC_ERR_FOPEN, "can't stat %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        struct dirent **namelist = NULL;
+        int n = scandir(path, &namelist, NULL, alphasort);
+        if (n < 0) {
+            SCLogError(SC_ERR_FOPEN, "can't read directory %s: %s", path,
+                       strerror(errno));
+            return -1;
+        }
+        files = SCCalloc(n > 0 ? n : 1, sizeof(char *));
+        if (unlikely(files == NULL)) {
+            for (i = 0; i < n; i++)
+                free(namelist[i]);
+            free(namelist);
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            char fullpath[PATH_MAX];
+            snprintf(fullpath, sizeof(fullpath), "%s/%s", path,
+                     namelist[i]->d_name);
+            free(namelist[i]);
+
+            if (stat(fullpath, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            files[nfiles] = SCStrdup(fullpath);
+            if (unlikely(files[nfiles] == NULL))
+                continue;
+            nfiles++;
+        }
+        free(namelist);
+    } else {
+        files = SCCalloc(1, sizeof(char *));
+        if (unlikely(files == NULL))
+            return -1;
+        files[0] = SCStrdup(path);
+        if (unlikely(files[0] == NULL)) {
+            SCFree(files);
+            return -1;
+        }
+        nfiles = 1;
+    }
+
+    if (nfiles == 0) {
+        SCLogError(SC_ERR_FOPEN, "no files to read in %s", path);
+        SCFree(files);
+        return -1;
+    }
+
+    if (readers > nfiles)
+        readers = nfiles;
+
+    pcap_merge.readers = SCCalloc(readers, sizeof(PcapFileMergeReader));
+    if (unlikely(pcap_merge.readers == NULL))
+        goto error;
+    pcap_merge.nreaders = readers;
+    pcap_merge.ordered = ordered;
+    SC_ATOMIC_INIT(pcap_merge.reader_next);
+    SC_ATOMIC_INIT(pcap_merge.done_cnt);
+
+    for (i = 0; i < readers; i++) {
+        PcapFileMergeReader *r = &pcap_merge.readers[i];
+        SC_ATOMIC_INIT(r->done);
+        r->files = SCCalloc((nfiles / readers) + 1, sizeof(char *));
+        if (unlikely(r->files == NULL))
+            goto error;
+    }
+    for (i = 0; i < nfiles; i++) {
+        PcapFileMergeReader *r = &pcap_merge.readers[i % readers];
+        r->files[r->nfiles++] = files[i];
+    }
+    SCFree(files);
+
+    SCLogInfo("reading %d file(s) with %d reader(s), %s", nfiles, readers,
+              ordered ? "merged in timestamp order" : "unordered");
+    return readers;
+
+error:
+    for (i = 0; i < nfiles; i++)
+        SCFree(files[i]);
+    SCFree(files);
+    if (pcap_merge.readers != NULL) {
+        for (i = 0; i < pcap_merge.nreaders; i++) {
+            if (pcap_merge.readers[i].files != NULL)
+                SCFree(pcap_merge.readers[i].files);
+        }
+        SCFree(pcap_merge.readers);
+        pcap_merge.readers = NULL;
+    }
+    return -1;
+}
+
+/**
+ * \brief get the oldest packet across the readers
+ *
+ * A packet is only handed out once every reader that isn't done has
+ * one queued, so a later read can't come before it.
+ *
+ * \retval p packet, or NULL if all readers are done or we're stopping
+ */
+static Packet *PcapFileMergeNext(PcapFileMergeThreadVars *mtv)
+{
+    int best = -1;
+    int i;
+
+    for (i = 0; i < pcap_merge.nreaders; i++) {
+        if (mtv->drained[i])
+            continue;
+
+        if (mtv->head[i] == NULL) {
+            PcapFileMergeReader *r = &pcap_merge.readers[i];
+            PacketQueue *q = r->pq;
+
+            SCMutexLock(&q->mutex_q);
+            while (q->len == 0 && !SC_ATOMIC_GET(r->done)) {
+                if ((suricata_ctl_flags & SURICATA_STOP) ||
+                        TmThreadsCheckFlag(mtv->tv, THV_KILL_PKTACQ)) {
+                    SCMutexUnlock(&q->mutex_q);
+                    return NULL;
+                }
+                SCCondWait(&q->cond_q, &q->mutex_q);
+            }
+            if (q->len == 0) {
+                SCMutexUnlock(&q->mutex_q);
+                mtv->drained[i] = 1;
+                continue;
+            }
+            mtv->head[i] = PacketDequeue(q);
+            SCMutexUnlock(&q->mutex_q);
+        }
+
+        if (best == -1 || timercmp(&mtv->head[i]->ts, &mtv->head[best]->ts, <))
+            best = i;
+    }
+
+    if (best == -1)
+        return NULL;
+
+    Packet *p = mtv->head[best];
+    mtv->head[best] = NULL;
+    return p;
+}
+
+/** \brief return the packets we hold or that are still queued to the pool */
+static void PcapFileMergeFlush(PcapFileMergeThreadVars *mtv)
+{
+    int i;
+
+    for (i = 0; i < pcap_merge.nreaders; i++) {
+        PacketQueue *q = pcap_merge.readers[i].pq;
+        Packet *p;
+
+        if (mtv->head[i] != NULL) {
+            TmqhOutputPacketpool(mtv->tv, mtv->head[i]);
+            mtv->head[i] = NULL;
+        }
+
+        SCMutexLock(&q->mutex_q);
+        while ((p = PacketDequeue(q)) != NULL) {
+            TmqhOutputPacketpool(mtv->tv, p);
+        }
+        SCMutexUnlock(&q->mutex_q);
+    }
+}
+
+/**
+ * \brief Merge thread loop: pass the reader packets on in timestamp
+ *        order, so flow handling and the offline clock see the same
+ *        order as when reading the files one after the other.
+ */
+TmEcode PcapFileMergeLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    PcapFileMergeThreadVars *mtv = (PcapFileMergeThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+
+    mtv->slot = s->slot_next;
+
+    while (1) {
+        if (suricata_ctl_flags & SURICATA_STOP) {
+            PcapFileMergeFlush(mtv);
+            SCReturnInt(TM_ECODE_OK);
+        }
+
+        Packet *p = PcapFileMergeNext(mtv);
+        if (p == NULL) {
+            if (suricata_ctl_flags & SURICATA_STOP)
+                continue;
+            if (TmThreadsCheckFlag(tv, THV_KILL_PKTACQ)) {
+                PcapFileMergeFlush(mtv);
+                SCReturnInt(TM_ECODE_OK);
+            }
+            SCLogInfo("all pcap file readers done");
+            EngineStop();
+            SCReturnInt(TM_ECODE_DONE);
+        }
+
+        /* number the packets in the order they are handed out */
+        p->pcap_cnt = ++mtv->cnt;
+
+        if (TmThreadsSlotProcessPkt(tv, mtv->slot, p) != TM_ECODE_OK) {
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode PcapFileMergeBreakLoop(ThreadVars *tv, void *data)
+{
+    int i;
+
+    if (pcap_merge.readers == NULL)
+        return TM_ECODE_OK;
+
+    for (i = 0; i < pcap_merge.nreaders; i++) {
+        PacketQueue *q = pcap_merge.readers[i].pq;
+        SCMutexLock(&q->mutex_q);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+    return TM_ECODE_OK;
+}
+
+TmEcode PcapFileMergeThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    int i;
+
+    if (pcap_merge.readers == NULL || !pcap_merge.ordered) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap file merge thread "
+                   "without ordered readers");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    for (i = 0; i < pcap_merge.nreaders; i++) {
+        if (pcap_merge.readers[i].pq == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap file reader %d "
+                       "not started before the merge thread", i);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+    }
+
+    PcapFileMergeThreadVars *mtv = SCMalloc(sizeof(PcapFileMergeThreadVars));
+    if (unlikely(mtv == NULL))
+        SCReturnInt(TM_ECODE_FAILED);
+    memset(mtv, 0, sizeof(PcapFileMergeThreadVars));
+
+    mtv->head = SCCalloc(pcap_merge.nreaders, sizeof(Packet *));
+    mtv->drained = SCCalloc(pcap_merge.nreaders, sizeof(uint8_t));
+    if (unlikely(mtv->head == NULL || mtv->drained == NULL)) {
+        if (mtv->head != NULL)
+            SCFree(mtv->head);
+        if (mtv->drained != NULL)
+            SCFree(mtv->drained);
+        SCFree(mtv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    mtv->tv = tv;
+    *data = (void *)mtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+void PcapFileMergeThreadExitStats(ThreadVars *tv, void *data)
+{
+    PcapFileMergeThreadVars *mtv = (PcapFileMergeThreadVars *)data;
+    SCLogNotice("Pcap-file merge passed on %" PRIu64 " packets from %d "
+                "readers", mtv->cnt, pcap_merge.nreaders);
+}
+
+TmEcode PcapFileMergeThreadDeinit(ThreadVars *tv, void *data)
+{
+    PcapFileMergeThreadVars *mtv = (PcapFileMergeThreadVars *)data;
+    if (mtv != NULL) {
+        SCFree(mtv->head);
+        SCFree(mtv->drained);
+        SCFree(mtv);
+    }
+    SCReturnInt(TM_ECODE_OK);
+}
+
 static double prev_signaled_ts = 0;
 
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
@@ -421,8 +1173,10 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
         FlowWakeupFlowManagerThread();
     }
 
-    /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    /* call the decoder, the datalink is per file */
+    PcapFileDecoder Decoder = PcapFileGetDecoder(p->datalink);
+    if (likely(Decoder != NULL))
+        Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
 #ifdef DEBUG
     BUG_ON(p->pkt_src != PKT_SRC_WIRE && p->pkt_src != PKT_SRC_FFR);
@@ -26,10 +26,12 @@
 
 void TmModuleReceivePcapFileRegister (void);
 void TmModuleDecodePcapFileRegister (void);
+void TmModulePcapFileMergeRegister (void);
 
 void PcapIncreaseInvalidChecksum(void);
 
 void PcapFileGlobalInit(void);
+int PcapFileMergeSetup(const char *path, int readers, int ordered);
 
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
@@ -40,6 +40,10 @@ char *PcapLiveGetDevice(int);
 typedef struct PcapPacketVars_
 {
     uint32_t tenant_id;
+    /** pcapng interface the packet was captured on, 0 otherwise */
+    uint32_t if_id;
+    /** mapped pcap file the packet data points to, if any */
+    void *mmap;
 } PcapPacketVars;
 
 /** needs to be able to contain Windows adapter id's, so
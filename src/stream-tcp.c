@@ -1941,6 +1941,20 @@ static int StreamTcpPacketStateSynRecv(ThreadVars *tv, Packet *p,
     return 0;
 }
 
+/**
+ *  \brief length of the packet data that has to fit in the window
+ *
+ *  The segments of a GRO super packet were sent as the window opened,
+ *  but we may only see the ACKs that opened it after the super packet.
+ *  Only its first segment is checked against the window.
+ */
+static inline uint32_t StreamTcpPacketWindowLen(const Packet *p)
+{
+    if (p->gso_size != 0 && p->payload_len > p->gso_size)
+        return p->gso_size;
+    return p->payload_len;
+}
+
 /**
  *  \brief  Function to handle the TCP_ESTABLISHED state packets, which are
  *          sent by the client to server. The function handles
@@ -2085,7 +2099,7 @@ static int HandleEstablishedPacketToServer(ThreadVars *tv, TcpSession *ssn, Pack
     /* in window check */
     if (zerowindowprobe) {
         SCLogDebug("ssn %p: zero window probe, skipping oow check", ssn);
-    } else if (SEQ_LEQ(TCP_GET_SEQ(p) + p->payload_len, ssn->client.next_win) ||
+    } else if (SEQ_LEQ(TCP_GET_SEQ(p) + StreamTcpPacketWindowLen(p), ssn->client.next_win) ||
             (ssn->flags & (STREAMTCP_FLAG_MIDSTREAM|STREAMTCP_FLAG_ASYNC)))
     {
         SCLogDebug("ssn %p: seq %"PRIu32" in window, ssn->client.next_win "
@@ -2241,7 +2255,7 @@ static int HandleEstablishedPacketToClient(ThreadVars *tv, TcpSession *ssn, Pack
 
     if (zerowindowprobe) {
         SCLogDebug("ssn %p: zero window probe, skipping oow check", ssn);
-    } else if (SEQ_LEQ(TCP_GET_SEQ(p) + p->payload_len, ssn->server.next_win) ||
+    } else if (SEQ_LEQ(TCP_GET_SEQ(p) + StreamTcpPacketWindowLen(p), ssn->server.next_win) ||
             (ssn->flags & (STREAMTCP_FLAG_MIDSTREAM|STREAMTCP_FLAG_ASYNC)))
     {
         SCLogDebug("ssn %p: seq %"PRIu32" in window, ssn->server.next_win "
@@ -4909,6 +4923,11 @@ TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
     }
     AppLayerProfilingReset(stt->ra_ctx->app_tctx);
 
+    if (p->gso_size != 0 && p->payload_len > p->gso_size) {
+        StatsAddUI64(tv, stt->counter_tcp_gso_segments,
+                (p->payload_len + p->gso_size - 1) / p->gso_size);
+    }
+
     (void)StreamTcpPacket(tv, p, stt, pq);
 
     return TM_ECODE_OK;
@@ -4934,6 +4953,7 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_syn = StatsRegisterCounter("tcp.syn", tv);
     stt->counter_tcp_synack = StatsRegisterCounter("tcp.synack", tv);
     stt->counter_tcp_rst = StatsRegisterCounter("tcp.rst", tv);
+    stt->counter_tcp_gso_segments = StatsRegisterCounter("tcp.gso_segments", tv);
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -10401,6 +10421,72 @@ end:
     return ret;
 }
 
+/** \test GRO super packet going past the window */
+static int StreamTcpTest46 (void)
+{
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF(unlikely(p == NULL));
+    Flow f;
+    ThreadVars tv;
+    StreamTcpThread stt;
+    TCPHdr tcph;
+    static uint8_t payload[3000];
+    PacketQueue pq;
+
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&pq, 0, sizeof(PacketQueue));
+    memset(&f, 0, sizeof(Flow));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&stt, 0, sizeof(StreamTcpThread));
+    memset(&tcph, 0, sizeof(TCPHdr));
+
+    FLOW_INITIALIZE(&f);
+    p->flow = &f;
+    p->tcph = &tcph;
+
+    StreamTcpUTInit(&stt.ra_ctx);
+
+    /* SYN */
+    tcph.th_win = htons(5480);
+    tcph.th_seq = htonl(100);
+    tcph.th_flags = TH_SYN;
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+
+    /* SYN/ACK opening a 1000 bytes window */
+    tcph.th_win = htons(1000);
+    tcph.th_seq = htonl(500);
+    tcph.th_ack = htonl(101);
+    tcph.th_flags = TH_SYN|TH_ACK;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+
+    /* ACK */
+    tcph.th_win = htons(5480);
+    tcph.th_seq = htonl(101);
+    tcph.th_ack = htonl(501);
+    tcph.th_flags = TH_ACK;
+    p->flowflags = FLOW_PKT_TOSERVER;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+
+    /* 3 segments of 1000 bytes, out of window as a single segment */
+    tcph.th_flags = TH_ACK|TH_PUSH;
+    p->payload = payload;
+    p->payload_len = sizeof(payload);
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) != -1);
+
+    /* accepted as a super packet, its first segment is in window */
+    p->gso_size = 1000;
+    FAIL_IF(StreamTcpPacket(&tv, p, &stt, &pq) == -1);
+    FAIL_IF(((TcpSession *)(p->flow->protoctx))->client.next_seq != 3101);
+
+    StreamTcpSessionClear(p->flow->protoctx);
+    SCFree(p);
+    FLOW_DESTROY(&f);
+    StreamTcpUTDeinit(stt.ra_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpRegisterTests (void)
@@ -10477,6 +10563,7 @@ void StreamTcpRegisterTests (void)
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45);
+    UtRegisterTest("StreamTcpTest46 -- GRO super packet window", StreamTcpTest46);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
@@ -94,6 +94,8 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_synack;
     /** rst pkts */
     uint16_t counter_tcp_rst;
+    /** segments received coalesced in GRO super packets */
+    uint16_t counter_tcp_gso_segments;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
@@ -180,6 +180,8 @@
 #include <netdb.h>
 #endif
 
+/* pcap/bpf.h conflicts with linux/bpf.h used by the eBPF code */
+#ifndef SC_PCAP_DONT_INCLUDE_PCAP_H
 #ifdef HAVE_PCAP_H
 #include <pcap.h>
 #endif
@@ -191,6 +193,7 @@
 #ifdef HAVE_PCAP_BPF_H
 #include <pcap/bpf.h>
 #endif
+#endif /* SC_PCAP_DONT_INCLUDE_PCAP_H */
 
 #if __CYGWIN__
 #if !defined _X86_ && !defined __x86_64
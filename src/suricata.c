@@ -48,6 +48,7 @@
 #include "util-atomic.h"
 #include "util-spm.h"
 #include "util-cpu.h"
+#include "util-checksum.h"
 #include "util-action.h"
 #include "util-pidfile.h"
 #include "util-ioctl.h"
@@ -93,6 +94,7 @@
 
 #include "source-af-packet.h"
 #include "source-netmap.h"
+#include "source-af-xdp.h"
 #include "source-mpipe.h"
 
 #include "respond-reject.h"
@@ -102,6 +104,7 @@
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-bypass.h"
 #include "pkt-var.h"
 #include "host-bit.h"
 
@@ -169,6 +172,7 @@
 #endif
 #include "util-mpm-hs.h"
 #include "util-storage.h"
+#include "util-hugepages.h"
 #include "host-storage.h"
 
 #include "util-lua.h"
@@ -360,6 +364,7 @@ void GlobalsInitPreConfig(void)
     }
 
     CreateLowercaseTable();
+    ChecksumSetup();
 
     TimeInit();
     SupportFastPatternForSigMatchTypes();
@@ -659,6 +664,9 @@ static void PrintUsage(const char *progname)
 #ifdef HAVE_NETMAP
     printf("\t--netmap[=<dev>]                     : run in netmap mode, no value select interfaces from suricata.yaml\n");
 #endif
+#ifdef HAVE_AF_XDP
+    printf("\t--af-xdp[=<dev>]                     : run in af-xdp mode, no value select interfaces from suricata.yaml\n");
+#endif
 #ifdef HAVE_PFRING
     printf("\t--pfring[=<dev>]                     : run in pfring mode, use interfaces from suricata.yaml\n");
     printf("\t--pfring-int <dev>                   : run in pfring mode, use interface <dev>\n");
@@ -736,6 +744,12 @@ static void PrintBuildInfo(void)
 #ifdef HAVE_NETMAP
     strlcat(features, "NETMAP ", sizeof(features));
 #endif
+#ifdef HAVE_AF_XDP
+    strlcat(features, "AF_XDP ", sizeof(features));
+#endif
+#ifdef HAVE_PACKET_EBPF
+    strlcat(features, "HAVE_PACKET_EBPF ", sizeof(features));
+#endif
 #ifdef HAVE_PACKET_FANOUT
     strlcat(features, "HAVE_PACKET_FANOUT ", sizeof(features));
 #endif
@@ -908,6 +922,7 @@ void RegisterAllModules(void)
     /* pcap file */
     TmModuleReceivePcapFileRegister();
     TmModuleDecodePcapFileRegister();
+    TmModulePcapFileMergeRegister();
 #ifdef HAVE_MPIPE
     /* mpipe */
     TmModuleReceiveMpipeRegister();
@@ -919,6 +934,9 @@ void RegisterAllModules(void)
     /* netmap */
     TmModuleReceiveNetmapRegister();
     TmModuleDecodeNetmapRegister();
+    /* af-xdp */
+    TmModuleReceiveAFXDPRegister();
+    TmModuleDecodeAFXDPRegister();
     /* pfring */
     TmModuleReceivePfringRegister();
     TmModuleDecodePfringRegister();
@@ -1042,6 +1060,26 @@ static TmEcode ParseInterfacesList(int runmode, char *pcap_dev)
             }
         }
 #endif
+#ifdef HAVE_AF_XDP
+    } else if (runmode == RUNMODE_AFXDP_DEV) {
+        /* iface has been set on command line */
+        if (strlen(pcap_dev)) {
+            if (ConfSetFinal("af-xdp.live-interface", pcap_dev) != 1) {
+                SCLogError(SC_ERR_INITIALIZATION, "Failed to set af-xdp.live-interface");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        } else {
+            int ret = LiveBuildDeviceList("af-xdp");
+            if (ret == 0) {
+                SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for af-xdp");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            if (AFXDPRunModeIsIPS()) {
+                SCLogInfo("AF_XDP: Setting IPS mode");
+                EngineModeSetIPS();
+            }
+        }
+#endif
 #ifdef HAVE_NFLOG
     } else if (runmode == RUNMODE_NFLOG) {
         int ret = LiveBuildDeviceListCustom("nflog", "group");
@@ -1166,6 +1204,39 @@ static int ParseCommandLineAfpacket(SCInstance *suri, const char *in_arg)
 #endif
 }
 
+static int ParseCommandLineAfxdp(SCInstance *suri, const char *in_arg)
+{
+#ifdef HAVE_AF_XDP
+    if (suri->run_mode == RUNMODE_UNKNOWN) {
+        suri->run_mode = RUNMODE_AFXDP_DEV;
+        if (in_arg) {
+            LiveRegisterDevice(in_arg);
+            memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
+            strlcpy(suri->pcap_dev, in_arg, sizeof(suri->pcap_dev));
+        }
+    } else if (suri->run_mode == RUNMODE_AFXDP_DEV) {
+        SCLogWarning(SC_WARN_PCAP_MULTI_DEV_EXPERIMENTAL, "using "
+                "multiple devices to get packets is experimental.");
+        if (in_arg) {
+            LiveRegisterDevice(in_arg);
+        } else {
+            SCLogInfo("Multiple af-xdp option without interface on each is useless");
+        }
+    } else {
+        SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                "has been specified");
+        PrintUsage(suri->progname);
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+#else
+    SCLogError(SC_ERR_NO_AF_XDP, "AF_XDP not enabled. On Linux "
+            "host, make sure to pass --enable-af-xdp to "
+            "configure when building.");
+    return TM_ECODE_FAILED;
+#endif
+}
+
 static int ParseCommandLinePcapLive(SCInstance *suri, const char *in_arg)
 {
     memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
@@ -1470,6 +1541,7 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pfring-cluster-type", required_argument, 0, 0},
         {"af-packet", optional_argument, 0, 0},
         {"netmap", optional_argument, 0, 0},
+        {"af-xdp", optional_argument, 0, 0},
         {"pcap", optional_argument, 0, 0},
         {"simulate-ips", 0, 0 , 0},
         {"no-random", 0, &g_disable_randomness, 1},
@@ -1607,6 +1679,10 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                 if (ParseCommandLineAfpacket(suri, optarg) != TM_ECODE_OK) {
                     return TM_ECODE_FAILED;
                 }
+            } else if (strcmp((long_opts[option_index]).name , "af-xdp") == 0) {
+                if (ParseCommandLineAfxdp(suri, optarg) != TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
             } else if (strcmp((long_opts[option_index]).name , "netmap") == 0){
 #ifdef HAVE_NETMAP
                 if (suri->run_mode == RUNMODE_UNKNOWN) {
@@ -2219,6 +2295,7 @@ void PreRunInit(const int runmode)
     SCProfilingSghsGlobalInit();
     SCProfilingInit();
 #endif /* PROFILING */
+    HugepagesInitConfig();
     DefragInit();
     FlowInitConfig(FLOW_QUIET);
     IPPairInitConfig(FLOW_QUIET);
@@ -2279,6 +2356,7 @@ void PostRunDeinit(const int runmode, struct timeval *start_time)
     HostCleanup();
     StreamTcpFreeConfig(STREAM_VERBOSE);
     DefragDestroy();
+    HugepagesDeinit();
     TmqResetQueues();
 #ifdef PROFILING
     if (profiling_rules_enabled)
@@ -2432,6 +2510,7 @@ static int ConfigGetCaptureValue(SCInstance *suri)
         switch (suri->run_mode) {
             case RUNMODE_PCAP_DEV:
             case RUNMODE_AFP_DEV:
+            case RUNMODE_AFXDP_DEV:
             case RUNMODE_NETMAP:
                 /* in netmap igb0+ has a special meaning, however the
                  * interface really is igb0 */
@@ -2453,7 +2532,16 @@ static int ConfigGetCaptureValue(SCInstance *suri)
                     int mtu = GetIfaceMTU(dev);
                     g_default_mtu = MAX(mtu, g_default_mtu);
 
-                    unsigned int iface_max_packet_size = GetIfaceMaxPacketSize(dev);
+                    unsigned int iface_max_packet_size;
+#ifdef HAVE_AF_PACKET
+                    if (suri->run_mode == RUNMODE_AFP_DEV) {
+                        /* GRO super packets with vnet-hdr */
+                        iface_max_packet_size = AFPGetIfaceMaxPacketSize(dev);
+                    } else
+#endif
+                    {
+                        iface_max_packet_size = GetIfaceMaxPacketSize(dev);
+                    }
                     if (iface_max_packet_size > default_packet_size)
                         default_packet_size = iface_max_packet_size;
                 }
@@ -2672,6 +2760,7 @@ static int PostConfLoadedSetup(SCInstance *suri)
 
     TagInitCtx();
     PacketAlertTagInit();
+    RegisterFlowBypassInfo();
     ThresholdInit();
     HostBitInitCtx();
     IPPairBitInitCtx();
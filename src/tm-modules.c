@@ -209,6 +209,7 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_RECEIVEPCAPFILE);
         CASE_CODE (TMM_DECODEPCAP);
         CASE_CODE (TMM_DECODEPCAPFILE);
+        CASE_CODE (TMM_PCAPFILEMERGE);
         CASE_CODE (TMM_RECEIVEPFRING);
         CASE_CODE (TMM_DECODEPFRING);
         CASE_CODE (TMM_RESPONDREJECT);
@@ -233,6 +234,8 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_DETECTLOADER);
         CASE_CODE (TMM_RECEIVENETMAP);
         CASE_CODE (TMM_DECODENETMAP);
+        CASE_CODE (TMM_RECEIVEAFXDP);
+        CASE_CODE (TMM_DECODEAFXDP);
 
         CASE_CODE (TMM_SIZE);
     }
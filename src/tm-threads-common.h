@@ -39,6 +39,7 @@ typedef enum {
     TMM_RECEIVEPCAPFILE,
     TMM_DECODEPCAP,
     TMM_DECODEPCAPFILE,
+    TMM_PCAPFILEMERGE,
     TMM_RECEIVEPFRING,
     TMM_DECODEPFRING,
     TMM_RESPONDREJECT,
@@ -53,6 +54,8 @@ typedef enum {
     TMM_DECODEAFP,
     TMM_RECEIVENETMAP,
     TMM_DECODENETMAP,
+    TMM_RECEIVEAFXDP,
+    TMM_DECODEAFXDP,
     TMM_ALERTPCAPINFO,
     TMM_RECEIVEMPIPE,
     TMM_DECODEMPIPE,
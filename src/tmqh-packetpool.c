@@ -48,6 +48,7 @@
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-profiling.h"
+#include "util-hugepages.h"
 #include "util-device.h"
 
 /* Number of freed packet to save for one pool before freeing them. */
@@ -278,6 +279,39 @@ Packet *PacketPoolGetPacket(void)
     return NULL;
 }
 
+/** \brief Get up to n packets from the packet pool in one go
+ *
+ *  Batch version of PacketPoolGetPacket(). The return stack is only
+ *  locked once, when the local stack runs dry.
+ *
+ *  \param pkts array to store the packets in
+ *  \param n number of packets requested
+ *
+ *  \retval cnt number of packets stored in pkts, can be less than n
+ */
+uint32_t PacketPoolGetPackets(Packet **pkts, uint32_t n)
+{
+    PktPool *pool = GetThreadPacketPool();
+    uint32_t cnt = 0;
+#ifdef DEBUG_VALIDATION
+    BUG_ON(pool->initialized == 0);
+    BUG_ON(pool->destroyed == 1);
+#endif /* DEBUG_VALIDATION */
+
+    if (pool->head == NULL) {
+        PacketPoolGetReturnedPackets(pool);
+    }
+
+    while (cnt < n && pool->head != NULL) {
+        Packet *p = pool->head;
+        pool->head = p->next;
+        p->pool = pool;
+        PACKET_REINIT(p);
+        pkts[cnt++] = p;
+    }
+    return cnt;
+}
+
 /** \brief Return packet to Packet pool
  *
  */
@@ -385,12 +419,28 @@ void PacketPoolInit(void)
     /* pre allocate packets */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
                (uintmax_t)SIZE_OF_PACKET);
+
+    /* with huge pages all the packets of the pool are carved from a
+     * single area on the NUMA node of the thread */
+    const size_t psize = (SIZE_OF_PACKET + CLS - 1) & ~((size_t)CLS - 1);
+    uint8_t *area = NULL;
+    if (HugepagesEnabled()) {
+        area = HugepagesAlloc(psize * max_pending_packets, HUGEPAGES_NUMA_LOCAL);
+    }
+
     int i = 0;
     for (i = 0; i < max_pending_packets; i++) {
-        Packet *p = PacketGetFromAlloc();
-        if (unlikely(p == NULL)) {
-            SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet. Exiting...");
-            exit(EXIT_FAILURE);
+        Packet *p;
+        if (area != NULL) {
+            /* area is zeroed, released by PacketFree() as a whole */
+            p = (Packet *)(area + (size_t)i * psize);
+            PACKET_INITIALIZE(p);
+        } else {
+            p = PacketGetFromAlloc();
+            if (unlikely(p == NULL)) {
+                SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet. Exiting...");
+                exit(EXIT_FAILURE);
+            }
         }
         PacketPoolStorePacket(p);
     }
@@ -72,6 +72,7 @@ void TmqhOutputPacketpool(ThreadVars *, Packet *);
 void TmqhReleasePacketsToPacketPool(PacketQueue *);
 void TmqhPacketpoolRegister(void);
 Packet *PacketPoolGetPacket(void);
+uint32_t PacketPoolGetPackets(Packet **pkts, uint32_t n);
 void PacketPoolWait(void);
 void PacketPoolWaitForN(int n);
 void PacketPoolReturnPacket(Packet *p);
@@ -26,6 +26,135 @@
 #include "suricata-common.h"
 
 #include "util-checksum.h"
+#include "util-cpu.h"
+#include "util-unittest.h"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define CHECKSUM_HAVE_SSE2 1
+/* AVX2 code is built with a target attribute and only used if the CPU
+ * supports it */
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#include <immintrin.h>
+#define CHECKSUM_HAVE_AVX2 1
+#endif
+#endif
+
+static inline uint16_t ChecksumFold(uint64_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/* words of the buffer, the odd last byte padded as in network order */
+static inline uint32_t ChecksumSumTail(const uint8_t *buf, uint16_t len)
+{
+    const uint16_t *w = (const uint16_t *)buf;
+    uint32_t sum = 0;
+
+    while (len > 1) {
+        sum += *w++;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *(const uint8_t *)w;
+        sum += pad;
+    }
+    return sum;
+}
+
+static uint16_t ChecksumSum16Scalar(const uint8_t *buf, uint16_t len)
+{
+    const uint16_t *w = (const uint16_t *)buf;
+    uint32_t sum = 0;
+
+    while (len >= 32) {
+        sum += w[0] + w[1] + w[2] + w[3] + w[4] + w[5] + w[6] + w[7] +
+            w[8] + w[9] + w[10] + w[11] + w[12] + w[13] + w[14] + w[15];
+        len -= 32;
+        w += 16;
+    }
+    return ChecksumFold((uint64_t)sum + ChecksumSumTail((const uint8_t *)w, len));
+}
+
+#ifdef CHECKSUM_HAVE_SSE2
+/* the words are zero extended to 32 bits lanes: with at most 64k of data
+ * a lane can't overflow, the carries are folded at the end */
+static uint16_t ChecksumSum16SSE2(const uint8_t *buf, uint16_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+
+    while (len >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)buf);
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        buf += 16;
+        len -= 16;
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    uint64_t sum = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return ChecksumFold(sum + ChecksumSumTail(buf, len));
+}
+#endif
+
+#ifdef CHECKSUM_HAVE_AVX2
+__attribute__((target("avx2")))
+static uint16_t ChecksumSum16AVX2(const uint8_t *buf, uint16_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+
+    while (len >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        buf += 32;
+        len -= 32;
+    }
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    uint64_t sum = 0;
+    for (int i = 0; i < 8; i++)
+        sum += lanes[i];
+    return ChecksumFold(sum + ChecksumSumTail(buf, len));
+}
+#endif
+
+uint16_t (*ChecksumSum16)(const uint8_t *buf, uint16_t len) =
+#ifdef CHECKSUM_HAVE_SSE2
+    ChecksumSum16SSE2;
+#else
+    ChecksumSum16Scalar;
+#endif
+
+/**
+ * \brief select the checksum implementation for this CPU
+ *
+ * Called once at startup, before the threads are created.
+ */
+void ChecksumSetup(void)
+{
+#ifdef CHECKSUM_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ChecksumSum16 = ChecksumSum16AVX2;
+        SCLogDebug("using AVX2 checksums");
+        return;
+    }
+#endif
+#ifdef CHECKSUM_HAVE_SSE2
+    ChecksumSum16 = ChecksumSum16SSE2;
+    SCLogDebug("using SSE2 checksums");
+#else
+    ChecksumSum16 = ChecksumSum16Scalar;
+#endif
+}
 
 int ReCalculateChecksum(Packet *p)
 {
@@ -88,3 +217,109 @@ int ChecksumAutoModeCheck(uint32_t thread_count,
     }
     return 0;
 }
+
+#ifdef UNITTESTS
+
+/**
+ * \test ChecksumTest01 all the implementations give the same sum, for all
+ *       the lengths and alignments
+ */
+static int ChecksumTest01(void)
+{
+    uint8_t buf[1600];
+
+    for (uint32_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 7 + (i >> 3));
+    /* worst case for the carries */
+    memset(buf + 1000, 0xff, 600);
+
+    for (int off = 0; off < 4; off++) {
+        for (uint16_t len = 0; len <= sizeof(buf) - 4; len++) {
+            const uint16_t ref = ChecksumSum16Scalar(buf + off, len);
+#ifdef CHECKSUM_HAVE_SSE2
+            FAIL_IF(ChecksumSum16SSE2(buf + off, len) != ref);
+#endif
+#ifdef CHECKSUM_HAVE_AVX2
+            if (__builtin_cpu_supports("avx2")) {
+                FAIL_IF(ChecksumSum16AVX2(buf + off, len) != ref);
+            }
+#endif
+            FAIL_IF(ChecksumSum16(buf + off, len) != ref);
+        }
+    }
+    PASS;
+}
+
+/**
+ * \test ChecksumTest02 sum of a known buffer, RFC 1071 example
+ */
+static int ChecksumTest02(void)
+{
+    uint8_t buf[] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7, 0x01 };
+    uint16_t sum;
+
+    sum = ChecksumSum16(buf, 8);
+    FAIL_IF(ntohs(sum) != 0xddf2);
+    /* odd byte is the high byte of the last word */
+    sum = ChecksumSum16(buf, 9);
+    FAIL_IF(ntohs(sum) != 0xdef2);
+    PASS;
+}
+
+#define CHECKSUM_TEST_RUNS 1000000
+
+/**
+ * \test ChecksumTest03 prints the cycles per 1500 bytes packet of the
+ *       implementations
+ */
+static int ChecksumTest03(void)
+{
+#ifdef PROFILING
+    uint8_t buf[1500];
+    uint64_t ticks_start, ticks_end;
+    uint32_t r = 0;
+
+    for (uint32_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)i;
+
+    printf("\n");
+
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < CHECKSUM_TEST_RUNS; i++)
+        r += ChecksumSum16Scalar(buf, sizeof(buf));
+    ticks_end = UtilCpuGetTicks();
+    printf("scalar(%d) \t%"PRIu64"\n", CHECKSUM_TEST_RUNS,
+           (ticks_end - ticks_start) / CHECKSUM_TEST_RUNS);
+#ifdef CHECKSUM_HAVE_SSE2
+    ticks_start = UtilCpuGetTicks();
+    for (int i = 0; i < CHECKSUM_TEST_RUNS; i++)
+        r += ChecksumSum16SSE2(buf, sizeof(buf));
+    ticks_end = UtilCpuGetTicks();
+    printf("sse2(%d) \t%"PRIu64"\n", CHECKSUM_TEST_RUNS,
+           (ticks_end - ticks_start) / CHECKSUM_TEST_RUNS);
+#endif
+#ifdef CHECKSUM_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        ticks_start = UtilCpuGetTicks();
+        for (int i = 0; i < CHECKSUM_TEST_RUNS; i++)
+            r += ChecksumSum16AVX2(buf, sizeof(buf));
+        ticks_end = UtilCpuGetTicks();
+        printf("avx2(%d) \t%"PRIu64"\n", CHECKSUM_TEST_RUNS,
+               (ticks_end - ticks_start) / CHECKSUM_TEST_RUNS);
+    }
+#endif
+    printf("r %u\n", r);
+#endif
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void ChecksumRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumTest01", ChecksumTest01);
+    UtRegisterTest("ChecksumTest02", ChecksumTest02);
+    UtRegisterTest("ChecksumTest03", ChecksumTest03);
+#endif /* UNITTESTS */
+}
@@ -24,10 +24,20 @@
 #ifndef __UTIL_CHECKSUM_H__
 #define __UTIL_CHECKSUM_H__
 
-int ReCalculateChecksum(Packet *p);
+/* included by the decoders headers before Packet is defined */
+struct Packet_;
+
+int ReCalculateChecksum(struct Packet_ *p);
 int ChecksumAutoModeCheck(uint32_t thread_count,
         unsigned int iface_count, unsigned int iface_fail);
 
+/** one's complement sum of the 16 bits words of buf folded to 16 bits,
+ *  an odd last byte is padded with a zero byte. Set by ChecksumSetup()
+ *  to the fastest implementation the CPU supports. */
+extern uint16_t (*ChecksumSum16)(const uint8_t *buf, uint16_t len);
+void ChecksumSetup(void);
+void ChecksumRegisterTests(void);
+
 /* constant linked with detection of interface with
  * invalid checksums */
 #define CHECKSUM_SAMPLE_COUNT 1000
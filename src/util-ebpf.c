@@ -0,0 +1,465 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * eBPF programs and maps handling
+ *
+ * Programs are loaded from ELF files built from ebpf/. The maps of a
+ * program are registered per interface so the capture method and the
+ * flow manager can access them by name.
+ */
+
+#define SC_PCAP_DONT_INCLUDE_PCAP_H 1
+#include "suricata-common.h"
+#include "flow-bypass.h"
+
+#ifdef HAVE_PACKET_EBPF
+
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "util-ebpf.h"
+#include "util-debug.h"
+#include "flow.h"
+#include "flow-hash.h"
+#include "flow-private.h"
+
+#define BPF_MAP_MAX_COUNT 16
+
+typedef struct EBPFMapDescription_ {
+    char *name;
+    int fd;
+} EBPFMapDescription;
+
+typedef struct EBPFIfaceMaps_ {
+    char *iface;
+    /* section of the program, several programs (filter, load balancer)
+     * can be used on the same interface */
+    char *section;
+    /* fd of the program loaded for the interface */
+    int prog_fd;
+    EBPFMapDescription maps[BPF_MAP_MAX_COUNT];
+    int last;
+    struct EBPFIfaceMaps_ *next;
+} EBPFIfaceMaps;
+
+/* filled at init by the runmode, read only afterwards */
+static EBPFIfaceMaps *g_ebpf_ifaces = NULL;
+
+static int g_ebpf_nr_cpus = 0;
+
+static EBPFIfaceMaps *EBPFGetIfaceMaps(const char *iface, const char *section)
+{
+    EBPFIfaceMaps *im = g_ebpf_ifaces;
+    while (im) {
+        if (strcmp(im->iface, iface) == 0 && strcmp(im->section, section) == 0)
+            return im;
+        im = im->next;
+    }
+    return NULL;
+}
+
+static int EBPFGetMapFD(const EBPFIfaceMaps *im, const char *name)
+{
+    for (int i = 0; i < im->last; i++) {
+        if (strcmp(im->maps[i].name, name) == 0) {
+            SCLogDebug("Got fd %d for eBPF map '%s'", im->maps[i].fd, name);
+            return im->maps[i].fd;
+        }
+    }
+    return -1;
+}
+
+/**
+ * \brief get the fd of a map loaded for an interface
+ *
+ * \retval fd of the map or -1 if not found
+ */
+int EBPFGetMapFDByName(const char *iface, const char *name)
+{
+    if (iface == NULL || name == NULL)
+        return -1;
+
+    for (EBPFIfaceMaps *im = g_ebpf_ifaces; im != NULL; im = im->next) {
+        if (strcmp(im->iface, iface) != 0)
+            continue;
+        int fd = EBPFGetMapFD(im, name);
+        if (fd != -1)
+            return fd;
+    }
+    return -1;
+}
+
+/** \brief number of possible CPUs, size of the per CPU map values */
+int EBPFNumPossibleCPUs(void)
+{
+    if (g_ebpf_nr_cpus <= 0) {
+        g_ebpf_nr_cpus = libbpf_num_possible_cpus();
+    }
+    return g_ebpf_nr_cpus;
+}
+
+/**
+ * \brief Load an eBPF program from a file
+ *
+ * The program of the section is loaded in the kernel together with
+ * its maps. Maps are registered for the interface. A section is loaded
+ * only once per interface, later calls return the same program.
+ *
+ * \param iface interface the program is used on
+ * \param path path of the ELF file
+ * \param section section of the program in the file
+ * \param val set to the fd of the program
+ * \param flags EBPF_SOCKET_FILTER to load the program as a socket filter
+ *
+ * \retval 0 on success, -1 on error
+ */
+int EBPFLoadFile(const char *iface, const char *path, const char *section,
+                 int *val, uint8_t flags)
+{
+    struct bpf_object *bpfobj = NULL;
+    struct bpf_program *bpfprog = NULL;
+    struct bpf_map *map = NULL;
+    int found = 0;
+
+    if (iface == NULL || path == NULL || section == NULL)
+        return -1;
+
+    EBPFIfaceMaps *im = EBPFGetIfaceMaps(iface, section);
+    if (im != NULL) {
+        *val = im->prog_fd;
+        return 0;
+    }
+
+    bpfobj = bpf_object__open(path);
+    if (libbpf_get_error(bpfobj)) {
+        SCLogError(SC_ERR_BPF, "Unable to load eBPF objects in '%s'",
+                   path);
+        return -1;
+    }
+
+    bpf_object__for_each_program(bpfprog, bpfobj) {
+        const char *title = bpf_program__title(bpfprog, 0);
+        if (title != NULL && strcmp(title, section) == 0) {
+            found = 1;
+            break;
+        }
+    }
+    if (found == 0) {
+        SCLogError(SC_ERR_BPF, "No section '%s' in '%s' file",
+                   section, path);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    if (flags & EBPF_SOCKET_FILTER) {
+        bpf_program__set_type(bpfprog, BPF_PROG_TYPE_SOCKET_FILTER);
+    }
+
+    if (bpf_object__load(bpfobj) != 0) {
+        SCLogError(SC_ERR_BPF, "Unable to load eBPF object '%s': %s (%d)",
+                   path, strerror(errno), errno);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    int pfd = bpf_program__fd(bpfprog);
+    if (pfd == -1) {
+        SCLogError(SC_ERR_BPF, "Unable to find %s section", section);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+
+    im = SCCalloc(1, sizeof(*im));
+    if (im == NULL) {
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+    im->iface = SCStrdup(iface);
+    im->section = SCStrdup(section);
+    if (im->iface == NULL || im->section == NULL) {
+        if (im->iface != NULL)
+            SCFree(im->iface);
+        if (im->section != NULL)
+            SCFree(im->section);
+        SCFree(im);
+        bpf_object__close(bpfobj);
+        return -1;
+    }
+    im->prog_fd = pfd;
+
+    bpf_map__for_each(map, bpfobj) {
+        if (im->last == BPF_MAP_MAX_COUNT) {
+            SCLogWarning(SC_ERR_BPF, "Too many maps in '%s', ignoring '%s'",
+                         path, bpf_map__name(map));
+            continue;
+        }
+        im->maps[im->last].name = SCStrdup(bpf_map__name(map));
+        if (im->maps[im->last].name == NULL) {
+            continue;
+        }
+        im->maps[im->last].fd = bpf_map__fd(map);
+        SCLogDebug("Got eBPF map '%s' with fd %d for %s",
+                   im->maps[im->last].name, im->maps[im->last].fd, iface);
+        im->last++;
+    }
+
+    im->next = g_ebpf_ifaces;
+    g_ebpf_ifaces = im;
+
+    SCLogInfo("Successfully loaded eBPF file '%s' on '%s'", path, iface);
+
+    /* the object is kept open: closing it would release the maps */
+    *val = pfd;
+    return 0;
+}
+
+/**
+ * \brief Insert one direction of a flow in a bypass map
+ *
+ * The per CPU values are initialised with the current time so the entry
+ * does not time out before the first packet hits it.
+ *
+ * \param mapfd fd of the flow table
+ * \param key flowv4_keys or flowv6_keys matching the table
+ *
+ * \retval 1 if the entry was inserted or already present, 0 otherwise
+ */
+int EBPFInsertHalfFlow(int mapfd, void *key)
+{
+    struct timespec curtime;
+    int nr_cpus = EBPFNumPossibleCPUs();
+
+    if (mapfd == -1 || nr_cpus <= 0)
+        return 0;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &curtime) != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Can't get time: %s (%d)",
+                     strerror(errno), errno);
+        return 0;
+    }
+
+    struct pair value[nr_cpus];
+    for (int i = 0; i < nr_cpus; i++) {
+        value[i].time = (uint64_t)curtime.tv_sec * 1000000000ULL + curtime.tv_nsec;
+        value[i].packets = 0;
+        value[i].bytes = 0;
+    }
+
+    if (bpf_map_update_elem(mapfd, key, value, BPF_NOEXIST) != 0) {
+        switch (errno) {
+            /* no more place in the hash */
+            case E2BIG:
+                return 0;
+            /* entry is already there */
+            case EEXIST:
+                return 1;
+            default:
+                SCLogDebug("Can't update eBPF map: %s (%d)",
+                           strerror(errno), errno);
+                return 0;
+        }
+    }
+    return 1;
+}
+
+union EBPFFlowKeys {
+    struct flowv4_keys v4;
+    struct flowv6_keys v6;
+};
+
+static void EBPFFlowKeySetup(FlowKey *fk, const union EBPFFlowKeys *key, int family)
+{
+    memset(fk, 0, sizeof(*fk));
+    if (family == AF_INET) {
+        fk->src.family = AF_INET;
+        fk->src.addr_data32[0] = htonl(key->v4.src);
+        fk->dst.family = AF_INET;
+        fk->dst.addr_data32[0] = htonl(key->v4.dst);
+        fk->sp = key->v4.port16[0];
+        fk->dp = key->v4.port16[1];
+        fk->proto = key->v4.ip_proto;
+        fk->vlan_id[0] = key->v4.vlan0;
+    } else {
+        fk->src.family = AF_INET6;
+        fk->dst.family = AF_INET6;
+        for (int i = 0; i < 4; i++) {
+            fk->src.addr_data32[i] = htonl(key->v6.src[i]);
+            fk->dst.addr_data32[i] = htonl(key->v6.dst[i]);
+        }
+        fk->sp = key->v6.port16[0];
+        fk->dp = key->v6.port16[1];
+        fk->proto = key->v6.ip_proto;
+        fk->vlan_id[0] = key->v6.vlan0;
+    }
+}
+
+/**
+ * \internal
+ * \brief report the counters of a map entry into its Flow
+ *
+ * Entries are per direction, the counters are the totals seen since
+ * the flow was bypassed so only the increase since the last call is
+ * added to the Flow.
+ *
+ * \retval 1 if the Flow was found, 0 otherwise
+ */
+static int EBPFUpdateFlow(FlowKey *fk, uint64_t pkts, uint64_t bytes,
+                          struct timeval *lastts)
+{
+    Flow *f = FlowGetExistingFlowFromHash(fk, FlowKeyGetHash(fk));
+    if (f == NULL)
+        return 0;
+
+    FlowBypassInfo *fc = FlowGetBypassInfo(f);
+    if (fc != NULL) {
+        if (CMP_ADDR(&f->src, &fk->src) && f->sp == fk->sp) {
+            if (pkts > fc->todstpktcnt) {
+                f->todstpktcnt += pkts - fc->todstpktcnt;
+                f->todstbytecnt += bytes - fc->todstbytecnt;
+                fc->todstpktcnt = pkts;
+                fc->todstbytecnt = bytes;
+            }
+        } else {
+            if (pkts > fc->tosrcpktcnt) {
+                f->tosrcpktcnt += pkts - fc->tosrcpktcnt;
+                f->tosrcbytecnt += bytes - fc->tosrcbytecnt;
+                fc->tosrcpktcnt = pkts;
+                fc->tosrcbytecnt = bytes;
+            }
+        }
+    }
+    /* keep the flow alive as long as the kernel sees packets */
+    if (timercmp(lastts, &f->lastts, >)) {
+        f->lastts = *lastts;
+    }
+    FLOWLOCK_UNLOCK(f);
+    return 1;
+}
+
+/**
+ * \internal
+ * \brief walk a bypass map, updating active flows and removing idle ones
+ *
+ * \retval number of removed entries
+ */
+static int EBPFForEachFlowTable(const EBPFIfaceMaps *im, const char *name, int family,
+                                struct flows_stats *flowstats,
+                                struct timespec *ctime, struct timeval *tv)
+{
+    int mapfd = EBPFGetMapFD(im, name);
+    if (mapfd == -1)
+        return 0;
+
+    int nr_cpus = EBPFNumPossibleCPUs();
+    if (nr_cpus <= 0)
+        return 0;
+
+    union EBPFFlowKeys key, next_key;
+    struct pair values_array[nr_cpus];
+    int pending_delete = 0;
+    int found = 0;
+    const uint64_t now = (uint64_t)ctime->tv_sec * 1000000000ULL + ctime->tv_nsec;
+
+    memset(&key, 0, sizeof(key));
+    while (bpf_map_get_next_key(mapfd, &key, &next_key) == 0) {
+        /* the current key is needed to get the next one, so entries
+         * are removed one iteration later */
+        if (pending_delete) {
+            bpf_map_delete_elem(mapfd, &key);
+            pending_delete = 0;
+        }
+        key = next_key;
+
+        if (bpf_map_lookup_elem(mapfd, &key, values_array) != 0)
+            continue;
+
+        uint64_t pkts = 0, bytes = 0, last = 0;
+        for (int i = 0; i < nr_cpus; i++) {
+            pkts += values_array[i].packets;
+            bytes += values_array[i].bytes;
+            if (values_array[i].time > last)
+                last = values_array[i].time;
+        }
+
+        const uint64_t age = (now > last) ? now - last : 0;
+        if (age > (uint64_t)FLOW_BYPASSED_TIMEOUT * 1000000000ULL) {
+            SCLogDebug("Got no packet for %d -> %d at %" PRIu64,
+                       key.v4.port16[0], key.v4.port16[1], last);
+            flowstats->count++;
+            flowstats->packets += pkts;
+            flowstats->bytes += bytes;
+            found = 1;
+            pending_delete = 1;
+            continue;
+        }
+
+        /* convert the time of the last packet to the flow engine time */
+        struct timeval agetv = { age / 1000000000ULL, (age % 1000000000ULL) / 1000 };
+        struct timeval lastts;
+        timersub(tv, &agetv, &lastts);
+
+        FlowKey fk;
+        EBPFFlowKeySetup(&fk, &key, family);
+        if (EBPFUpdateFlow(&fk, pkts, bytes, &lastts) == 0) {
+            /* flow is gone from the flow engine, no need to keep it */
+            pending_delete = 1;
+        }
+    }
+    if (pending_delete) {
+        bpf_map_delete_elem(mapfd, &key);
+    }
+
+    return found;
+}
+
+/**
+ * \brief Flow manager callback for the flows bypassed in eBPF maps
+ *
+ * \param bypassstats stats of the removed flows
+ * \param curtime current CLOCK_MONOTONIC time, same clock as the
+ *        bpf_ktime_get_ns() values stored by the programs
+ * \param tv current time of the flow engine
+ *
+ * \retval number of removed flows
+ */
+int EBPFCheckBypassedFlowTimeout(struct flows_stats *bypassstats,
+                                 struct timespec *curtime,
+                                 struct timeval *tv)
+{
+    struct flows_stats local_bypassstats = { 0, 0, 0};
+    int ret = 0;
+
+    for (EBPFIfaceMaps *im = g_ebpf_ifaces; im != NULL; im = im->next) {
+        ret += EBPFForEachFlowTable(im, EBPF_FLOW_TABLE_V4, AF_INET,
+                                    &local_bypassstats, curtime, tv);
+        ret += EBPFForEachFlowTable(im, EBPF_FLOW_TABLE_V6, AF_INET6,
+                                    &local_bypassstats, curtime, tv);
+    }
+    if (ret) {
+        SCLogDebug("Bypassed flow timed out: %" PRIu64 " flows",
+                   local_bypassstats.count);
+        bypassstats->count = local_bypassstats.count;
+        bypassstats->packets = local_bypassstats.packets;
+        bypassstats->bytes = local_bypassstats.bytes;
+    }
+    return local_bypassstats.count;
+}
+
+#endif /* HAVE_PACKET_EBPF */
@@ -0,0 +1,75 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * eBPF programs and maps handling
+ */
+
+#ifndef __UTIL_EBPF_H__
+#define __UTIL_EBPF_H__
+
+#ifdef HAVE_PACKET_EBPF
+
+#include "flow-bypass.h"
+
+/* keys and values of the bypass maps, they must match the definitions
+ * of the eBPF programs in ebpf/. Key fields are in host byte order. */
+struct flowv4_keys {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t port16[2];
+    uint8_t ip_proto;
+    uint8_t pad;
+    uint16_t vlan0;
+};
+
+struct flowv6_keys {
+    uint32_t src[4];
+    uint32_t dst[4];
+    uint16_t port16[2];
+    uint8_t ip_proto;
+    uint8_t pad;
+    uint16_t vlan0;
+};
+
+struct pair {
+    uint64_t time;
+    uint64_t packets;
+    uint64_t bytes;
+} __attribute__((__aligned__(8)));
+
+/* map names used by the bypass programs */
+#define EBPF_FLOW_TABLE_V4  "flow_table_v4"
+#define EBPF_FLOW_TABLE_V6  "flow_table_v6"
+
+#define EBPF_SOCKET_FILTER  (1<<0)
+
+int EBPFGetMapFDByName(const char *iface, const char *name);
+int EBPFLoadFile(const char *iface, const char *path, const char *section,
+                 int *val, uint8_t flags);
+int EBPFNumPossibleCPUs(void);
+int EBPFInsertHalfFlow(int mapfd, void *key);
+
+int EBPFCheckBypassedFlowTimeout(struct flows_stats *bypassstats,
+                                 struct timespec *curtime,
+                                 struct timeval *tv);
+
+#endif /* HAVE_PACKET_EBPF */
+
+#endif /* __UTIL_EBPF_H__ */
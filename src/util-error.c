@@ -341,6 +341,9 @@ const char * SCErrorToString(SCError err)
         CASE_CODE (SC_WARN_LOG_CF_TOO_MANY_NODES);
         CASE_CODE (SC_WARN_EVENT_DROPPED);
         CASE_CODE (SC_ERR_NO_REDIS_ASYNC);
+        CASE_CODE (SC_ERR_NO_AF_XDP);
+        CASE_CODE (SC_ERR_AF_XDP_CREATE);
+        CASE_CODE (SC_ERR_AF_XDP_READ);
     }
 
     return "UNKNOWN_ERROR";
@@ -330,7 +330,10 @@ typedef enum {
     SC_WARN_CHMOD,
     SC_WARN_LOG_CF_TOO_MANY_NODES,
     SC_WARN_EVENT_DROPPED,
-    SC_ERR_NO_REDIS_ASYNC
+    SC_ERR_NO_REDIS_ASYNC,
+    SC_ERR_NO_AF_XDP,
+    SC_ERR_AF_XDP_CREATE,
+    SC_ERR_AF_XDP_READ,
 } SCError;
 
 const char *SCErrorToString(SCError);
@@ -0,0 +1,414 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hash functions over arrays of 32 bits words:
+ *
+ * - lookup3: Bob Jenkins' hashword(), the default.
+ * - crc32c: the CRC32C instruction of SSE4.2 over 8 bytes at a time.
+ *   The words are added to the key before, so the collisions depend on
+ *   it, and the result is mixed by the murmur3 finalizer. Only on x86_64
+ *   CPUs with SSE4.2.
+ * - xxh32: xxHash32 of the words, the 4 lanes of the 16 bytes stripes
+ *   in a SSE4.1 register if the CPU supports it.
+ *
+ * The SIMD code is built with a target attribute and only used if the
+ * CPU supports it.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+
+#include "util-hash-word.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#if defined(__x86_64__) && ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#include <immintrin.h>
+#define HASH_WORD_HAVE_SSE4 1
+#endif
+
+#define XXH_PRIME32_1   2654435761U
+#define XXH_PRIME32_2   2246822519U
+#define XXH_PRIME32_3   3266489917U
+#define XXH_PRIME32_4   668265263U
+#define XXH_PRIME32_5   374761393U
+
+static inline uint32_t HashWordRotl(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t Xxh32Round(uint32_t acc, uint32_t input)
+{
+    acc += input * XXH_PRIME32_2;
+    acc = HashWordRotl(acc, 13);
+    return acc * XXH_PRIME32_1;
+}
+
+/** \internal
+ *  \brief xxHash32 of the words left after the stripes, and its avalanche
+ */
+static inline uint32_t Xxh32Finish(uint32_t h, const uint32_t *k, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        h += k[i] * XXH_PRIME32_3;
+        h = HashWordRotl(h, 17) * XXH_PRIME32_4;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME32_2;
+    h ^= h >> 13;
+    h *= XXH_PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t HashWordXxh32Scalar(const uint32_t *k, size_t length, uint32_t initval)
+{
+    uint32_t h;
+    size_t i = 0;
+
+    if (length >= 4) {
+        uint32_t v1 = initval + XXH_PRIME32_1 + XXH_PRIME32_2;
+        uint32_t v2 = initval + XXH_PRIME32_2;
+        uint32_t v3 = initval;
+        uint32_t v4 = initval - XXH_PRIME32_1;
+
+        for ( ; i + 4 <= length; i += 4) {
+            v1 = Xxh32Round(v1, k[i]);
+            v2 = Xxh32Round(v2, k[i + 1]);
+            v3 = Xxh32Round(v3, k[i + 2]);
+            v4 = Xxh32Round(v4, k[i + 3]);
+        }
+        h = HashWordRotl(v1, 1) + HashWordRotl(v2, 7) +
+            HashWordRotl(v3, 12) + HashWordRotl(v4, 18);
+    } else {
+        h = initval + XXH_PRIME32_5;
+    }
+    h += (uint32_t)(length * sizeof(uint32_t));
+
+    return Xxh32Finish(h, k + i, length - i);
+}
+
+#ifdef HASH_WORD_HAVE_SSE4
+__attribute__((target("sse4.1")))
+static uint32_t HashWordXxh32SSE41(const uint32_t *k, size_t length, uint32_t initval)
+{
+    uint32_t h;
+    size_t i = 0;
+
+    if (length >= 4) {
+        const __m128i p1 = _mm_set1_epi32((int)XXH_PRIME32_1);
+        const __m128i p2 = _mm_set1_epi32((int)XXH_PRIME32_2);
+        __m128i acc = _mm_set_epi32((int)(initval - XXH_PRIME32_1), (int)initval,
+                (int)(initval + XXH_PRIME32_2),
+                (int)(initval + XXH_PRIME32_1 + XXH_PRIME32_2));
+
+        for ( ; i + 4 <= length; i += 4) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(k + i));
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(v, p2));
+            acc = _mm_or_si128(_mm_slli_epi32(acc, 13), _mm_srli_epi32(acc, 19));
+            acc = _mm_mullo_epi32(acc, p1);
+        }
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        h = HashWordRotl(lanes[0], 1) + HashWordRotl(lanes[1], 7) +
+            HashWordRotl(lanes[2], 12) + HashWordRotl(lanes[3], 18);
+    } else {
+        h = initval + XXH_PRIME32_5;
+    }
+    h += (uint32_t)(length * sizeof(uint32_t));
+
+    return Xxh32Finish(h, k + i, length - i);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t HashWordCrc32c(const uint32_t *k, size_t length, uint32_t initval)
+{
+    const uint64_t key = ((uint64_t)initval << 32) | initval;
+    uint64_t h = initval;
+    size_t i = 0;
+
+    for ( ; i + 2 <= length; i += 2) {
+        uint64_t v;
+        memcpy(&v, k + i, sizeof(v));
+        h = _mm_crc32_u64(h, v + key);
+    }
+    if (i < length)
+        h = _mm_crc32_u32((uint32_t)h, k[i] + initval);
+
+    /* murmur3 finalizer, the crc alone spreads its input bits badly */
+    uint32_t r = (uint32_t)h ^ (uint32_t)length;
+    r ^= r >> 16;
+    r *= 0x85ebca6b;
+    r ^= r >> 13;
+    r *= 0xc2b2ae35;
+    r ^= r >> 16;
+    return r;
+}
+#endif /* HASH_WORD_HAVE_SSE4 */
+
+/**
+ *  \brief get a hash function by its name
+ *
+ *  \retval f the function or NULL if the name is unknown or the CPU
+ *          doesn't support it
+ */
+HashWordFunc HashWordGetFunc(const char *name)
+{
+    if (strcasecmp(name, "lookup3") == 0)
+        return hashword;
+
+    if (strcasecmp(name, "xxh32") == 0) {
+#ifdef HASH_WORD_HAVE_SSE4
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.1"))
+            return HashWordXxh32SSE41;
+#endif
+        return HashWordXxh32Scalar;
+    }
+
+    if (strcasecmp(name, "crc32c") == 0) {
+#ifdef HASH_WORD_HAVE_SSE4
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            return HashWordCrc32c;
+#endif
+        return NULL;
+    }
+
+    return NULL;
+}
+
+/**
+ *  \brief get the hash function set up for a module in its
+ *         'hash-function' setting
+ *
+ *  \param module name of the config section, e.g. "flow"
+ *
+ *  \retval f the function, lookup3's hashword() by default
+ */
+HashWordFunc HashWordConfig(const char *module)
+{
+    char varname[64];
+    const char *name = NULL;
+
+    snprintf(varname, sizeof(varname), "%s.hash-function", module);
+    if (ConfGet(varname, &name) != 1 || name == NULL)
+        return hashword;
+
+    HashWordFunc f = HashWordGetFunc(name);
+    if (f != NULL) {
+        SCLogConfig("%s: using the %s hash function", module, name);
+        return f;
+    }
+
+    if (strcasecmp(name, "crc32c") == 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "%s: crc32c needs a x86_64 CPU "
+                "with SSE4.2, using lookup3", varname);
+        return hashword;
+    }
+
+    SCLogError(SC_ERR_INVALID_VALUE, "invalid %s \"%s\", expected lookup3, "
+            "crc32c or xxh32", varname, name);
+    exit(EXIT_FAILURE);
+}
+
+#ifdef UNITTESTS
+
+#define HASH_WORD_TEST_BUCKETS  65536
+#define HASH_WORD_TEST_KEYS     (4 * HASH_WORD_TEST_BUCKETS)
+
+/** \internal
+ *  \brief key of the i-th flow of the test traffic: a /16 of clients
+ *         talking to a few servers, like the IPv4 flow hash key
+ */
+static void HashWordTestKey4(uint32_t i, uint32_t k[5])
+{
+    k[0] = htonl(0x0a000000 | (i & 0xffff));
+    k[1] = htonl(0xc0a80001 + ((i >> 16) & 0x3));
+    k[2] = (uint32_t)(1024 + (i & 0x3ff)) | (80U << 16);
+    k[3] = 6;
+    k[4] = 0;
+}
+
+/** \internal
+ *  \brief like HashWordTestKey4(), for the IPv6 flow hash key
+ */
+static void HashWordTestKey6(uint32_t i, uint32_t k[11])
+{
+    k[0] = htonl(0x20010db8);
+    k[1] = 0;
+    k[2] = 0;
+    k[3] = htonl(i & 0xffff);
+    k[4] = htonl(0x20010db8);
+    k[5] = htonl(0x00000001);
+    k[6] = 0;
+    k[7] = htonl(1 + ((i >> 16) & 0x3));
+    k[8] = (uint32_t)(1024 + (i & 0x3ff)) | (443U << 16);
+    k[9] = 6;
+    k[10] = 0;
+}
+
+/** \internal
+ *  \brief fill the buckets with the test keys
+ *
+ *  \retval max most keys in a bucket
+ */
+static uint32_t HashWordTestFill(HashWordFunc f, uint32_t words,
+        uint32_t *buckets, uint32_t seed)
+{
+    uint32_t k[11];
+    uint32_t max = 0;
+
+    memset(buckets, 0, HASH_WORD_TEST_BUCKETS * sizeof(uint32_t));
+    for (uint32_t i = 0; i < HASH_WORD_TEST_KEYS; i++) {
+        if (words == 5)
+            HashWordTestKey4(i, k);
+        else
+            HashWordTestKey6(i, k);
+        uint32_t b = f(k, words, seed) % HASH_WORD_TEST_BUCKETS;
+        if (++buckets[b] > max)
+            max = buckets[b];
+    }
+    return max;
+}
+
+static const char *hash_word_test_names[] = { "lookup3", "crc32c", "xxh32", NULL };
+
+/**
+ * \test the functions spread the keys of the test traffic over the
+ *       buckets and depend on the seed
+ */
+static int HashWordTest01(void)
+{
+    uint32_t *buckets = SCMalloc(HASH_WORD_TEST_BUCKETS * sizeof(uint32_t));
+    FAIL_IF_NULL(buckets);
+
+    for (int n = 0; hash_word_test_names[n] != NULL; n++) {
+        HashWordFunc f = HashWordGetFunc(hash_word_test_names[n]);
+        if (f == NULL)
+            continue;
+
+        /* 4 keys per bucket on average */
+        FAIL_IF(HashWordTestFill(f, 5, buckets, 0x12345678) > 24);
+        FAIL_IF(HashWordTestFill(f, 11, buckets, 0x12345678) > 24);
+
+        uint32_t k[11];
+        HashWordTestKey6(1, k);
+        FAIL_IF(f(k, 11, 1) != f(k, 11, 1));
+        FAIL_IF(f(k, 11, 1) == f(k, 11, 2));
+        FAIL_IF(f(k, 5, 1) == f(k, 11, 1));
+    }
+
+    SCFree(buckets);
+    PASS;
+}
+
+/**
+ * \test the vectorized xxh32 gives the same hashes as the scalar one
+ */
+static int HashWordTest02(void)
+{
+    uint32_t k[11];
+
+    /* xxHash32 of no input with seed 0 */
+    FAIL_IF(HashWordXxh32Scalar(k, 0, 0) != 0x02cc5d05);
+
+    HashWordFunc f = HashWordGetFunc("xxh32");
+    FAIL_IF_NULL(f);
+    for (uint32_t i = 0; i < 1000; i++) {
+        HashWordTestKey6(i, k);
+        for (size_t len = 0; len <= 11; len++) {
+            FAIL_IF(f(k, len, i) != HashWordXxh32Scalar(k, len, i));
+        }
+    }
+    PASS;
+}
+
+/**
+ * \test HashWordTest03 prints the time per key and the spread over the
+ *       buckets of the functions, for IPv4 and IPv6 flow keys
+ */
+static int HashWordTest03(void)
+{
+#ifdef PROFILING
+    uint32_t *buckets = SCMalloc(HASH_WORD_TEST_BUCKETS * sizeof(uint32_t));
+    FAIL_IF_NULL(buckets);
+
+    printf("\n");
+    for (int n = 0; hash_word_test_names[n] != NULL; n++) {
+        HashWordFunc f = HashWordGetFunc(hash_word_test_names[n]);
+        if (f == NULL) {
+            printf("%s \tnot supported\n", hash_word_test_names[n]);
+            continue;
+        }
+
+        for (uint32_t words = 5; words <= 11; words += 6) {
+            uint32_t k[11];
+            uint32_t r = 0;
+            struct timespec start, end;
+
+            if (words == 5)
+                HashWordTestKey4(0, k);
+            else
+                HashWordTestKey6(0, k);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (uint32_t i = 0; i < HASH_WORD_TEST_KEYS; i++) {
+                k[0] = i;
+                r += f(k, words, 0x12345678);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            uint64_t ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+                end.tv_nsec - start.tv_nsec;
+
+            uint32_t max = HashWordTestFill(f, words, buckets, 0x12345678);
+            /* chi square of the bucket counts over the buckets, about 1
+             * for a hash as good as random */
+            double chi = 0;
+            const double mean = (double)HASH_WORD_TEST_KEYS / HASH_WORD_TEST_BUCKETS;
+            for (uint32_t b = 0; b < HASH_WORD_TEST_BUCKETS; b++) {
+                chi += (buckets[b] - mean) * (buckets[b] - mean) / mean;
+            }
+            chi /= HASH_WORD_TEST_BUCKETS;
+
+            printf("%s %u words \t%.2f ns/key \tmax %u \tchi2/n %.3f \t(%u)\n",
+                    hash_word_test_names[n], words,
+                    (double)ns / HASH_WORD_TEST_KEYS, max, chi, r);
+        }
+    }
+
+    SCFree(buckets);
+#endif
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void HashWordRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashWordTest01", HashWordTest01);
+    UtRegisterTest("HashWordTest02", HashWordTest02);
+    UtRegisterTest("HashWordTest03", HashWordTest03);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,52 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hash functions over arrays of 32 bits words, used for the keys of the
+ * flow, host, ippair and defrag hashes.
+ */
+
+#ifndef __UTIL_HASH_WORD_H__
+#define __UTIL_HASH_WORD_H__
+
+#include "util-hash-lookup3.h"
+
+/** hash of length words of k, keyed by initval. Same signature as
+ *  lookup3's hashword(). */
+typedef uint32_t (*HashWordFunc)(const uint32_t *k, size_t length, uint32_t initval);
+
+/**
+ *  \brief hash the words of k with f
+ *
+ *  Falls back to hashword() if f is not set up, e.g. in unittests
+ *  that don't initialize the hash the key is for.
+ */
+static inline uint32_t HashWord(HashWordFunc f, const uint32_t *k,
+        size_t length, uint32_t initval)
+{
+    if (unlikely(f == NULL))
+        return hashword(k, length, initval);
+    return f(k, length, initval);
+}
+
+HashWordFunc HashWordGetFunc(const char *name);
+HashWordFunc HashWordConfig(const char *module);
+void HashWordRegisterTests(void);
+
+#endif /* __UTIL_HASH_WORD_H__ */
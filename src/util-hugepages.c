@@ -0,0 +1,305 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge pages backed memory areas
+ *
+ * Large preallocated pools (packets, spare flows) are carved from areas
+ * mapped with huge pages to reduce the TLB misses when walking them. If
+ * no huge pages are reserved, transparent huge pages are requested
+ * instead.
+ *
+ * Areas are registered so the pools can tell if an object belongs to
+ * an area or was allocated with SCMalloc.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-hugepages.h"
+#include "util-misc.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define HUGEPAGES_MAX_AREAS 1024
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/* from linux/mempolicy.h */
+#define HUGEPAGES_MPOL_PREFERRED  1
+#define HUGEPAGES_MPOL_INTERLEAVE 3
+
+typedef struct HugepagesArea_ {
+    uintptr_t start;
+    size_t size;
+} HugepagesArea;
+
+static int hugepages_enabled = 0;
+static int hugepages_numa = 1;
+static uint64_t hugepages_page_size = 2 * 1024 * 1024;
+
+/* areas are only added or removed by the threads setting up or
+ * destroying their pools, HugepagesOwns() reads them without lock */
+static HugepagesArea hugepages_areas[HUGEPAGES_MAX_AREAS];
+static SCMutex hugepages_lock = SCMUTEX_INITIALIZER;
+SC_ATOMIC_DECLARE(uint32_t, hugepages_areas_cnt);
+
+/**
+ * \brief read the hugepages configuration
+ *
+ * \code
+ * hugepages:
+ *   enabled: yes
+ *   page-size: 2mb
+ *   numa: yes
+ * \endcode
+ */
+void HugepagesInitConfig(void)
+{
+    int enabled = 0;
+    const char *page_size = NULL;
+    int numa = 1;
+
+    SC_ATOMIC_INIT(hugepages_areas_cnt);
+
+    if (ConfGetBool("hugepages.enabled", &enabled) != 1 || !enabled) {
+        hugepages_enabled = 0;
+        return;
+    }
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+    if (ConfGet("hugepages.page-size", &page_size) == 1) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(page_size, &size) < 0 ||
+                (size != 2 * 1024 * 1024 && size != 1024 * 1024 * 1024)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid hugepages.page-size "
+                       "'%s', must be 2mb or 1gb", page_size);
+            exit(EXIT_FAILURE);
+        }
+        hugepages_page_size = size;
+    }
+    if (ConfGetBool("hugepages.numa", &numa) == 1) {
+        hugepages_numa = numa;
+    }
+    hugepages_enabled = 1;
+
+    SCLogConfig("using %"PRIu64"MB huge pages for the packet and flow pools%s",
+                hugepages_page_size / (1024 * 1024),
+                hugepages_numa ? " with NUMA placement" : "");
+#else
+    SCLogWarning(SC_ERR_UNIMPLEMENTED, "huge pages are not supported "
+                 "on this system");
+#endif
+}
+
+int HugepagesEnabled(void)
+{
+    return hugepages_enabled;
+}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+static void HugepagesSetPolicy(void *ptr, size_t size, int numa)
+{
+#if defined(SYS_mbind) && defined(SYS_getcpu)
+    unsigned long mask[16];
+    int mode;
+
+    memset(mask, 0, sizeof(mask));
+    if (numa == HUGEPAGES_NUMA_LOCAL) {
+        unsigned int cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+                node >= sizeof(mask) * 8) {
+            return;
+        }
+        mask[node / (sizeof(mask[0]) * 8)] = 1UL << (node % (sizeof(mask[0]) * 8));
+        mode = HUGEPAGES_MPOL_PREFERRED;
+    } else {
+        /* the kernel restricts the mask to the allowed nodes */
+        memset(mask, 0xff, sizeof(mask));
+        mode = HUGEPAGES_MPOL_INTERLEAVE;
+    }
+
+    if (syscall(SYS_mbind, ptr, size, mode, mask, sizeof(mask) * 8, 0) != 0) {
+        SCLogDebug("mbind failed: %s", strerror(errno));
+    }
+#endif
+}
+
+static int HugepagesRegister(void *ptr, size_t size)
+{
+    int r = -1;
+
+    SCMutexLock(&hugepages_lock);
+    uint32_t cnt = SC_ATOMIC_GET(hugepages_areas_cnt);
+    /* reuse the slot of a freed area */
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (hugepages_areas[i].size == 0) {
+            hugepages_areas[i].start = (uintptr_t)ptr;
+            hugepages_areas[i].size = size;
+            r = 0;
+            goto end;
+        }
+    }
+    if (cnt < HUGEPAGES_MAX_AREAS) {
+        hugepages_areas[cnt].start = (uintptr_t)ptr;
+        hugepages_areas[cnt].size = size;
+        /* make the area visible once it is set */
+        (void)SC_ATOMIC_ADD(hugepages_areas_cnt, 1);
+        r = 0;
+    }
+end:
+    SCMutexUnlock(&hugepages_lock);
+    return r;
+}
+#endif
+
+/**
+ * \brief allocate a zeroed area backed by huge pages
+ *
+ * Falls back to transparent huge pages if no huge pages are available.
+ * The memory is touched before returning so it is placed following the
+ * NUMA policy: the caller must run on the CPUs of its affinity.
+ *
+ * \param size size of the area, rounded up to the page size
+ * \param numa HUGEPAGES_NUMA_LOCAL or HUGEPAGES_NUMA_INTERLEAVE
+ *
+ * \retval ptr to the area or NULL if hugepages are disabled or on error
+ */
+void *HugepagesAlloc(size_t size, int numa)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+    static int thp_warned = 0;
+
+    if (!hugepages_enabled || size == 0)
+        return NULL;
+
+    size = (size + hugepages_page_size - 1) & ~(hugepages_page_size - 1);
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    if (hugepages_page_size == 1024 * 1024 * 1024)
+        flags |= (30 << MAP_HUGE_SHIFT);
+
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) {
+        if (!thp_warned) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "unable to map huge pages (%s), "
+                         "check vm.nr_hugepages. Using transparent huge pages.",
+                         strerror(errno));
+            thp_warned = 1;
+        }
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            SCLogError(SC_ERR_MEM_ALLOC, "mmap failed: %s", strerror(errno));
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        (void)madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    if (hugepages_numa) {
+        HugepagesSetPolicy(ptr, size, numa);
+    }
+
+    /* fault the pages in now, on the right node */
+    memset(ptr, 0, size);
+
+    if (HugepagesRegister(ptr, size) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "too many huge pages areas");
+        munmap(ptr, size);
+        return NULL;
+    }
+    SCLogDebug("mapped %"PRIuMAX" bytes at %p", (uintmax_t)size, ptr);
+    return ptr;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * \brief unmap an area returned by HugepagesAlloc()
+ */
+void HugepagesFree(void *ptr)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+    SCMutexLock(&hugepages_lock);
+    uint32_t cnt = SC_ATOMIC_GET(hugepages_areas_cnt);
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (hugepages_areas[i].start == (uintptr_t)ptr &&
+                hugepages_areas[i].size != 0) {
+            munmap(ptr, hugepages_areas[i].size);
+            hugepages_areas[i].start = 0;
+            hugepages_areas[i].size = 0;
+            break;
+        }
+    }
+    SCMutexUnlock(&hugepages_lock);
+#endif
+}
+
+/**
+ * \brief check if memory belongs to a huge pages area
+ *
+ * \retval 1 if ptr is in an area, 0 otherwise
+ */
+int HugepagesOwns(const void *ptr)
+{
+    if (!hugepages_enabled)
+        return 0;
+
+    uintptr_t p = (uintptr_t)ptr;
+    uint32_t cnt = SC_ATOMIC_GET(hugepages_areas_cnt);
+    for (uint32_t i = 0; i < cnt; i++) {
+        const HugepagesArea *a = &hugepages_areas[i];
+        if (p >= a->start && p < a->start + a->size)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \brief unmap all the areas
+ *
+ * Called once the threads are gone, the objects of the areas must not
+ * be used anymore.
+ */
+void HugepagesDeinit(void)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+    SCMutexLock(&hugepages_lock);
+    uint32_t cnt = SC_ATOMIC_GET(hugepages_areas_cnt);
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (hugepages_areas[i].size != 0) {
+            munmap((void *)hugepages_areas[i].start, hugepages_areas[i].size);
+            hugepages_areas[i].start = 0;
+            hugepages_areas[i].size = 0;
+        }
+    }
+    SCMutexUnlock(&hugepages_lock);
+#endif
+}
@@ -0,0 +1,42 @@
+/* Copyright (C) 2017 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge pages backed memory areas
+ */
+
+#ifndef __UTIL_HUGEPAGES_H__
+#define __UTIL_HUGEPAGES_H__
+
+/* NUMA placement of an area */
+enum {
+    /* on the node of the CPU of the calling thread */
+    HUGEPAGES_NUMA_LOCAL,
+    /* spread on all the nodes, for areas shared by all the threads */
+    HUGEPAGES_NUMA_INTERLEAVE,
+};
+
+void HugepagesInitConfig(void);
+int HugepagesEnabled(void);
+void *HugepagesAlloc(size_t size, int numa);
+void HugepagesFree(void *ptr);
+int HugepagesOwns(const void *ptr);
+void HugepagesDeinit(void);
+
+#endif /* __UTIL_HUGEPAGES_H__ */
@@ -69,6 +69,15 @@ void SCDropMainThreadCaps(uint32_t userid, uint32_t groupid)
                     CAP_NET_ADMIN,
                     -1);
             break;
+        case RUNMODE_AFXDP_DEV:
+            capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
+                    CAP_NET_RAW,
+                    CAP_SYS_NICE,
+                    CAP_NET_ADMIN,
+                    CAP_SYS_ADMIN,          /* needed to load the XDP program */
+                    CAP_IPC_LOCK,           /* needed to register the UMEM */
+                    -1);
+            break;
         case RUNMODE_PFRING:
             capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
                     CAP_NET_ADMIN, CAP_NET_RAW, CAP_SYS_NICE,
@@ -422,6 +422,22 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
                         const char *recv_mod_name,
                         const char *verdict_mod_name,
                         const char *decode_mod_name)
+{
+    return RunModeSetIPSAutoFpVerdictThreads(ConfigParser, recv_mod_name,
+            verdict_mod_name, decode_mod_name, LiveGetDeviceCount());
+}
+
+/**
+ * \brief autofp IPS runmode with a chosen number of verdict threads
+ *
+ * \param nverdict number of verdict threads, the verdict module of the
+ *        thread i is set up with the config of the queue i
+ */
+int RunModeSetIPSAutoFpVerdictThreads(ConfigIPSParserFunc ConfigParser,
+                        const char *recv_mod_name,
+                        const char *verdict_mod_name,
+                        const char *decode_mod_name,
+                        int nverdict)
 {
     SCEnter();
     char tname[TM_THREAD_NAME_MAX];
@@ -522,7 +538,7 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
     }
 
     /* create the threads */
-    for (int i = 0; i < nqueue; i++) {
+    for (int i = 0; i < nverdict; i++) {
         memset(tname, 0, sizeof(tname));
         snprintf(tname, sizeof(tname), "%s#%02d", thread_name_verdict, i);
 
@@ -59,6 +59,12 @@ int RunModeSetIPSAutoFp(ConfigIPSParserFunc ConfigParser,
                         const char *verdict_mod_name,
                         const char *decode_mod_name);
 
+int RunModeSetIPSAutoFpVerdictThreads(ConfigIPSParserFunc ConfigParser,
+                        const char *recv_mod_name,
+                        const char *verdict_mod_name,
+                        const char *decode_mod_name,
+                        int nverdict);
+
 int RunModeSetIPSWorker(ConfigIPSParserFunc ConfigParser,
                         const char *recv_mod_name,
                         const char *verdict_mod_name,
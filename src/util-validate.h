@@ -36,10 +36,12 @@
 /** \brief test if a flow is locked.
  *
  * If trylock returns 0 it got a lock. Which means
- * the flow was previously unlocked.
+ * the flow was previously unlocked. Flows owned by
+ * a thread are never locked.
  */
 #define DEBUG_ASSERT_FLOW_LOCKED(f) do {            \
-    if ((f) != NULL) {                              \
+    if ((f) != NULL &&                              \
+            !((f)->flags & FLOW_THREAD_OWNED)) {    \
         int r = SCMutexTrylock(&(f)->m);            \
         if (r == 0) {                               \
             BUG_ON(1);                              \